@@ -9,10 +9,16 @@
 #import "SimRuntimeHelperProtocol.h"
 #import "AppBinaryPatcher.h"
 #import "tmpfs_overlay.h"
+#import "bootstrap_image.h"
 
 @interface SimRuntimeHelper : NSObject <NSXPCListenerDelegate, SimRuntimeHelperProtocol>
 @property (atomic, strong) NSXPCListener *listener;
+@property (nonatomic, strong) dispatch_source_t overlayGrowthTimer;
+// Everything that mounts, unmounts, grows or writes through overlays runs here, so a grow can't remount an overlay under a running request
+@property (nonatomic, strong) dispatch_queue_t overlayQueue;
 - (void)startListener;
+- (void)restoreOverlays;
+- (void)startOverlayGrowthMonitor;
 @end
 
 @implementation SimRuntimeHelper
@@ -21,6 +27,7 @@
     if ((self = [super init])) {
         self.listener = [[NSXPCListener alloc] initWithMachServiceName:kSimRuntimeHelperServiceName];
         self.listener.delegate = self;
+        self.overlayQueue = dispatch_queue_create("com.objc.simulator-trainer.helper.overlays", DISPATCH_QUEUE_SERIAL);
     }
     
     return self;
@@ -31,74 +38,73 @@
     [[NSRunLoop currentRunLoop] run];
 }
 
+- (void)restoreOverlays {
+    // Overlays don't survive a host reboot. Bring back everything in the overlay config without holding up the listener
+    dispatch_async(self.overlayQueue, ^{
+        overlay_remount_report_t *reports = NULL;
+        int count = 0;
+        uint64_t start = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+        reapply_all_overlays_with_reports(&reports, &count);
+        uint64_t elapsed = clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - start;
+        
+        for (int i = 0; i < count; i++) {
+            overlay_remount_report_t *report = &reports[i];
+            if (report->result != 0) {
+                NSLog(@"Failed to restore overlay at %s", report->target_path);
+                continue;
+            }
+            
+            if (!report->already_mounted) {
+                // Same permissions as overlays mounted through mountTmpfsOverlaysAtPaths:
+                chmod(report->target_path, 0777);
+            }
+        }
+        
+        NSLog(@"Restored %d overlays in %.1fms", count, elapsed / 1e6);
+        free(reports);
+    });
+}
+
+- (void)startOverlayGrowthMonitor {
+    // Overlays are sized from their backing store when mounted. Check regularly that none is about to run out of pages or nodes
+    self.overlayGrowthTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, self.overlayQueue);
+    dispatch_source_set_timer(self.overlayGrowthTimer, dispatch_time(DISPATCH_TIME_NOW, 30 * NSEC_PER_SEC), 30 * NSEC_PER_SEC, 5 * NSEC_PER_SEC);
+    dispatch_source_set_event_handler(self.overlayGrowthTimer, ^{
+        if (grow_overlays_if_needed() != 0) {
+            NSLog(@"Failed to grow one or more overlays");
+        }
+    });
+    dispatch_resume(self.overlayGrowthTimer);
+}
+
 - (BOOL)listener:(NSXPCListener *)listener shouldAcceptNewConnection:(NSXPCConnection *)newConnection {
-    newConnection.exportedInterface = [NSXPCInterface interfaceWithProtocol:@protocol(SimRuntimeHelperProtocol)];
+    newConnection.exportedInterface = SimRuntimeHelperXPCInterface();
     newConnection.exportedObject = self;
     [newConnection resume];
     return YES;
 }
 
-- (void)setupTweakInjectionWithOptions:(SimInjectionOptions *)options withAuthorization:(NSData *)authData completion:(void (^)(NSError *error))completion {
-    // Check authorization
-    if (![self checkAuthorization:authData error:nil]) {
-        if (completion) {
-            NSError *error = [NSError errorWithDomain:NSOSStatusErrorDomain code:errAuthorizationDenied userInfo:@{NSLocalizedDescriptionKey: @"Authorization denied"}];
-            completion(error);
-        }
-        return;
+- (NSError *)_copyItemAtPath:(NSString *)sourcePath toPath:(NSString *)targetPath {
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    if ([fileManager fileExistsAtPath:targetPath]) {
+        NSLog(@"File already exists at target path: %@", targetPath);
+        return nil;
     }
     
-    if (!options || !options.tweakLoaderSourcePath || !options.tweakLoaderDestinationPath || !options.victimPathForTweakLoader) {
-        if (completion) {
-            NSError *error = [NSError errorWithDomain:NSOSStatusErrorDomain code:paramErr userInfo:@{NSLocalizedDescriptionKey:[NSString stringWithFormat:@"Invalid options: %@", options]}];
-            completion(error);
+    NSError *error = nil;
+    NSString *targetDir = [targetPath stringByDeletingLastPathComponent];
+    if (![fileManager fileExistsAtPath:targetDir]) {
+        // Concurrent copies can race to create the same directory, which is fine as long as it exists afterwards
+        if (![fileManager createDirectoryAtPath:targetDir withIntermediateDirectories:YES attributes:@{NSFilePosixPermissions:@(0777)} error:&error] && ![fileManager fileExistsAtPath:targetDir]) {
+            return error;
         }
-        return;
     }
     
-    __block NSError *error = nil;
-    if (![[NSFileManager defaultManager] fileExistsAtPath:options.tweakLoaderDestinationPath]) {
-        [[NSFileManager defaultManager] copyItemAtPath:options.tweakLoaderSourcePath toPath:options.tweakLoaderDestinationPath error:&error];
-    
-        for (NSString *sourcePath in options.filesToCopy) {
-            NSString *targetPath = options.filesToCopy[sourcePath];
-            if ([[NSFileManager defaultManager] fileExistsAtPath:targetPath]) {
-                NSLog(@"File already exists at target path: %@", targetPath);
-                continue;
-            }
-    
-            NSString *targetDir = [targetPath stringByDeletingLastPathComponent];
-            if (![[NSFileManager defaultManager] fileExistsAtPath:targetDir]) {
-
-                NSError *error = nil;
-                [[NSFileManager defaultManager] createDirectoryAtPath:targetDir withIntermediateDirectories:YES attributes:@{NSFilePosixPermissions:@(0777)} error:&error];
-                if (error) {
-                    NSLog(@"Failed to create target directory: %@", error);
-                    break;
-                }
-            }
-    
-            [[NSFileManager defaultManager] copyItemAtPath:sourcePath toPath:targetPath error:&error];
-            if (error) {
-                NSLog(@"Failed to copy file from %@ to %@: %@", sourcePath, targetPath, error);
-                break;
-            }
-        }
-        
-        if (!error) {
-            [AppBinaryPatcher injectDylib:options.tweakLoaderDestinationPath intoBinary:options.victimPathForTweakLoader usingOptoolAtPath:options.optoolPath completion:^(BOOL success, NSError *patchError) {
-                error = patchError;
-            }];
-        }
-        else {
-            NSLog(@"Failed to copy loader: %@", error);
-            error = [NSError errorWithDomain:NSOSStatusErrorDomain code:errAuthorizationDenied userInfo:@{NSLocalizedDescriptionKey: @"Failed to copy tweakloader into simruntime"}];
-        }
+    if (![fileManager copyItemAtPath:sourcePath toPath:targetPath error:&error]) {
+        return error;
     }
     
-    if (completion) {
-        completion(error);
-    }
+    return nil;
 }
 
 - (BOOL)checkAuthorization:(NSData *)authData error:(NSError **)error {
@@ -146,24 +152,27 @@
         }
         return;
     }
-    for (NSString *overlayPath in overlayPaths) {
-        NSError *error = nil;
-        if (![self _mountOverlayAtPath:overlayPath error:&error]) {
-            NSLog(@"Failed to mount overlay at path: %@ with error: %@", overlayPath, error);
-            completion(error);
-            return;
+    
+    dispatch_async(self.overlayQueue, ^{
+        for (NSString *overlayPath in overlayPaths) {
+            NSError *error = nil;
+            if (![self _mountOverlayAtPath:overlayPath error:&error]) {
+                NSLog(@"Failed to mount overlay at path: %@ with error: %@", overlayPath, error);
+                completion(error);
+                return;
+            }
+            
+            // Set permissions to allow the non-privileged app to read+write to the overlay
+            [[NSFileManager defaultManager] setAttributes:@{NSFilePosixPermissions: @(0777)} ofItemAtPath:overlayPath error:&error];
+            if (error) {
+                NSLog(@"Failed to set permissions for overlay at path: %@ with error: %@", overlayPath, error);
+                completion(error);
+                return;
+            }
         }
         
-        // Set permissions to allow the non-privileged app to read+write to the overlay
-        [[NSFileManager defaultManager] setAttributes:@{NSFilePosixPermissions: @(0777)} ofItemAtPath:overlayPath error:&error];
-        if (error) {
-            NSLog(@"Failed to set permissions for overlay at path: %@ with error: %@", overlayPath, error);
-            completion(error);
-            return;
-        }
-    }
-    
-    completion(nil);
+        completion(nil);
+    });
 }
 
 - (BOOL)_mountOverlayAtPath:(NSString *)overlayPath error:(NSError **)error {
@@ -205,15 +214,292 @@
         }
         return;
     }
-    for (NSString *mountPoint in mountPoints) {
-        NSError *error = nil;
-        if (![self _unmountOverlayAtPath:mountPoint error:&error]) {
-            completion(error);
-            return;
+    
+    dispatch_async(self.overlayQueue, ^{
+        for (NSString *mountPoint in mountPoints) {
+            NSError *error = nil;
+            if (![self _unmountOverlayAtPath:mountPoint error:&error]) {
+                completion(error);
+                return;
+            }
+        }
+        
+        completion(nil);
+    });
+}
+
+- (void)overlayMetricsForPaths:(NSArray<NSString *> *)overlayPaths withAuthorization:(NSData *)authData completion:(void (^)(NSArray<NSDictionary<NSString *, id> *> *, NSError *))completion {
+    // Check authorization
+    NSError *authError = nil;
+    if (![self checkAuthorization:authData error:&authError]) {
+        if (completion) {
+            completion(nil, authError ?: [NSError errorWithDomain:NSOSStatusErrorDomain code:errAuthorizationDenied userInfo:@{NSLocalizedDescriptionKey: @"Authorization denied"}]);
+        }
+        return;
+    }
+    
+    dispatch_async(self.overlayQueue, ^{
+        NSMutableArray *metrics = [NSMutableArray array];
+        for (NSString *overlayPath in overlayPaths) {
+            overlay_metrics_t overlayMetrics;
+            if (overlay_get_metrics(overlayPath.UTF8String, &overlayMetrics) != 0) {
+                NSLog(@"No overlay metrics for path: %@", overlayPath);
+                continue;
+            }
+            
+            [metrics addObject:@{
+                kSimOverlayMetricsPathKey: overlayPath,
+                kSimOverlayMetricsMaxPagesKey: @(overlayMetrics.max_pages),
+                kSimOverlayMetricsPagesUsedKey: @(overlayMetrics.pages_used),
+                kSimOverlayMetricsMaxNodesKey: @(overlayMetrics.max_nodes),
+                kSimOverlayMetricsNodesUsedKey: @(overlayMetrics.nodes_used),
+                kSimOverlayMetricsMaterializedFilesKey: @(overlayMetrics.materialized_files),
+                kSimOverlayMetricsMaterializedBytesKey: @(overlayMetrics.materialized_bytes),
+                kSimOverlayMetricsSymlinksKey: @(overlayMetrics.symlinks),
+                kSimOverlayMetricsSymlinkedBytesKey: @(overlayMetrics.symlinked_bytes),
+            }];
+        }
+        
+        if (completion) {
+            completion(metrics, nil);
+        }
+    });
+}
+
+- (void)runTransaction:(SimHelperTransaction *)transaction progress:(id<SimHelperTransactionProgress>)progress withAuthorization:(NSData *)authData completion:(void (^)(NSArray<SimHelperStepResult *> *, NSError *))completion {
+    // One authorization check covers every step in the transaction
+    NSError *authError = nil;
+    if (![self checkAuthorization:authData error:&authError]) {
+        if (completion) {
+            completion(nil, authError ?: [NSError errorWithDomain:NSOSStatusErrorDomain code:errAuthorizationDenied userInfo:@{NSLocalizedDescriptionKey: @"Authorization denied"}]);
+        }
+        return;
+    }
+    
+    NSError *planError = nil;
+    if (!transaction || ![transaction validatePlan:&planError]) {
+        if (completion) {
+            completion(nil, planError ?: [NSError errorWithDomain:NSOSStatusErrorDomain code:paramErr userInfo:@{NSLocalizedDescriptionKey: @"Invalid transaction"}]);
+        }
+        return;
+    }
+    
+    dispatch_async(self.overlayQueue, ^{
+        NSArray<SimHelperTransactionStep *> *steps = transaction.steps;
+        NSMutableDictionary<NSString *, SimHelperTransactionStep *> *stepsById = [NSMutableDictionary dictionary];
+        NSMutableDictionary<NSString *, NSNumber *> *remainingDependencies = [NSMutableDictionary dictionary];
+        NSMutableDictionary<NSString *, NSMutableArray<NSString *> *> *dependents = [NSMutableDictionary dictionary];
+        for (SimHelperTransactionStep *step in steps) {
+            stepsById[step.identifier] = step;
+            remainingDependencies[step.identifier] = @(step.dependencies.count);
+            for (NSString *dependency in step.dependencies) {
+                if (!dependents[dependency]) {
+                    dependents[dependency] = [NSMutableArray array];
+                }
+                [dependents[dependency] addObject:step.identifier];
+            }
+        }
+        
+        // Scheduling state is only touched on stateQueue. Steps themselves run concurrently as soon as their dependencies finish
+        dispatch_queue_t stateQueue = dispatch_queue_create("com.objc.simulator-trainer.helper.transaction", DISPATCH_QUEUE_SERIAL);
+        dispatch_queue_t workQueue = dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0);
+        dispatch_group_t group = dispatch_group_create();
+        NSMutableDictionary<NSString *, SimHelperStepResult *> *results = [NSMutableDictionary dictionary];
+        // Steps that failed or were skipped because of a failure. A step skipped for having nothing to do doesn't block its dependents
+        NSMutableSet<NSString *> *blockedSteps = [NSMutableSet set];
+        NSInteger totalSteps = steps.count;
+        uint64_t transactionStart = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+        
+        __block void (^finishStep)(SimHelperStepResult *);
+        __block void (^startStep)(SimHelperTransactionStep *);
+        
+        startStep = ^(SimHelperTransactionStep *step) {
+            dispatch_group_enter(group);
+            dispatch_async(workQueue, ^{
+                [progress transactionStepDidStart:step.identifier];
+                
+                uint64_t stepStart = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+                BOOL skipped = NO;
+                NSError *stepError = [self _performTransactionStep:step skipped:&skipped];
+                
+                SimHelperStepResult *result = [[SimHelperStepResult alloc] init];
+                result.identifier = step.identifier;
+                result.error = stepError;
+                result.skipped = skipped && !stepError;
+                result.duration = (clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - stepStart) / 1e9;
+                if (stepError) {
+                    NSLog(@"Transaction step %@ failed: %@", step, stepError);
+                }
+                
+                dispatch_async(stateQueue, ^{
+                    finishStep(result);
+                    dispatch_group_leave(group);
+                });
+            });
+        };
+        
+        finishStep = ^(SimHelperStepResult *result) {
+            results[result.identifier] = result;
+            [progress transactionStepDidFinish:result completedSteps:results.count totalSteps:totalSteps];
+            
+            if (result.error || [blockedSteps containsObject:result.identifier]) {
+                // Nothing that depends on a failed step runs
+                for (NSString *dependent in dependents[result.identifier]) {
+                    if (results[dependent]) {
+                        continue;
+                    }
+                    
+                    SimHelperStepResult *skippedResult = [[SimHelperStepResult alloc] init];
+                    skippedResult.identifier = dependent;
+                    skippedResult.skipped = YES;
+                    [blockedSteps addObject:dependent];
+                    finishStep(skippedResult);
+                }
+                return;
+            }
+            
+            for (NSString *dependent in dependents[result.identifier]) {
+                NSInteger remaining = remainingDependencies[dependent].integerValue - 1;
+                remainingDependencies[dependent] = @(remaining);
+                if (remaining == 0 && !results[dependent]) {
+                    startStep(stepsById[dependent]);
+                }
+            }
+        };
+        
+        dispatch_sync(stateQueue, ^{
+            for (SimHelperTransactionStep *step in steps) {
+                if (step.dependencies.count == 0) {
+                    startStep(step);
+                }
+            }
+        });
+        
+        // Holding the overlay queue until every step is done keeps overlay growth from remounting under the transaction
+        dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+        NSMutableArray<SimHelperStepResult *> *orderedResults = [NSMutableArray array];
+        __block NSError *firstError = nil;
+        dispatch_sync(stateQueue, ^{
+            for (SimHelperTransactionStep *step in steps) {
+                SimHelperStepResult *result = results[step.identifier];
+                if (!result) {
+                    continue;
+                }
+                
+                [orderedResults addObject:result];
+                if (!firstError && result.error) {
+                    firstError = result.error;
+                }
+            }
+            
+            NSLog(@"Ran transaction of %ld steps in %.1fms", (long)totalSteps, (clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - transactionStart) / 1e6);
+            
+            // Break the retain cycle between the two blocks
+            startStep = nil;
+            finishStep = nil;
+            
+        });
+        
+        if (completion) {
+            completion(orderedResults, firstError);
+        }
+    });
+}
+
+// Sets `skipped` when the step had nothing to do, which still counts as success for the steps depending on it
+- (NSError *)_performTransactionStep:(SimHelperTransactionStep *)step skipped:(BOOL *)skipped {
+    NSError *error = nil;
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    
+    switch (step.kind) {
+        case SimHelperStepKindMountOverlay: {
+            if (![self _mountOverlayAtPath:step.path error:&error]) {
+                return error ?: [NSError errorWithDomain:NSOSStatusErrorDomain code:errAuthorizationDenied userInfo:@{NSLocalizedDescriptionKey: @"Failed to mount overlay"}];
+            }
+            
+            // Set permissions to allow the non-privileged app to read+write to the overlay
+            [fileManager setAttributes:@{NSFilePosixPermissions: @(0777)} ofItemAtPath:step.path error:&error];
+            return error;
+        }
+            
+        case SimHelperStepKindUnmount: {
+            [self _unmountOverlayAtPath:step.path error:&error];
+            return error;
+        }
+            
+        case SimHelperStepKindCopyItem: {
+            if (!step.sourcePath) {
+                return [NSError errorWithDomain:NSOSStatusErrorDomain code:paramErr userInfo:@{NSLocalizedDescriptionKey: @"Copy step has no source path"}];
+            }
+            
+            *skipped = [fileManager fileExistsAtPath:step.path];
+            return [self _copyItemAtPath:step.sourcePath toPath:step.path];
+        }
+            
+        case SimHelperStepKindAddLoadCommand: {
+            if (!step.sourcePath) {
+                return [NSError errorWithDomain:NSOSStatusErrorDomain code:paramErr userInfo:@{NSLocalizedDescriptionKey: @"Load command step has no dylib path"}];
+            }
+            
+            // The binary itself says whether it has been injected. The loader existing on disk doesn't
+            if ([AppBinaryPatcher binary:step.path loadsDylib:step.sourcePath]) {
+                *skipped = YES;
+                return nil;
+            }
+            
+            if (![AppBinaryPatcher addLoadCommandForDylib:step.sourcePath toBinary:step.path usingOptoolAtPath:step.toolPath error:&error]) {
+                return error ?: [NSError errorWithDomain:NSOSStatusErrorDomain code:ioErr userInfo:@{NSLocalizedDescriptionKey: [NSString stringWithFormat:@"Failed to add a load command for %@ to %@", step.sourcePath, step.path]}];
+            }
+            return nil;
+        }
+            
+        case SimHelperStepKindSignBinary: {
+            // Covers binaries injected by an earlier run that were left unsigned, or changed after signing
+            if ([AppBinaryPatcher hasValidSignatureAtPath:step.path]) {
+                *skipped = YES;
+                return nil;
+            }
+            
+            // Wait for the completion rather than assuming codesigning finishes synchronously
+            __block NSError *signError = nil;
+            dispatch_semaphore_t signSemaphore = dispatch_semaphore_create(0);
+            [AppBinaryPatcher codesignItemAtPath:step.path completion:^(BOOL success, NSError *codesignError) {
+                if (!success) {
+                    signError = codesignError ?: [NSError errorWithDomain:NSOSStatusErrorDomain code:ioErr userInfo:@{NSLocalizedDescriptionKey: [NSString stringWithFormat:@"Failed to sign %@", step.path]}];
+                }
+                dispatch_semaphore_signal(signSemaphore);
+            }];
+            dispatch_semaphore_wait(signSemaphore, DISPATCH_TIME_FOREVER);
+            return signError;
+        }
+            
+        case SimHelperStepKindSetPermissions: {
+            // Limited to the overlays this helper mounted, and never setuid/setgid
+            if (overlay_set_permissions(step.path.fileSystemRepresentation, (mode_t)(step.mode & 0777)) != 0) {
+                return [NSError errorWithDomain:NSOSStatusErrorDomain code:errAuthorizationDenied userInfo:@{NSLocalizedDescriptionKey: [NSString stringWithFormat:@"Can't change permissions of %@", step.path]}];
+            }
+            return nil;
+        }
+            
+        case SimHelperStepKindDeployBootstrapImage: {
+            bootstrap_image_t *image = bootstrap_image_open(step.sourcePath.fileSystemRepresentation);
+            if (!image) {
+                return [NSError errorWithDomain:NSOSStatusErrorDomain code:paramErr userInfo:@{NSLocalizedDescriptionKey: [NSString stringWithFormat:@"Invalid bootstrap image: %@", step.sourcePath]}];
+            }
+            
+            bootstrap_deploy_stats_t stats;
+            int result = bootstrap_image_deploy(image, step.path.fileSystemRepresentation, &stats);
+            bootstrap_image_close(image);
+            
+            NSLog(@"Deployed bootstrap image to %@: %d unchanged, %d cloned, %d copied, %d failed in %.1fms", step.path, stats.unchanged, stats.cloned, stats.copied, stats.failed, stats.total_ns / 1e6);
+            if (result != 0) {
+                return [NSError errorWithDomain:NSOSStatusErrorDomain code:ioErr userInfo:@{NSLocalizedDescriptionKey: [NSString stringWithFormat:@"Failed to place %d bootstrap files", stats.failed]}];
+            }
+            return nil;
         }
     }
     
-    completion(nil);
+    return [NSError errorWithDomain:NSOSStatusErrorDomain code:paramErr userInfo:@{NSLocalizedDescriptionKey: [NSString stringWithFormat:@"Unknown step kind %ld", (long)step.kind]}];
 }
 
 - (BOOL)_unmountOverlayAtPath:(NSString *)overlayPath error:(NSError **)error {
@@ -233,6 +519,8 @@
         return NO;
     }
     
+    // Explicitly removed overlays shouldn't come back the next time the helper starts
+    forget_overlay(overlayPath.UTF8String);
     return YES;
 }
 
@@ -242,6 +530,8 @@
 int main(int argc, const char * argv[]) {
     @autoreleasepool {
         SimRuntimeHelper *helper = [[SimRuntimeHelper alloc] init];
+        [helper restoreOverlays];
+        [helper startOverlayGrowthMonitor];
         [helper startListener];
     }
 
@@ -0,0 +1,112 @@
+#! /usr/bin/python3
+#
+#   Packs the jailbreak bootstrap files into a single content-addressed image
+#   that the privileged helper deploys into a simulator runtime in one pass.
+#
+#   usage: build_bootstrap_image.py <bootstrap source dir> <output .image dir>
+#
+#   Layout of the image directory:
+#     manifest    header, fixed-size entries, then a table of NUL-terminated destination paths
+#     objects/    one file per distinct content, named by its lowercase hex SHA-256
+#
+#   Which files go where comes from BootstrapFiles.plist in the source dir.
+#   Mach-O objects are ad-hoc signed here so nothing has to be re-signed after deployment.
+#   The manifest format is read by Injection/bootstrap_image.c and the two have to be kept in sync.
+
+import hashlib
+import os
+import plistlib
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+
+MANIFEST_MAGIC = b"SBIM"
+MANIFEST_VERSION = 1
+HEADER_FORMAT = "<4sIIII4x"
+ENTRY_FORMAT = "<32sQII"
+
+# Bundle file -> path relative to the simulator runtime root. The app reads the same list when it has no image to deploy
+BOOTSTRAP_FILES_MANIFEST = "BootstrapFiles.plist"
+
+MACHO_MAGICS = (b"\xcf\xfa\xed\xfe", b"\xce\xfa\xed\xfe", b"\xca\xfe\xba\xbe")
+
+
+def is_macho(path):
+    with open(path, "rb") as f:
+        return f.read(4) in MACHO_MAGICS
+
+
+def presign(path):
+    if sys.platform != "darwin" or not is_macho(path):
+        return
+    subprocess.check_call(["codesign", "-f", "-s", "-", "--generate-entitlement-der", path],
+                          stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+
+def sha256_of(path):
+    digest = hashlib.sha256()
+    with open(path, "rb") as f:
+        for chunk in iter(lambda: f.read(1 << 20), b""):
+            digest.update(chunk)
+    return digest.digest()
+
+
+def build(source_dir, image_dir):
+    objects_dir = os.path.join(image_dir, "objects")
+    os.makedirs(objects_dir, exist_ok=True)
+
+    with open(os.path.join(source_dir, BOOTSTRAP_FILES_MANIFEST), "rb") as f:
+        bootstrap_files = plistlib.load(f)
+
+    entries = []
+    live_objects = set()
+    with tempfile.TemporaryDirectory() as staging:
+        for name in sorted(bootstrap_files):
+            source = os.path.join(source_dir, name)
+            if not os.path.isfile(source):
+                print("warning: bootstrap file %s is missing, leaving it out of the image" % name)
+                continue
+
+            staged = os.path.join(staging, name)
+            shutil.copy2(source, staged)
+            presign(staged)
+
+            digest = sha256_of(staged)
+            object_name = digest.hex()
+            object_path = os.path.join(objects_dir, object_name)
+            if not os.path.exists(object_path):
+                shutil.copy2(staged, object_path)
+            live_objects.add(object_name)
+
+            mode = os.stat(staged).st_mode & 0o777
+            entries.append((digest, os.path.getsize(staged), mode, bootstrap_files[name].lstrip("/")))
+
+    # Objects from earlier builds whose content is no longer in the set
+    for object_name in os.listdir(objects_dir):
+        if object_name not in live_objects:
+            os.unlink(os.path.join(objects_dir, object_name))
+
+    strings = bytearray()
+    packed_entries = bytearray()
+    for digest, size, mode, dest in entries:
+        packed_entries += struct.pack(ENTRY_FORMAT, digest, size, mode, len(strings))
+        strings += dest.encode("utf-8") + b"\0"
+
+    strings_offset = struct.calcsize(HEADER_FORMAT) + len(packed_entries)
+    header = struct.pack(HEADER_FORMAT, MANIFEST_MAGIC, MANIFEST_VERSION, len(entries), strings_offset, len(strings))
+
+    manifest_path = os.path.join(image_dir, "manifest")
+    with open(manifest_path + ".tmp", "wb") as f:
+        f.write(header + packed_entries + strings)
+    os.replace(manifest_path + ".tmp", manifest_path)
+
+    print("Packed %d bootstrap files (%d objects) into %s" % (len(entries), len(live_objects), image_dir))
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        sys.stderr.write("usage: %s <bootstrap source dir> <output .image dir>\n" % sys.argv[0])
+        sys.exit(1)
+    build(sys.argv[1], sys.argv[2])
@@ -9,6 +9,14 @@
 
 NS_ASSUME_NONNULL_BEGIN
 
+// Stops a running command when cancelled. Can be cancelled from any thread
+@interface CommandCancellationToken : NSObject
+
+- (void)cancel;
+- (BOOL)isCancelled;
+
+@end
+
 @interface CommandRunner : NSObject
 
 + (BOOL)runCommand:(NSString *)command withArguments:(NSArray<NSString *> *)arguments cwd:(NSString * _Nullable)cwdPath environment:(NSDictionary * _Nullable)environment stdoutString:(NSString * _Nullable *_Nullable)stdoutString error:(NSError ** _Nullable)errorOut;
@@ -17,8 +25,25 @@ NS_ASSUME_NONNULL_BEGIN
 
 + (BOOL)runCommand:(NSString *)command withArguments:(NSArray<NSString *> *)arguments cwd:(NSString * _Nullable)cwdPath environment:(NSDictionary * _Nullable)environment stdoutString:(NSString * _Nullable *_Nullable)stdoutString error:(NSError ** _Nullable)errorOut waitUntilExit:(BOOL)waitUntilExit;
 
+/**
+  * Run a command and wait for it, reading its output while it runs so it can't stall on a full pipe.
+  * @param timeout Seconds before the command is killed and fails with ETIMEDOUT. 0 for no limit
+  * @param cancellationToken Kills the command when cancelled, which then fails with ECANCELED
+  * @param lineHandler Called on the calling thread with each line of stdout and stderr as it is written
+ */
++ (BOOL)runCommand:(NSString *)command withArguments:(NSArray<NSString *> *)arguments cwd:(NSString * _Nullable)cwdPath environment:(NSDictionary * _Nullable)environment timeout:(NSTimeInterval)timeout cancellationToken:(CommandCancellationToken * _Nullable)cancellationToken lineHandler:(void (^ _Nullable)(NSString *line, BOOL isStderr))lineHandler stdoutString:(NSString * _Nullable * _Nullable)stdoutString error:(NSError ** _Nullable)errorOut;
+
+/**
+  * Run a tool from the selected Xcode, like "lipo" or "simctl", without going through xcrun each time.
+  * The tool's path comes from ToolchainRegistry
+ */
++ (BOOL)runTool:(NSString *)tool withArguments:(NSArray<NSString *> *)arguments environment:(NSDictionary * _Nullable)environment stdoutString:(NSString * _Nullable * _Nullable)stdoutString error:(NSError ** _Nullable)errorOut;
+
 + (NSString *)xcrunInvokeAndWait:(NSArray<NSString *> *)argument;
 
+// Spawn-to-exit time of every tool run so far, keyed by tool ("lipo", "xcrun otool"), with "runs", "averageSeconds" and "maxSeconds"
++ (NSDictionary<NSString *, NSDictionary<NSString *, NSNumber *> *> *)toolLatencies;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -6,6 +6,26 @@
 //
 
 #import "CommandRunner.h"
+#import "process_runner.h"
+#import "ToolchainRegistry.h"
+
+@interface CommandCancellationToken () {
+    @public
+    atomic_bool _cancelled;
+}
+@end
+
+@implementation CommandCancellationToken
+
+- (void)cancel {
+    atomic_store(&_cancelled, true);
+}
+
+- (BOOL)isCancelled {
+    return atomic_load(&_cancelled);
+}
+
+@end
 
 @implementation CommandRunner
 
@@ -18,6 +38,41 @@
 }
 
 + (BOOL)runCommand:(NSString *)command withArguments:(NSArray<NSString *> *)arguments cwd:(NSString * _Nullable)cwdPath environment:(NSDictionary * _Nullable)environment stdoutString:(NSString * _Nullable *)stdoutString error:(NSError ** _Nullable)errorOut waitUntilExit:(BOOL)waitUntilExit {
+    if (!waitUntilExit) {
+        // Nothing is read, but the process still has to be reaped
+        dispatch_async(dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+            [self runCommand:command withArguments:arguments cwd:cwdPath environment:environment timeout:0 cancellationToken:nil lineHandler:nil stdoutString:nil error:nil];
+        });
+        return YES;
+    }
+
+    return [self runCommand:command withArguments:arguments cwd:cwdPath environment:environment timeout:0 cancellationToken:nil lineHandler:nil stdoutString:stdoutString error:errorOut];
+}
+
+static void _deliverLine(int stream, const char *line, size_t length, void *ctx) {
+    void (^lineHandler)(NSString *, BOOL) = (__bridge void (^)(NSString *, BOOL))ctx;
+    NSString *lineString = [[NSString alloc] initWithBytes:line length:length encoding:NSUTF8StringEncoding];
+    if (!lineString) {
+        lineString = [[NSString alloc] initWithBytes:line length:length encoding:NSISOLatin1StringEncoding];
+    }
+
+    lineHandler(lineString, stream == PROCESS_STREAM_STDERR);
+}
+
++ (NSString * _Nullable)_stringFromOutput:(const char *)output length:(size_t)length {
+    if (!output || length == 0) {
+        return nil;
+    }
+
+    NSString *string = [[NSString alloc] initWithBytes:output length:length encoding:NSUTF8StringEncoding];
+    if ([string hasSuffix:@"\n"]) {
+        string = [string substringToIndex:(string.length - 1)];
+    }
+
+    return string;
+}
+
++ (BOOL)runCommand:(NSString *)command withArguments:(NSArray<NSString *> *)arguments cwd:(NSString * _Nullable)cwdPath environment:(NSDictionary * _Nullable)environment timeout:(NSTimeInterval)timeout cancellationToken:(CommandCancellationToken * _Nullable)cancellationToken lineHandler:(void (^ _Nullable)(NSString *line, BOOL isStderr))lineHandler stdoutString:(NSString * _Nullable * _Nullable)stdoutString error:(NSError ** _Nullable)errorOut {
     if (!command) {
         NSLog(@"No command provided to runCommand. Command %@, Arguments %@", command, arguments);
         if (errorOut) {
@@ -26,110 +81,129 @@
 
         return NO;
     }
-    
-    NSTask *task = [[NSTask alloc] init];
-    task.launchPath = command;
-    task.arguments = arguments;
-    
-    NSPipe *outputPipe = nil;
-    if (stdoutString != nil) {
-        outputPipe = [NSPipe pipe];
-        task.standardOutput = outputPipe;
-    }
-    
-    NSPipe *errorPipe = [NSPipe pipe];
-    task.standardError = errorPipe;
-    
-    NSDictionary *env = [[NSProcessInfo processInfo] environment];
-    if (environment) {
-        NSMutableDictionary *mutableEnv = [NSMutableDictionary dictionaryWithDictionary:env];
-        [mutableEnv addEntriesFromDictionary:environment];
-        env = mutableEnv;
-    }
-    task.environment = env;
-    
-    if (cwdPath) {
-        task.currentDirectoryPath = cwdPath;
-    }
 
-    [task launch];
-    if (!waitUntilExit) {
-        return YES;
-    }
-    [task waitUntilExit];
-    
-    NSString *stdErrString = [CommandRunner _readStringFromPipe:errorPipe withTimeout:5.0];
-    NSString *commandOutput = nil;
-    if (outputPipe != nil) {
-        commandOutput = [CommandRunner _readStringFromPipe:outputPipe withTimeout:5.0];
-        if (stdoutString != nil) {
-            *stdoutString = commandOutput;
-        }
+    // The strings stay alive in these arrays until the command is done
+    NSMutableArray<NSString *> *argvStrings = [NSMutableArray arrayWithObject:command];
+    [argvStrings addObjectsFromArray:arguments ?: @[]];
+    const char **argv = calloc(argvStrings.count + 1, sizeof(char *));
+    for (NSUInteger i = 0; i < argvStrings.count; i++) {
+        argv[i] = argvStrings[i].UTF8String;
     }
 
-    [[errorPipe fileHandleForReading] closeFile];
-    if (outputPipe) {
-        [[outputPipe fileHandleForReading] closeFile];
+    NSMutableArray<NSString *> *environmentStrings = [NSMutableArray array];
+    for (NSString *key in environment) {
+        [environmentStrings addObject:[NSString stringWithFormat:@"%@=%@", key, environment[key]]];
     }
-    
-    if (task.terminationStatus != 0 && errorOut) {
-        *errorOut = [NSError errorWithDomain:@"CommandExecutionErrorDomain" code:task.terminationStatus userInfo:@{
-            NSLocalizedDescriptionKey: @"Command execution failed",
-            NSUnderlyingErrorKey: [NSError errorWithDomain:@"CommandExecutionErrorDomain" code:task.terminationStatus userInfo:@{
-                NSLocalizedDescriptionKey: @"Command execution failed",
-                @"CommandPath": command,
-                @"Arguments": arguments ?: @[],
-                @"TerminationStatus": @(task.terminationStatus),
-                @"CommandOutput": commandOutput ?: @"",
-                @"CommandError": stdErrString ?: @""
-            }],
-        }];
+    const char **environmentEntries = calloc(environmentStrings.count + 1, sizeof(char *));
+    for (NSUInteger i = 0; i < environmentStrings.count; i++) {
+        environmentEntries[i] = environmentStrings[i].UTF8String;
     }
 
-    return task.terminationStatus == 0;
-}
+    process_spawn_options_t options = {
+        .path = command.fileSystemRepresentation,
+        .argv = argv,
+        .environment = environmentEntries,
+        .cwd = cwdPath.fileSystemRepresentation,
+        .timeout_seconds = timeout,
+        .cancel = cancellationToken ? &cancellationToken->_cancelled : NULL,
+        .capture_stdout = stdoutString != nil,
+        .capture_stderr = YES,
+        .line_handler = lineHandler ? _deliverLine : NULL,
+        .line_handler_ctx = (__bridge void *)lineHandler,
+    };
+
+    process_result_t result;
+    int runResult = process_run(&options, &result);
+    int runErrno = errno;
+    free(argv);
+    free(environmentEntries);
+
+    if (runResult != 0) {
+        if (errorOut) {
+            *errorOut = [NSError errorWithDomain:NSPOSIXErrorDomain code:runErrno userInfo:@{
+                NSLocalizedDescriptionKey: [NSString stringWithFormat:@"Failed to launch %@: %s", command, strerror(runErrno)],
+            }];
+        }
 
-+ (NSString * _Nullable)_readStringFromPipe:(NSPipe *)pipe withTimeout:(NSTimeInterval)timeout {
-    __block NSData *readData = nil;
+        return NO;
+    }
 
-    if (timeout <= 0) {
-        readData = [pipe.fileHandleForReading readDataToEndOfFile];
+    NSString *commandOutput = [CommandRunner _stringFromOutput:result.stdout_data length:result.stdout_length];
+    NSString *stdErrString = [CommandRunner _stringFromOutput:result.stderr_data length:result.stderr_length];
+    if (stdoutString != nil) {
+        *stdoutString = commandOutput;
     }
-    else {
-        dispatch_queue_t read_queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
 
-        dispatch_semaphore_t sem = dispatch_semaphore_create(0);
-        dispatch_async(read_queue, ^{
-            readData = [pipe.fileHandleForReading readDataToEndOfFile];
-            dispatch_semaphore_signal(sem);
-        });
+    int terminationStatus = result.exit_status;
+    BOOL timedOut = result.timed_out;
+    BOOL cancelled = result.cancelled;
+    process_result_free(&result);
 
-        if (dispatch_semaphore_wait(sem, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(timeout * NSEC_PER_SEC))) != 0) {
-            NSLog(@"Timeout reading from pipe after %f seconds.", timeout);
-            return nil;
+    BOOL succeeded = terminationStatus == 0 && !timedOut && !cancelled;
+    if (!succeeded && errorOut) {
+        NSDictionary *details = @{
+            NSLocalizedDescriptionKey: @"Command execution failed",
+            @"CommandPath": command,
+            @"Arguments": arguments ?: @[],
+            @"TerminationStatus": @(terminationStatus),
+            @"CommandOutput": commandOutput ?: @"",
+            @"CommandError": stdErrString ?: @""
+        };
+
+        if (timedOut || cancelled) {
+            NSMutableDictionary *userInfo = [details mutableCopy];
+            userInfo[NSLocalizedDescriptionKey] = [NSString stringWithFormat:@"%@ %@", command, timedOut ? [NSString stringWithFormat:@"timed out after %.1fs", timeout] : @"was cancelled"];
+            *errorOut = [NSError errorWithDomain:NSPOSIXErrorDomain code:timedOut ? ETIMEDOUT : ECANCELED userInfo:userInfo];
+        }
+        else {
+            *errorOut = [NSError errorWithDomain:@"CommandExecutionErrorDomain" code:terminationStatus userInfo:@{
+                NSLocalizedDescriptionKey: @"Command execution failed",
+                NSUnderlyingErrorKey: [NSError errorWithDomain:@"CommandExecutionErrorDomain" code:terminationStatus userInfo:details],
+            }];
         }
     }
 
-    if (readData && readData.length > 0) {
-        NSString *output = [[NSString alloc] initWithData:readData encoding:NSUTF8StringEncoding];
-        if ([output hasSuffix:@"\n"]) {
-            output = [output substringToIndex:(output.length - 1)];
-        }
+    return succeeded;
+}
 
-        return output;
++ (BOOL)runTool:(NSString *)tool withArguments:(NSArray<NSString *> *)arguments environment:(NSDictionary * _Nullable)environment stdoutString:(NSString * _Nullable * _Nullable)stdoutString error:(NSError ** _Nullable)errorOut {
+    ToolchainRegistry *toolchain = [ToolchainRegistry sharedRegistry];
+    NSMutableDictionary *toolEnvironment = [NSMutableDictionary dictionaryWithObject:[toolchain developerDir] forKey:@"DEVELOPER_DIR"];
+    [toolEnvironment addEntriesFromDictionary:environment ?: @{}];
+
+    NSString *toolPath = [toolchain pathForTool:tool];
+    if (!toolPath) {
+        // Let xcrun report why the tool is missing
+        return [self runCommand:@"/usr/bin/xcrun" withArguments:[@[tool] arrayByAddingObjectsFromArray:arguments] cwd:nil environment:toolEnvironment stdoutString:stdoutString error:errorOut];
     }
 
-    return nil;
+    return [self runCommand:toolPath withArguments:arguments cwd:nil environment:toolEnvironment stdoutString:stdoutString error:errorOut];
 }
 
 + (NSString *)xcrunInvokeAndWait:(NSArray<NSString *> *)arguments {
     return [self _runXCRunCommand:arguments environment:nil waitUntilExit:YES];
 }
 
++ (NSDictionary<NSString *, NSDictionary<NSString *, NSNumber *> *> *)toolLatencies {
+    process_tool_stats_t stats[64];
+    size_t count = process_copy_tool_stats(stats, sizeof(stats) / sizeof(stats[0]));
+
+    NSMutableDictionary *latencies = [NSMutableDictionary dictionary];
+    for (size_t i = 0; i < count; i++) {
+        latencies[@(stats[i].tool)] = @{
+            @"runs": @(stats[i].runs),
+            @"averageSeconds": @((double)stats[i].total_ns / (double)stats[i].runs / 1e9),
+            @"maxSeconds": @((double)stats[i].max_ns / 1e9),
+        };
+    }
+
+    return latencies;
+}
+
 + (NSString *)_runXCRunCommand:(NSArray<NSString *> *)arguments environment:(NSDictionary<NSString *, NSString *> *)customEnvironment waitUntilExit:(BOOL)waitUntilExit {
     NSString *output = nil;
     NSError *error = nil;
-    if ([CommandRunner runCommand:@"/usr/bin/xcrun" withArguments:arguments cwd:nil environment:customEnvironment stdoutString:&output error:&error]) {
+    if (arguments.count > 0 && [CommandRunner runTool:arguments.firstObject withArguments:[arguments subarrayWithRange:NSMakeRange(1, arguments.count - 1)] environment:customEnvironment stdoutString:&output error:&error]) {
         return output;
     }
     
@@ -5,11 +5,15 @@
 //  Created by m1book on 6/3/25.
 //
 
-#import <libproc.h>
+#import <sys/event.h>
+#import <sys/socket.h>
+#import <sys/un.h>
+#import <netinet/in.h>
 #import "TerminalWindowController.h"
 #import "CycriptLauncher.h"
 #import "AppBinaryPatcher.h"
 #import "CommandRunner.h"
+#import "SimProcessIndex.h"
 
 @implementation CycriptLaunchRequest
 @end
@@ -41,28 +45,24 @@
 }
 
 - (pid_t)_getProcessIDForTarget:(NSString *)target {
-    int pids[1024];
-    int count = proc_listpids(PROC_ALL_PIDS, 0, pids, sizeof(pids));
-    if (count <= 0) {
-        NSLog(@"Failed to list processes");
+    // Scoped to the requested device, so the same app running in another simulator isn't picked up
+    SimProcessIndex *processIndex = [SimProcessIndex sharedIndex];
+    NSArray<SimProcessInfo *> *matches = [processIndex processesNamed:target deviceUdid:self.request.targetDeviceId];
+    if (matches.count == 0) {
+        NSString *pattern = [NSString stringWithFormat:@"*%@*", target];
+        matches = [processIndex processesMatchingPattern:pattern deviceUdid:self.request.targetDeviceId];
+    }
+    
+    if (matches.count == 0) {
+        NSLog(@"No process matching %@ in %@", target, self.request.targetDeviceId ?: @"any simulator");
         return -1;
     }
     
-    for (int i = 0; i < count; i++) {
-        if (pids[i] == 0) {
-            continue;
-        }
-
-        char namebuf[PROC_PIDPATHINFO_MAXSIZE];
-        proc_pidpath(pids[i], namebuf, sizeof(namebuf));
-        
-        NSString *processName = [NSString stringWithUTF8String:namebuf];
-        if ([processName containsString:target]) {
-            return pids[i];
-        }
+    if (matches.count > 1) {
+        NSLog(@"%lu processes match %@, using %@", (unsigned long)matches.count, target, matches.firstObject);
     }
     
-    return -1;
+    return matches.firstObject.pid;
 }
 
 - (pid_t)_launchTargetProcess {
@@ -83,31 +83,25 @@
         }
         [[NSFileManager defaultManager] copyItemAtPath:libInAssetPath toPath:libInTmpPath error:nil];
         
-        __block pid_t pid = -1;
-//        dispatch_semaphore_t sema = dispatch_semaphore_create(0);
-//        [AppBinaryPatcher codesignItemAtPath:libInTmpPath completion:^(BOOL success, NSError * _Nullable error) {
-//            if (error) {
-//                NSLog(@"Failed to codesign libobjsee: %@", error);
-//                return;
-//            }
-//
-        int cycript_server_port = (9973 * getpid()) % 49901 + 8100;
+        // Let the kernel pick a free port rather than deriving one from our pid, which collided between launches
+        int cycript_server_port = [self _reserveLoopbackPort];
+        if (cycript_server_port <= 0) {
+            NSLog(@"Failed to reserve a port for cycript_server");
+            return -1;
+        }
+        
         self.request.serverPort = cycript_server_port;
-            NSArray *xcrunArgs = @[@"simctl", @"launch", @"--terminate-running-process", self.request.targetDeviceId, self.request.targetBundleId];
-            NSDictionary *envs = @{
-                @"SIMCTL_CHILD_DYLD_INSERT_LIBRARIES": libInTmpPath,
-                @"SIMCTL_CHILD_CYCRIPT_SERVER_PORT": [NSString stringWithFormat:@"%d", cycript_server_port],
-            };
-            
-            NSString *output = nil;
-            [CommandRunner runCommand:@"/usr/bin/xcrun" withArguments:xcrunArgs cwd:nil environment:envs stdoutString:&output error:nil];
-            
-            NSString *pidString = [output componentsSeparatedByString:@":"].lastObject;
-            pid = (pid_t)[pidString integerValue];
-//            dispatch_semaphore_signal(sema);
-//        }];
+        NSArray *simctlArgs = @[@"launch", @"--terminate-running-process", self.request.targetDeviceId, self.request.targetBundleId];
+        NSDictionary *envs = @{
+            @"SIMCTL_CHILD_DYLD_INSERT_LIBRARIES": libInTmpPath,
+            @"SIMCTL_CHILD_CYCRIPT_SERVER_PORT": [NSString stringWithFormat:@"%d", cycript_server_port],
+        };
+        
+        NSString *output = nil;
+        [CommandRunner runTool:@"simctl" withArguments:simctlArgs environment:envs stdoutString:&output error:nil];
         
-//        dispatch_semaphore_wait(sema, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(5 * NSEC_PER_SEC)));
+        NSString *pidString = [output componentsSeparatedByString:@":"].lastObject;
+        pid_t pid = (pid_t)[pidString integerValue];
         return pid;
     }
     else {
@@ -115,13 +109,42 @@
     }
 }
 
-- (int)_readServerPortFromSockForPid:(pid_t)pid {
-    char socket_path[64];
-    snprintf(socket_path, sizeof(socket_path), "/var/tmp/cycript-port.%d.sock", pid);
+- (int)_reserveLoopbackPort {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        NSLog(@"Failed to create socket: %s", strerror(errno));
+        return -1;
+    }
+    
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    
+    socklen_t addr_len = sizeof(addr);
+    int port = -1;
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0 && getsockname(sock, (struct sockaddr *)&addr, &addr_len) == 0) {
+        port = ntohs(addr.sin_port);
+    }
+    
+    close(sock);
+    return port;
+}
+
+- (int)_readServerPortFromSocketPath:(const char *)socket_path timeout:(NSTimeInterval)timeout {
     int sock = socket(AF_UNIX, SOCK_STREAM, 0);
     if (sock < 0) {
         NSLog(@"Failed to create socket: %s", strerror(errno));
-        return NO;
+        return -1;
+    }
+    
+    // A server that accepts but never writes its port would otherwise hold the recv forever
+    struct timeval receive_timeout = {(time_t)timeout, (int)((timeout - (double)(time_t)timeout) * 1e6)};
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &receive_timeout, sizeof(receive_timeout)) != 0) {
+        NSLog(@"Failed to set receive timeout: %s", strerror(errno));
+        close(sock);
+        return -1;
     }
     
     struct sockaddr_un addr;
@@ -129,46 +152,111 @@
     addr.sun_family = AF_UNIX;
     strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
     
-    for (int i = 0; i < 50; i++) {
-        if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+    int cycript_server_port = -1;
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        ssize_t n = recv(sock, &cycript_server_port, sizeof(cycript_server_port), MSG_WAITALL);
+        if (n != sizeof(cycript_server_port)) {
+            cycript_server_port = -1;
+        }
+    }
+    
+    close(sock);
+    return cycript_server_port;
+}
+
+/**
+  * cycript_server announces itself once it is listening, by binding /var/tmp/cycript-port.<pid>.sock and handing
+  * its port to whoever connects. Wait for that socket to show up instead of sleeping or retrying connect
+ */
+- (int)_waitForServerPortForPid:(pid_t)pid timeout:(NSTimeInterval)timeout {
+    char socket_path[64];
+    snprintf(socket_path, sizeof(socket_path), "/var/tmp/cycript-port.%d.sock", pid);
+    
+    int kq = kqueue();
+    int dir_fd = open("/var/tmp", O_EVTONLY);
+    if (kq >= 0 && dir_fd >= 0) {
+        struct kevent change;
+        EV_SET(&change, dir_fd, EVFILT_VNODE, EV_ADD | EV_CLEAR, NOTE_WRITE, 0, NULL);
+        kevent(kq, &change, 1, NULL, 0, NULL);
+    }
+    
+    CFAbsoluteTime deadline = CFAbsoluteTimeGetCurrent() + timeout;
+    int cycript_server_port = -1;
+    for (;;) {
+        // Checked after arming the watch, so a socket created in between isn't missed
+        if (access(socket_path, F_OK) == 0) {
+            cycript_server_port = [self _readServerPortFromSocketPath:socket_path timeout:MAX(deadline - CFAbsoluteTimeGetCurrent(), 0.01)];
+            if (cycript_server_port > 0) {
+                break;
+            }
+        }
+        
+        double remaining = deadline - CFAbsoluteTimeGetCurrent();
+        if (remaining <= 0 || kq < 0 || dir_fd < 0) {
             break;
         }
         
-        usleep(100000);
+        // The socket can exist a moment before the server accepts on it, so a directory event isn't the only wakeup
+        double wait = MIN(remaining, 0.25);
+        struct timespec wait_ts = {(time_t)wait, (long)((wait - (double)(time_t)wait) * 1e9)};
+        struct kevent event;
+        kevent(kq, NULL, 0, &event, 1, &wait_ts);
+        
+        if (kill(pid, 0) != 0 && errno == ESRCH) {
+            NSLog(@"Process %d exited before cycript_server came up", pid);
+            break;
+        }
     }
     
-    int cycript_server_port = -1;
-    ssize_t n = recv(sock, &cycript_server_port, sizeof(cycript_server_port), 0);
-    close(sock);
+    if (dir_fd >= 0) {
+        close(dir_fd);
+    }
     
-    if (n != sizeof(cycript_server_port) || cycript_server_port <= 0) {
-        NSLog(@"Failed to receive cycript port");
-        return NO;
+    if (kq >= 0) {
+        close(kq);
     }
     
     return cycript_server_port;
 }
 
 - (BOOL)launch {
-
-    if (!self.request.serverPort || self.request.serverPort <= 0) {
-        pid_t pid = [self _launchTargetProcess];
-        if (pid <= 0) {
-            NSLog(@"Failed to find running process for request %@", self.request);
-            return NO;
-        }
-    }
-
-    int cycript_server_port = (int)self.request.serverPort;
-    if (cycript_server_port <= 0) {
-        NSLog(@"Invalid or missing cycript server port");
+    if (!self.request.processName.length && !self.request.targetBundleId.length && self.request.serverPort <= 0) {
+        NSLog(@"Cycript request needs a process name, bundle id or server port: %@", self.request);
         return NO;
     }
-
-    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(2 * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
-        NSString *termTitle = [NSString stringWithFormat:@"cycript -- (127.0.0.1:%d)", cycript_server_port];
-        NSArray *cycriptArgs = @[@"-r", [NSString stringWithFormat:@"127.0.0.1:%d", cycript_server_port]];
-        [TerminalWindowController presentTerminalWithExecutable:[self _cycriptExecutablePath] args:cycriptArgs env:nil title:termTitle];
+    
+    // Launching through simctl blocks until the app is up, so the whole attach runs off the main thread
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+        int cycript_server_port = (int)self.request.serverPort;
+        if (cycript_server_port <= 0) {
+            pid_t pid = [self _launchTargetProcess];
+            if (pid <= 0) {
+                NSLog(@"Failed to find running process for request %@", self.request);
+                return;
+            }
+            
+            // The server reports the port it actually bound. For launches that's the one requested above
+            int reported_port = [self _waitForServerPortForPid:pid timeout:10.0];
+            if (reported_port > 0) {
+                cycript_server_port = reported_port;
+            }
+            else {
+                NSLog(@"cycript_server in %d never announced itself", pid);
+                cycript_server_port = (int)self.request.serverPort;
+            }
+        }
+        
+        if (cycript_server_port <= 0) {
+            NSLog(@"Invalid or missing cycript server port");
+            return;
+        }
+        
+        self.request.serverPort = cycript_server_port;
+        dispatch_async(dispatch_get_main_queue(), ^{
+            NSString *termTitle = [NSString stringWithFormat:@"cycript -- (127.0.0.1:%d)", cycript_server_port];
+            NSArray *cycriptArgs = @[@"-r", [NSString stringWithFormat:@"127.0.0.1:%d", cycript_server_port]];
+            [TerminalWindowController presentTerminalWithExecutable:[self _cycriptExecutablePath] args:cycriptArgs env:nil title:termTitle];
+        });
     });
 
     return YES;
@@ -15,6 +15,12 @@ NS_ASSUME_NONNULL_BEGIN
 @property (nonatomic, strong) NSArray *classPatterns;
 @property (nonatomic, strong) NSArray *methodPatterns;
 @property (nonatomic, strong) NSArray *imagePatterns;
+// Describe argument values in each line. On by default. Formatting them is the bulk of the tracer's cost in the app
+@property (nonatomic) BOOL includeArguments;
+// Non-zero to profile instead of printing every call: 1 profiles every call tree, N samples one in N
+@property (nonatomic) NSUInteger profileSampleInterval;
+// Where to record the trace to disk, if anywhere
+@property (nonatomic, strong, nullable) NSString *recordingPath;
 @end
 
 @interface ObjseeTraceLauncher : NSObject
@@ -25,6 +31,12 @@ NS_ASSUME_NONNULL_BEGIN
 
 - (void)launch;
 
+/**
+  * Show the recorded calls matching `method` in a terminal. `method` is "-[Class selector]", "+[Class selector]",
+  * a bare class name, or empty for every call. `threadId` is the thread's index in the recording, or -1 for any
+ */
++ (void)presentRecordingAtPath:(NSString *)path method:(nullable NSString *)method threadId:(NSInteger)threadId;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -6,8 +6,11 @@
 //
 
 #import "TerminalWindowController.h"
+#import "ObjseeTraceReceiver.h"
 #import "ObjseeTraceLauncher.h"
 #import "AppBinaryPatcher.h"
+#import "CommandRunner.h"
+#import "objsee_trace_file.h"
 
 typedef enum {
     TRACER_ARG_FORMAT_NONE,
@@ -105,7 +108,32 @@ typedef enum {
 
 extern tracer_result_t encode_tracer_config(tracer_config_t *config, char **out_str);
 
+typedef struct {
+    FILE *file;
+    uint64_t first_timestamp_ns;
+} recording_print_context_t;
+
+static bool print_recorded_event(const objsee_trace_event_t *event, void *context) {
+    recording_print_context_t *print_context = context;
+    if (print_context->first_timestamp_ns == 0) {
+        print_context->first_timestamp_ns = event->timestamp_ns;
+    }
+
+    double seconds = (double)(event->timestamp_ns - print_context->first_timestamp_ns) / 1e9;
+    fprintf(print_context->file, "%10.6f [%u] %*s%c[%s %s]\n", seconds, event->thread_id, (int)event->depth, "", event->is_class_method ? '+' : '-', event->class_name, event->selector);
+    return true;
+}
+
 @implementation ObjseeTraceRequest
+
+- (id)init {
+    if ((self = [super init])) {
+        _includeArguments = YES;
+    }
+
+    return self;
+}
+
 @end
 
 @implementation ObjseeTraceLauncher
@@ -119,26 +147,40 @@ extern tracer_result_t encode_tracer_config(tracer_config_t *config, char **out_
 }
 
 - (void)launch {
-    
+    // The traced app only writes bare lines to a socket; decoding, coloring and indentation happen in the receiver
+    ObjseeTraceReceiver *receiver = [[ObjseeTraceReceiver alloc] init];
+    receiver.profileSampleInterval = self.traceRequest.profileSampleInterval;
+    receiver.recordingPath = self.traceRequest.recordingPath;
+    NSError *receiverError = nil;
+    if (![receiver start:&receiverError]) {
+        NSLog(@"Failed to start trace receiver: %@", receiverError);
+        return;
+    }
+
     tracer_config_t config = {
-        .transport = TRACER_TRANSPORT_STDOUT,
+        .transport = TRACER_TRANSPORT_SOCKET,
+        .transport_config = {
+            .host = "127.0.0.1",
+            .port = receiver.port,
+        },
         .from_dyld_insert = true,
     };
 
     config.format = (tracer_format_options_t) {
-        .include_colors = true,
+        .include_colors = false,
         .include_formatted_trace = true,
         .include_event_json = false,
         .output_as_json = false,
-        .include_thread_id = false,
+        // Profiles need each call's thread to rebuild its stack, and recordings keep it for queries
+        .include_thread_id = (receiver.profileSampleInterval > 0 || receiver.recordingPath != nil),
         .include_indents = true,
         .indent_char = " ",
-        .include_indent_separators = true,
-        .indent_separator_char = "|",
+        .include_indent_separators = false,
+        .indent_separator_char = "",
         .variable_separator_spacing = false,
         .static_separator_spacing = 2,
-        .include_newline_in_formatted_trace = false,
-        .args = TRACER_ARG_FORMAT_DESCRIPTIVE,
+        .include_newline_in_formatted_trace = true,
+        .args = self.traceRequest.includeArguments ? TRACER_ARG_FORMAT_DESCRIPTIVE : TRACER_ARG_FORMAT_NONE,
     };
     
     for (NSString *classPattern in self.traceRequest.classPatterns) {
@@ -168,6 +210,7 @@ extern tracer_result_t encode_tracer_config(tracer_config_t *config, char **out_
     char *encoded_config = NULL;
     if (encode_tracer_config(&config, (char **)&encoded_config) != TRACER_SUCCESS || encoded_config == NULL) {
         NSLog(@"Failed to encode tracer config");
+        [receiver stop];
         return;
     }
     NSString *encodedConfigString = [NSString stringWithUTF8String:encoded_config];
@@ -180,6 +223,7 @@ extern tracer_result_t encode_tracer_config(tracer_config_t *config, char **out_
         [[NSFileManager defaultManager] removeItemAtPath:libObjseeTmpPath error:&error];
         if (error) {
             NSLog(@"Failed to remove old libobjsee: %@", error);
+            [receiver stop];
             return;
         }
     }
@@ -188,17 +232,83 @@ extern tracer_result_t encode_tracer_config(tracer_config_t *config, char **out_
     [AppBinaryPatcher codesignItemAtPath:libObjseeTmpPath completion:^(BOOL success, NSError * _Nullable error) {
         if (error) {
             NSLog(@"Failed to codesign libobjsee: %@", error);
+            [receiver stop];
             return;
         }
 
-        NSArray *xcrunArgs = @[@"simctl", @"launch", @"--console", @"--terminate-running-process", self.traceRequest.targetDeviceId, self.traceRequest.targetBundleId];
-        NSArray *envs = @[
-            [NSString stringWithFormat:@"SIMCTL_CHILD_DYLD_INSERT_LIBRARIES=%@", libObjseeTmpPath],
-            [NSString stringWithFormat:@"SIMCTL_CHILD_OBJSEE_CONFIG=%@", encodedConfigString],
-        ];
-        
-        [TerminalWindowController presentTerminalWithExecutable:@"/usr/bin/xcrun" args:xcrunArgs env:envs title:[NSString stringWithFormat:@"Tracing %@", self.traceRequest.targetBundleId]];
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [TerminalWindowController presentTerminalWithExecutable:@"/bin/cat" args:@[receiver.fifoPath] env:nil title:[NSString stringWithFormat:@"%@ %@", receiver.profileSampleInterval > 0 ? @"Profiling" : @"Tracing", self.traceRequest.targetBundleId]];
+        });
+
+        dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+            NSArray *simctlArgs = @[@"launch", @"--terminate-running-process", self.traceRequest.targetDeviceId, self.traceRequest.targetBundleId];
+            NSDictionary *env = @{
+                @"SIMCTL_CHILD_DYLD_INSERT_LIBRARIES": libObjseeTmpPath,
+                @"SIMCTL_CHILD_OBJSEE_CONFIG": encodedConfigString,
+            };
+
+            NSError *launchError = nil;
+            if (![CommandRunner runTool:@"simctl" withArguments:simctlArgs environment:env stdoutString:nil error:&launchError]) {
+                NSLog(@"Failed to launch %@ for tracing: %@", self.traceRequest.targetBundleId, launchError);
+                [receiver stop];
+            }
+        });
     }];
 }
 
++ (void)presentRecordingAtPath:(NSString *)path method:(NSString *)method threadId:(NSInteger)threadId {
+    NSString *trimmedMethod = [method stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+    NSString *className = nil;
+    NSString *selector = nil;
+    int32_t methodKind = -1;
+    if (trimmedMethod.length > 3 && ([trimmedMethod hasPrefix:@"-["] || [trimmedMethod hasPrefix:@"+["]) && [trimmedMethod hasSuffix:@"]"]) {
+        NSArray<NSString *> *parts = [[trimmedMethod substringWithRange:NSMakeRange(2, trimmedMethod.length - 3)] componentsSeparatedByString:@" "];
+        className = parts.firstObject;
+        selector = parts.count > 1 ? parts[1] : nil;
+        methodKind = [trimmedMethod hasPrefix:@"+"] ? 1 : 0;
+    }
+    else if (trimmedMethod.length > 0 && ![trimmedMethod isEqualToString:@"*"]) {
+        className = trimmedMethod;
+    }
+
+    // Queries over long recordings can take a while, even with the chunk index
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+        objsee_trace_reader_t *reader = objsee_trace_reader_open(path.fileSystemRepresentation);
+        if (!reader) {
+            NSLog(@"Failed to open trace recording %@", path);
+            return;
+        }
+
+        NSString *resultsPath = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSString stringWithFormat:@"objsee-query-%@.txt", [[NSUUID UUID] UUIDString]]];
+        FILE *resultsFile = fopen(resultsPath.fileSystemRepresentation, "w");
+        if (!resultsFile) {
+            NSLog(@"Failed to create %@: %s", resultsPath, strerror(errno));
+            objsee_trace_reader_close(reader);
+            return;
+        }
+
+        objsee_trace_query_t query = {
+            .class_name = className.UTF8String,
+            .selector = selector.UTF8String,
+            .method_kind = methodKind,
+            .thread_id = (int32_t)MAX(MIN(threadId, UINT16_MAX), -1),
+        };
+        recording_print_context_t printContext = {.file = resultsFile};
+        int64_t matched = objsee_trace_reader_query(reader, &query, print_recorded_event, &printContext);
+        if (matched < 0) {
+            fprintf(resultsFile, "\nThe recording is corrupt past this point\n");
+        }
+        else {
+            fprintf(resultsFile, "\n%lld of %llu recorded calls matched\n", matched, objsee_trace_reader_event_count(reader));
+        }
+
+        fclose(resultsFile);
+        objsee_trace_reader_close(reader);
+
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [TerminalWindowController presentTerminalWithExecutable:@"/bin/cat" args:@[resultsPath] env:nil title:[NSString stringWithFormat:@"%@ in %@", trimmedMethod.length > 0 ? trimmedMethod : @"Calls", path.lastPathComponent]];
+        });
+    });
+}
+
 @end
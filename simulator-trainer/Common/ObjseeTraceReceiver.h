@@ -0,0 +1,38 @@
+//
+//  ObjseeTraceReceiver.h
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+  * Host end of an objsee socket trace. Lines from the traced process are decoded into fixed-size records with
+  * interned class and selector ids and queued in a single-producer/single-consumer ring. Formatting (indents,
+  * colors) happens on the host, on the consumer side, and only for records that are actually displayed.
+  * The formatted trace is written to a FIFO that a terminal can `cat`
+ */
+@interface ObjseeTraceReceiver : NSObject
+
+// Loopback port the traced process connects to. Valid after -start:
+@property (nonatomic, readonly) uint16_t port;
+@property (nonatomic, copy, readonly, nullable) NSString *fifoPath;
+// Records that didn't fit in the ring because the display fell behind
+@property (nonatomic, readonly) uint64_t droppedRecords;
+
+// Set before -start: to fold calls into a profile instead of printing them. 1 profiles every call tree, N one in N
+@property (nonatomic) NSUInteger profileSampleInterval;
+// Where a profiled trace's call paths are written when it ends, in the collapsed-stack format flamegraph.pl reads
+@property (nonatomic, copy, readonly, nullable) NSString *collapsedStacksPath;
+// Set before -start: to also write every call to a trace file that can be queried later with objsee_trace_reader
+@property (nonatomic, copy, nullable) NSString *recordingPath;
+
+- (BOOL)start:(NSError **)error;
+- (void)stop;
+
+@end
+
+NS_ASSUME_NONNULL_END
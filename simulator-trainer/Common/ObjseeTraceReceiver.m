@@ -0,0 +1,737 @@
+//
+//  ObjseeTraceReceiver.m
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#import <poll.h>
+#import <stdatomic.h>
+#import <sys/socket.h>
+#import <sys/stat.h>
+#import <netinet/in.h>
+#import "ObjseeTraceReceiver.h"
+#import "objsee_profile.h"
+#import "objsee_trace_file.h"
+
+// Records the ring holds before the display is considered behind and new records are dropped
+#define RING_CAPACITY (1 << 16)
+#define INTERN_PAGE_SIZE 1024
+#define INTERN_MAX_PAGES 1024
+#define RECORD_SUFFIX_SIZE 42
+// Lines that aren't calls are rare, so only this many can wait for the display at once. Longer ones are cut
+#define RAW_LINE_CAPACITY 256
+#define RAW_LINE_SIZE 512
+#define READ_BUFFER_SIZE (64 * 1024)
+#define MAX_LINE_LENGTH 4096
+#define PROFILE_REPORT_INTERVAL_NS (1 * NSEC_PER_SEC)
+#define PROFILE_REPORT_LIMIT 40
+// How long to wait for the traced process to connect
+#define ACCEPT_TIMEOUT_NS (60 * NSEC_PER_SEC)
+
+#define COLOR_CLASS "\x1b[36m"
+#define COLOR_SELECTOR "\x1b[33m"
+#define COLOR_DIM "\x1b[2m"
+#define COLOR_RESET "\x1b[0m"
+
+typedef struct {
+    // Host arrival time. Lines come in batches, so this is only an approximation of when the call was made
+    uint64_t timestamp_ns;
+    uint32_t class_id;
+    // For lines that didn't parse, the slot holding the line's text in the ring's raw lines
+    uint32_t selector_id;
+    uint16_t depth;
+    // Dense index from the receiver's thread map, 0 when the line had no thread
+    uint16_t thread_id;
+    uint8_t is_class_method;
+    uint8_t is_raw;
+    // Whatever followed the selector, typically arguments. Truncated
+    char suffix[RECORD_SUFFIX_SIZE];
+} trace_record_t;
+
+/**
+  * Single producer, single consumer. Raw records take their slots in `raw_lines` in the same order as they
+  * take slots in `records`, so the consumer frees them by advancing `raw_tail` once per raw record it is done with
+ */
+typedef struct {
+    trace_record_t records[RING_CAPACITY];
+    _Atomic uint64_t head;
+    _Atomic uint64_t tail;
+    char raw_lines[RAW_LINE_CAPACITY][RAW_LINE_SIZE];
+    // Producer only
+    uint64_t raw_head;
+    _Atomic uint64_t raw_tail;
+} trace_ring_t;
+
+/**
+  * Producer-owned string table. Ids index into pages that are never moved, so the consumer can resolve any id
+  * it has seen in a published record without taking a lock. `count` is published with release ordering after
+  * the string is in place
+ */
+typedef struct {
+    char **pages[INTERN_MAX_PAGES];
+    _Atomic uint32_t count;
+    uint32_t *slots;
+    uint32_t slot_capacity;
+} intern_table_t;
+
+static const char *intern_lookup(const intern_table_t *table, uint32_t string_id) {
+    if (string_id == 0 || string_id > atomic_load_explicit(&table->count, memory_order_acquire)) {
+        return "?";
+    }
+
+    uint32_t index = string_id - 1;
+    return table->pages[index / INTERN_PAGE_SIZE][index % INTERN_PAGE_SIZE];
+}
+
+static uint32_t intern_hash(const char *string, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t)string[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+static void intern_grow(intern_table_t *table) {
+    uint32_t new_capacity = table->slot_capacity ? table->slot_capacity * 2 : 4096;
+    uint32_t *new_slots = calloc(new_capacity, sizeof(uint32_t));
+    for (uint32_t i = 0; i < table->slot_capacity; i++) {
+        uint32_t string_id = table->slots[i];
+        if (string_id == 0) {
+            continue;
+        }
+
+        const char *string = intern_lookup(table, string_id);
+        uint32_t slot = intern_hash(string, strlen(string)) & (new_capacity - 1);
+        while (new_slots[slot] != 0) {
+            slot = (slot + 1) & (new_capacity - 1);
+        }
+        new_slots[slot] = string_id;
+    }
+
+    free(table->slots);
+    table->slots = new_slots;
+    table->slot_capacity = new_capacity;
+}
+
+// Producer only. Returns 0 once the table is full
+static uint32_t intern_string(intern_table_t *table, const char *string, size_t length) {
+    if (table->slot_capacity == 0 || (atomic_load_explicit(&table->count, memory_order_relaxed) + 1) * 2 > table->slot_capacity) {
+        intern_grow(table);
+    }
+
+    uint32_t slot = intern_hash(string, length) & (table->slot_capacity - 1);
+    while (table->slots[slot] != 0) {
+        const char *existing = intern_lookup(table, table->slots[slot]);
+        if (strncmp(existing, string, length) == 0 && existing[length] == '\0') {
+            return table->slots[slot];
+        }
+        slot = (slot + 1) & (table->slot_capacity - 1);
+    }
+
+    uint32_t index = atomic_load_explicit(&table->count, memory_order_relaxed);
+    if (index >= INTERN_PAGE_SIZE * INTERN_MAX_PAGES) {
+        return 0;
+    }
+
+    if (table->pages[index / INTERN_PAGE_SIZE] == NULL) {
+        table->pages[index / INTERN_PAGE_SIZE] = calloc(INTERN_PAGE_SIZE, sizeof(char *));
+    }
+
+    table->pages[index / INTERN_PAGE_SIZE][index % INTERN_PAGE_SIZE] = strndup(string, length);
+    atomic_store_explicit(&table->count, index + 1, memory_order_release);
+    table->slots[slot] = index + 1;
+    return index + 1;
+}
+
+static void intern_free(intern_table_t *table) {
+    uint32_t count = atomic_load(&table->count);
+    for (uint32_t i = 0; i < count; i++) {
+        free(table->pages[i / INTERN_PAGE_SIZE][i % INTERN_PAGE_SIZE]);
+    }
+
+    for (uint32_t page = 0; page < INTERN_MAX_PAGES; page++) {
+        free(table->pages[page]);
+    }
+
+    free(table->slots);
+    memset(table, 0, sizeof(*table));
+}
+
+static const char *intern_name(uint32_t string_id, void *context) {
+    return intern_lookup((const intern_table_t *)context, string_id);
+}
+
+/**
+  * Producer-only map from the traced process's 64-bit thread ids to dense 16-bit indices, handed out in the order
+  * threads show up. Index 0 is for lines without a thread, and for threads beyond the last index
+ */
+typedef struct {
+    uint64_t *keys;
+    // 0 marks an empty slot
+    uint16_t *indices;
+    uint32_t count;
+    uint32_t slot_capacity;
+} thread_map_t;
+
+static void thread_map_grow(thread_map_t *map) {
+    uint32_t new_capacity = map->slot_capacity ? map->slot_capacity * 2 : 256;
+    uint64_t *new_keys = calloc(new_capacity, sizeof(uint64_t));
+    uint16_t *new_indices = calloc(new_capacity, sizeof(uint16_t));
+    if (!new_keys || !new_indices) {
+        free(new_keys);
+        free(new_indices);
+        return;
+    }
+
+    for (uint32_t i = 0; i < map->slot_capacity; i++) {
+        if (map->indices[i] == 0) {
+            continue;
+        }
+
+        uint32_t slot = (uint32_t)((map->keys[i] * 0x9e3779b97f4a7c15ULL) >> 32) & (new_capacity - 1);
+        while (new_indices[slot] != 0) {
+            slot = (slot + 1) & (new_capacity - 1);
+        }
+        new_keys[slot] = map->keys[i];
+        new_indices[slot] = map->indices[i];
+    }
+
+    free(map->keys);
+    free(map->indices);
+    map->keys = new_keys;
+    map->indices = new_indices;
+    map->slot_capacity = new_capacity;
+}
+
+static uint16_t thread_map_index(thread_map_t *map, uint64_t thread_id) {
+    if (map->count < UINT16_MAX && (map->count + 1) * 2 > map->slot_capacity) {
+        thread_map_grow(map);
+    }
+
+    if (map->slot_capacity == 0) {
+        return 0;
+    }
+
+    uint32_t slot = (uint32_t)((thread_id * 0x9e3779b97f4a7c15ULL) >> 32) & (map->slot_capacity - 1);
+    while (map->indices[slot] != 0) {
+        if (map->keys[slot] == thread_id) {
+            return map->indices[slot];
+        }
+        slot = (slot + 1) & (map->slot_capacity - 1);
+    }
+
+    if (map->count >= UINT16_MAX || (map->count + 1) * 2 > map->slot_capacity) {
+        return 0;
+    }
+
+    map->count++;
+    map->keys[slot] = thread_id;
+    map->indices[slot] = (uint16_t)map->count;
+    return (uint16_t)map->count;
+}
+
+static void thread_map_free(thread_map_t *map) {
+    free(map->keys);
+    free(map->indices);
+    memset(map, 0, sizeof(*map));
+}
+
+// Skips a "[0x1a2b] " thread prefix, if there is one at `p`
+static const char *skip_thread_prefix(const char *p, const char *end, uint64_t *thread_id_out, bool *found_out) {
+    if (end - p < 6 || strncmp(p, "[0x", 3) != 0) {
+        return p;
+    }
+
+    uint64_t thread_id = 0;
+    const char *digit = p + 3;
+    for (; digit < end && *digit != ']'; digit++) {
+        int value = (*digit >= '0' && *digit <= '9') ? *digit - '0' : (*digit >= 'a' && *digit <= 'f') ? *digit - 'a' + 10 : -1;
+        if (value < 0 || digit - (p + 3) >= 16) {
+            return p;
+        }
+        thread_id = (thread_id << 4) | (uint64_t)value;
+    }
+
+    if (digit + 1 >= end || digit[1] != ' ') {
+        return p;
+    }
+
+    *thread_id_out = thread_id;
+    *found_out = true;
+    return digit + 2;
+}
+
+/**
+  * Turn one line of objsee output into a record. Lines look like "[0xthread] <indent>-[Class selector]<rest>",
+  * with the thread prefix only there when thread ids are enabled. Anything else becomes a raw record, whose text
+  * the caller has to keep, since only class and selector names go into the string table
+ */
+static void decode_line(intern_table_t *table, thread_map_t *threads, const char *line, size_t length, trace_record_t *record_out) {
+    memset(record_out, 0, sizeof(*record_out));
+
+    const char *end = line + length;
+    uint64_t thread_id = 0;
+    bool has_thread = false;
+    const char *indent_start = skip_thread_prefix(line, end, &thread_id, &has_thread);
+    const char *p = indent_start;
+    while (p < end && *p == ' ') {
+        p++;
+    }
+    size_t indent = (size_t)(p - indent_start);
+    p = skip_thread_prefix(p, end, &thread_id, &has_thread);
+    if (has_thread) {
+        record_out->thread_id = thread_map_index(threads, thread_id);
+    }
+    const char *class_start = p + 2;
+    const char *class_end = (end - p > 3 && (p[0] == '-' || p[0] == '+') && p[1] == '[') ? memchr(class_start, ' ', (size_t)(end - class_start)) : NULL;
+    const char *selector_end = class_end ? memchr(class_end + 1, ']', (size_t)(end - class_end - 1)) : NULL;
+    if (!selector_end) {
+        memset(record_out, 0, sizeof(*record_out));
+        record_out->is_raw = 1;
+        return;
+    }
+
+    record_out->depth = (uint16_t)(indent > UINT16_MAX ? UINT16_MAX : indent);
+    record_out->is_class_method = (p[0] == '+');
+    record_out->class_id = intern_string(table, class_start, (size_t)(class_end - class_start));
+    record_out->selector_id = intern_string(table, class_end + 1, (size_t)(selector_end - class_end - 1));
+
+    size_t suffix_length = (size_t)(end - selector_end - 1);
+    if (suffix_length >= RECORD_SUFFIX_SIZE) {
+        suffix_length = RECORD_SUFFIX_SIZE - 1;
+    }
+    memcpy(record_out->suffix, selector_end + 1, suffix_length);
+}
+
+static void append_to_recording(objsee_trace_writer_t *writer, const trace_record_t *record) {
+    if (writer && !record->is_raw) {
+        objsee_trace_writer_append(writer, record->timestamp_ns, record->thread_id, record->depth, record->class_id, record->selector_id, record->is_class_method);
+    }
+}
+
+static int format_record(const intern_table_t *table, const trace_ring_t *ring, const trace_record_t *record, char *buffer, size_t size) {
+    if (record->is_raw) {
+        return snprintf(buffer, size, "%s\n", ring->raw_lines[record->selector_id]);
+    }
+
+    return snprintf(buffer, size, "%*s%c[" COLOR_CLASS "%s" COLOR_RESET " " COLOR_SELECTOR "%s" COLOR_RESET "]" COLOR_DIM "%s" COLOR_RESET "\n", (int)record->depth, "", record->is_class_method ? '+' : '-', intern_lookup(table, record->class_id), intern_lookup(table, record->selector_id), record->suffix);
+}
+
+@interface ObjseeTraceReceiver () {
+    trace_ring_t *_ring;
+    intern_table_t _strings;
+    thread_map_t _threads;
+    _Atomic uint64_t _droppedRecords;
+    _Atomic bool _stopping;
+    _Atomic int _listenSocket;
+    _Atomic int _clientSocket;
+    objsee_trace_writer_t *_recordingWriter;
+}
+
+@property (nonatomic, readwrite) uint16_t port;
+@property (nonatomic, copy, readwrite, nullable) NSString *fifoPath;
+@property (nonatomic, copy, readwrite, nullable) NSString *collapsedStacksPath;
+@property (nonatomic, strong) dispatch_semaphore_t recordsAvailable;
+@property (nonatomic, strong) dispatch_group_t threadsGroup;
+
+@end
+
+@implementation ObjseeTraceReceiver
+
+// Receivers outlive the launcher that starts them, and stay here until their trace ends
++ (NSMutableSet<ObjseeTraceReceiver *> *)_activeReceivers {
+    static NSMutableSet *activeReceivers = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        activeReceivers = [[NSMutableSet alloc] init];
+    });
+
+    return activeReceivers;
+}
+
+- (id)init {
+    if ((self = [super init])) {
+        _ring = calloc(1, sizeof(trace_ring_t));
+        atomic_init(&_listenSocket, -1);
+        atomic_init(&_clientSocket, -1);
+        _recordsAvailable = dispatch_semaphore_create(0);
+        _threadsGroup = dispatch_group_create();
+    }
+
+    return self;
+}
+
+- (void)dealloc {
+    free(_ring);
+    intern_free(&_strings);
+    thread_map_free(&_threads);
+}
+
+- (uint64_t)droppedRecords {
+    return atomic_load(&_droppedRecords);
+}
+
+- (BOOL)start:(NSError **)error {
+    int listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addrLength = sizeof(addr);
+    if (listenSocket < 0 || bind(listenSocket, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listenSocket, 1) != 0 || getsockname(listenSocket, (struct sockaddr *)&addr, &addrLength) != 0) {
+        if (error) {
+            *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:@{NSLocalizedDescriptionKey: @"Failed to listen for the trace connection"}];
+        }
+
+        if (listenSocket >= 0) {
+            close(listenSocket);
+        }
+        return NO;
+    }
+
+    NSString *fifoPath = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSString stringWithFormat:@"objsee-%@.fifo", [[NSUUID UUID] UUIDString]]];
+    if (mkfifo(fifoPath.fileSystemRepresentation, 0600) != 0) {
+        if (error) {
+            *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:@{NSLocalizedDescriptionKey: @"Failed to create the trace FIFO"}];
+        }
+
+        close(listenSocket);
+        return NO;
+    }
+
+    atomic_store(&_listenSocket, listenSocket);
+    self.port = ntohs(addr.sin_port);
+    self.fifoPath = fifoPath;
+    if (self.profileSampleInterval > 0) {
+        self.collapsedStacksPath = [[fifoPath stringByDeletingPathExtension] stringByAppendingPathExtension:@"collapsed"];
+    }
+
+    @synchronized ([ObjseeTraceReceiver _activeReceivers]) {
+        [[ObjseeTraceReceiver _activeReceivers] addObject:self];
+    }
+
+    // Both sides block on I/O for the whole trace, so they get their own threads rather than GCD workers
+    dispatch_group_enter(self.threadsGroup);
+    [NSThread detachNewThreadWithBlock:^{
+        [self _produce];
+        dispatch_group_leave(self.threadsGroup);
+    }];
+
+    dispatch_group_enter(self.threadsGroup);
+    [NSThread detachNewThreadWithBlock:^{
+        [self _consume];
+        dispatch_group_leave(self.threadsGroup);
+    }];
+
+    dispatch_group_notify(self.threadsGroup, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+        unlink(fifoPath.fileSystemRepresentation);
+        NSLog(@"Trace on port %u ended, %llu records dropped", self.port, self.droppedRecords);
+        @synchronized ([ObjseeTraceReceiver _activeReceivers]) {
+            [[ObjseeTraceReceiver _activeReceivers] removeObject:self];
+        }
+    });
+
+    return YES;
+}
+
+- (void)stop {
+    if (atomic_exchange(&_stopping, true)) {
+        return;
+    }
+
+    // Closing the sockets ends the producer's wait for a connection and unblocks its recv()
+    int listenSocket = atomic_exchange(&_listenSocket, -1);
+    if (listenSocket >= 0) {
+        shutdown(listenSocket, SHUT_RDWR);
+        close(listenSocket);
+    }
+
+    int clientSocket = atomic_exchange(&_clientSocket, -1);
+    if (clientSocket >= 0) {
+        shutdown(clientSocket, SHUT_RDWR);
+    }
+
+    dispatch_semaphore_signal(self.recordsAvailable);
+
+    // A consumer still waiting for a reader on the FIFO is released by briefly opening the read end
+    int fifoFd = open(self.fifoPath.fileSystemRepresentation, O_RDONLY | O_NONBLOCK);
+    if (fifoFd >= 0) {
+        close(fifoFd);
+    }
+}
+
+#pragma mark - Producer
+
+- (void)_enqueueLine:(const char *)line length:(size_t)length {
+    trace_record_t record;
+    decode_line(&_strings, &_threads, line, length, &record);
+    record.timestamp_ns = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+
+    uint64_t head = atomic_load_explicit(&_ring->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&_ring->tail, memory_order_acquire);
+    if (head - tail >= RING_CAPACITY) {
+        atomic_fetch_add_explicit(&_droppedRecords, 1, memory_order_relaxed);
+        return;
+    }
+
+    if (record.is_raw) {
+        if (_ring->raw_head - atomic_load_explicit(&_ring->raw_tail, memory_order_acquire) >= RAW_LINE_CAPACITY) {
+            atomic_fetch_add_explicit(&_droppedRecords, 1, memory_order_relaxed);
+            return;
+        }
+
+        uint32_t slot = (uint32_t)(_ring->raw_head & (RAW_LINE_CAPACITY - 1));
+        size_t kept = MIN(length, (size_t)RAW_LINE_SIZE - 1);
+        memcpy(_ring->raw_lines[slot], line, kept);
+        _ring->raw_lines[slot][kept] = '\0';
+        record.selector_id = slot;
+        _ring->raw_head++;
+    }
+
+    _ring->records[head & (RING_CAPACITY - 1)] = record;
+    atomic_store_explicit(&_ring->head, head + 1, memory_order_release);
+}
+
+- (void)_produce {
+    // The app may never come up or never load the tracer, so the wait for it is bounded and ends early on -stop
+    int listenSocket = atomic_load(&_listenSocket);
+    int clientSocket = -1;
+    uint64_t acceptDeadline = clock_gettime_nsec_np(CLOCK_UPTIME_RAW) + ACCEPT_TIMEOUT_NS;
+    while (listenSocket >= 0 && !atomic_load(&_stopping) && clock_gettime_nsec_np(CLOCK_UPTIME_RAW) < acceptDeadline) {
+        struct pollfd listenPoll = {.fd = listenSocket, .events = POLLIN};
+        int ready = poll(&listenPoll, 1, 250);
+        if (ready > 0) {
+            clientSocket = accept(listenSocket, NULL, NULL);
+            break;
+        }
+
+        if (ready < 0 && errno != EINTR) {
+            break;
+        }
+    }
+
+    if (clientSocket < 0 && !atomic_load(&_stopping)) {
+        NSLog(@"No traced process connected on port %u", self.port);
+    }
+
+    int closingListenSocket = atomic_exchange(&_listenSocket, -1);
+    if (closingListenSocket >= 0) {
+        close(closingListenSocket);
+    }
+
+    if (clientSocket < 0) {
+        [self stop];
+        return;
+    }
+
+    atomic_store(&_clientSocket, clientSocket);
+    char *buffer = malloc(READ_BUFFER_SIZE + MAX_LINE_LENGTH);
+    size_t pending = 0;
+    for (;;) {
+        ssize_t received = recv(clientSocket, buffer + pending, READ_BUFFER_SIZE, 0);
+        if (received <= 0) {
+            break;
+        }
+
+        size_t available = pending + (size_t)received;
+        size_t lineStart = 0;
+        for (size_t i = 0; i < available; i++) {
+            if (buffer[i] != '\n') {
+                continue;
+            }
+
+            size_t lineLength = i - lineStart;
+            if (lineLength > 0 && buffer[i - 1] == '\r') {
+                lineLength--;
+            }
+
+            if (lineLength > 0) {
+                [self _enqueueLine:buffer + lineStart length:lineLength];
+            }
+            lineStart = i + 1;
+        }
+
+        // Keep a partial line for the next read, unless it is too long to ever complete
+        pending = available - lineStart;
+        if (pending >= MAX_LINE_LENGTH) {
+            [self _enqueueLine:buffer + lineStart length:pending];
+            pending = 0;
+        }
+        else if (pending > 0) {
+            memmove(buffer, buffer + lineStart, pending);
+        }
+
+        dispatch_semaphore_signal(self.recordsAvailable);
+    }
+
+    free(buffer);
+    int closingClientSocket = atomic_exchange(&_clientSocket, -1);
+    if (closingClientSocket >= 0) {
+        close(closingClientSocket);
+    }
+
+    const char *endLine = "[trace ended]";
+    [self _enqueueLine:endLine length:strlen(endLine)];
+    atomic_store(&_stopping, true);
+    dispatch_semaphore_signal(self.recordsAvailable);
+}
+
+#pragma mark - Consumer
+
+- (void)_consume {
+    if (self.recordingPath) {
+        _recordingWriter = objsee_trace_writer_create(self.recordingPath.fileSystemRepresentation, intern_name, &_strings);
+    }
+
+    // Blocks until the terminal opens the read end
+    int fifoFd = open(self.fifoPath.fileSystemRepresentation, O_WRONLY);
+    if (fifoFd < 0) {
+        [self _finishRecording];
+        [self stop];
+        return;
+    }
+
+    // A closed terminal should end the trace, not the app
+    fcntl(fifoFd, F_SETNOSIGPIPE, 1);
+
+    if (self.profileSampleInterval > 0) {
+        [self _consumeIntoProfileWritingTo:fifoFd];
+        [self _finishRecording];
+        close(fifoFd);
+        [self stop];
+        return;
+    }
+
+    char *output = malloc(READ_BUFFER_SIZE);
+    BOOL readerGone = NO;
+    while (!readerGone) {
+        dispatch_semaphore_wait(self.recordsAvailable, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(100 * NSEC_PER_MSEC)));
+
+        uint64_t tail = atomic_load_explicit(&_ring->tail, memory_order_relaxed);
+        uint64_t head = atomic_load_explicit(&_ring->head, memory_order_acquire);
+        if (tail == head && atomic_load(&_stopping)) {
+            break;
+        }
+
+        size_t used = 0;
+        uint64_t rawDone = 0;
+        while (tail < head && !readerGone) {
+            const trace_record_t *record = &_ring->records[tail & (RING_CAPACITY - 1)];
+            int written = format_record(&_strings, _ring, record, output + used, READ_BUFFER_SIZE - used);
+            if (written >= 0 && (size_t)written >= READ_BUFFER_SIZE - used && used > 0) {
+                readerGone = (write(fifoFd, output, used) < 0);
+                used = 0;
+                continue;
+            }
+
+            // A single record that doesn't fit on its own is skipped
+            if (written >= 0 && (size_t)written < READ_BUFFER_SIZE - used) {
+                used += (size_t)written;
+            }
+            append_to_recording(_recordingWriter, record);
+            rawDone += record->is_raw;
+            tail++;
+        }
+
+        if (used > 0 && !readerGone) {
+            readerGone = (write(fifoFd, output, used) < 0);
+        }
+
+        atomic_fetch_add_explicit(&_ring->raw_tail, rawDone, memory_order_release);
+        atomic_store_explicit(&_ring->tail, tail, memory_order_release);
+    }
+
+    free(output);
+    [self _finishRecording];
+    close(fifoFd);
+    [self stop];
+}
+
+- (void)_finishRecording {
+    if (_recordingWriter && objsee_trace_writer_close(_recordingWriter) != 0) {
+        NSLog(@"Failed to finish trace recording %@", self.recordingPath);
+    }
+
+    _recordingWriter = NULL;
+}
+
+- (BOOL)_writeProfileReport:(objsee_profile_t *)profile toFd:(int)fd {
+    char *report = NULL;
+    size_t reportLength = 0;
+    FILE *reportFile = open_memstream(&report, &reportLength);
+    if (!reportFile) {
+        return YES;
+    }
+
+    // Redraw in place rather than scrolling
+    fputs("\x1b[H\x1b[2J", reportFile);
+    objsee_profile_write_top(profile, reportFile, PROFILE_REPORT_LIMIT, intern_name, &_strings);
+    if (atomic_load(&_droppedRecords) > 0) {
+        fprintf(reportFile, "\n%llu calls dropped\n", atomic_load(&_droppedRecords));
+    }
+    fclose(reportFile);
+
+    BOOL written = (write(fd, report, reportLength) >= 0);
+    free(report);
+    return written;
+}
+
+/**
+  * Profile mode: records are folded into call counts instead of being printed, with the top methods
+  * redrawn in the terminal every second. The call paths are written out as collapsed stacks when the trace ends
+ */
+- (void)_consumeIntoProfileWritingTo:(int)fifoFd {
+    objsee_profile_t *profile = objsee_profile_create((uint32_t)MIN(self.profileSampleInterval, UINT32_MAX));
+    if (!profile) {
+        return;
+    }
+
+    uint64_t nextReport = clock_gettime_nsec_np(CLOCK_UPTIME_RAW) + PROFILE_REPORT_INTERVAL_NS;
+    BOOL readerGone = NO;
+    while (!readerGone) {
+        dispatch_semaphore_wait(self.recordsAvailable, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(100 * NSEC_PER_MSEC)));
+
+        uint64_t tail = atomic_load_explicit(&_ring->tail, memory_order_relaxed);
+        uint64_t head = atomic_load_explicit(&_ring->head, memory_order_acquire);
+        if (tail == head && atomic_load(&_stopping)) {
+            break;
+        }
+
+        uint64_t rawDone = 0;
+        for (; tail < head; tail++) {
+            const trace_record_t *record = &_ring->records[tail & (RING_CAPACITY - 1)];
+            append_to_recording(_recordingWriter, record);
+            if (record->is_raw) {
+                rawDone++;
+            }
+            else {
+                objsee_profile_record_call(profile, record->thread_id, record->depth, record->class_id, record->selector_id, record->is_class_method);
+            }
+        }
+        atomic_fetch_add_explicit(&_ring->raw_tail, rawDone, memory_order_release);
+        atomic_store_explicit(&_ring->tail, tail, memory_order_release);
+
+        if (clock_gettime_nsec_np(CLOCK_UPTIME_RAW) >= nextReport) {
+            readerGone = ![self _writeProfileReport:profile toFd:fifoFd];
+            nextReport = clock_gettime_nsec_np(CLOCK_UPTIME_RAW) + PROFILE_REPORT_INTERVAL_NS;
+        }
+    }
+
+    FILE *collapsedFile = fopen(self.collapsedStacksPath.fileSystemRepresentation, "w");
+    if (collapsedFile) {
+        if (objsee_profile_write_collapsed(profile, collapsedFile, intern_name, &_strings) != 0) {
+            NSLog(@"Failed to write collapsed stacks to %@", self.collapsedStacksPath);
+        }
+        fclose(collapsedFile);
+    }
+
+    if (!readerGone && [self _writeProfileReport:profile toFd:fifoFd]) {
+        dprintf(fifoFd, "\nCollapsed stacks written to %s\n", self.collapsedStacksPath.fileSystemRepresentation);
+    }
+
+    objsee_profile_destroy(profile);
+}
+
+@end
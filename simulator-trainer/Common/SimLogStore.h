@@ -0,0 +1,72 @@
+//
+//  SimLogStore.h
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+@interface SimLogRecord : NSObject
+
+@property (nonatomic, strong, readonly) NSDate *date;
+@property (nonatomic, readonly) int level;
+@property (nonatomic, copy, readonly) NSString *function;
+@property (nonatomic, readonly) int line;
+@property (nonatomic, copy, readonly) NSString *message;
+// Set for records kept per device, otherwise the record belongs to `subsystem`
+@property (nonatomic, copy, readonly, nullable) NSString *deviceUdid;
+@property (nonatomic, copy, readonly, nullable) NSString *subsystem;
+
+@end
+
+@interface SimLogQuery : NSObject
+
+// Both nil to search every device and subsystem
+@property (nonatomic, copy, nullable) NSString *deviceUdid;
+@property (nonatomic, copy, nullable) NSString *subsystem;
+@property (nonatomic, strong, nullable) NSDate *startDate;
+@property (nonatomic, strong, nullable) NSDate *endDate;
+@property (nonatomic) int minimumLevel;
+// Keep only the newest records. 0 for no limit
+@property (nonatomic) NSUInteger limit;
+
+@end
+
+/**
+  * Recent simulator log messages, structured and grouped into fixed-size ring buffers, one per device and
+  * one per subsystem. Memory never grows past the arena's fixed size: the oldest records in a buffer are
+  * overwritten, and the least recently written buffer is reused when every buffer is taken.
+  * The shared store's arena is a memory-mapped file in Caches, so the messages from before a crash can be read
+  * on the next launch
+ */
+@interface SimLogStore : NSObject
+
++ (instancetype)sharedStore;
+
+/**
+  * @param path File backing the arena, or nil for an arena that only lives in memory
+ */
+- (instancetype _Nullable)initWithPersistentPath:(NSString * _Nullable)path;
+
+/**
+  * Messages without a device are filed under `subsystem`. If both are nil, the device is taken from the UDID of a
+  * device SimDeviceRegistry knows, when the message mentions one, and otherwise the subsystem from the class in
+  * the function name
+ */
+- (void)appendMessage:(NSString *)message level:(int)level function:(const char *)function line:(int)line deviceUdid:(NSString * _Nullable)udid subsystem:(NSString * _Nullable)subsystem;
+
+// Oldest first
+- (NSArray<SimLogRecord *> *)recordsMatchingQuery:(SimLogQuery *)query;
+
+/**
+  * The device's messages within `window` seconds either side of `date`, oldest first. Meant for showing what
+  * CoreSimulator was saying around a failure
+ */
+- (NSArray<SimLogRecord *> *)recordsForDeviceUdid:(NSString *)udid around:(NSDate *)date window:(NSTimeInterval)window;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,419 @@
+//
+//  SimLogStore.m
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#import <os/lock.h>
+#import <sys/file.h>
+#import <sys/mman.h>
+#import "SimLogStore.h"
+#import "SimDeviceRegistry.h"
+
+#define LOG_STORE_MAGIC 0x534c4f47
+#define LOG_STORE_VERSION 1
+#define LOG_STORE_BUCKET_COUNT 32
+// Subsystems only ever take this many buckets, the rest stay available to devices
+#define LOG_STORE_MAX_SUBSYSTEM_BUCKETS 8
+#define LOG_STORE_RECORDS_PER_BUCKET 1024
+#define LOG_STORE_KEY_SIZE 64
+#define LOG_STORE_FUNCTION_SIZE 48
+#define LOG_STORE_MESSAGE_SIZE 192
+#define UDID_LENGTH 36
+
+typedef enum {
+    LOG_BUCKET_UNUSED,
+    LOG_BUCKET_DEVICE,
+    LOG_BUCKET_SUBSYSTEM,
+} log_bucket_kind_t;
+
+// 256 bytes, so the arena is 8MB with the sizes above
+typedef struct {
+    double timestamp;
+    int32_t level;
+    int32_t line;
+    char function[LOG_STORE_FUNCTION_SIZE];
+    char message[LOG_STORE_MESSAGE_SIZE];
+} log_record_t;
+
+typedef struct {
+    uint32_t kind;
+    uint32_t reserved;
+    char key[LOG_STORE_KEY_SIZE];
+    // Records ever written. The newest is at (written - 1) % LOG_STORE_RECORDS_PER_BUCKET
+    uint64_t written;
+    double last_write;
+    log_record_t records[LOG_STORE_RECORDS_PER_BUCKET];
+} log_bucket_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t bucket_count;
+    uint32_t records_per_bucket;
+    uint32_t record_size;
+    uint32_t reserved;
+    log_bucket_t buckets[LOG_STORE_BUCKET_COUNT];
+} log_arena_t;
+
+// Copy as much of `source` as fits, without cutting a UTF-8 sequence in half
+static void copy_truncated_utf8(char *destination, size_t size, const char *source) {
+    size_t length = strlen(source);
+    if (length >= size) {
+        length = size - 1;
+        while (length > 0 && ((unsigned char)source[length] & 0xc0) == 0x80) {
+            length--;
+        }
+    }
+
+    memcpy(destination, source, length);
+    destination[length] = '\0';
+}
+
+static bool is_hex_digit(char c) {
+    return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'F') || (c >= 'a' && c <= 'f');
+}
+
+// First 8-4-4-4-12 UUID in `text`, if there is one. Pass the character after a previous match to find the next
+static const char *find_udid(const char *text) {
+    static const int dash_positions[] = {8, 13, 18, 23};
+    for (const char *start = text; *start; start++) {
+        if (!is_hex_digit(*start)) {
+            continue;
+        }
+
+        int position = 0;
+        int next_dash = 0;
+        for (; position < UDID_LENGTH && start[position]; position++) {
+            if (next_dash < 4 && position == dash_positions[next_dash]) {
+                if (start[position] != '-') {
+                    break;
+                }
+                next_dash++;
+            }
+            else if (!is_hex_digit(start[position])) {
+                break;
+            }
+        }
+
+        if (position == UDID_LENGTH && !is_hex_digit(start[UDID_LENGTH])) {
+            return start;
+        }
+    }
+
+    return NULL;
+}
+
+@interface SimLogRecord ()
+@property (nonatomic, strong, readwrite) NSDate *date;
+@property (nonatomic, readwrite) int level;
+@property (nonatomic, copy, readwrite) NSString *function;
+@property (nonatomic, readwrite) int line;
+@property (nonatomic, copy, readwrite) NSString *message;
+@property (nonatomic, copy, readwrite, nullable) NSString *deviceUdid;
+@property (nonatomic, copy, readwrite, nullable) NSString *subsystem;
+@end
+
+@implementation SimLogRecord
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"%@ [%d] %@:%d %@", self.date, self.level, self.function, self.line, self.message];
+}
+
+@end
+
+@implementation SimLogQuery
+@end
+
+@interface SimLogStore () {
+    log_arena_t *_arena;
+    size_t _arenaSize;
+    int _persistentFd;
+    // Guards bucket assignment
+    os_unfair_lock _bucketsLock;
+    os_unfair_lock _bucketLocks[LOG_STORE_BUCKET_COUNT];
+    // Devices in SimDeviceRegistry. Only their UDIDs are taken from messages; any other UUID is just part of the text
+    NSMutableSet<NSString *> *_knownUdids;
+    uint64_t _knownUdidsGeneration;
+    // Guards _knownUdids. The set itself is only changed on the main queue
+    os_unfair_lock _knownUdidsLock;
+}
+@end
+
+@implementation SimLogStore
+
++ (instancetype)sharedStore {
+    static SimLogStore *sharedStore = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSString *cachesDirectory = [NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES) firstObject];
+        NSString *storeDirectory = [cachesDirectory stringByAppendingPathComponent:@"com.simulatortrainer"];
+        [[NSFileManager defaultManager] createDirectoryAtPath:storeDirectory withIntermediateDirectories:YES attributes:nil error:nil];
+
+        sharedStore = [[SimLogStore alloc] initWithPersistentPath:[storeDirectory stringByAppendingPathComponent:@"simulator-logs.store"]];
+        if (!sharedStore) {
+            sharedStore = [[SimLogStore alloc] initWithPersistentPath:nil];
+        }
+    });
+
+    return sharedStore;
+}
+
+- (instancetype)initWithPersistentPath:(NSString *)path {
+    if ((self = [super init])) {
+        _persistentFd = -1;
+        _arenaSize = sizeof(log_arena_t);
+        _bucketsLock = OS_UNFAIR_LOCK_INIT;
+        for (int i = 0; i < LOG_STORE_BUCKET_COUNT; i++) {
+            _bucketLocks[i] = OS_UNFAIR_LOCK_INIT;
+        }
+        _knownUdids = [[NSMutableSet alloc] init];
+        _knownUdidsLock = OS_UNFAIR_LOCK_INIT;
+
+        if (path) {
+            // Another instance of the app already owns the file
+            _persistentFd = open(path.fileSystemRepresentation, O_RDWR | O_CREAT, 0600);
+            if (_persistentFd < 0 || flock(_persistentFd, LOCK_EX | LOCK_NB) != 0 || ftruncate(_persistentFd, (off_t)_arenaSize) != 0) {
+                NSLog(@"Failed to open log store at %@: %s", path, strerror(errno));
+                if (_persistentFd >= 0) {
+                    close(_persistentFd);
+                }
+                return nil;
+            }
+        }
+
+        void *arena = mmap(NULL, _arenaSize, PROT_READ | PROT_WRITE, path ? MAP_SHARED : (MAP_PRIVATE | MAP_ANON), _persistentFd, 0);
+        if (arena == MAP_FAILED) {
+            NSLog(@"Failed to map log store: %s", strerror(errno));
+            if (_persistentFd >= 0) {
+                close(_persistentFd);
+            }
+            return nil;
+        }
+
+        _arena = arena;
+        if (_arena->magic != LOG_STORE_MAGIC || _arena->version != LOG_STORE_VERSION || _arena->bucket_count != LOG_STORE_BUCKET_COUNT || _arena->records_per_bucket != LOG_STORE_RECORDS_PER_BUCKET || _arena->record_size != sizeof(log_record_t)) {
+            // New file, or one written with a different layout
+            memset(_arena, 0, _arenaSize);
+            _arena->magic = LOG_STORE_MAGIC;
+            _arena->version = LOG_STORE_VERSION;
+            _arena->bucket_count = LOG_STORE_BUCKET_COUNT;
+            _arena->records_per_bucket = LOG_STORE_RECORDS_PER_BUCKET;
+            _arena->record_size = sizeof(log_record_t);
+        }
+    }
+
+    // The registry logs while it loads, so it is only asked for its devices once this store is fully set up
+    [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(_deviceRegistryDidChange:) name:SimDeviceRegistryDidChangeNotification object:nil];
+    __weak typeof(self) weakSelf = self;
+    dispatch_async(dispatch_get_main_queue(), ^{
+        [weakSelf _loadKnownUdids];
+    });
+
+    return self;
+}
+
+- (void)dealloc {
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    munmap(_arena, _arenaSize);
+    if (_persistentFd >= 0) {
+        close(_persistentFd);
+    }
+}
+
+// Main queue only
+- (void)_loadKnownUdids {
+    uint64_t generation = 0;
+    NSArray<SimulatorWrapper *> *devices = [[SimDeviceRegistry sharedRegistry] devicesWithGeneration:&generation];
+    NSMutableSet<NSString *> *udids = [[NSMutableSet alloc] initWithCapacity:devices.count];
+    for (SimulatorWrapper *device in devices) {
+        NSString *udid = [device udidString];
+        if (udid) {
+            [udids addObject:udid];
+        }
+    }
+
+    os_unfair_lock_lock(&_knownUdidsLock);
+    _knownUdids = udids;
+    _knownUdidsGeneration = generation;
+    os_unfair_lock_unlock(&_knownUdidsLock);
+}
+
+// Posted on the main queue
+- (void)_deviceRegistryDidChange:(NSNotification *)notification {
+    uint64_t generation = [notification.userInfo[SimDeviceRegistryGenerationKey] unsignedLongLongValue];
+    os_unfair_lock_lock(&_knownUdidsLock);
+    // Batches up to the generation that was loaded are already in the set
+    if (generation > _knownUdidsGeneration) {
+        for (SimDeviceRegistryChange *change in notification.userInfo[SimDeviceRegistryChangesKey]) {
+            if (change.kind == SimDeviceRegistryChangeRemoved) {
+                [_knownUdids removeObject:change.udid];
+            }
+            else {
+                [_knownUdids addObject:change.udid];
+            }
+        }
+        _knownUdidsGeneration = generation;
+    }
+    os_unfair_lock_unlock(&_knownUdidsLock);
+}
+
+// First UDID in `text` that belongs to a known device
+- (const char *)_findKnownUdidInText:(const char *)text {
+    for (const char *found = find_udid(text); found; found = find_udid(found + UDID_LENGTH)) {
+        NSString *udid = [[NSString alloc] initWithBytes:found length:UDID_LENGTH encoding:NSASCIIStringEncoding];
+        os_unfair_lock_lock(&_knownUdidsLock);
+        BOOL known = [_knownUdids containsObject:udid.uppercaseString];
+        os_unfair_lock_unlock(&_knownUdidsLock);
+        if (known) {
+            return found;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+  * Lock and return the bucket for `key`, claiming one if needed. The least recently written bucket is reused
+  * when all are taken, except that a subsystem past LOG_STORE_MAX_SUBSYSTEM_BUCKETS reuses the oldest subsystem
+  * bucket, so a burst of chatty subsystems can't push out device logs.
+  * The bucket stays locked so it can't be reused again before the caller writes to it
+ */
+- (int)_lockBucketForKind:(log_bucket_kind_t)kind key:(const char *)key {
+    os_unfair_lock_lock(&_bucketsLock);
+    int oldestIndex = 0;
+    int oldestSubsystemIndex = -1;
+    int subsystemBuckets = 0;
+    for (int i = 0; i < LOG_STORE_BUCKET_COUNT; i++) {
+        log_bucket_t *bucket = &_arena->buckets[i];
+        if (bucket->kind == (uint32_t)kind && strncmp(bucket->key, key, LOG_STORE_KEY_SIZE) == 0) {
+            os_unfair_lock_lock(&_bucketLocks[i]);
+            os_unfair_lock_unlock(&_bucketsLock);
+            return i;
+        }
+
+        if (bucket->kind == LOG_BUCKET_UNUSED || (_arena->buckets[oldestIndex].kind != LOG_BUCKET_UNUSED && bucket->last_write < _arena->buckets[oldestIndex].last_write)) {
+            oldestIndex = i;
+        }
+
+        if (bucket->kind == LOG_BUCKET_SUBSYSTEM) {
+            subsystemBuckets++;
+            if (oldestSubsystemIndex < 0 || bucket->last_write < _arena->buckets[oldestSubsystemIndex].last_write) {
+                oldestSubsystemIndex = i;
+            }
+        }
+    }
+
+    if (kind == LOG_BUCKET_SUBSYSTEM && subsystemBuckets >= LOG_STORE_MAX_SUBSYSTEM_BUCKETS) {
+        oldestIndex = oldestSubsystemIndex;
+    }
+
+    os_unfair_lock_lock(&_bucketLocks[oldestIndex]);
+    log_bucket_t *bucket = &_arena->buckets[oldestIndex];
+    bucket->kind = kind;
+    bucket->written = 0;
+    bucket->last_write = CFAbsoluteTimeGetCurrent();
+    copy_truncated_utf8(bucket->key, sizeof(bucket->key), key);
+    os_unfair_lock_unlock(&_bucketsLock);
+    return oldestIndex;
+}
+
+- (void)appendMessage:(NSString *)message level:(int)level function:(const char *)function line:(int)line deviceUdid:(NSString *)udid subsystem:(NSString *)subsystem {
+    const char *messageBytes = message.UTF8String ?: "";
+    function = function ?: "";
+
+    log_bucket_kind_t kind = LOG_BUCKET_SUBSYSTEM;
+    char key[LOG_STORE_KEY_SIZE];
+    if (udid) {
+        kind = LOG_BUCKET_DEVICE;
+        copy_truncated_utf8(key, sizeof(key), udid.UTF8String);
+    }
+    else if (subsystem) {
+        copy_truncated_utf8(key, sizeof(key), subsystem.UTF8String);
+    }
+    else {
+        const char *foundUdid = [self _findKnownUdidInText:messageBytes];
+        if (foundUdid) {
+            kind = LOG_BUCKET_DEVICE;
+            memcpy(key, foundUdid, UDID_LENGTH);
+            key[UDID_LENGTH] = '\0';
+        }
+        else if ((function[0] == '-' || function[0] == '+') && function[1] == '[') {
+            // The class of an Objective-C method
+            size_t classLength = strcspn(function + 2, " ]");
+            snprintf(key, sizeof(key), "%.*s", (int)MIN(classLength, sizeof(key) - 1), function + 2);
+        }
+        else {
+            copy_truncated_utf8(key, sizeof(key), "CoreSimulator");
+        }
+    }
+
+    int bucketIndex = [self _lockBucketForKind:kind key:key];
+    log_bucket_t *bucket = &_arena->buckets[bucketIndex];
+    log_record_t *record = &bucket->records[bucket->written % LOG_STORE_RECORDS_PER_BUCKET];
+    record->timestamp = CFAbsoluteTimeGetCurrent();
+    record->level = level;
+    record->line = line;
+    copy_truncated_utf8(record->function, sizeof(record->function), function);
+    copy_truncated_utf8(record->message, sizeof(record->message), messageBytes);
+    bucket->written++;
+    bucket->last_write = record->timestamp;
+    os_unfair_lock_unlock(&_bucketLocks[bucketIndex]);
+}
+
+- (NSArray<SimLogRecord *> *)recordsMatchingQuery:(SimLogQuery *)query {
+    double start = query.startDate ? query.startDate.timeIntervalSinceReferenceDate : -DBL_MAX;
+    double end = query.endDate ? query.endDate.timeIntervalSinceReferenceDate : DBL_MAX;
+
+    NSMutableArray<SimLogRecord *> *records = [NSMutableArray array];
+    for (int i = 0; i < LOG_STORE_BUCKET_COUNT; i++) {
+        os_unfair_lock_lock(&_bucketLocks[i]);
+        log_bucket_t *bucket = &_arena->buckets[i];
+        NSString *key = bucket->kind != LOG_BUCKET_UNUSED ? [NSString stringWithUTF8String:bucket->key] : nil;
+        BOOL matches = key && (!query.deviceUdid || (bucket->kind == LOG_BUCKET_DEVICE && [key isEqualToString:query.deviceUdid])) && (!query.subsystem || (bucket->kind == LOG_BUCKET_SUBSYSTEM && [key isEqualToString:query.subsystem]));
+        if (!matches) {
+            os_unfair_lock_unlock(&_bucketLocks[i]);
+            continue;
+        }
+
+        uint64_t count = MIN(bucket->written, (uint64_t)LOG_STORE_RECORDS_PER_BUCKET);
+        for (uint64_t n = bucket->written - count; n < bucket->written; n++) {
+            const log_record_t *record = &bucket->records[n % LOG_STORE_RECORDS_PER_BUCKET];
+            if (record->timestamp < start || record->timestamp > end || record->level < query.minimumLevel) {
+                continue;
+            }
+
+            SimLogRecord *result = [[SimLogRecord alloc] init];
+            result.date = [NSDate dateWithTimeIntervalSinceReferenceDate:record->timestamp];
+            result.level = record->level;
+            result.function = [NSString stringWithUTF8String:record->function] ?: @"";
+            result.line = record->line;
+            result.message = [NSString stringWithUTF8String:record->message] ?: @"";
+            result.deviceUdid = bucket->kind == LOG_BUCKET_DEVICE ? key : nil;
+            result.subsystem = bucket->kind == LOG_BUCKET_SUBSYSTEM ? key : nil;
+            [records addObject:result];
+        }
+        os_unfair_lock_unlock(&_bucketLocks[i]);
+    }
+
+    [records sortUsingComparator:^NSComparisonResult(SimLogRecord *lhs, SimLogRecord *rhs) {
+        return [lhs.date compare:rhs.date];
+    }];
+
+    if (query.limit > 0 && records.count > query.limit) {
+        return [records subarrayWithRange:NSMakeRange(records.count - query.limit, query.limit)];
+    }
+
+    return records;
+}
+
+- (NSArray<SimLogRecord *> *)recordsForDeviceUdid:(NSString *)udid around:(NSDate *)date window:(NSTimeInterval)window {
+    SimLogQuery *query = [[SimLogQuery alloc] init];
+    query.deviceUdid = udid;
+    query.startDate = [date dateByAddingTimeInterval:-window];
+    query.endDate = [date dateByAddingTimeInterval:window];
+    return [self recordsMatchingQuery:query];
+}
+
+@end
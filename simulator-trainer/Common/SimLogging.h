@@ -13,6 +13,9 @@ NS_ASSUME_NONNULL_BEGIN
 
 + (void)observeSimulatorLogs;
 
+// How many CoreSimulator messages each ignore pattern has suppressed so far
++ (NSDictionary<NSString *, NSNumber *> *)suppressedMessageCounts;
+
 @end
 
 NS_ASSUME_NONNULL_END
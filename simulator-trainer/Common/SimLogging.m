@@ -6,45 +6,196 @@
 //
 
 #import "SimLogging.h"
+#import "pattern_matcher.h"
+#import "SimLogStore.h"
+#import <stdatomic.h>
 #import <dlfcn.h>
 
 // Filter out some of the spammy Simulator logs
-const NSString *kSimLogIgnoreStrings[] = {
-    @" is handling device added notification: ",
-    @"-[SimDeviceSet addDeviceAsync:]:",
-    @"On devices queue adding device",
-    @" to _devicesByUDID for set ",
-    @"VolumeManager: Appeared: Ignoring",
-    @"Ignoring disk due to missing volume path.",
-    @"Found duplicate SDKs for",
-    @" New device pair (",
-    @"Runtime bundle found. Adding to supported runtimes",
-    @"VolumeManager: Disk Appeared <DADisk ",
+static const char *kSimLogIgnoreStrings[] = {
+    " is handling device added notification: ",
+    "-[SimDeviceSet addDeviceAsync:]:",
+    "On devices queue adding device",
+    " to _devicesByUDID for set ",
+    "VolumeManager: Appeared: Ignoring",
+    "Ignoring disk due to missing volume path.",
+    "Found duplicate SDKs for",
+    " New device pair (",
+    "Runtime bundle found. Adding to supported runtimes",
+    "VolumeManager: Disk Appeared <DADisk ",
 };
 
+#define SIM_LOG_IGNORE_COUNT (sizeof(kSimLogIgnoreStrings) / sizeof(kSimLogIgnoreStrings[0]))
+// Messages that can wait for the writer before new ones are dropped
+#define SIM_LOG_RING_CAPACITY 4096
+#define SIM_LOG_FORMAT_BUFFER_SIZE 1024
+
+typedef struct {
+    _Atomic uint64_t sequence;
+    int level;
+    const char *function;
+    int line;
+    CFStringRef message;
+} sim_log_slot_t;
+
+static pattern_matcher_t *gIgnoreMatcher;
+static _Atomic uint64_t gSuppressedCounts[SIM_LOG_IGNORE_COUNT];
+static _Atomic uint64_t gDroppedCount;
+
+// Bounded multi-producer ring. Each slot's sequence says whether it is free for the producer claiming `position`
+// (sequence == position) or holds a message for the writer (sequence == position + 1)
+static sim_log_slot_t gRing[SIM_LOG_RING_CAPACITY];
+static _Atomic uint64_t gRingHead;
+static uint64_t gRingTail;
+static dispatch_source_t gWriterSource;
+
+static void _matchFunctionAndLine(pattern_match_state_t *state, const char *function, int line) {
+    char lineBuffer[16];
+    int lineLength = snprintf(lineBuffer, sizeof(lineBuffer), ":%d ", line);
+    pattern_matcher_feed(gIgnoreMatcher, state, function, strlen(function));
+    pattern_matcher_feed(gIgnoreMatcher, state, lineBuffer, (size_t)lineLength);
+}
+
+/**
+  * Try to reject a message from its function name and format string alone, before anything is formatted.
+  * Patterns that only appear once the arguments are filled in are caught later by the writer
+ */
+static int32_t _prefilterMatch(const char *function, int line, NSString *format) {
+    pattern_match_state_t state = PATTERN_MATCH_STATE_INIT;
+    _matchFunctionAndLine(&state, function, line);
+    if (state.match >= 0) {
+        return state.match;
+    }
+
+    // Both paths avoid the heap; the second truncates very long format strings, which is fine for a prefilter
+    const char *formatBytes = CFStringGetCStringPtr((__bridge CFStringRef)format, kCFStringEncodingUTF8);
+    char formatBuffer[SIM_LOG_FORMAT_BUFFER_SIZE];
+    if (!formatBytes) {
+        CFIndex converted = 0;
+        CFStringGetBytes((__bridge CFStringRef)format, CFRangeMake(0, MIN(CFStringGetLength((__bridge CFStringRef)format), (CFIndex)sizeof(formatBuffer))), kCFStringEncodingUTF8, '?', false, (UInt8 *)formatBuffer, sizeof(formatBuffer), &converted);
+        pattern_matcher_feed(gIgnoreMatcher, &state, formatBuffer, (size_t)converted);
+    }
+    else {
+        pattern_matcher_feed(gIgnoreMatcher, &state, formatBytes, strlen(formatBytes));
+    }
+
+    return state.match;
+}
+
+static BOOL _enqueueMessage(int level, const char *function, int line, CFStringRef message) {
+    uint64_t position = atomic_load_explicit(&gRingHead, memory_order_relaxed);
+    for (;;) {
+        sim_log_slot_t *slot = &gRing[position % SIM_LOG_RING_CAPACITY];
+        uint64_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        if (sequence == position) {
+            if (atomic_compare_exchange_weak_explicit(&gRingHead, &position, position + 1, memory_order_relaxed, memory_order_relaxed)) {
+                slot->level = level;
+                slot->function = function;
+                slot->line = line;
+                slot->message = message;
+                atomic_store_explicit(&slot->sequence, position + 1, memory_order_release);
+                return YES;
+            }
+        }
+        else if (sequence < position) {
+            // Full. The writer is behind, and CoreSimulator's threads must never wait for it
+            return NO;
+        }
+        else {
+            position = atomic_load_explicit(&gRingHead, memory_order_relaxed);
+        }
+    }
+}
+
+static void _drainMessages(void) {
+    for (;;) {
+        sim_log_slot_t *slot = &gRing[gRingTail % SIM_LOG_RING_CAPACITY];
+        if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != gRingTail + 1) {
+            break;
+        }
+
+        int level = slot->level;
+        const char *function = slot->function;
+        int line = slot->line;
+        NSString *message = CFBridgingRelease(slot->message);
+        slot->message = NULL;
+        atomic_store_explicit(&slot->sequence, gRingTail + SIM_LOG_RING_CAPACITY, memory_order_release);
+        gRingTail++;
+
+        // Same check as before, now against the formatted message. Some of the ignore-strings include function names
+        pattern_match_state_t state = PATTERN_MATCH_STATE_INIT;
+        _matchFunctionAndLine(&state, function, line);
+        const char *messageBytes = message.UTF8String ?: "";
+        pattern_matcher_feed(gIgnoreMatcher, &state, messageBytes, strlen(messageBytes));
+        if (state.match >= 0) {
+            atomic_fetch_add_explicit(&gSuppressedCounts[state.match], 1, memory_order_relaxed);
+            continue;
+        }
+
+        [[SimLogStore sharedStore] appendMessage:message level:level function:function line:line deviceUdid:nil subsystem:nil];
+        NSLog(@"%s:%d %@", function, line, message);
+    }
+
+    uint64_t dropped = atomic_exchange_explicit(&gDroppedCount, 0, memory_order_relaxed);
+    if (dropped > 0) {
+        NSLog(@"Dropped %llu simulator log messages", dropped);
+    }
+}
+
 static void _SimServiceLog(int level, const char *function, int line, NSString *format, va_list args) {
     if (!format) {
         return;
     }
 
+    if (!function) {
+        function = "";
+    }
+
+    int32_t match = _prefilterMatch(function, line, format);
+    if (match >= 0) {
+        atomic_fetch_add_explicit(&gSuppressedCounts[match], 1, memory_order_relaxed);
+        return;
+    }
+
+    // The arguments are only valid during this call, so formatting can't move to the writer
     NSString *formattedString = [[NSString alloc] initWithFormat:format arguments:args];
-    if (formattedString) {
-        NSString *logString = [NSString stringWithFormat:@"%s:%d %@", function, line, formattedString];
-        // Check if the log message contains any of the ignore strings.
-        // This happens after building the message because some of the ignore-strings include function names
-        for (int i = 0; i < sizeof(kSimLogIgnoreStrings) / sizeof(NSString *); i++) {
-            if ([logString containsString:(NSString *)kSimLogIgnoreStrings[i]]) {
-                return;
-            }
-        }
-        
-        NSLog(@"%@", logString);
+    if (!formattedString) {
+        return;
+    }
+
+    CFStringRef message = (CFStringRef)CFBridgingRetain(formattedString);
+    if (!_enqueueMessage(level, function, line, message)) {
+        CFRelease(message);
+        atomic_fetch_add_explicit(&gDroppedCount, 1, memory_order_relaxed);
     }
+
+    dispatch_source_merge_data(gWriterSource, 1);
 }
 
 @implementation SimLogging
 
 + (void)observeSimulatorLogs {
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        gIgnoreMatcher = pattern_matcher_create(kSimLogIgnoreStrings, SIM_LOG_IGNORE_COUNT);
+        for (uint64_t i = 0; i < SIM_LOG_RING_CAPACITY; i++) {
+            atomic_init(&gRing[i].sequence, i);
+        }
+
+        // Wakeups from many messages coalesce into one drain
+        dispatch_queue_t writerQueue = dispatch_queue_create("com.simulatortrainer.simlog", DISPATCH_QUEUE_SERIAL);
+        gWriterSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_DATA_ADD, 0, 0, writerQueue);
+        dispatch_source_set_event_handler(gWriterSource, ^{
+            _drainMessages();
+        });
+        dispatch_resume(gWriterSource);
+    });
+
+    if (!gIgnoreMatcher) {
+        NSLog(@"Failed to build the simulator log filter");
+        return;
+    }
+
     // Register a logging handler for the Simulator. This will receive all logs regardless of their level
     void *coreSimHandle = dlopen("/Library/Developer/PrivateFrameworks/CoreSimulator.framework/Versions/A/CoreSimulator", RTLD_GLOBAL);
     void *_SimLogSetHandler = dlsym(coreSimHandle, "SimLogSetHandler");
@@ -52,8 +203,20 @@ static void _SimServiceLog(int level, const char *function, int line, NSString *
         NSLog(@"Failed to find SimLogSetHandler. CoreSimulator handle: %p", coreSimHandle);
         return;
     }
-    
+
     ((void (*)(void *))_SimLogSetHandler)(_SimServiceLog);
 }
 
++ (NSDictionary<NSString *, NSNumber *> *)suppressedMessageCounts {
+    NSMutableDictionary *counts = [NSMutableDictionary dictionary];
+    for (size_t i = 0; i < SIM_LOG_IGNORE_COUNT; i++) {
+        uint64_t count = atomic_load_explicit(&gSuppressedCounts[i], memory_order_relaxed);
+        if (count > 0) {
+            counts[@(kSimLogIgnoreStrings[i])] = @(count);
+        }
+    }
+
+    return counts;
+}
+
 @end
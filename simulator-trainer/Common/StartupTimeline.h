@@ -0,0 +1,44 @@
+//
+//  StartupTimeline.h
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+  * Runs the app's startup work as named tasks with explicit dependencies, so independent work overlaps, and
+  * records every task and finer-grained span on a timeline that can be opened in chrome://tracing or Perfetto
+ */
+@interface StartupTimeline : NSObject
+
++ (instancetype)sharedTimeline;
+
+/**
+  * Run `block` on `queue` once every task in `dependencies` has succeeded. A task that returns NO fails, and
+  * the tasks depending on it are skipped. Dependencies don't have to be added first
+ */
+- (void)addTaskNamed:(NSString *)name dependencies:(NSArray<NSString *> *)dependencies queue:(dispatch_queue_t)queue block:(BOOL (^)(void))block;
+
+// Called on `queue` when the task finished or was skipped, right away if that already happened
+- (void)notifyWhenTaskNamed:(NSString *)name finishesOnQueue:(dispatch_queue_t)queue block:(void (^)(BOOL succeeded))block;
+
+// Spans time part of a task, or work outside the task graph. Returns an id for -endSpan:
+- (NSUInteger)beginSpanNamed:(NSString *)name;
+- (void)endSpan:(NSUInteger)spanId;
+
+/**
+  * The chain of tasks that decided when `name` finished: starting from it, each step goes to the dependency
+  * that finished last. Earliest first
+ */
+- (NSArray<NSString *> *)criticalPathToTaskNamed:(NSString *)name;
+
+// Chrome trace event format (JSON)
+- (BOOL)writeChromeTraceToPath:(NSString *)path error:(NSError ** _Nullable)error;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,300 @@
+//
+//  StartupTimeline.m
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#import <pthread.h>
+#import <sys/sysctl.h>
+#import "StartupTimeline.h"
+
+typedef NS_ENUM(NSInteger, StartupTaskState) {
+    StartupTaskStateWaiting,
+    StartupTaskStateRunning,
+    StartupTaskStateSucceeded,
+    StartupTaskStateFailed,
+    StartupTaskStateSkipped,
+};
+
+@interface StartupSpan : NSObject
+@property (nonatomic, copy) NSString *name;
+@property (nonatomic, copy) NSString *category;
+// Microseconds since the epoch
+@property (nonatomic) uint64_t start;
+@property (nonatomic) uint64_t end;
+@property (nonatomic) uint64_t threadId;
+@end
+
+@implementation StartupSpan
+@end
+
+@interface StartupTask : NSObject
+@property (nonatomic, copy) NSString *name;
+@property (nonatomic, copy) NSArray<NSString *> *dependencies;
+@property (nonatomic, strong) dispatch_queue_t queue;
+@property (nonatomic, copy) BOOL (^block)(void);
+@property (nonatomic) StartupTaskState state;
+@property (nonatomic, strong) StartupSpan *span;
+@property (nonatomic, strong) NSMutableArray *finishHandlers;
+@end
+
+@implementation StartupTask
+@end
+
+static uint64_t _nowMicroseconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
+
+static uint64_t _currentThreadId(void) {
+    uint64_t threadId = 0;
+    pthread_threadid_np(NULL, &threadId);
+    return threadId;
+}
+
+@interface StartupTimeline ()
+// Guards everything below
+@property (nonatomic, strong) dispatch_queue_t stateQueue;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, StartupTask *> *tasks;
+@property (nonatomic, strong) NSMutableArray<StartupSpan *> *spans;
+@property (nonatomic) NSUInteger nextSpanId;
+@property (nonatomic, strong) NSMutableDictionary<NSNumber *, StartupSpan *> *openSpans;
+@end
+
+@implementation StartupTimeline
+
++ (instancetype)sharedTimeline {
+    static StartupTimeline *sharedTimeline = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedTimeline = [[StartupTimeline alloc] init];
+    });
+
+    return sharedTimeline;
+}
+
+- (instancetype)init {
+    if ((self = [super init])) {
+        _stateQueue = dispatch_queue_create("com.simulatortrainer.startup", DISPATCH_QUEUE_SERIAL);
+        _tasks = [NSMutableDictionary dictionary];
+        _spans = [NSMutableArray array];
+        _openSpans = [NSMutableDictionary dictionary];
+        _nextSpanId = 1;
+
+        // Everything from exec to the first span, which includes dyld and the app's own static initializers
+        struct kinfo_proc processInfo;
+        size_t size = sizeof(processInfo);
+        int mib[] = {CTL_KERN, KERN_PROC, KERN_PROC_PID, getpid()};
+        if (sysctl(mib, 4, &processInfo, &size, NULL, 0) == 0 && size > 0) {
+            StartupSpan *launchSpan = [[StartupSpan alloc] init];
+            launchSpan.name = @"process-launch";
+            launchSpan.category = @"span";
+            launchSpan.start = (uint64_t)processInfo.kp_proc.p_starttime.tv_sec * 1000000ULL + (uint64_t)processInfo.kp_proc.p_starttime.tv_usec;
+            launchSpan.end = _nowMicroseconds();
+            launchSpan.threadId = _currentThreadId();
+            [_spans addObject:launchSpan];
+        }
+    }
+
+    return self;
+}
+
+- (void)addTaskNamed:(NSString *)name dependencies:(NSArray<NSString *> *)dependencies queue:(dispatch_queue_t)queue block:(BOOL (^)(void))block {
+    dispatch_async(self.stateQueue, ^{
+        if (self.tasks[name]) {
+            NSLog(@"Startup task %@ was added twice", name);
+            return;
+        }
+
+        StartupTask *task = [[StartupTask alloc] init];
+        task.name = name;
+        task.dependencies = dependencies ?: @[];
+        task.queue = queue;
+        task.block = block;
+        task.finishHandlers = [NSMutableArray array];
+        self.tasks[name] = task;
+        [self _startReadyTasks];
+    });
+}
+
+// State queue only. Starts waiting tasks whose dependencies are done, and skips the ones that can no longer run
+- (void)_startReadyTasks {
+    BOOL changed = YES;
+    while (changed) {
+        changed = NO;
+        for (StartupTask *task in self.tasks.allValues) {
+            if (task.state != StartupTaskStateWaiting) {
+                continue;
+            }
+
+            BOOL ready = YES;
+            BOOL blocked = NO;
+            for (NSString *dependencyName in task.dependencies) {
+                StartupTask *dependency = self.tasks[dependencyName];
+                ready = ready && dependency.state == StartupTaskStateSucceeded;
+                blocked = blocked || dependency.state == StartupTaskStateFailed || dependency.state == StartupTaskStateSkipped;
+            }
+
+            if (blocked) {
+                NSLog(@"Skipping startup task %@, a dependency failed", task.name);
+                [self _finishTask:task state:StartupTaskStateSkipped];
+                changed = YES;
+            }
+            else if (ready) {
+                task.state = StartupTaskStateRunning;
+                [self _runTask:task];
+            }
+        }
+    }
+}
+
+// State queue only
+- (void)_runTask:(StartupTask *)task {
+    dispatch_async(task.queue, ^{
+        StartupSpan *span = [[StartupSpan alloc] init];
+        span.name = task.name;
+        span.category = @"task";
+        span.threadId = _currentThreadId();
+        span.start = _nowMicroseconds();
+        BOOL succeeded = task.block();
+        span.end = _nowMicroseconds();
+
+        dispatch_async(self.stateQueue, ^{
+            task.span = span;
+            task.block = nil;
+            [self.spans addObject:span];
+            if (!succeeded) {
+                NSLog(@"Startup task %@ failed", task.name);
+            }
+
+            [self _finishTask:task state:succeeded ? StartupTaskStateSucceeded : StartupTaskStateFailed];
+            [self _startReadyTasks];
+        });
+    });
+}
+
+// State queue only
+- (void)_finishTask:(StartupTask *)task state:(StartupTaskState)state {
+    task.state = state;
+    for (void (^handler)(void) in task.finishHandlers) {
+        handler();
+    }
+    [task.finishHandlers removeAllObjects];
+}
+
+- (void)notifyWhenTaskNamed:(NSString *)name finishesOnQueue:(dispatch_queue_t)queue block:(void (^)(BOOL succeeded))block {
+    dispatch_async(self.stateQueue, ^{
+        StartupTask *task = self.tasks[name];
+        if (!task) {
+            NSLog(@"No startup task named %@", name);
+            return;
+        }
+
+        __weak StartupTask *weakTask = task;
+        void (^handler)(void) = ^{
+            BOOL succeeded = weakTask.state == StartupTaskStateSucceeded;
+            dispatch_async(queue, ^{
+                block(succeeded);
+            });
+        };
+
+        if (task.state == StartupTaskStateWaiting || task.state == StartupTaskStateRunning) {
+            [task.finishHandlers addObject:handler];
+        }
+        else {
+            handler();
+        }
+    });
+}
+
+- (NSUInteger)beginSpanNamed:(NSString *)name {
+    StartupSpan *span = [[StartupSpan alloc] init];
+    span.name = name;
+    span.category = @"span";
+    span.threadId = _currentThreadId();
+    span.start = _nowMicroseconds();
+
+    __block NSUInteger spanId = 0;
+    dispatch_sync(self.stateQueue, ^{
+        spanId = self.nextSpanId++;
+        self.openSpans[@(spanId)] = span;
+    });
+
+    return spanId;
+}
+
+- (void)endSpan:(NSUInteger)spanId {
+    uint64_t end = _nowMicroseconds();
+    dispatch_async(self.stateQueue, ^{
+        StartupSpan *span = self.openSpans[@(spanId)];
+        if (!span) {
+            return;
+        }
+
+        span.end = end;
+        [self.openSpans removeObjectForKey:@(spanId)];
+        [self.spans addObject:span];
+    });
+}
+
+- (NSArray<NSString *> *)criticalPathToTaskNamed:(NSString *)name {
+    __block NSMutableArray<NSString *> *path = [NSMutableArray array];
+    dispatch_sync(self.stateQueue, ^{
+        StartupTask *task = self.tasks[name];
+        while (task) {
+            [path insertObject:task.name atIndex:0];
+
+            StartupTask *latestDependency = nil;
+            for (NSString *dependencyName in task.dependencies) {
+                StartupTask *dependency = self.tasks[dependencyName];
+                if (dependency.span && (!latestDependency || dependency.span.end > latestDependency.span.end)) {
+                    latestDependency = dependency;
+                }
+            }
+            task = latestDependency;
+        }
+    });
+
+    return path;
+}
+
+- (BOOL)writeChromeTraceToPath:(NSString *)path error:(NSError **)error {
+    __block NSMutableArray *events = [NSMutableArray array];
+    dispatch_sync(self.stateQueue, ^{
+        int pid = getpid();
+        for (StartupSpan *span in self.spans) {
+            [events addObject:@{
+                @"name": span.name,
+                @"cat": span.category,
+                @"ph": @"X",
+                @"ts": @(span.start),
+                @"dur": @(span.end - span.start),
+                @"pid": @(pid),
+                @"tid": @(span.threadId),
+            }];
+        }
+
+        for (StartupTask *task in self.tasks.allValues) {
+            if (task.state == StartupTaskStateSkipped || task.state == StartupTaskStateFailed) {
+                // Instant event, so failures show up on the timeline too
+                NSString *state = task.state == StartupTaskStateSkipped ? @"skipped" : @"failed";
+                [events addObject:@{
+                    @"name": [NSString stringWithFormat:@"%@ %@", task.name, state],
+                    @"cat": @"task",
+                    @"ph": @"i",
+                    @"s": @"p",
+                    @"ts": @(task.span ? task.span.end : _nowMicroseconds()),
+                    @"pid": @(pid),
+                    @"tid": @(task.span.threadId),
+                }];
+            }
+        }
+    });
+
+    NSData *data = [NSJSONSerialization dataWithJSONObject:@{@"traceEvents": events, @"displayTimeUnit": @"ms"} options:0 error:error];
+    return data && [data writeToFile:path options:NSDataWritingAtomic error:error];
+}
+
+@end
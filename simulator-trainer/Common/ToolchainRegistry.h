@@ -0,0 +1,35 @@
+//
+//  ToolchainRegistry.h
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+  * Resolves the active developer dir and the paths of developer tools once, instead of paying for xcrun's lookup
+  * on every call. Resolved paths are saved to disk, keyed by the xcode-select target, and thrown away as soon as
+  * a different Xcode is selected
+ */
+@interface ToolchainRegistry : NSObject
+
++ (instancetype)sharedRegistry;
+
+// The selected Xcode's Contents/Developer. Falls back to /Applications/Xcode.app when nothing is selected
+- (NSString *)developerDir;
+
+/**
+  * Full path of a tool from the selected toolchain, like "lipo" or "simctl".
+  * @return nil if xcrun can't find it
+ */
+- (NSString * _Nullable)pathForTool:(NSString *)tool;
+
+// Forget everything that was resolved
+- (void)invalidate;
+
+@end
+
+NS_ASSUME_NONNULL_END
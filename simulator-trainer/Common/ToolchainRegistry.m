@@ -0,0 +1,189 @@
+//
+//  ToolchainRegistry.m
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#import <os/lock.h>
+#import "ToolchainRegistry.h"
+#import "CommandRunner.h"
+
+// xcode-select --switch points this link at the selected developer dir
+#define XCODE_SELECT_LINK "/var/db/xcode_select_link"
+#define DEFAULT_DEVELOPER_DIR @"/Applications/Xcode.app/Contents/Developer"
+
+@interface ToolchainRegistry () {
+    os_unfair_lock _lock;
+}
+
+@property (nonatomic, copy) NSString *cachePath;
+// What the developer dir was resolved from. Everything cached belongs to this selection
+@property (nonatomic, copy) NSString *selection;
+@property (nonatomic, copy) NSString *resolvedDeveloperDir;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSString *> *toolPaths;
+
+@end
+
+@implementation ToolchainRegistry
+
++ (instancetype)sharedRegistry {
+    static ToolchainRegistry *sharedRegistry = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedRegistry = [[ToolchainRegistry alloc] init];
+    });
+
+    return sharedRegistry;
+}
+
+- (instancetype)init {
+    if ((self = [super init])) {
+        _lock = OS_UNFAIR_LOCK_INIT;
+        _toolPaths = [NSMutableDictionary dictionary];
+
+        NSString *cachesDirectory = [NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES) firstObject];
+        NSString *storeDirectory = [cachesDirectory stringByAppendingPathComponent:@"com.simulatortrainer"];
+        [[NSFileManager defaultManager] createDirectoryAtPath:storeDirectory withIntermediateDirectories:YES attributes:nil error:nil];
+        _cachePath = [storeDirectory stringByAppendingPathComponent:@"toolchain.plist"];
+
+        NSDictionary *cache = [NSDictionary dictionaryWithContentsOfFile:_cachePath];
+        if ([cache[@"selection"] isKindOfClass:[NSString class]] && [cache[@"developerDir"] isKindOfClass:[NSString class]] && [cache[@"tools"] isKindOfClass:[NSDictionary class]]) {
+            _selection = cache[@"selection"];
+            _resolvedDeveloperDir = cache[@"developerDir"];
+            [_toolPaths addEntriesFromDictionary:cache[@"tools"]];
+        }
+    }
+
+    return self;
+}
+
+/**
+  * Identifies the current Xcode selection without spawning anything: DEVELOPER_DIR wins over xcode-select,
+  * same as for xcrun
+ */
+- (NSString *)_currentSelection {
+    const char *developerDirOverride = getenv("DEVELOPER_DIR");
+    if (developerDirOverride && developerDirOverride[0]) {
+        return [NSString stringWithFormat:@"env:%s", developerDirOverride];
+    }
+
+    char linkTarget[PATH_MAX];
+    ssize_t length = readlink(XCODE_SELECT_LINK, linkTarget, sizeof(linkTarget) - 1);
+    if (length > 0) {
+        linkTarget[length] = '\0';
+        return [NSString stringWithFormat:@"link:%s", linkTarget];
+    }
+
+    return @"default";
+}
+
+- (NSString *)_resolveDeveloperDirForSelection:(NSString *)selection {
+    NSString *developerDir = nil;
+    if ([selection hasPrefix:@"env:"] || [selection hasPrefix:@"link:"]) {
+        developerDir = [selection substringFromIndex:[selection rangeOfString:@":"].location + 1];
+    }
+    else {
+        [CommandRunner runCommand:@"/usr/bin/xcode-select" withArguments:@[@"--print-path"] stdoutString:&developerDir error:nil];
+    }
+
+    // xcode-select also accepts the path of Xcode.app itself
+    if ([developerDir hasSuffix:@".app"]) {
+        developerDir = [developerDir stringByAppendingPathComponent:@"Contents/Developer"];
+    }
+
+    BOOL isDirectory = NO;
+    if (!developerDir || ![[NSFileManager defaultManager] fileExistsAtPath:developerDir isDirectory:&isDirectory] || !isDirectory) {
+        NSLog(@"Failed to resolve the developer dir for %@, using %@", selection, DEFAULT_DEVELOPER_DIR);
+        developerDir = DEFAULT_DEVELOPER_DIR;
+    }
+
+    return developerDir;
+}
+
+/**
+  * The developer dir for the current selection. A new selection drops what was resolved for the earlier one.
+  * Resolving can run xcode-select, so it happens outside the lock and only the result is published under it
+ */
+- (NSString *)_validatedDeveloperDir {
+    NSString *selection = [self _currentSelection];
+    os_unfair_lock_lock(&_lock);
+    NSString *developerDir = [selection isEqualToString:self.selection] ? self.resolvedDeveloperDir : nil;
+    os_unfair_lock_unlock(&_lock);
+    if (developerDir) {
+        return developerDir;
+    }
+
+    // Two threads may both resolve a new selection, which is harmless
+    developerDir = [self _resolveDeveloperDirForSelection:selection];
+
+    os_unfair_lock_lock(&_lock);
+    if (![selection isEqualToString:self.selection] || !self.resolvedDeveloperDir) {
+        if (self.selection) {
+            NSLog(@"Xcode selection changed from %@ to %@", self.selection, selection);
+        }
+
+        self.selection = selection;
+        self.resolvedDeveloperDir = developerDir;
+        [self.toolPaths removeAllObjects];
+        [self _saveCache];
+    }
+    developerDir = self.resolvedDeveloperDir;
+    os_unfair_lock_unlock(&_lock);
+    return developerDir;
+}
+
+// Call with the lock held
+- (void)_saveCache {
+    NSDictionary *cache = @{
+        @"selection": self.selection ?: @"",
+        @"developerDir": self.resolvedDeveloperDir ?: @"",
+        @"tools": [self.toolPaths copy],
+    };
+
+    if (![cache writeToFile:self.cachePath atomically:YES]) {
+        NSLog(@"Failed to save toolchain cache to %@", self.cachePath);
+    }
+}
+
+- (NSString *)developerDir {
+    return [self _validatedDeveloperDir];
+}
+
+- (NSString *)pathForTool:(NSString *)tool {
+    NSString *developerDir = [self _validatedDeveloperDir];
+    os_unfair_lock_lock(&_lock);
+    NSString *toolPath = [self.resolvedDeveloperDir isEqualToString:developerDir] ? self.toolPaths[tool] : nil;
+    os_unfair_lock_unlock(&_lock);
+
+    if (toolPath && access(toolPath.fileSystemRepresentation, X_OK) == 0) {
+        return toolPath;
+    }
+
+    // Resolved outside the lock. Two threads may both look up a new tool, which is harmless
+    NSString *foundPath = nil;
+    NSError *error = nil;
+    if (![CommandRunner runCommand:@"/usr/bin/xcrun" withArguments:@[@"--find", tool] cwd:nil environment:@{@"DEVELOPER_DIR": developerDir} stdoutString:&foundPath error:&error] || foundPath.length == 0) {
+        NSLog(@"Failed to find %@ in %@: %@", tool, developerDir, error);
+        return nil;
+    }
+
+    os_unfair_lock_lock(&_lock);
+    if ([self.resolvedDeveloperDir isEqualToString:developerDir]) {
+        self.toolPaths[tool] = foundPath;
+        [self _saveCache];
+    }
+    os_unfair_lock_unlock(&_lock);
+
+    return foundPath;
+}
+
+- (void)invalidate {
+    os_unfair_lock_lock(&_lock);
+    self.selection = nil;
+    self.resolvedDeveloperDir = nil;
+    [self.toolPaths removeAllObjects];
+    os_unfair_lock_unlock(&_lock);
+}
+
+@end
@@ -0,0 +1,364 @@
+//
+//  objsee_profile.c
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#include "objsee_profile.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_THREADS (UINT16_MAX + 1)
+#define ROOT_NODE 0
+
+typedef struct {
+    uint64_t method_key;
+    uint64_t calls;
+    // Calls made directly from this method
+    uint64_t callee_calls;
+    // Frames on the stack, this one included, at the deepest point it was called
+    uint32_t max_stack_depth;
+} method_stats_t;
+
+typedef struct {
+    uint32_t parent;
+    uint64_t method_key;
+    uint64_t calls;
+} call_node_t;
+
+typedef struct {
+    uint16_t depth;
+    uint32_t node;
+    uint32_t method_index;
+} frame_t;
+
+typedef struct {
+    frame_t *frames;
+    uint32_t frame_count;
+    uint32_t frame_capacity;
+    uint64_t trees_seen;
+    // While a tree that wasn't sampled runs, calls deeper than its root are ignored
+    bool skipping;
+    uint16_t skip_depth;
+} thread_state_t;
+
+struct objsee_profile {
+    uint32_t sample_interval;
+    uint64_t total_calls;
+
+    // Open addressing, slots hold index + 1
+    method_stats_t *methods;
+    uint32_t method_count;
+    uint32_t method_capacity;
+    uint32_t *method_slots;
+    uint32_t method_slot_capacity;
+
+    call_node_t *nodes;
+    uint32_t node_count;
+    uint32_t node_capacity;
+    uint32_t *node_slots;
+    uint32_t node_slot_capacity;
+
+    thread_state_t *threads[MAX_THREADS];
+};
+
+static uint64_t make_method_key(uint32_t class_id, uint32_t selector_id, bool is_class_method) {
+    // Interned ids stay far below 2^31, which leaves the top selector bit for the method kind
+    return ((uint64_t)class_id << 32) | ((uint64_t)is_class_method << 31) | selector_id;
+}
+
+static uint32_t hash_u64(uint64_t value) {
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    return (uint32_t)value;
+}
+
+static void *grow_array(void *array, uint32_t *capacity, size_t element_size) {
+    uint32_t new_capacity = *capacity ? *capacity * 2 : 256;
+    void *grown = realloc(array, new_capacity * element_size);
+    if (grown) {
+        *capacity = new_capacity;
+    }
+
+    return grown;
+}
+
+static uint32_t *rehash_slots(uint32_t *slots, uint32_t *slot_capacity, uint32_t count, uint64_t (*key_for_index)(const objsee_profile_t *, uint32_t), const objsee_profile_t *profile) {
+    uint32_t new_capacity = *slot_capacity ? *slot_capacity * 2 : 1024;
+    uint32_t *new_slots = calloc(new_capacity, sizeof(uint32_t));
+    if (!new_slots) {
+        return NULL;
+    }
+
+    for (uint32_t index = 0; index < count; index++) {
+        uint32_t slot = hash_u64(key_for_index(profile, index)) & (new_capacity - 1);
+        while (new_slots[slot] != 0) {
+            slot = (slot + 1) & (new_capacity - 1);
+        }
+        new_slots[slot] = index + 1;
+    }
+
+    free(slots);
+    *slot_capacity = new_capacity;
+    return new_slots;
+}
+
+static uint64_t method_key_at(const objsee_profile_t *profile, uint32_t index) {
+    return profile->methods[index].method_key;
+}
+
+static uint64_t node_key(uint32_t parent, uint64_t method_key) {
+    return method_key * 31 + parent;
+}
+
+static uint64_t node_key_at(const objsee_profile_t *profile, uint32_t index) {
+    return node_key(profile->nodes[index].parent, profile->nodes[index].method_key);
+}
+
+static int64_t method_index_for_key(objsee_profile_t *profile, uint64_t method_key) {
+    if ((profile->method_count + 1) * 2 > profile->method_slot_capacity) {
+        uint32_t *slots = rehash_slots(profile->method_slots, &profile->method_slot_capacity, profile->method_count, method_key_at, profile);
+        if (!slots) {
+            return -1;
+        }
+        profile->method_slots = slots;
+    }
+
+    uint32_t mask = profile->method_slot_capacity - 1;
+    uint32_t slot = hash_u64(method_key) & mask;
+    while (profile->method_slots[slot] != 0) {
+        uint32_t index = profile->method_slots[slot] - 1;
+        if (profile->methods[index].method_key == method_key) {
+            return index;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    if (profile->method_count == profile->method_capacity) {
+        method_stats_t *methods = grow_array(profile->methods, &profile->method_capacity, sizeof(method_stats_t));
+        if (!methods) {
+            return -1;
+        }
+        profile->methods = methods;
+    }
+
+    uint32_t index = profile->method_count++;
+    profile->methods[index] = (method_stats_t){.method_key = method_key};
+    profile->method_slots[slot] = index + 1;
+    return index;
+}
+
+static int64_t node_index_for_path(objsee_profile_t *profile, uint32_t parent, uint64_t method_key) {
+    if ((profile->node_count + 1) * 2 > profile->node_slot_capacity) {
+        uint32_t *slots = rehash_slots(profile->node_slots, &profile->node_slot_capacity, profile->node_count, node_key_at, profile);
+        if (!slots) {
+            return -1;
+        }
+        profile->node_slots = slots;
+    }
+
+    uint32_t mask = profile->node_slot_capacity - 1;
+    uint32_t slot = hash_u64(node_key(parent, method_key)) & mask;
+    while (profile->node_slots[slot] != 0) {
+        uint32_t index = profile->node_slots[slot] - 1;
+        if (profile->nodes[index].parent == parent && profile->nodes[index].method_key == method_key) {
+            return index;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    if (profile->node_count == profile->node_capacity) {
+        call_node_t *nodes = grow_array(profile->nodes, &profile->node_capacity, sizeof(call_node_t));
+        if (!nodes) {
+            return -1;
+        }
+        profile->nodes = nodes;
+    }
+
+    uint32_t index = profile->node_count++;
+    profile->nodes[index] = (call_node_t){.parent = parent, .method_key = method_key};
+    profile->node_slots[slot] = index + 1;
+    return index;
+}
+
+objsee_profile_t *objsee_profile_create(uint32_t sample_interval) {
+    objsee_profile_t *profile = calloc(1, sizeof(objsee_profile_t));
+    if (!profile) {
+        return NULL;
+    }
+
+    profile->sample_interval = sample_interval ? sample_interval : 1;
+
+    // Node 0 is the root every thread's outermost calls hang off
+    if (node_index_for_path(profile, ROOT_NODE, 0) != ROOT_NODE) {
+        objsee_profile_destroy(profile);
+        return NULL;
+    }
+
+    return profile;
+}
+
+void objsee_profile_destroy(objsee_profile_t *profile) {
+    if (!profile) {
+        return;
+    }
+
+    for (uint32_t thread_id = 0; thread_id < MAX_THREADS; thread_id++) {
+        if (profile->threads[thread_id]) {
+            free(profile->threads[thread_id]->frames);
+            free(profile->threads[thread_id]);
+        }
+    }
+
+    free(profile->methods);
+    free(profile->method_slots);
+    free(profile->nodes);
+    free(profile->node_slots);
+    free(profile);
+}
+
+void objsee_profile_record_call(objsee_profile_t *profile, uint16_t thread_id, uint16_t depth, uint32_t class_id, uint32_t selector_id, bool is_class_method) {
+    thread_state_t *thread = profile->threads[thread_id];
+    if (!thread) {
+        thread = calloc(1, sizeof(thread_state_t));
+        if (!thread) {
+            return;
+        }
+        profile->threads[thread_id] = thread;
+    }
+
+    while (thread->frame_count > 0 && thread->frames[thread->frame_count - 1].depth >= depth) {
+        thread->frame_count--;
+    }
+
+    if (thread->skipping) {
+        if (depth > thread->skip_depth) {
+            return;
+        }
+        thread->skipping = false;
+    }
+
+    if (thread->frame_count == 0 && (thread->trees_seen++ % profile->sample_interval) != 0) {
+        thread->skipping = true;
+        thread->skip_depth = depth;
+        return;
+    }
+
+    uint64_t method_key = make_method_key(class_id, selector_id, is_class_method);
+    int64_t method_index = method_index_for_key(profile, method_key);
+    uint32_t parent = thread->frame_count > 0 ? thread->frames[thread->frame_count - 1].node : ROOT_NODE;
+    int64_t node_index = node_index_for_path(profile, parent, method_key);
+    if (method_index < 0 || node_index < 0) {
+        return;
+    }
+
+    if (thread->frame_count == thread->frame_capacity) {
+        frame_t *frames = grow_array(thread->frames, &thread->frame_capacity, sizeof(frame_t));
+        if (!frames) {
+            return;
+        }
+        thread->frames = frames;
+    }
+
+    thread->frames[thread->frame_count++] = (frame_t){
+        .depth = depth,
+        .node = (uint32_t)node_index,
+        .method_index = (uint32_t)method_index,
+    };
+
+    if (thread->frame_count > 1) {
+        profile->methods[thread->frames[thread->frame_count - 2].method_index].callee_calls++;
+    }
+
+    method_stats_t *method = &profile->methods[method_index];
+    if (thread->frame_count > method->max_stack_depth) {
+        method->max_stack_depth = thread->frame_count;
+    }
+    method->calls++;
+    profile->nodes[node_index].calls++;
+    profile->total_calls++;
+}
+
+uint64_t objsee_profile_total_calls(const objsee_profile_t *profile) {
+    return profile->total_calls;
+}
+
+static int write_method_name(FILE *file, uint64_t method_key, objsee_profile_name_fn resolve_name, void *context) {
+    uint32_t class_id = (uint32_t)(method_key >> 32);
+    uint32_t selector_id = (uint32_t)(method_key & 0x7fffffff);
+    bool is_class_method = (method_key >> 31) & 1;
+    return fprintf(file, "%c[%s %s]", is_class_method ? '+' : '-', resolve_name(class_id, context), resolve_name(selector_id, context));
+}
+
+int objsee_profile_write_collapsed(const objsee_profile_t *profile, FILE *file, objsee_profile_name_fn resolve_name, void *context) {
+    uint32_t path_capacity = 64;
+    uint32_t *path = malloc(path_capacity * sizeof(uint32_t));
+    if (!path) {
+        return -1;
+    }
+
+    for (uint32_t index = 1; index < profile->node_count; index++) {
+        uint32_t path_length = 0;
+        for (uint32_t node = index; node != ROOT_NODE; node = profile->nodes[node].parent) {
+            if (path_length == path_capacity) {
+                uint32_t *grown = grow_array(path, &path_capacity, sizeof(uint32_t));
+                if (!grown) {
+                    free(path);
+                    return -1;
+                }
+                path = grown;
+            }
+            path[path_length++] = node;
+        }
+
+        // Outermost frame first
+        for (uint32_t i = path_length; i > 0; i--) {
+            write_method_name(file, profile->nodes[path[i - 1]].method_key, resolve_name, context);
+            fputc(i > 1 ? ';' : ' ', file);
+        }
+
+        fprintf(file, "%llu\n", (unsigned long long)profile->nodes[index].calls);
+    }
+
+    free(path);
+    return ferror(file) ? -1 : 0;
+}
+
+static int compare_methods_by_calls(const void *lhs, const void *rhs) {
+    const method_stats_t *a = *(const method_stats_t * const *)lhs;
+    const method_stats_t *b = *(const method_stats_t * const *)rhs;
+    if (a->calls != b->calls) {
+        return a->calls > b->calls ? -1 : 1;
+    }
+
+    return a->callee_calls > b->callee_calls ? -1 : (a->callee_calls < b->callee_calls);
+}
+
+int objsee_profile_write_top(const objsee_profile_t *profile, FILE *file, size_t limit, objsee_profile_name_fn resolve_name, void *context) {
+    const method_stats_t **sorted = malloc((profile->method_count + 1) * sizeof(method_stats_t *));
+    if (!sorted) {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < profile->method_count; i++) {
+        sorted[i] = &profile->methods[i];
+    }
+    qsort(sorted, profile->method_count, sizeof(method_stats_t *), compare_methods_by_calls);
+
+    fprintf(file, "%llu calls, %u methods", (unsigned long long)profile->total_calls, profile->method_count);
+    if (profile->sample_interval > 1) {
+        fprintf(file, ", 1 in %u call trees sampled", profile->sample_interval);
+    }
+    fprintf(file, "\n\n%12s %12s %10s  %s\n", "calls", "callees", "max depth", "method");
+
+    for (size_t i = 0; i < profile->method_count && i < limit; i++) {
+        fprintf(file, "%12llu %12llu %10u  ", (unsigned long long)sorted[i]->calls, (unsigned long long)sorted[i]->callee_calls, sorted[i]->max_stack_depth);
+        write_method_name(file, sorted[i]->method_key, resolve_name, context);
+        fputc('\n', file);
+    }
+
+    free(sorted);
+    return ferror(file) ? -1 : 0;
+}
@@ -0,0 +1,52 @@
+//
+//  objsee_profile.h
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#ifndef objsee_profile_h
+#define objsee_profile_h
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <stdio.h>
+
+/**
+  * Aggregates a stream of traced calls into per-method and per-call-path totals instead of keeping the trace.
+  * Calls are attributed to per-thread stacks rebuilt from each call's depth, so memory grows with the number of
+  * distinct methods and call paths, not with the length of the session.
+  * The tracer's lines carry no timestamps, so the profile only counts calls. Times taken from when lines arrive
+  * would measure the gaps between batches, not the calls.
+  * Methods and names are identified by interned ids; names are only resolved when a report is written
+ */
+typedef struct objsee_profile objsee_profile_t;
+
+typedef const char *(*objsee_profile_name_fn)(uint32_t name_id, void *context);
+
+/**
+  * @param sample_interval Profile one in every `sample_interval` top-level call trees per thread. 0 or 1 profiles every call
+ */
+objsee_profile_t *objsee_profile_create(uint32_t sample_interval);
+void objsee_profile_destroy(objsee_profile_t *profile);
+
+/**
+  * Record the start of a call. Calls at the same or a lower depth on the same thread end the calls they replace
+ */
+void objsee_profile_record_call(objsee_profile_t *profile, uint16_t thread_id, uint16_t depth, uint32_t class_id, uint32_t selector_id, bool is_class_method);
+
+uint64_t objsee_profile_total_calls(const objsee_profile_t *profile);
+
+/**
+  * Write one line per distinct call path in the collapsed-stack format read by flamegraph.pl and speedscope,
+  * weighted by the number of calls made on that path
+  * @return 0 on success, -1 on failure
+ */
+int objsee_profile_write_collapsed(const objsee_profile_t *profile, FILE *file, objsee_profile_name_fn resolve_name, void *context);
+
+/**
+  * Write the `limit` most called methods with the calls made directly from them and the deepest stack they were seen on
+  * @return 0 on success, -1 on failure
+ */
+int objsee_profile_write_top(const objsee_profile_t *profile, FILE *file, size_t limit, objsee_profile_name_fn resolve_name, void *context);
+
+#endif /* objsee_profile_h */
@@ -0,0 +1,740 @@
+//
+//  objsee_trace_file.c
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#include "objsee_trace_file.h"
+#include <compression.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TRACE_FILE_MAGIC "OBJSEETR"
+#define TRACE_FILE_VERSION 1
+#define CHUNK_MAGIC 0x4b435451
+#define CHUNK_EVENT_CAPACITY 65536
+// Largest varint (a 64-bit timestamp delta) times the events in a chunk
+#define COLUMN_BUFFER_SIZE (CHUNK_EVENT_CAPACITY * 10)
+#define METHOD_KIND_BIT (1u << 31)
+
+enum {
+    COLUMN_TIMESTAMP,
+    COLUMN_THREAD,
+    COLUMN_DEPTH,
+    COLUMN_METHOD,
+    COLUMN_COUNT,
+};
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+} file_header_t;
+
+/**
+  * Followed by the chunk's payload, in this order: new methods, method index, thread index (padded to 4 bytes),
+  * new strings, then the columns. The payload is padded to 8 bytes so the next header stays aligned
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t event_count;
+    uint64_t first_timestamp_ns;
+    uint64_t last_timestamp_ns;
+    // Names and methods first used in this chunk. Ids carry on from the previous chunk
+    uint32_t new_string_count;
+    uint32_t new_strings_size;
+    uint32_t new_method_count;
+    // Sorted, distinct methods and threads with events in this chunk
+    uint32_t method_index_count;
+    uint32_t thread_index_count;
+    uint32_t column_raw_sizes[COLUMN_COUNT];
+    // Same as the raw size when the column was stored uncompressed
+    uint32_t column_stored_sizes[COLUMN_COUNT];
+    uint32_t reserved;
+    uint64_t payload_size;
+} chunk_header_t;
+
+typedef struct {
+    uint32_t class_id;
+    // Selector name id, with METHOD_KIND_BIT set for class methods
+    uint32_t selector_word;
+} method_entry_t;
+
+static size_t align_up(size_t value, size_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static size_t write_varint(uint8_t *buffer, uint64_t value) {
+    size_t length = 0;
+    while (value >= 0x80) {
+        buffer[length++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    buffer[length++] = (uint8_t)value;
+    return length;
+}
+
+static bool read_varint(const uint8_t **cursor, const uint8_t *end, uint64_t *value_out) {
+    uint64_t value = 0;
+    for (unsigned shift = 0; shift < 64 && *cursor < end; shift += 7) {
+        uint8_t byte = *(*cursor)++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            *value_out = value;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static uint64_t zigzag_encode(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t zigzag_decode(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static int compare_u32(const void *lhs, const void *rhs) {
+    uint32_t a = *(const uint32_t *)lhs;
+    uint32_t b = *(const uint32_t *)rhs;
+    return (a > b) - (a < b);
+}
+
+static uint32_t sort_unique_u32(uint32_t *values, uint32_t count) {
+    qsort(values, count, sizeof(uint32_t), compare_u32);
+    uint32_t unique_count = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (unique_count == 0 || values[unique_count - 1] != values[i]) {
+            values[unique_count++] = values[i];
+        }
+    }
+
+    return unique_count;
+}
+
+struct objsee_trace_writer {
+    FILE *file;
+    objsee_trace_name_fn resolve_name;
+    void *context;
+    bool failed;
+
+    uint32_t strings_written;
+    uint32_t max_string_id;
+
+    // Open addressing over method keys, slots hold method id + 1
+    uint32_t *method_slots;
+    uint32_t method_slot_capacity;
+    uint64_t *method_keys;
+    uint32_t method_count;
+    uint32_t method_capacity;
+    uint32_t methods_written;
+
+    uint32_t event_count;
+    uint64_t timestamps[CHUNK_EVENT_CAPACITY];
+    uint16_t threads[CHUNK_EVENT_CAPACITY];
+    uint16_t depths[CHUNK_EVENT_CAPACITY];
+    uint32_t methods[CHUNK_EVENT_CAPACITY];
+    uint32_t index_scratch[CHUNK_EVENT_CAPACITY];
+
+    uint8_t *raw_columns[COLUMN_COUNT];
+    uint8_t *stored_columns[COLUMN_COUNT];
+};
+
+static uint32_t hash_method_key(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return (uint32_t)key;
+}
+
+static int64_t writer_method_id(objsee_trace_writer_t *writer, uint64_t key) {
+    if ((writer->method_count + 1) * 2 > writer->method_slot_capacity) {
+        uint32_t new_capacity = writer->method_slot_capacity ? writer->method_slot_capacity * 2 : 1024;
+        uint32_t *new_slots = calloc(new_capacity, sizeof(uint32_t));
+        if (!new_slots) {
+            return -1;
+        }
+
+        for (uint32_t method_id = 0; method_id < writer->method_count; method_id++) {
+            uint32_t slot = hash_method_key(writer->method_keys[method_id]) & (new_capacity - 1);
+            while (new_slots[slot] != 0) {
+                slot = (slot + 1) & (new_capacity - 1);
+            }
+            new_slots[slot] = method_id + 1;
+        }
+
+        free(writer->method_slots);
+        writer->method_slots = new_slots;
+        writer->method_slot_capacity = new_capacity;
+    }
+
+    uint32_t mask = writer->method_slot_capacity - 1;
+    uint32_t slot = hash_method_key(key) & mask;
+    while (writer->method_slots[slot] != 0) {
+        uint32_t method_id = writer->method_slots[slot] - 1;
+        if (writer->method_keys[method_id] == key) {
+            return method_id;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    if (writer->method_count == writer->method_capacity) {
+        uint32_t new_capacity = writer->method_capacity ? writer->method_capacity * 2 : 1024;
+        uint64_t *keys = realloc(writer->method_keys, new_capacity * sizeof(uint64_t));
+        if (!keys) {
+            return -1;
+        }
+        writer->method_keys = keys;
+        writer->method_capacity = new_capacity;
+    }
+
+    uint32_t method_id = writer->method_count++;
+    writer->method_keys[method_id] = key;
+    writer->method_slots[slot] = method_id + 1;
+    return method_id;
+}
+
+objsee_trace_writer_t *objsee_trace_writer_create(const char *path, objsee_trace_name_fn resolve_name, void *context) {
+    objsee_trace_writer_t *writer = calloc(1, sizeof(objsee_trace_writer_t));
+    if (!writer) {
+        return NULL;
+    }
+
+    writer->resolve_name = resolve_name;
+    writer->context = context;
+    for (int column = 0; column < COLUMN_COUNT; column++) {
+        writer->raw_columns[column] = malloc(COLUMN_BUFFER_SIZE);
+        writer->stored_columns[column] = malloc(COLUMN_BUFFER_SIZE);
+        if (!writer->raw_columns[column] || !writer->stored_columns[column]) {
+            writer->failed = true;
+        }
+    }
+
+    writer->file = writer->failed ? NULL : fopen(path, "wb");
+    if (!writer->file) {
+        fprintf(stderr, "Failed to create trace file %s: %s\n", path, strerror(errno));
+        writer->failed = true;
+        objsee_trace_writer_close(writer);
+        return NULL;
+    }
+
+    file_header_t header = {.version = TRACE_FILE_VERSION};
+    memcpy(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic));
+    fwrite(&header, sizeof(header), 1, writer->file);
+    return writer;
+}
+
+static size_t encode_column(objsee_trace_writer_t *writer, int column, uint64_t first_timestamp_ns) {
+    uint8_t *buffer = writer->raw_columns[column];
+    size_t length = 0;
+    uint64_t previous_timestamp = first_timestamp_ns;
+    uint16_t previous_depth = 0;
+    for (uint32_t i = 0; i < writer->event_count; i++) {
+        switch (column) {
+            case COLUMN_TIMESTAMP:
+                length += write_varint(buffer + length, writer->timestamps[i] - previous_timestamp);
+                previous_timestamp = writer->timestamps[i];
+                break;
+            case COLUMN_THREAD:
+                length += write_varint(buffer + length, writer->threads[i]);
+                break;
+            case COLUMN_DEPTH:
+                length += write_varint(buffer + length, zigzag_encode((int64_t)writer->depths[i] - previous_depth));
+                previous_depth = writer->depths[i];
+                break;
+            case COLUMN_METHOD:
+                length += write_varint(buffer + length, writer->methods[i]);
+                break;
+        }
+    }
+
+    return length;
+}
+
+static int writer_flush_chunk(objsee_trace_writer_t *writer) {
+    if (writer->event_count == 0 || writer->failed) {
+        return writer->failed ? -1 : 0;
+    }
+
+    chunk_header_t header = {
+        .magic = CHUNK_MAGIC,
+        .event_count = writer->event_count,
+        .first_timestamp_ns = writer->timestamps[0],
+        .last_timestamp_ns = writer->timestamps[writer->event_count - 1],
+        .new_string_count = writer->max_string_id - writer->strings_written,
+        .new_method_count = writer->method_count - writer->methods_written,
+    };
+
+    for (uint32_t string_id = writer->strings_written + 1; string_id <= writer->max_string_id; string_id++) {
+        header.new_strings_size += (uint32_t)strlen(writer->resolve_name(string_id, writer->context)) + 1;
+    }
+
+    for (int column = 0; column < COLUMN_COUNT; column++) {
+        size_t raw_size = encode_column(writer, column, header.first_timestamp_ns);
+        size_t stored_size = compression_encode_buffer(writer->stored_columns[column], COLUMN_BUFFER_SIZE, writer->raw_columns[column], raw_size, NULL, COMPRESSION_LZFSE);
+        if (stored_size == 0 || stored_size >= raw_size) {
+            memcpy(writer->stored_columns[column], writer->raw_columns[column], raw_size);
+            stored_size = raw_size;
+        }
+
+        header.column_raw_sizes[column] = (uint32_t)raw_size;
+        header.column_stored_sizes[column] = (uint32_t)stored_size;
+    }
+
+    long header_offset = ftell(writer->file);
+    fwrite(&header, sizeof(header), 1, writer->file);
+
+    // Both indexes are built in the same scratch buffer, so each is written out before the next is built
+    memcpy(writer->index_scratch, writer->methods, writer->event_count * sizeof(uint32_t));
+    header.method_index_count = sort_unique_u32(writer->index_scratch, writer->event_count);
+    size_t payload_size = header.new_method_count * sizeof(method_entry_t) + header.method_index_count * sizeof(uint32_t);
+
+    for (uint32_t method_id = writer->methods_written; method_id < writer->method_count; method_id++) {
+        uint64_t key = writer->method_keys[method_id];
+        method_entry_t entry = {.class_id = (uint32_t)(key >> 32), .selector_word = (uint32_t)key};
+        fwrite(&entry, sizeof(entry), 1, writer->file);
+    }
+    fwrite(writer->index_scratch, sizeof(uint32_t), header.method_index_count, writer->file);
+
+    for (uint32_t i = 0; i < writer->event_count; i++) {
+        writer->index_scratch[i] = writer->threads[i];
+    }
+    header.thread_index_count = sort_unique_u32(writer->index_scratch, writer->event_count);
+    for (uint32_t i = 0; i < header.thread_index_count; i++) {
+        uint16_t thread_id = (uint16_t)writer->index_scratch[i];
+        fwrite(&thread_id, sizeof(thread_id), 1, writer->file);
+    }
+    payload_size += align_up(header.thread_index_count * sizeof(uint16_t), 4);
+    static const uint8_t padding[8] = {0};
+    fwrite(padding, 1, align_up(header.thread_index_count * sizeof(uint16_t), 4) - header.thread_index_count * sizeof(uint16_t), writer->file);
+
+    for (uint32_t string_id = writer->strings_written + 1; string_id <= writer->max_string_id; string_id++) {
+        const char *string = writer->resolve_name(string_id, writer->context);
+        fwrite(string, 1, strlen(string) + 1, writer->file);
+    }
+    payload_size += header.new_strings_size;
+
+    for (int column = 0; column < COLUMN_COUNT; column++) {
+        fwrite(writer->stored_columns[column], 1, header.column_stored_sizes[column], writer->file);
+        payload_size += header.column_stored_sizes[column];
+    }
+
+    fwrite(padding, 1, align_up(payload_size, 8) - payload_size, writer->file);
+    header.payload_size = align_up(payload_size, 8);
+
+    // The index counts and payload size are only known now
+    long end_offset = ftell(writer->file);
+    if (header_offset < 0 || fseek(writer->file, header_offset, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, writer->file) != 1 || fseek(writer->file, end_offset, SEEK_SET) != 0 || ferror(writer->file)) {
+        fprintf(stderr, "Failed to write trace chunk: %s\n", strerror(errno));
+        writer->failed = true;
+        return -1;
+    }
+
+    writer->strings_written = writer->max_string_id;
+    writer->methods_written = writer->method_count;
+    writer->event_count = 0;
+    return 0;
+}
+
+int objsee_trace_writer_append(objsee_trace_writer_t *writer, uint64_t timestamp_ns, uint16_t thread_id, uint16_t depth, uint32_t class_id, uint32_t selector_id, bool is_class_method) {
+    if (writer->failed) {
+        return -1;
+    }
+
+    uint64_t key = ((uint64_t)class_id << 32) | selector_id | (is_class_method ? METHOD_KIND_BIT : 0);
+    int64_t method_id = writer_method_id(writer, key);
+    if (method_id < 0) {
+        writer->failed = true;
+        return -1;
+    }
+
+    // Timestamps are delta-encoded as unsigned, so they must never go backwards within a chunk
+    uint32_t index = writer->event_count;
+    if (index > 0 && timestamp_ns < writer->timestamps[index - 1]) {
+        timestamp_ns = writer->timestamps[index - 1];
+    }
+
+    writer->timestamps[index] = timestamp_ns;
+    writer->threads[index] = thread_id;
+    writer->depths[index] = depth;
+    writer->methods[index] = (uint32_t)method_id;
+    writer->event_count++;
+
+    uint32_t highest_id = class_id > selector_id ? class_id : selector_id;
+    if (highest_id > writer->max_string_id) {
+        writer->max_string_id = highest_id;
+    }
+
+    return writer->event_count == CHUNK_EVENT_CAPACITY ? writer_flush_chunk(writer) : 0;
+}
+
+int objsee_trace_writer_close(objsee_trace_writer_t *writer) {
+    if (!writer) {
+        return -1;
+    }
+
+    int result = writer_flush_chunk(writer);
+    if (writer->file && fclose(writer->file) != 0) {
+        result = -1;
+    }
+
+    for (int column = 0; column < COLUMN_COUNT; column++) {
+        free(writer->raw_columns[column]);
+        free(writer->stored_columns[column]);
+    }
+
+    free(writer->method_slots);
+    free(writer->method_keys);
+    free(writer);
+    return result;
+}
+
+typedef struct {
+    const chunk_header_t *header;
+    const uint32_t *method_index;
+    const uint16_t *thread_index;
+    const uint8_t *columns[COLUMN_COUNT];
+} chunk_ref_t;
+
+struct objsee_trace_reader {
+    uint8_t *base;
+    size_t size;
+    uint64_t event_count;
+
+    chunk_ref_t *chunks;
+    uint32_t chunk_count;
+
+    // strings[id - 1], pointing into the mapping
+    const char **strings;
+    uint32_t string_count;
+    const method_entry_t **methods;
+    uint32_t method_count;
+
+    uint8_t *raw_column;
+    uint64_t *timestamps;
+    uint32_t *threads;
+    uint32_t *depths;
+    uint32_t *method_ids;
+};
+
+static bool reader_append_pointers(void ***array, uint32_t count, uint32_t *capacity, uint32_t additional) {
+    if (count + additional <= *capacity) {
+        return true;
+    }
+
+    uint32_t new_capacity = *capacity ? *capacity : 1024;
+    while (new_capacity < count + additional) {
+        new_capacity *= 2;
+    }
+
+    void **grown = realloc(*array, new_capacity * sizeof(void *));
+    if (!grown) {
+        return false;
+    }
+
+    *array = grown;
+    *capacity = new_capacity;
+    return true;
+}
+
+static bool reader_index_chunk(objsee_trace_reader_t *reader, const chunk_header_t *header, uint32_t *chunk_capacity, uint32_t *string_capacity, uint32_t *method_capacity) {
+    const uint8_t *cursor = (const uint8_t *)(header + 1);
+    const uint8_t *end = cursor + header->payload_size;
+
+    if (reader->chunk_count == *chunk_capacity) {
+        uint32_t new_capacity = *chunk_capacity ? *chunk_capacity * 2 : 256;
+        chunk_ref_t *chunks = realloc(reader->chunks, new_capacity * sizeof(chunk_ref_t));
+        if (!chunks) {
+            return false;
+        }
+        reader->chunks = chunks;
+        *chunk_capacity = new_capacity;
+    }
+
+    chunk_ref_t *chunk = &reader->chunks[reader->chunk_count];
+    chunk->header = header;
+
+    size_t methods_size = header->new_method_count * sizeof(method_entry_t);
+    if ((size_t)(end - cursor) < methods_size || !reader_append_pointers((void ***)&reader->methods, reader->method_count, method_capacity, header->new_method_count)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < header->new_method_count; i++) {
+        reader->methods[reader->method_count++] = (const method_entry_t *)cursor + i;
+    }
+    cursor += methods_size;
+
+    size_t method_index_size = header->method_index_count * sizeof(uint32_t);
+    size_t thread_index_size = align_up(header->thread_index_count * sizeof(uint16_t), 4);
+    if ((size_t)(end - cursor) < method_index_size + thread_index_size + header->new_strings_size) {
+        return false;
+    }
+    chunk->method_index = (const uint32_t *)cursor;
+    cursor += method_index_size;
+    chunk->thread_index = (const uint16_t *)cursor;
+    cursor += thread_index_size;
+
+    const char *strings = (const char *)cursor;
+    const char *strings_end = strings + header->new_strings_size;
+    if (header->new_strings_size > 0 && strings_end[-1] != '\0') {
+        return false;
+    }
+    if (!reader_append_pointers((void ***)&reader->strings, reader->string_count, string_capacity, header->new_string_count)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < header->new_string_count; i++) {
+        if (strings >= strings_end) {
+            return false;
+        }
+        reader->strings[reader->string_count++] = strings;
+        strings += strlen(strings) + 1;
+    }
+    cursor += header->new_strings_size;
+
+    for (int column = 0; column < COLUMN_COUNT; column++) {
+        if ((size_t)(end - cursor) < header->column_stored_sizes[column] || header->column_raw_sizes[column] > COLUMN_BUFFER_SIZE) {
+            return false;
+        }
+        chunk->columns[column] = cursor;
+        cursor += header->column_stored_sizes[column];
+    }
+
+    reader->chunk_count++;
+    reader->event_count += header->event_count;
+    return true;
+}
+
+objsee_trace_reader_t *objsee_trace_reader_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open trace file %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(file_header_t)) {
+        fprintf(stderr, "%s is not a trace file\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "Failed to map trace file %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    const file_header_t *file_header = base;
+    if (memcmp(file_header->magic, TRACE_FILE_MAGIC, sizeof(file_header->magic)) != 0 || file_header->version != TRACE_FILE_VERSION) {
+        fprintf(stderr, "%s is not a version %d trace file\n", path, TRACE_FILE_VERSION);
+        munmap(base, (size_t)st.st_size);
+        return NULL;
+    }
+
+    objsee_trace_reader_t *reader = calloc(1, sizeof(objsee_trace_reader_t));
+    if (!reader) {
+        fprintf(stderr, "Failed to allocate a reader for %s\n", path);
+        munmap(base, (size_t)st.st_size);
+        return NULL;
+    }
+
+    reader->base = base;
+    reader->size = (size_t)st.st_size;
+    reader->raw_column = malloc(COLUMN_BUFFER_SIZE);
+    reader->timestamps = malloc(CHUNK_EVENT_CAPACITY * sizeof(uint64_t));
+    reader->threads = malloc(CHUNK_EVENT_CAPACITY * sizeof(uint32_t));
+    reader->depths = malloc(CHUNK_EVENT_CAPACITY * sizeof(uint32_t));
+    reader->method_ids = malloc(CHUNK_EVENT_CAPACITY * sizeof(uint32_t));
+    if (!reader->raw_column || !reader->timestamps || !reader->threads || !reader->depths || !reader->method_ids) {
+        fprintf(stderr, "Failed to allocate decode buffers for %s\n", path);
+        // Frees whichever buffers were allocated, and unmaps the file
+        objsee_trace_reader_close(reader);
+        return NULL;
+    }
+
+    uint32_t chunk_capacity = 0;
+    uint32_t string_capacity = 0;
+    uint32_t method_capacity = 0;
+    size_t offset = sizeof(file_header_t);
+    while (offset + sizeof(chunk_header_t) <= reader->size) {
+        const chunk_header_t *header = (const chunk_header_t *)(reader->base + offset);
+        if (header->magic != CHUNK_MAGIC || header->event_count > CHUNK_EVENT_CAPACITY || header->payload_size > reader->size - offset - sizeof(chunk_header_t)) {
+            // A recording that was cut short ends in a partial chunk
+            break;
+        }
+
+        if (!reader_index_chunk(reader, header, &chunk_capacity, &string_capacity, &method_capacity)) {
+            fprintf(stderr, "Corrupt chunk at offset %zu in %s\n", offset, path);
+            break;
+        }
+
+        offset += sizeof(chunk_header_t) + header->payload_size;
+    }
+
+    return reader;
+}
+
+void objsee_trace_reader_close(objsee_trace_reader_t *reader) {
+    if (!reader) {
+        return;
+    }
+
+    munmap(reader->base, reader->size);
+    free(reader->chunks);
+    free(reader->strings);
+    free(reader->methods);
+    free(reader->raw_column);
+    free(reader->timestamps);
+    free(reader->threads);
+    free(reader->depths);
+    free(reader->method_ids);
+    free(reader);
+}
+
+uint64_t objsee_trace_reader_event_count(const objsee_trace_reader_t *reader) {
+    return reader->event_count;
+}
+
+static const char *reader_string(const objsee_trace_reader_t *reader, uint32_t string_id) {
+    return (string_id > 0 && string_id <= reader->string_count) ? reader->strings[string_id - 1] : "?";
+}
+
+// Decompress and decode one column of `chunk` into `values_out`, as 32-bit values or, for timestamps, 64-bit ones
+static bool reader_decode_column(objsee_trace_reader_t *reader, const chunk_ref_t *chunk, int column, void *values_out) {
+    const chunk_header_t *header = chunk->header;
+    const uint8_t *raw = chunk->columns[column];
+    size_t raw_size = header->column_raw_sizes[column];
+    if (header->column_stored_sizes[column] != raw_size) {
+        if (compression_decode_buffer(reader->raw_column, COLUMN_BUFFER_SIZE, chunk->columns[column], header->column_stored_sizes[column], NULL, COMPRESSION_LZFSE) != raw_size) {
+            return false;
+        }
+        raw = reader->raw_column;
+    }
+
+    const uint8_t *cursor = raw;
+    const uint8_t *end = raw + raw_size;
+    uint64_t previous = (column == COLUMN_TIMESTAMP) ? header->first_timestamp_ns : 0;
+    for (uint32_t i = 0; i < header->event_count; i++) {
+        uint64_t value = 0;
+        if (!read_varint(&cursor, end, &value)) {
+            return false;
+        }
+
+        switch (column) {
+            case COLUMN_TIMESTAMP:
+                previous += value;
+                ((uint64_t *)values_out)[i] = previous;
+                break;
+            case COLUMN_DEPTH:
+                previous = (uint64_t)((int64_t)previous + zigzag_decode(value));
+                ((uint32_t *)values_out)[i] = (uint32_t)previous;
+                break;
+            default:
+                ((uint32_t *)values_out)[i] = (uint32_t)value;
+                break;
+        }
+    }
+
+    return true;
+}
+
+int64_t objsee_trace_reader_query(objsee_trace_reader_t *reader, const objsee_trace_query_t *query, objsee_trace_visitor_t visitor, void *context) {
+    // Methods are matched by name once, up front. The chunk indexes are then checked against the matching ids
+    uint8_t *method_matches = calloc(reader->method_count + 1, 1);
+    if (!method_matches) {
+        return -1;
+    }
+
+    bool any_method_matches = false;
+    for (uint32_t method_id = 0; method_id < reader->method_count; method_id++) {
+        const method_entry_t *method = reader->methods[method_id];
+        bool class_matches = !query->class_name || strcmp(reader_string(reader, method->class_id), query->class_name) == 0;
+        bool selector_matches = !query->selector || strcmp(reader_string(reader, method->selector_word & ~METHOD_KIND_BIT), query->selector) == 0;
+        bool kind_matches = query->method_kind < 0 || ((method->selector_word & METHOD_KIND_BIT) != 0) == (query->method_kind == 1);
+        method_matches[method_id] = class_matches && selector_matches && kind_matches;
+        any_method_matches |= method_matches[method_id];
+    }
+
+    int64_t visited = 0;
+    uint64_t end_ns = query->end_ns ? query->end_ns : UINT64_MAX;
+    for (uint32_t chunk_index = 0; chunk_index < reader->chunk_count && any_method_matches; chunk_index++) {
+        const chunk_ref_t *chunk = &reader->chunks[chunk_index];
+        const chunk_header_t *header = chunk->header;
+        if (header->last_timestamp_ns < query->start_ns || header->first_timestamp_ns > end_ns) {
+            continue;
+        }
+
+        if (query->thread_id >= 0) {
+            uint16_t thread_id = (uint16_t)query->thread_id;
+            bool has_thread = false;
+            for (uint32_t low = 0, high = header->thread_index_count; low < high && !has_thread;) {
+                uint32_t middle = low + (high - low) / 2;
+                has_thread = (chunk->thread_index[middle] == thread_id);
+                if (chunk->thread_index[middle] < thread_id) {
+                    low = middle + 1;
+                }
+                else {
+                    high = middle;
+                }
+            }
+
+            if (!has_thread) {
+                continue;
+            }
+        }
+
+        bool has_method = false;
+        for (uint32_t i = 0; i < header->method_index_count && !has_method; i++) {
+            has_method = chunk->method_index[i] < reader->method_count && method_matches[chunk->method_index[i]];
+        }
+
+        if (!has_method) {
+            continue;
+        }
+
+        if (!reader_decode_column(reader, chunk, COLUMN_METHOD, reader->method_ids) || !reader_decode_column(reader, chunk, COLUMN_TIMESTAMP, reader->timestamps) || !reader_decode_column(reader, chunk, COLUMN_THREAD, reader->threads) || !reader_decode_column(reader, chunk, COLUMN_DEPTH, reader->depths)) {
+            fprintf(stderr, "Failed to decode trace chunk %u\n", chunk_index);
+            free(method_matches);
+            return -1;
+        }
+
+        for (uint32_t i = 0; i < header->event_count; i++) {
+            uint32_t method_id = reader->method_ids[i];
+            if (method_id >= reader->method_count || !method_matches[method_id] || reader->timestamps[i] < query->start_ns || reader->timestamps[i] > end_ns) {
+                continue;
+            }
+
+            if (query->thread_id >= 0 && reader->threads[i] != (uint32_t)query->thread_id) {
+                continue;
+            }
+
+            const method_entry_t *method = reader->methods[method_id];
+            objsee_trace_event_t event = {
+                .timestamp_ns = reader->timestamps[i],
+                .thread_id = (uint16_t)reader->threads[i],
+                .depth = (uint16_t)reader->depths[i],
+                .is_class_method = (method->selector_word & METHOD_KIND_BIT) != 0,
+                .class_name = reader_string(reader, method->class_id),
+                .selector = reader_string(reader, method->selector_word & ~METHOD_KIND_BIT),
+            };
+
+            visited++;
+            if (!visitor(&event, context)) {
+                free(method_matches);
+                return visited;
+            }
+        }
+    }
+
+    free(method_matches);
+    return visited;
+}
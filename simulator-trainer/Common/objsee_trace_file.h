@@ -0,0 +1,86 @@
+//
+//  objsee_trace_file.h
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#ifndef objsee_trace_file_h
+#define objsee_trace_file_h
+
+#include <CoreFoundation/CoreFoundation.h>
+
+/**
+  * On-disk format for recorded objsee traces.
+  * Events are written in chunks. Each chunk stores its columns separately: timestamps, thread ids, depths and
+  * method ids. Timestamps and depths are delta-encoded, every column is varint-packed, and then each column is
+  * compressed with LZFSE. Class and selector names are interned. Each chunk carries the names and methods first
+  * seen in it, so a file that was cut short can still be read up to its last complete chunk.
+  * Chunks also list the methods and threads they contain, and their time range. Queries use these lists
+  * to skip chunks without decompressing them.
+  * There is no image column. The tracer's lines name the class and selector but not the image that implements
+  * them, and the host can't resolve that after the fact
+ */
+
+typedef const char *(*objsee_trace_name_fn)(uint32_t name_id, void *context);
+
+typedef struct objsee_trace_writer objsee_trace_writer_t;
+
+/**
+  * @param resolve_name Returns the string for an interned id. Ids must be handed out sequentially starting at 1
+ */
+objsee_trace_writer_t *objsee_trace_writer_create(const char *path, objsee_trace_name_fn resolve_name, void *context);
+
+/**
+  * @return 0 on success, -1 if the chunk could not be written
+ */
+int objsee_trace_writer_append(objsee_trace_writer_t *writer, uint64_t timestamp_ns, uint16_t thread_id, uint16_t depth, uint32_t class_id, uint32_t selector_id, bool is_class_method);
+
+/**
+  * Flush the last chunk and close the file. The writer is freed either way
+  * @return 0 on success, -1 on failure
+ */
+int objsee_trace_writer_close(objsee_trace_writer_t *writer);
+
+typedef struct objsee_trace_reader objsee_trace_reader_t;
+
+typedef struct {
+    uint64_t timestamp_ns;
+    uint16_t thread_id;
+    uint16_t depth;
+    bool is_class_method;
+    const char *class_name;
+    const char *selector;
+} objsee_trace_event_t;
+
+typedef struct {
+    // NULL matches any class or selector
+    const char *class_name;
+    const char *selector;
+    // -1 matches both kinds, 0 only instance methods, 1 only class methods
+    int32_t method_kind;
+    // -1 matches any thread
+    int32_t thread_id;
+    // An end of 0 means no upper bound
+    uint64_t start_ns;
+    uint64_t end_ns;
+} objsee_trace_query_t;
+
+// Return false to stop the query
+typedef bool (*objsee_trace_visitor_t)(const objsee_trace_event_t *event, void *context);
+
+/**
+  * Map a trace file and index its chunks. Only chunk headers and dictionaries are read here
+ */
+objsee_trace_reader_t *objsee_trace_reader_open(const char *path);
+void objsee_trace_reader_close(objsee_trace_reader_t *reader);
+
+uint64_t objsee_trace_reader_event_count(const objsee_trace_reader_t *reader);
+
+/**
+  * Visit every event matching `query`, in file order. Chunks whose index rules them out are not decompressed
+  * @return The number of events visited, or -1 on a corrupt chunk
+ */
+int64_t objsee_trace_reader_query(objsee_trace_reader_t *reader, const objsee_trace_query_t *query, objsee_trace_visitor_t visitor, void *context);
+
+#endif /* objsee_trace_file_h */
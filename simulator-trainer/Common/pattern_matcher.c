@@ -0,0 +1,124 @@
+//
+//  pattern_matcher.c
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#include "pattern_matcher.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ALPHABET_SIZE 256
+
+struct pattern_matcher {
+    // transitions[state * ALPHABET_SIZE + byte]
+    uint32_t *transitions;
+    // Pattern ending at each state, or at one of its suffixes, -1 if none
+    int32_t *matches;
+    uint32_t state_count;
+};
+
+pattern_matcher_t *pattern_matcher_create(const char * const *patterns, size_t pattern_count) {
+    size_t max_states = 1;
+    for (size_t i = 0; i < pattern_count; i++) {
+        max_states += strlen(patterns[i]);
+    }
+
+    pattern_matcher_t *matcher = calloc(1, sizeof(pattern_matcher_t));
+    uint32_t *failure = calloc(max_states, sizeof(uint32_t));
+    uint32_t *queue = calloc(max_states, sizeof(uint32_t));
+    if (matcher) {
+        matcher->transitions = calloc(max_states * ALPHABET_SIZE, sizeof(uint32_t));
+        matcher->matches = malloc(max_states * sizeof(int32_t));
+    }
+
+    if (!matcher || !failure || !queue || !matcher->transitions || !matcher->matches) {
+        fprintf(stderr, "Failed to allocate pattern matcher with %zu states\n", max_states);
+        free(failure);
+        free(queue);
+        pattern_matcher_destroy(matcher);
+        return NULL;
+    }
+
+    // Trie of the patterns. 0 doubles as "no transition" since nothing goes back to the root
+    matcher->state_count = 1;
+    matcher->matches[0] = -1;
+    for (size_t i = 0; i < pattern_count; i++) {
+        uint32_t state = 0;
+        for (const unsigned char *p = (const unsigned char *)patterns[i]; *p; p++) {
+            uint32_t *next = &matcher->transitions[state * ALPHABET_SIZE + *p];
+            if (*next == 0) {
+                *next = matcher->state_count;
+                matcher->matches[matcher->state_count++] = -1;
+            }
+            state = *next;
+        }
+
+        // The earliest listed pattern wins when two are identical
+        if (matcher->matches[state] < 0) {
+            matcher->matches[state] = (int32_t)i;
+        }
+    }
+
+    // Breadth-first, fill in the missing transitions from each state's failure state to turn the trie into a DFA
+    size_t head = 0;
+    size_t tail = 0;
+    for (int byte = 0; byte < ALPHABET_SIZE; byte++) {
+        uint32_t next = matcher->transitions[byte];
+        if (next != 0) {
+            failure[next] = 0;
+            queue[tail++] = next;
+        }
+    }
+
+    while (head < tail) {
+        uint32_t state = queue[head++];
+        if (matcher->matches[state] < 0) {
+            matcher->matches[state] = matcher->matches[failure[state]];
+        }
+
+        for (int byte = 0; byte < ALPHABET_SIZE; byte++) {
+            uint32_t *next = &matcher->transitions[state * ALPHABET_SIZE + byte];
+            uint32_t fallback = matcher->transitions[failure[state] * ALPHABET_SIZE + byte];
+            if (*next == 0) {
+                *next = fallback;
+            }
+            else {
+                failure[*next] = fallback;
+                queue[tail++] = *next;
+            }
+        }
+    }
+
+    free(failure);
+    free(queue);
+    return matcher;
+}
+
+void pattern_matcher_destroy(pattern_matcher_t *matcher) {
+    if (!matcher) {
+        return;
+    }
+
+    free(matcher->transitions);
+    free(matcher->matches);
+    free(matcher);
+}
+
+void pattern_matcher_feed(const pattern_matcher_t *matcher, pattern_match_state_t *state, const char *bytes, size_t length) {
+    uint32_t current = state->state;
+    for (size_t i = 0; i < length && state->match < 0; i++) {
+        current = matcher->transitions[current * ALPHABET_SIZE + (unsigned char)bytes[i]];
+        state->match = matcher->matches[current];
+    }
+
+    state->state = current;
+}
+
+int32_t pattern_matcher_find(const pattern_matcher_t *matcher, const char *text) {
+    pattern_match_state_t state = PATTERN_MATCH_STATE_INIT;
+    pattern_matcher_feed(matcher, &state, text, strlen(text));
+    return state.match;
+}
@@ -0,0 +1,41 @@
+//
+//  pattern_matcher.h
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#ifndef pattern_matcher_h
+#define pattern_matcher_h
+
+#include <CoreFoundation/CoreFoundation.h>
+
+/**
+  * Aho-Corasick matcher over a fixed set of byte patterns, compiled once into a DFA.
+  * Matching walks each input byte once whatever the number of patterns, allocates nothing, and can be fed
+  * one piece of text at a time, so text split across several buffers never has to be joined first
+ */
+typedef struct pattern_matcher pattern_matcher_t;
+
+typedef struct {
+    uint32_t state;
+    // Index of the first pattern that matched, or -1
+    int32_t match;
+} pattern_match_state_t;
+
+#define PATTERN_MATCH_STATE_INIT ((pattern_match_state_t){.state = 0, .match = -1})
+
+pattern_matcher_t *pattern_matcher_create(const char * const *patterns, size_t pattern_count);
+void pattern_matcher_destroy(pattern_matcher_t *matcher);
+
+/**
+  * Continue matching with `length` more bytes. Stops early once a pattern has matched
+ */
+void pattern_matcher_feed(const pattern_matcher_t *matcher, pattern_match_state_t *state, const char *bytes, size_t length);
+
+/**
+  * @return The index of a pattern found in the NUL-terminated `text`, or -1
+ */
+int32_t pattern_matcher_find(const pattern_matcher_t *matcher, const char *text);
+
+#endif /* pattern_matcher_h */
@@ -0,0 +1,445 @@
+//
+//  process_runner.c
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#include "process_runner.h"
+#include <sys/event.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// How often the cancel flag is checked while nothing else is happening
+#define CANCEL_POLL_INTERVAL 0.05
+#define READ_CHUNK_SIZE 16384
+#define MAX_TRACKED_TOOLS 32
+
+extern char **environ;
+
+typedef struct {
+    int fd;
+    int stream;
+    bool capture;
+    char *data;
+    size_t length;
+    size_t capacity;
+    // Start of the line not yet passed to the line handler
+    size_t line_start;
+} process_stream_t;
+
+static pthread_once_t base_environment_once = PTHREAD_ONCE_INIT;
+static char **base_environment;
+static size_t base_environment_count;
+
+static pthread_mutex_t tool_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static process_tool_stats_t tool_stats[MAX_TRACKED_TOOLS];
+static size_t tool_stats_count;
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// This process's environment doesn't change after launch, so it's copied once instead of on every spawn
+static void capture_base_environment(void) {
+    size_t count = 0;
+    while (environ[count]) {
+        count++;
+    }
+
+    base_environment = calloc(count + 1, sizeof(char *));
+    if (!base_environment) {
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        base_environment[base_environment_count] = strdup(environ[i]);
+        if (base_environment[base_environment_count]) {
+            base_environment_count++;
+        }
+    }
+}
+
+static bool environment_keys_equal(const char *lhs, const char *rhs) {
+    size_t lhs_length = strcspn(lhs, "=");
+    return lhs_length == strcspn(rhs, "=") && strncmp(lhs, rhs, lhs_length) == 0;
+}
+
+/**
+  * The base environment with `overrides` applied, as an array of borrowed pointers. The caller frees only the array
+ */
+static char **build_environment(const char * const *overrides) {
+    pthread_once(&base_environment_once, capture_base_environment);
+
+    size_t override_count = 0;
+    while (overrides && overrides[override_count]) {
+        override_count++;
+    }
+
+    char **environment = calloc(base_environment_count + override_count + 1, sizeof(char *));
+    if (!environment) {
+        return NULL;
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < base_environment_count; i++) {
+        bool overridden = false;
+        for (size_t j = 0; j < override_count && !overridden; j++) {
+            overridden = environment_keys_equal(base_environment[i], overrides[j]);
+        }
+
+        if (!overridden) {
+            environment[count++] = base_environment[i];
+        }
+    }
+
+    for (size_t j = 0; j < override_count; j++) {
+        environment[count++] = (char *)overrides[j];
+    }
+
+    return environment;
+}
+
+static void tool_name_for_spawn(const process_spawn_options_t *options, char *name, size_t size) {
+    const char *slash = strrchr(options->path, '/');
+    const char *basename = slash ? slash + 1 : options->path;
+
+    // Everything run through xcrun would otherwise look like the same tool
+    const char *subcommand = options->argv[0] ? options->argv[1] : NULL;
+    if (strcmp(basename, "xcrun") == 0 && subcommand && subcommand[0] != '-') {
+        snprintf(name, size, "xcrun %s", subcommand);
+    }
+    else {
+        snprintf(name, size, "%s", basename);
+    }
+}
+
+static void record_tool_latency(const char *tool, uint64_t duration_ns) {
+    pthread_mutex_lock(&tool_stats_lock);
+    process_tool_stats_t *stats = NULL;
+    for (size_t i = 0; i < tool_stats_count && !stats; i++) {
+        if (strcmp(tool_stats[i].tool, tool) == 0) {
+            stats = &tool_stats[i];
+        }
+    }
+
+    if (!stats && tool_stats_count < MAX_TRACKED_TOOLS) {
+        stats = &tool_stats[tool_stats_count++];
+        snprintf(stats->tool, sizeof(stats->tool), "%s", tool);
+    }
+
+    if (stats) {
+        stats->runs++;
+        stats->total_ns += duration_ns;
+        if (duration_ns > stats->max_ns) {
+            stats->max_ns = duration_ns;
+        }
+    }
+    pthread_mutex_unlock(&tool_stats_lock);
+}
+
+size_t process_copy_tool_stats(process_tool_stats_t *stats, size_t capacity) {
+    pthread_mutex_lock(&tool_stats_lock);
+    size_t count = tool_stats_count < capacity ? tool_stats_count : capacity;
+    memcpy(stats, tool_stats, count * sizeof(process_tool_stats_t));
+    pthread_mutex_unlock(&tool_stats_lock);
+    return count;
+}
+
+static void deliver_lines(const process_spawn_options_t *options, process_stream_t *stream, bool at_end) {
+    if (!options->line_handler) {
+        return;
+    }
+
+    while (stream->line_start < stream->length) {
+        char *newline = memchr(stream->data + stream->line_start, '\n', stream->length - stream->line_start);
+        if (!newline) {
+            break;
+        }
+
+        size_t line_end = (size_t)(newline - stream->data);
+        options->line_handler(stream->stream, stream->data + stream->line_start, line_end - stream->line_start, options->line_handler_ctx);
+        stream->line_start = line_end + 1;
+    }
+
+    if (at_end && stream->line_start < stream->length) {
+        options->line_handler(stream->stream, stream->data + stream->line_start, stream->length - stream->line_start, options->line_handler_ctx);
+        stream->line_start = stream->length;
+    }
+
+    if (!stream->capture && stream->line_start > 0) {
+        // Only the unfinished line needs to be kept
+        memmove(stream->data, stream->data + stream->line_start, stream->length - stream->line_start);
+        stream->length -= stream->line_start;
+        stream->line_start = 0;
+    }
+}
+
+/**
+  * Read what's available without blocking. Returns false once the stream reached EOF or failed
+ */
+static bool drain_stream(const process_spawn_options_t *options, process_stream_t *stream) {
+    bool keep = stream->capture || options->line_handler;
+    for (;;) {
+        if (keep && stream->capacity - stream->length < READ_CHUNK_SIZE + 1) {
+            size_t new_capacity = stream->capacity ? stream->capacity * 2 : READ_CHUNK_SIZE * 4;
+            while (new_capacity - stream->length < READ_CHUNK_SIZE + 1) {
+                new_capacity *= 2;
+            }
+
+            char *data = realloc(stream->data, new_capacity);
+            if (!data) {
+                fprintf(stderr, "Failed to grow output buffer to %zu bytes\n", new_capacity);
+                return false;
+            }
+            stream->data = data;
+            stream->capacity = new_capacity;
+        }
+
+        char discard[READ_CHUNK_SIZE];
+        char *destination = keep ? stream->data + stream->length : discard;
+        ssize_t bytes_read = read(stream->fd, destination, READ_CHUNK_SIZE);
+        if (bytes_read > 0) {
+            if (keep) {
+                stream->length += (size_t)bytes_read;
+                deliver_lines(options, stream, false);
+            }
+            continue;
+        }
+
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (bytes_read < 0 && errno == EAGAIN) {
+            return true;
+        }
+
+        if (keep) {
+            deliver_lines(options, stream, true);
+        }
+        return false;
+    }
+}
+
+static int spawn_process(const process_spawn_options_t *options, int stdout_fd, int stderr_fd, pid_t *pid_out) {
+    posix_spawn_file_actions_t file_actions;
+    posix_spawn_file_actions_init(&file_actions);
+    posix_spawn_file_actions_addopen(&file_actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&file_actions, stdout_fd, STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&file_actions, stderr_fd, STDERR_FILENO);
+    if (options->cwd) {
+        posix_spawn_file_actions_addchdir_np(&file_actions, options->cwd);
+    }
+
+    // The child starts with default signal handling and only the three standard descriptors, whatever this process has open
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    sigset_t signals;
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attributes, &signals);
+    sigfillset(&signals);
+    posix_spawnattr_setsigdefault(&attributes, &signals);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_CLOEXEC_DEFAULT);
+
+    int result = -1;
+    char **environment = build_environment(options->environment);
+    if (!environment) {
+        errno = ENOMEM;
+    }
+    else {
+        int spawn_error = posix_spawn(pid_out, options->path, &file_actions, &attributes, (char * const *)options->argv, environment);
+        if (spawn_error != 0) {
+            errno = spawn_error;
+        }
+        else {
+            result = 0;
+        }
+    }
+
+    free(environment);
+    posix_spawnattr_destroy(&attributes);
+    posix_spawn_file_actions_destroy(&file_actions);
+    return result;
+}
+
+int process_run(const process_spawn_options_t *options, process_result_t *result) {
+    memset(result, 0, sizeof(process_result_t));
+    result->pid = -1;
+
+    int stdout_pipe[2] = {-1, -1};
+    int stderr_pipe[2] = {-1, -1};
+    int kq = -1;
+    if (pipe(stdout_pipe) != 0 || pipe(stderr_pipe) != 0 || (kq = kqueue()) < 0) {
+        int saved_errno = errno;
+        fprintf(stderr, "Failed to set up output pipes for %s: %s\n", options->path, strerror(errno));
+        for (int i = 0; i < 2; i++) {
+            if (stdout_pipe[i] >= 0) {
+                close(stdout_pipe[i]);
+            }
+            if (stderr_pipe[i] >= 0) {
+                close(stderr_pipe[i]);
+            }
+        }
+        errno = saved_errno;
+        return -1;
+    }
+
+    uint64_t start_ns = monotonic_ns();
+    pid_t pid = -1;
+    int spawn_result = spawn_process(options, stdout_pipe[1], stderr_pipe[1], &pid);
+    int spawn_errno = errno;
+    close(stdout_pipe[1]);
+    close(stderr_pipe[1]);
+    if (spawn_result != 0) {
+        fprintf(stderr, "Failed to spawn %s: %s\n", options->path, strerror(spawn_errno));
+        close(stdout_pipe[0]);
+        close(stderr_pipe[0]);
+        close(kq);
+        errno = spawn_errno;
+        return -1;
+    }
+
+    result->pid = pid;
+    process_stream_t streams[2] = {
+        {.fd = stdout_pipe[0], .stream = PROCESS_STREAM_STDOUT, .capture = options->capture_stdout},
+        {.fd = stderr_pipe[0], .stream = PROCESS_STREAM_STDERR, .capture = options->capture_stderr},
+    };
+
+    struct kevent changes[3];
+    for (int i = 0; i < 2; i++) {
+        fcntl(streams[i].fd, F_SETFL, fcntl(streams[i].fd, F_GETFL) | O_NONBLOCK);
+        EV_SET(&changes[i], streams[i].fd, EVFILT_READ, EV_ADD, 0, 0, &streams[i]);
+    }
+    EV_SET(&changes[2], pid, EVFILT_PROC, EV_ADD | EV_ONESHOT, NOTE_EXIT, 0, NULL);
+
+    bool exited = false;
+    if (kevent(kq, changes, 3, NULL, 0, NULL) < 0) {
+        // ESRCH when the process is already gone, before it could be watched
+        exited = errno == ESRCH;
+        if (!exited) {
+            fprintf(stderr, "Failed to watch %s (%d): %s\n", options->path, pid, strerror(errno));
+            kill(pid, SIGKILL);
+            exited = true;
+        }
+    }
+
+    uint64_t deadline_ns = options->timeout_seconds > 0 ? start_ns + (uint64_t)(options->timeout_seconds * 1e9) : 0;
+    bool open_streams[2] = {true, true};
+    bool killed = false;
+    while (!exited) {
+        double wait = -1;
+        if (!killed && deadline_ns) {
+            uint64_t now_ns = monotonic_ns();
+            wait = now_ns >= deadline_ns ? 0 : (double)(deadline_ns - now_ns) / 1e9;
+        }
+        if (!killed && options->cancel && (wait < 0 || wait > CANCEL_POLL_INTERVAL)) {
+            wait = CANCEL_POLL_INTERVAL;
+        }
+
+        struct timespec timeout = {(time_t)wait, (long)((wait - (double)(time_t)wait) * 1e9)};
+        struct kevent events[3];
+        int event_count = kevent(kq, NULL, 0, events, 3, wait >= 0 ? &timeout : NULL);
+        if (event_count < 0 && errno != EINTR) {
+            fprintf(stderr, "kevent failed while waiting for %s: %s\n", options->path, strerror(errno));
+            kill(pid, SIGKILL);
+            break;
+        }
+
+        for (int i = 0; i < event_count; i++) {
+            if (events[i].filter == EVFILT_PROC) {
+                exited = true;
+            }
+            else if (events[i].filter == EVFILT_READ) {
+                process_stream_t *stream = events[i].udata;
+                int index = (int)(stream - streams);
+                if (open_streams[index] && !drain_stream(options, stream)) {
+                    // Closing the descriptor also removes it from the kqueue
+                    open_streams[index] = false;
+                    close(stream->fd);
+                }
+            }
+        }
+
+        if (killed || exited) {
+            continue;
+        }
+
+        if (deadline_ns && monotonic_ns() >= deadline_ns) {
+            fprintf(stderr, "%s (%d) timed out after %.1fs\n", options->path, pid, options->timeout_seconds);
+            result->timed_out = true;
+        }
+        else if (options->cancel && atomic_load_explicit(options->cancel, memory_order_relaxed)) {
+            result->cancelled = true;
+        }
+
+        if (result->timed_out || result->cancelled) {
+            kill(pid, SIGKILL);
+            killed = true;
+        }
+    }
+
+    // Whatever the process wrote before exiting is still in the pipes. Don't wait for EOF, since anything the process
+    // left running in the background may hold the pipes open
+    for (int i = 0; i < 2; i++) {
+        if (open_streams[i]) {
+            if (drain_stream(options, &streams[i]) && (streams[i].capture || options->line_handler)) {
+                deliver_lines(options, &streams[i], true);
+            }
+            close(streams[i].fd);
+        }
+    }
+    close(kq);
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+
+    result->duration_ns = monotonic_ns() - start_ns;
+    result->exit_status = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+
+    for (int i = 0; i < 2; i++) {
+        char *data = NULL;
+        if (streams[i].capture) {
+            data = streams[i].data ? streams[i].data : calloc(1, 1);
+            if (data) {
+                data[streams[i].length] = '\0';
+            }
+        }
+        else {
+            free(streams[i].data);
+        }
+
+        if (i == 0) {
+            result->stdout_data = data;
+            result->stdout_length = data ? streams[i].length : 0;
+        }
+        else {
+            result->stderr_data = data;
+            result->stderr_length = data ? streams[i].length : 0;
+        }
+    }
+
+    char tool[sizeof(tool_stats[0].tool)];
+    tool_name_for_spawn(options, tool, sizeof(tool));
+    record_tool_latency(tool, result->duration_ns);
+    return 0;
+}
+
+void process_result_free(process_result_t *result) {
+    free(result->stdout_data);
+    free(result->stderr_data);
+    result->stdout_data = NULL;
+    result->stderr_data = NULL;
+}
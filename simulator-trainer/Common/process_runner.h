@@ -0,0 +1,80 @@
+//
+//  process_runner.h
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#ifndef process_runner_h
+#define process_runner_h
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define PROCESS_STREAM_STDOUT 1
+#define PROCESS_STREAM_STDERR 2
+
+/**
+  * Called with each line the process writes, without its newline. The last line of a stream is passed
+  * even if it doesn't end in a newline. `line` is only valid during the call
+ */
+typedef void (*process_line_fn)(int stream, const char *line, size_t length, void *ctx);
+
+typedef struct {
+    const char *path;
+    // NULL-terminated, starting with argv[0]
+    const char * const *argv;
+    // NULL-terminated "KEY=VALUE" entries added to, or replacing, this process's environment. May be NULL
+    const char * const *environment;
+    // May be NULL
+    const char *cwd;
+    // The process is killed after this many seconds. 0 for no limit
+    double timeout_seconds;
+    // The process is killed soon after this becomes true. May be NULL
+    const atomic_bool *cancel;
+    // Keep the output in the result. Streams that aren't captured and have no line handler are discarded
+    bool capture_stdout;
+    bool capture_stderr;
+    process_line_fn line_handler;
+    void *line_handler_ctx;
+} process_spawn_options_t;
+
+typedef struct {
+    pid_t pid;
+    // The exit code, or 128 + the signal that killed the process
+    int exit_status;
+    bool timed_out;
+    bool cancelled;
+    // NUL-terminated, malloc'd, NULL if the stream wasn't captured
+    char *stdout_data;
+    size_t stdout_length;
+    char *stderr_data;
+    size_t stderr_length;
+    // From spawn to exit
+    uint64_t duration_ns;
+} process_result_t;
+
+typedef struct {
+    // "lipo", or "xcrun lipo" for tools run through xcrun
+    char tool[48];
+    uint64_t runs;
+    uint64_t total_ns;
+    uint64_t max_ns;
+} process_tool_stats_t;
+
+/**
+  * Spawn a process and wait for it to exit, reading stdout and stderr as they are written so the process never
+  * blocks on a full pipe. Returns 0 once the process has exited (check `result->exit_status`), or -1 with errno
+  * set if it couldn't be started. Free the result with process_result_free()
+ */
+int process_run(const process_spawn_options_t *options, process_result_t *result);
+void process_result_free(process_result_t *result);
+
+/**
+  * Copy up to `capacity` entries of spawn-to-exit latency per tool. Returns the number of entries copied
+ */
+size_t process_copy_tool_stats(process_tool_stats_t *stats, size_t capacity);
+
+#endif /* process_runner_h */
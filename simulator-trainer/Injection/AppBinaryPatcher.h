@@ -12,7 +12,23 @@ NS_ASSUME_NONNULL_BEGIN
 @interface AppBinaryPatcher : NSObject
 
 + (void)injectDylib:(NSString *)dylibPath intoBinary:(NSString *)binaryPath usingOptoolAtPath:(NSString *)optoolPath completion:(void (^ _Nullable)(BOOL success, NSError * _Nullable error))completion;
+
+/**
+  * Inspect the binary's load commands, rather than anything on disk around it, to tell whether `dylibPath` is already injected
+ */
++ (BOOL)binary:(NSString *)binaryPath loadsDylib:(NSString *)dylibPath;
+
+/**
+  * Add an LC_LOAD_DYLIB without re-signing. Uses optool only if the command can't be written in place
+ */
++ (BOOL)addLoadCommandForDylib:(NSString *)dylibPath toBinary:(NSString *)binaryPath usingOptoolAtPath:(nullable NSString *)optoolPath error:(NSError **)error;
+
 + (void)codesignItemAtPath:(NSString *)path completion:(void (^)(BOOL, NSError * _Nullable))completion;
+
+/**
+  * `codesign -v`, which fails if the binary was changed after it was signed
+ */
++ (BOOL)hasValidSignatureAtPath:(NSString *)path;
 + (void)thinBinaryAtPath:(NSString *)binaryPath;
 + (BOOL)isBinaryArm64SimulatorCompatible:(NSString *)binaryPath;
 
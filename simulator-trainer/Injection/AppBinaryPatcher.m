@@ -7,10 +7,55 @@
 
 #import "AppBinaryPatcher.h"
 #import "CommandRunner.h"
+#import "load_command_injection.h"
 
 @implementation AppBinaryPatcher
 
 + (void)injectDylib:(NSString *)dylibPath intoBinary:(NSString *)binaryPath usingOptoolAtPath:(NSString *)optoolPath completion:(void (^ _Nullable)(BOOL success, NSError * _Nullable error))completion {
+    if ([AppBinaryPatcher binary:binaryPath loadsDylib:dylibPath]) {
+        // Already injected by an earlier run. That run may not have got as far as signing, or the binary changed since
+        if ([AppBinaryPatcher hasValidSignatureAtPath:binaryPath]) {
+            if (completion) {
+                completion(YES, nil);
+            }
+        }
+        else {
+            [AppBinaryPatcher codesignItemAtPath:binaryPath completion:completion];
+        }
+        
+        return;
+    }
+    
+    NSError *injectError = nil;
+    if (![AppBinaryPatcher addLoadCommandForDylib:dylibPath toBinary:binaryPath usingOptoolAtPath:optoolPath error:&injectError]) {
+        if (completion) {
+            completion(NO, injectError);
+        }
+        
+        return;
+    }
+    
+    [AppBinaryPatcher codesignItemAtPath:binaryPath completion:completion];
+}
+
++ (BOOL)binary:(NSString *)binaryPath loadsDylib:(NSString *)dylibPath {
+    return macho_loads_dylib(binaryPath.fileSystemRepresentation, dylibPath.fileSystemRepresentation) == 1;
+}
+
++ (BOOL)addLoadCommandForDylib:(NSString *)dylibPath toBinary:(NSString *)binaryPath usingOptoolAtPath:(NSString *)optoolPath error:(NSError **)error {
+    // Written in place when the binary has room after its load commands, which avoids lipo and optool entirely
+    if (macho_insert_load_dylib(binaryPath.fileSystemRepresentation, dylibPath.fileSystemRepresentation) >= 0) {
+        return YES;
+    }
+    
+    if (!optoolPath) {
+        if (error) {
+            *error = [NSError errorWithDomain:@"AppBinaryPatcher" code:3 userInfo:@{NSLocalizedDescriptionKey: [NSString stringWithFormat:@"Failed to add a load command for %@ to %@", dylibPath, binaryPath]}];
+        }
+        return NO;
+    }
+    
+    NSLog(@"Falling back to optool to inject %@ into %@", dylibPath, binaryPath);
     [AppBinaryPatcher thinBinaryAtPath:binaryPath];
 
     NSArray *arguments = @[
@@ -24,14 +69,13 @@
     NSError *optoolError = nil;
     if ([CommandRunner runCommand:optoolPath withArguments:arguments stdoutString:&optoolOutput error:&optoolError] == NO) {
         NSLog(@"optool error: %@", optoolError);
-        if (completion) {
-            completion(NO, optoolError);
+        if (error) {
+            *error = optoolError;
         }
-        
-        return;
+        return NO;
     }
     
-    [AppBinaryPatcher codesignItemAtPath:binaryPath completion:completion];
+    return YES;
 }
 
 + (void)thinBinaryAtPath:(NSString *)binaryPath {
@@ -48,19 +92,14 @@
 }
 
 + (void)codesignItemAtPath:(NSString *)path completion:(void (^)(BOOL, NSError * _Nullable))completion {
-    NSTask *codesignTask = [[NSTask alloc] init];
-    codesignTask.launchPath = @"/usr/bin/codesign";
-    codesignTask.arguments = @[@"-f", @"-s", @"-", @"--generate-entitlement-der", path];
-
-    NSPipe *pipe = [NSPipe pipe];
-    codesignTask.standardOutput = pipe;
-    codesignTask.standardError = pipe;
+    // codesign reports problems on stderr, but both streams go into the error like before
+    NSMutableArray<NSString *> *outputLines = [NSMutableArray array];
+    BOOL succeeded = [CommandRunner runCommand:@"/usr/bin/codesign" withArguments:@[@"-f", @"-s", @"-", @"--generate-entitlement-der", path] cwd:nil environment:nil timeout:0 cancellationToken:nil lineHandler:^(NSString *line, BOOL isStderr) {
+        [outputLines addObject:line];
+    } stdoutString:nil error:nil];
 
-    [codesignTask launch];
-    [codesignTask waitUntilExit];
-
-    NSString *output = [[NSString alloc] initWithData:[[pipe fileHandleForReading] readDataToEndOfFile] encoding:NSUTF8StringEncoding];
-    if (codesignTask.terminationStatus == 0) {
+    NSString *output = [outputLines componentsJoinedByString:@"\n"];
+    if (succeeded) {
         if (completion) {
             completion(YES, nil);
         }
@@ -73,6 +112,10 @@
     }
 }
 
++ (BOOL)hasValidSignatureAtPath:(NSString *)path {
+    return [CommandRunner runCommand:@"/usr/bin/codesign" withArguments:@[@"-v", path] stdoutString:nil error:nil];
+}
+
 + (BOOL)isBinaryArm64SimulatorCompatible:(NSString *)binaryPath {
     NSString *otoolOutput = [CommandRunner xcrunInvokeAndWait:@[@"otool", @"-l", binaryPath]];
     NSString *lipoOutput = [CommandRunner xcrunInvokeAndWait:@[@"lipo", @"-info", binaryPath]];
@@ -0,0 +1,423 @@
+//
+//  bootstrap_image.c
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#include "bootstrap_image.h"
+#include <CommonCrypto/CommonDigest.h>
+#include <copyfile.h>
+#include <dispatch/dispatch.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/clonefile.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Must match build_bootstrap_image.py
+#define BOOTSTRAP_MANIFEST_MAGIC "SBIM"
+#define BOOTSTRAP_MANIFEST_VERSION 1
+
+// Must match OVERLAY_STORE_PREFIX in tmpfs_overlay.c
+#define BOOTSTRAP_OVERLAY_STORE_PREFIX "/var/jb/overlays"
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t entry_count;
+    uint32_t strings_offset;
+    uint32_t strings_size;
+    uint32_t reserved;
+} bootstrap_manifest_header_t;
+
+typedef struct {
+    uint8_t sha256[CC_SHA256_DIGEST_LENGTH];
+    uint64_t size;
+    uint32_t mode;
+    uint32_t path_offset;
+} bootstrap_manifest_entry_t;
+
+_Static_assert(sizeof(bootstrap_manifest_header_t) == 24, "manifest header layout");
+_Static_assert(sizeof(bootstrap_manifest_entry_t) == 48, "manifest entry layout");
+
+struct bootstrap_image {
+    char objects_path[PATH_MAX];
+    const uint8_t *manifest;
+    size_t manifest_size;
+    const bootstrap_manifest_header_t *header;
+    const bootstrap_manifest_entry_t *entries;
+    const char *strings;
+};
+
+typedef enum {
+    PLACE_UNCHANGED,
+    PLACE_CLONED,
+    PLACE_COPIED,
+    PLACE_FAILED,
+} place_result_t;
+
+// Where the runtime root and its overlay store really are, with links resolved
+typedef struct {
+    char runtime_root[PATH_MAX];
+    char store_root[PATH_MAX];
+} deploy_roots_t;
+
+bootstrap_image_t *bootstrap_image_open(const char *image_path) {
+    if (image_path == NULL) {
+        return NULL;
+    }
+    
+    char manifest_path[PATH_MAX];
+    snprintf(manifest_path, sizeof(manifest_path), "%s/manifest", image_path);
+    int fd = open(manifest_path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot open bootstrap manifest '%s': %s\n", manifest_path, strerror(errno));
+        return NULL;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(bootstrap_manifest_header_t)) {
+        close(fd);
+        return NULL;
+    }
+    
+    void *manifest = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (manifest == MAP_FAILED) {
+        return NULL;
+    }
+    
+    const bootstrap_manifest_header_t *header = manifest;
+    uint64_t entries_end = sizeof(*header) + (uint64_t)header->entry_count * sizeof(bootstrap_manifest_entry_t);
+    bool valid = memcmp(header->magic, BOOTSTRAP_MANIFEST_MAGIC, 4) == 0 && header->version == BOOTSTRAP_MANIFEST_VERSION &&
+                 entries_end <= header->strings_offset && (uint64_t)header->strings_offset + header->strings_size <= (uint64_t)st.st_size &&
+                 (header->strings_size == 0 || ((const char *)manifest)[header->strings_offset + header->strings_size - 1] == '\0');
+    if (!valid) {
+        fprintf(stderr, "Malformed bootstrap manifest '%s'\n", manifest_path);
+        munmap(manifest, (size_t)st.st_size);
+        return NULL;
+    }
+    
+    bootstrap_image_t *image = calloc(1, sizeof(bootstrap_image_t));
+    if (image == NULL) {
+        munmap(manifest, (size_t)st.st_size);
+        return NULL;
+    }
+    
+    snprintf(image->objects_path, sizeof(image->objects_path), "%s/objects", image_path);
+    image->manifest = manifest;
+    image->manifest_size = (size_t)st.st_size;
+    image->header = header;
+    image->entries = (const bootstrap_manifest_entry_t *)(header + 1);
+    image->strings = (const char *)manifest + header->strings_offset;
+    return image;
+}
+
+void bootstrap_image_close(bootstrap_image_t *image) {
+    if (image == NULL) {
+        return;
+    }
+    
+    munmap((void *)image->manifest, image->manifest_size);
+    free(image);
+}
+
+int bootstrap_image_entry_count(const bootstrap_image_t *image) {
+    return image ? (int)image->header->entry_count : 0;
+}
+
+static bool destination_path_is_safe(const char *relative_path) {
+    // The helper runs as root, so nothing in the manifest may point outside the runtime
+    if (relative_path[0] == '\0' || relative_path[0] == '/') {
+        return false;
+    }
+    
+    const char *p = relative_path;
+    while (p != NULL) {
+        if (strncmp(p, "..", 2) == 0 && (p[2] == '/' || p[2] == '\0')) {
+            return false;
+        }
+        
+        p = strchr(p, '/');
+        if (p != NULL) {
+            p++;
+        }
+    }
+    
+    return true;
+}
+
+static bool file_matches_digest(int dir_fd, const char *name, const bootstrap_manifest_entry_t *entry) {
+    int fd = openat(dir_fd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    
+    // Size mismatches are by far the common case for stale files, and don't need hashing
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (uint64_t)st.st_size != entry->size) {
+        close(fd);
+        return false;
+    }
+    
+    uint8_t digest[CC_SHA256_DIGEST_LENGTH];
+    if (entry->size == 0) {
+        CC_SHA256("", 0, digest);
+    }
+    else {
+        void *contents = mmap(NULL, (size_t)entry->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (contents == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        
+        CC_SHA256(contents, (CC_LONG)entry->size, digest);
+        munmap(contents, (size_t)entry->size);
+    }
+    close(fd);
+    
+    return memcmp(digest, entry->sha256, sizeof(digest)) == 0;
+}
+
+static bool path_is_within(const char *path, const char *root) {
+    size_t root_len = strlen(root);
+    return strncmp(path, root, root_len) == 0 && (path[root_len] == '\0' || path[root_len] == '/');
+}
+
+/**
+  * Whether the directory open at `fd` really is under the runtime root, or under that root's overlay store. Overlays
+  * link their contents into the store, so bootstrap directories inside an overlay legitimately resolve there
+ */
+static bool directory_is_allowed(int fd, const deploy_roots_t *roots) {
+    char path[PATH_MAX];
+    if (fcntl(fd, F_GETPATH, path) != 0) {
+        return false;
+    }
+    
+    return path_is_within(path, roots->runtime_root) || (roots->store_root[0] != '\0' && path_is_within(path, roots->store_root));
+}
+
+/**
+  * Open the directory that `relative_path` goes in, creating missing directories on the way. Every component is opened
+  * relative to the one before it and checked after opening, so a link planted anywhere along the path can't send root's
+  * writes outside the runtime. New directories take their parent's permission bits
+  * @return The parent directory's fd, or -1
+ */
+static int open_parent_directory(const deploy_roots_t *roots, const char *relative_path) {
+    int dir_fd = open(roots->runtime_root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0) {
+        fprintf(stderr, "Cannot open runtime root '%s': %s\n", roots->runtime_root, strerror(errno));
+        return -1;
+    }
+    
+    char components[PATH_MAX];
+    strlcpy(components, relative_path, sizeof(components));
+    char *last_slash = strrchr(components, '/');
+    if (last_slash == NULL) {
+        return dir_fd;
+    }
+    *last_slash = '\0';
+    
+    char *cursor = components;
+    char *component = NULL;
+    while ((component = strsep(&cursor, "/")) != NULL) {
+        if (component[0] == '\0' || strcmp(component, ".") == 0) {
+            continue;
+        }
+        
+        int next_fd = openat(dir_fd, component, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (next_fd < 0 && errno == ENOENT) {
+            struct stat parent_st;
+            bool made = fstat(dir_fd, &parent_st) == 0 && mkdirat(dir_fd, component, parent_st.st_mode & 0777) == 0;
+            if (!made && errno != EEXIST) {
+                fprintf(stderr, "Cannot create '%s' under '%s': %s\n", component, roots->runtime_root, strerror(errno));
+                close(dir_fd);
+                return -1;
+            }
+            
+            next_fd = openat(dir_fd, component, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (next_fd >= 0 && made) {
+                // mkdir's mode is masked by the umask
+                fchmod(next_fd, parent_st.st_mode & 0777);
+            }
+        }
+        
+        if (next_fd < 0) {
+            fprintf(stderr, "Cannot open '%s' on the way to '%s': %s\n", component, relative_path, strerror(errno));
+            close(dir_fd);
+            return -1;
+        }
+        close(dir_fd);
+        dir_fd = next_fd;
+        
+        if (!directory_is_allowed(dir_fd, roots)) {
+            fprintf(stderr, "Refusing bootstrap entry '%s': '%s' resolves outside the runtime root\n", relative_path, component);
+            close(dir_fd);
+            return -1;
+        }
+    }
+    
+    return dir_fd;
+}
+
+static place_result_t place_entry(const bootstrap_image_t *image, const bootstrap_manifest_entry_t *entry, const deploy_roots_t *roots) {
+    const char *relative_path = image->strings + entry->path_offset;
+    if (entry->path_offset >= image->header->strings_size || !destination_path_is_safe(relative_path)) {
+        fprintf(stderr, "Refusing bootstrap entry with unsafe path '%s'\n", relative_path);
+        return PLACE_FAILED;
+    }
+    
+    const char *name = strrchr(relative_path, '/');
+    name = name ? name + 1 : relative_path;
+    char staging[NAME_MAX + 1];
+    char object_path[PATH_MAX];
+    if (name[0] == '\0' || snprintf(staging, sizeof(staging), "%s.bootstrap-%d", name, getpid()) >= (int)sizeof(staging)) {
+        fprintf(stderr, "Refusing bootstrap entry with unusable name '%s'\n", relative_path);
+        return PLACE_FAILED;
+    }
+    
+    int written = snprintf(object_path, sizeof(object_path), "%s/", image->objects_path);
+    for (size_t i = 0; i < CC_SHA256_DIGEST_LENGTH && written < (int)sizeof(object_path) - 2; i++) {
+        written += snprintf(object_path + written, sizeof(object_path) - written, "%02x", entry->sha256[i]);
+    }
+    
+    int dir_fd = open_parent_directory(roots, relative_path);
+    if (dir_fd < 0) {
+        return PLACE_FAILED;
+    }
+    
+    if (file_matches_digest(dir_fd, name, entry)) {
+        close(dir_fd);
+        return PLACE_UNCHANGED;
+    }
+    
+    // Objects are already signed, so a clone is the finished file. Overlays are a different filesystem from the app
+    // bundle though, and then only a copy works. Never a hard link: the runtime's copy would share its inode, and its
+    // mode, with the object in the app bundle, and anything later written to it in place would change the bundle too
+    place_result_t result = PLACE_FAILED;
+    unlinkat(dir_fd, staging, 0);
+    if (clonefileat(AT_FDCWD, object_path, dir_fd, staging, CLONE_NOFOLLOW) == 0) {
+        result = PLACE_CLONED;
+    }
+    else {
+        int object_fd = open(object_path, O_RDONLY | O_CLOEXEC);
+        int staging_fd = openat(dir_fd, staging, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+        if (object_fd >= 0 && staging_fd >= 0 && fcopyfile(object_fd, staging_fd, NULL, COPYFILE_DATA | COPYFILE_XATTR) == 0) {
+            result = PLACE_COPIED;
+        }
+        else {
+            fprintf(stderr, "Cannot place '%s' from '%s': %s\n", relative_path, object_path, strerror(errno));
+            if (staging_fd >= 0) {
+                unlinkat(dir_fd, staging, 0);
+            }
+        }
+        
+        if (object_fd >= 0) {
+            close(object_fd);
+        }
+        if (staging_fd >= 0) {
+            close(staging_fd);
+        }
+        
+        if (result == PLACE_FAILED) {
+            close(dir_fd);
+            return PLACE_FAILED;
+        }
+    }
+    
+    fchmodat(dir_fd, staging, (mode_t)(entry->mode & 0777), AT_SYMLINK_NOFOLLOW);
+    
+    if (renameat(dir_fd, staging, dir_fd, name) != 0) {
+        fprintf(stderr, "Cannot move '%s' into place: %s\n", relative_path, strerror(errno));
+        unlinkat(dir_fd, staging, 0);
+        close(dir_fd);
+        return PLACE_FAILED;
+    }
+    
+    close(dir_fd);
+    return result;
+}
+
+typedef struct {
+    const bootstrap_image_t *image;
+    const deploy_roots_t *roots;
+    place_result_t *results;
+} deploy_context_t;
+
+static void place_entry_at_index(void *context, size_t index) {
+    deploy_context_t *deploy = (deploy_context_t *)context;
+    deploy->results[index] = place_entry(deploy->image, &deploy->image->entries[index], deploy->roots);
+}
+
+int bootstrap_image_deploy(const bootstrap_image_t *image, const char *runtime_root, bootstrap_deploy_stats_t *stats_out) {
+    if (image == NULL || runtime_root == NULL) {
+        return -1;
+    }
+    
+    bootstrap_deploy_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    uint64_t start = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    
+    deploy_roots_t roots;
+    if (realpath(runtime_root, roots.runtime_root) == NULL) {
+        fprintf(stderr, "Cannot resolve runtime root '%s': %s\n", runtime_root, strerror(errno));
+        return -1;
+    }
+    
+    // The overlay config names the store after the runtime root as given, and the store prefix itself goes through /var
+    char store_root[PATH_MAX];
+    snprintf(store_root, sizeof(store_root), "%s%s", BOOTSTRAP_OVERLAY_STORE_PREFIX, runtime_root);
+    if (realpath(store_root, roots.store_root) == NULL) {
+        roots.store_root[0] = '\0';
+    }
+    
+    stats.entries = (int)image->header->entry_count;
+    place_result_t *results = calloc(stats.entries > 0 ? stats.entries : 1, sizeof(place_result_t));
+    if (results == NULL) {
+        return -1;
+    }
+    
+    // Every entry has its own destination, so they are hashed and placed concurrently. Parent directories
+    // shared between entries tolerate being created by more than one of them
+    deploy_context_t deploy = {
+        .image = image,
+        .roots = &roots,
+        .results = results,
+    };
+    dispatch_apply_f(image->header->entry_count, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), &deploy, place_entry_at_index);
+    
+    for (uint32_t i = 0; i < image->header->entry_count; i++) {
+        switch (results[i]) {
+            case PLACE_UNCHANGED:
+                stats.unchanged++;
+                continue;
+            case PLACE_CLONED:
+                stats.cloned++;
+                break;
+            case PLACE_COPIED:
+                stats.copied++;
+                break;
+            case PLACE_FAILED:
+                stats.failed++;
+                continue;
+        }
+        
+        stats.bytes_placed += image->entries[i].size;
+    }
+    free(results);
+    
+    stats.total_ns = clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - start;
+    if (stats_out) {
+        *stats_out = stats;
+    }
+    
+    return stats.failed == 0 ? 0 : -1;
+}
@@ -0,0 +1,46 @@
+//
+//  bootstrap_image.h
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#ifndef bootstrap_image_h
+#define bootstrap_image_h
+
+#include <CoreFoundation/CoreFoundation.h>
+
+typedef struct bootstrap_image bootstrap_image_t;
+
+typedef struct {
+    int entries;
+    // Destination already had the same contents
+    int unchanged;
+    int cloned;
+    int copied;
+    int failed;
+    uint64_t bytes_placed;
+    uint64_t total_ns;
+} bootstrap_deploy_stats_t;
+
+/**
+  * Map the manifest of an image built by build_bootstrap_image.py
+  * @param image_path The .image directory, containing `manifest` and `objects/`
+  * @return NULL if the image is missing or its manifest is malformed
+ */
+bootstrap_image_t *bootstrap_image_open(const char *image_path);
+void bootstrap_image_close(bootstrap_image_t *image);
+
+int bootstrap_image_entry_count(const bootstrap_image_t *image);
+
+/**
+  * Place every file in the image under `runtime_root`, several at a time. Destinations whose contents already hash the same are left alone,
+  * everything else is cloned or, across filesystems, copied from the image's objects and renamed into place
+  * Destination directories are opened one component at a time and have to stay inside `runtime_root` or its overlay store,
+  * so links inside the runtime can't redirect the writes
+  * @param stats_out Optional, receives what was done for each entry
+  * @return 0 if every entry is in place
+ */
+int bootstrap_image_deploy(const bootstrap_image_t *image, const char *runtime_root, bootstrap_deploy_stats_t *stats_out);
+
+#endif /* bootstrap_image_h */
@@ -0,0 +1,465 @@
+//
+//  fs_walk.c
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#include "fs_walk.h"
+#include <dispatch/dispatch.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct {
+    DIR *dir;
+    int fd;
+    int parent_fd;
+    int depth;
+    // Offsets into the shared relpath buffer, which may move when it grows
+    size_t relpath_len;
+    size_t own_relpath_len;
+    size_t name_offset;
+    void *parent_ctx;
+    void *ctx;
+} walk_frame_t;
+
+typedef struct {
+    fs_walk_visitor_t visitor;
+    void *info;
+    int max_depth;
+    atomic_bool *stopped;
+
+    char *relpath;
+    size_t relpath_capacity;
+
+    walk_frame_t *frames;
+    int frame_count;
+    int frame_capacity;
+} walk_state_t;
+
+static bool append_relpath(walk_state_t *state, size_t parent_len, const char *name, size_t *name_offset_out) {
+    size_t name_len = strlen(name);
+    size_t separator = (parent_len > 0) ? 1 : 0;
+    size_t needed = parent_len + separator + name_len + 1;
+    if (needed > state->relpath_capacity) {
+        size_t capacity = state->relpath_capacity ? state->relpath_capacity : 256;
+        while (capacity < needed) {
+            capacity *= 2;
+        }
+
+        char *grown = realloc(state->relpath, capacity);
+        if (grown == NULL) {
+            return false;
+        }
+
+        state->relpath = grown;
+        state->relpath_capacity = capacity;
+    }
+
+    if (separator) {
+        state->relpath[parent_len] = '/';
+    }
+
+    memcpy(state->relpath + parent_len + separator, name, name_len + 1);
+    *name_offset_out = parent_len + separator;
+    return true;
+}
+
+static bool push_frame(walk_state_t *state, const walk_frame_t *frame) {
+    if (state->frame_count == state->frame_capacity) {
+        int capacity = state->frame_capacity ? state->frame_capacity * 2 : 16;
+        walk_frame_t *grown = realloc(state->frames, capacity * sizeof(walk_frame_t));
+        if (grown == NULL) {
+            return false;
+        }
+
+        state->frames = grown;
+        state->frame_capacity = capacity;
+    }
+
+    state->frames[state->frame_count++] = *frame;
+    return true;
+}
+
+static fs_walk_entry_t entry_for_frame(walk_state_t *state, const walk_frame_t *frame, const char *root_name) {
+    fs_walk_entry_t entry = {0};
+    entry.parent_fd = frame->parent_fd;
+    entry.fd = frame->fd;
+    entry.name = (root_name != NULL) ? root_name : state->relpath + frame->name_offset;
+    entry.relpath = state->relpath;
+    entry.type = DT_DIR;
+    entry.depth = frame->depth;
+    entry.parent_ctx = frame->parent_ctx;
+    entry.ctx = frame->ctx;
+    return entry;
+}
+
+static void pop_frame(walk_state_t *state, const char *root_name, bool aborted) {
+    walk_frame_t *frame = &state->frames[state->frame_count - 1];
+    state->relpath[frame->own_relpath_len] = '\0';
+
+    fs_walk_entry_t entry = entry_for_frame(state, frame, (state->frame_count == 1) ? root_name : NULL);
+    entry.aborted = aborted;
+    fs_walk_action_t action = state->visitor(&entry, FS_WALK_LEAVE_DIR, state->info);
+    if (action == FS_WALK_STOP && !aborted) {
+        atomic_store(state->stopped, true);
+    }
+
+    // closedir() also closes the fd that fdopendir() took ownership of
+    closedir(frame->dir);
+    state->relpath[frame->relpath_len] = '\0';
+    state->frame_count--;
+}
+
+static uint8_t resolve_type(int parent_fd, const char *name, uint8_t d_type) {
+    if (d_type != DT_UNKNOWN) {
+        return d_type;
+    }
+
+    // Some filesystems don't fill in d_type
+    struct stat st;
+    if (fstatat(parent_fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+        return DT_UNKNOWN;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        return DT_DIR;
+    }
+    else if (S_ISLNK(st.st_mode)) {
+        return DT_LNK;
+    }
+    else if (S_ISREG(st.st_mode)) {
+        return DT_REG;
+    }
+
+    return DT_UNKNOWN;
+}
+
+/**
+  * Open `name` (relative to `parent_fd`) as a directory, deliver FS_WALK_ENTER_DIR and push it.
+  * `relpath_len` is the length of the relpath buffer *before* `name` was appended
+  * @return 1 if a frame was pushed, 0 if the directory was skipped, -1 on failure
+ */
+static int enter_directory(walk_state_t *state, int parent_fd, const char *name, size_t relpath_len, size_t name_offset, int depth, void *parent_ctx, const char *root_name) {
+    int fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT && root_name == NULL) {
+            // Removed since it was listed
+            return 0;
+        }
+
+        fprintf(stderr, "fs_walk: failed to open directory %s: %s\n", root_name ? root_name : state->relpath, strerror(errno));
+        return -1;
+    }
+
+    walk_frame_t frame = {0};
+    frame.fd = fd;
+    frame.parent_fd = parent_fd;
+    frame.depth = depth;
+    frame.relpath_len = relpath_len;
+    frame.own_relpath_len = strlen(state->relpath);
+    frame.name_offset = name_offset;
+    frame.parent_ctx = parent_ctx;
+
+    fs_walk_entry_t entry = entry_for_frame(state, &frame, root_name);
+    fs_walk_action_t action = state->visitor(&entry, FS_WALK_ENTER_DIR, state->info);
+    if (action != FS_WALK_CONTINUE) {
+        close(fd);
+        if (action == FS_WALK_STOP) {
+            return -1;
+        }
+
+        return 0;
+    }
+
+    frame.ctx = entry.ctx;
+    // readdir(3) on Darwin already pulls entries from the kernel in batches via getdirentries64(),
+    // and hands back d_type, so the common case needs no stat() per entry
+    frame.dir = fdopendir(fd);
+    if (frame.dir == NULL) {
+        fprintf(stderr, "fs_walk: fdopendir failed for %s: %s\n", root_name ? root_name : state->relpath, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    if (!push_frame(state, &frame)) {
+        closedir(frame.dir);
+        return -1;
+    }
+
+    return 1;
+}
+
+static int walk_from(int parent_fd, const char *name, const char *initial_relpath, int depth, void *parent_ctx, const fs_walk_options_t *options, fs_walk_visitor_t visitor, void *info, atomic_bool *stopped) {
+    walk_state_t state = {0};
+    state.visitor = visitor;
+    state.info = info;
+    state.max_depth = options ? options->max_depth : 0;
+    state.stopped = stopped;
+
+    size_t start_offset = 0;
+    if (!append_relpath(&state, 0, initial_relpath, &start_offset)) {
+        return -1;
+    }
+
+    // The walk root is the only entry whose name is an arbitrary path rather than a single component
+    const char *root_name = (depth == 0) ? name : NULL;
+    int result = 0;
+
+    uint8_t root_type = resolve_type(parent_fd, name, DT_UNKNOWN);
+    if (root_type != DT_DIR || (state.max_depth > 0 && depth >= state.max_depth)) {
+        fs_walk_entry_t entry = {0};
+        entry.parent_fd = parent_fd;
+        entry.fd = -1;
+        entry.name = name;
+        entry.relpath = state.relpath;
+        entry.type = root_type;
+        entry.depth = depth;
+        entry.parent_ctx = parent_ctx;
+        if (visitor(&entry, FS_WALK_ITEM, info) == FS_WALK_STOP) {
+            result = -1;
+        }
+
+        free(state.relpath);
+        return result;
+    }
+
+    if (enter_directory(&state, parent_fd, name, 0, start_offset, depth, parent_ctx, root_name) < 0) {
+        free(state.relpath);
+        return -1;
+    }
+
+    while (state.frame_count > 0) {
+        if (atomic_load(stopped)) {
+            result = -1;
+            break;
+        }
+
+        walk_frame_t *top = &state.frames[state.frame_count - 1];
+        errno = 0;
+        struct dirent *dirent = readdir(top->dir);
+        if (dirent == NULL) {
+            if (errno != 0) {
+                fprintf(stderr, "fs_walk: readdir failed in %s: %s\n", state.relpath, strerror(errno));
+                result = -1;
+                break;
+            }
+
+            pop_frame(&state, root_name, false);
+            continue;
+        }
+
+        if (strcmp(dirent->d_name, ".") == 0 || strcmp(dirent->d_name, "..") == 0) {
+            continue;
+        }
+
+        int dir_fd = top->fd;
+        int child_depth = top->depth + 1;
+        void *dir_ctx = top->ctx;
+        size_t dir_relpath_len = strlen(state.relpath);
+        size_t name_offset = 0;
+        if (!append_relpath(&state, dir_relpath_len, dirent->d_name, &name_offset)) {
+            result = -1;
+            break;
+        }
+
+        const char *child_name = state.relpath + name_offset;
+        uint8_t type = resolve_type(dir_fd, child_name, dirent->d_type);
+        if (type == DT_DIR && (state.max_depth == 0 || child_depth < state.max_depth)) {
+            int entered = enter_directory(&state, dir_fd, child_name, dir_relpath_len, name_offset, child_depth, dir_ctx, NULL);
+            if (entered < 0) {
+                result = -1;
+                break;
+            }
+            else if (entered > 0) {
+                // Its children are read on the next iterations
+                continue;
+            }
+        }
+        else {
+            fs_walk_entry_t entry = {0};
+            entry.parent_fd = dir_fd;
+            entry.fd = -1;
+            entry.name = child_name;
+            entry.relpath = state.relpath;
+            entry.type = type;
+            entry.depth = child_depth;
+            entry.parent_ctx = dir_ctx;
+            if (visitor(&entry, FS_WALK_ITEM, info) == FS_WALK_STOP) {
+                result = -1;
+                break;
+            }
+        }
+
+        state.relpath[dir_relpath_len] = '\0';
+    }
+
+    if (result != 0) {
+        atomic_store(stopped, true);
+    }
+
+    // Unwind whatever is still open so visitors can release their per-directory ctx
+    if (state.frame_count > 0) {
+        state.relpath[state.frames[state.frame_count - 1].own_relpath_len] = '\0';
+    }
+
+    while (state.frame_count > 0) {
+        pop_frame(&state, root_name, true);
+    }
+
+    if (atomic_load(stopped)) {
+        result = -1;
+    }
+
+    free(state.frames);
+    free(state.relpath);
+    return result;
+}
+
+typedef struct {
+    int root_fd;
+    void *root_ctx;
+    char **names;
+    const fs_walk_options_t *options;
+    fs_walk_visitor_t visitor;
+    void *info;
+    atomic_bool *stopped;
+} parallel_walk_t;
+
+static void walk_subtree_at_index(void *context, size_t index) {
+    parallel_walk_t *walk = (parallel_walk_t *)context;
+    if (atomic_load(walk->stopped)) {
+        return;
+    }
+
+    const char *name = walk->names[index];
+    walk_from(walk->root_fd, name, name, 1, walk->root_ctx, walk->options, walk->visitor, walk->info, walk->stopped);
+}
+
+static int walk_parallel(int parent_fd, const char *path, const fs_walk_options_t *options, fs_walk_visitor_t visitor, void *info, atomic_bool *stopped) {
+    if (resolve_type(parent_fd, path, DT_UNKNOWN) != DT_DIR || options->max_depth == 1) {
+        // Nothing to fan out
+        return walk_from(parent_fd, path, "", 0, NULL, options, visitor, info, stopped);
+    }
+
+    int root_fd = openat(parent_fd, path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (root_fd < 0) {
+        fprintf(stderr, "fs_walk: failed to open directory %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    fs_walk_entry_t root = {0};
+    root.parent_fd = parent_fd;
+    root.fd = root_fd;
+    root.name = path;
+    root.relpath = "";
+    root.type = DT_DIR;
+    fs_walk_action_t action = visitor(&root, FS_WALK_ENTER_DIR, info);
+    if (action != FS_WALK_CONTINUE) {
+        close(root_fd);
+        return (action == FS_WALK_STOP) ? -1 : 0;
+    }
+
+    DIR *dir = fdopendir(dup(root_fd));
+    if (dir == NULL) {
+        fprintf(stderr, "fs_walk: fdopendir failed for %s: %s\n", path, strerror(errno));
+        root.aborted = true;
+        visitor(&root, FS_WALK_LEAVE_DIR, info);
+        close(root_fd);
+        return -1;
+    }
+
+    // Non-directories at the top level are handled inline, subdirectories are collected and fanned out
+    char **subdirs = NULL;
+    size_t subdir_count = 0;
+    size_t subdir_capacity = 0;
+    struct dirent *dirent;
+    while (!atomic_load(stopped) && (dirent = readdir(dir)) != NULL) {
+        if (strcmp(dirent->d_name, ".") == 0 || strcmp(dirent->d_name, "..") == 0) {
+            continue;
+        }
+
+        uint8_t type = resolve_type(root_fd, dirent->d_name, dirent->d_type);
+        if (type == DT_DIR) {
+            if (subdir_count == subdir_capacity) {
+                subdir_capacity = subdir_capacity ? subdir_capacity * 2 : 32;
+                char **grown = realloc(subdirs, subdir_capacity * sizeof(char *));
+                if (grown == NULL) {
+                    atomic_store(stopped, true);
+                    break;
+                }
+                subdirs = grown;
+            }
+
+            char *subdir = strdup(dirent->d_name);
+            if (subdir == NULL) {
+                atomic_store(stopped, true);
+                break;
+            }
+
+            subdirs[subdir_count++] = subdir;
+            continue;
+        }
+
+        fs_walk_entry_t entry = {0};
+        entry.parent_fd = root_fd;
+        entry.fd = -1;
+        entry.name = dirent->d_name;
+        entry.relpath = dirent->d_name;
+        entry.type = type;
+        entry.depth = 1;
+        entry.parent_ctx = root.ctx;
+        if (visitor(&entry, FS_WALK_ITEM, info) == FS_WALK_STOP) {
+            atomic_store(stopped, true);
+        }
+    }
+    closedir(dir);
+
+    if (!atomic_load(stopped) && subdir_count > 0) {
+        parallel_walk_t walk = {
+            .root_fd = root_fd,
+            .root_ctx = root.ctx,
+            .names = subdirs,
+            .options = options,
+            .visitor = visitor,
+            .info = info,
+            .stopped = stopped,
+        };
+        dispatch_apply_f(subdir_count, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), &walk, walk_subtree_at_index);
+    }
+
+    for (size_t i = 0; i < subdir_count; i++) {
+        free(subdirs[i]);
+    }
+    free(subdirs);
+
+    root.aborted = atomic_load(stopped);
+    if (visitor(&root, FS_WALK_LEAVE_DIR, info) == FS_WALK_STOP && !root.aborted) {
+        atomic_store(stopped, true);
+    }
+    close(root_fd);
+
+    return atomic_load(stopped) ? -1 : 0;
+}
+
+int fs_walk_at(int parent_fd, const char *name, const fs_walk_options_t *options, fs_walk_visitor_t visitor, void *info) {
+    if (name == NULL || visitor == NULL) {
+        return -1;
+    }
+
+    atomic_bool stopped = false;
+    if (options && options->parallel) {
+        return walk_parallel(parent_fd, name, options, visitor, info, &stopped);
+    }
+
+    return walk_from(parent_fd, name, "", 0, NULL, options, visitor, info, &stopped);
+}
+
+int fs_walk(const char *path, const fs_walk_options_t *options, fs_walk_visitor_t visitor, void *info) {
+    return fs_walk_at(AT_FDCWD, path, options, visitor, info);
+}
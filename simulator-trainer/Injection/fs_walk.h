@@ -0,0 +1,80 @@
+//
+//  fs_walk.h
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#ifndef fs_walk_h
+#define fs_walk_h
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <dirent.h>
+#include <fcntl.h>
+
+/**
+  * Iterative, fd-relative directory walker.
+  * Every directory is opened relative to its parent's fd (openat + O_NOFOLLOW), so no syscall has to
+  * re-resolve a full path from `/`, there is no PATH_MAX limit on tree depth, and symlinks are never
+  * followed. Traversal uses an explicit heap-allocated stack instead of recursion
+  */
+
+typedef enum {
+    // A directory, before any of its children. Its fd is open
+    FS_WALK_ENTER_DIR,
+    // A directory, after all of its children. Its fd is still open
+    FS_WALK_LEAVE_DIR,
+    // Anything that isn't descended into: files, symlinks, and directories beyond max_depth
+    FS_WALK_ITEM,
+} fs_walk_phase_t;
+
+typedef enum {
+    FS_WALK_CONTINUE = 0,
+    // From FS_WALK_ENTER_DIR: don't descend. FS_WALK_LEAVE_DIR is not delivered for the directory
+    FS_WALK_SKIP = 1,
+    // Abort the walk. fs_walk() returns -1
+    FS_WALK_STOP = -1,
+} fs_walk_action_t;
+
+typedef struct {
+    // The directory containing this entry. AT_FDCWD for the walk root
+    int parent_fd;
+    // The entry's own fd for directory phases, -1 for FS_WALK_ITEM
+    int fd;
+    // Name relative to parent_fd. For the walk root this is the path that was passed in
+    const char *name;
+    // Path relative to the walk root ("" for the root itself)
+    const char *relpath;
+    // DT_DIR, DT_REG, DT_LNK, ...
+    uint8_t type;
+    // 0 for the walk root
+    int depth;
+    // The ctx that the containing directory's FS_WALK_ENTER_DIR left behind
+    void *parent_ctx;
+    // Set by FS_WALK_ENTER_DIR; handed back in FS_WALK_LEAVE_DIR and to children as parent_ctx
+    void *ctx;
+    // FS_WALK_LEAVE_DIR only: the walk is unwinding after a failure, the return value is ignored
+    bool aborted;
+} fs_walk_entry_t;
+
+typedef fs_walk_action_t (*fs_walk_visitor_t)(fs_walk_entry_t *entry, fs_walk_phase_t phase, void *info);
+
+typedef struct {
+    // 0 for unlimited. 1 visits only the root's direct children, and so on
+    int max_depth;
+    // Walk the root's subdirectories concurrently. The visitor must be thread safe
+    bool parallel;
+} fs_walk_options_t;
+
+/**
+  * Walk the tree rooted at `path`
+  * @return 0 on success, -1 if the walk failed or a visitor returned FS_WALK_STOP
+ */
+int fs_walk(const char *path, const fs_walk_options_t *options, fs_walk_visitor_t visitor, void *info);
+
+/**
+  * Walk the tree rooted at `name`, resolved relative to the directory `parent_fd`
+ */
+int fs_walk_at(int parent_fd, const char *name, const fs_walk_options_t *options, fs_walk_visitor_t visitor, void *info);
+
+#endif /* fs_walk_h */
@@ -0,0 +1,315 @@
+//
+//  mount_table.c
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#include "mount_table.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/event.h>
+#include <sys/mount.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct {
+    char path[MAXPATHLEN];
+    size_t path_len;
+    mount_table_entry_t entry;
+} mount_record_t;
+
+static pthread_mutex_t g_mount_table_lock = PTHREAD_MUTEX_INITIALIZER;
+static mount_record_t *g_records = NULL;
+static mount_record_t **g_records_by_device = NULL;
+static int g_record_count = 0;
+static bool g_stale = true;
+static uint64_t g_generation = 0;
+static int g_fs_events_kq = -2;
+
+static int compare_records_by_path(const void *a, const void *b) {
+    const mount_record_t *ra = (const mount_record_t *)a;
+    const mount_record_t *rb = (const mount_record_t *)b;
+    return strcmp(ra->path, rb->path);
+}
+
+static int compare_records_by_device(const void *a, const void *b) {
+    const mount_record_t *ra = *(const mount_record_t **)a;
+    const mount_record_t *rb = *(const mount_record_t **)b;
+    if (ra->entry.device == rb->entry.device) {
+        return 0;
+    }
+
+    return (ra->entry.device < rb->entry.device) ? -1 : 1;
+}
+
+static void watch_fs_events_locked(void) {
+    if (g_fs_events_kq != -2) {
+        return;
+    }
+
+    // EVFILT_FS fires for every mount/unmount on the host, including the ones the privileged helper
+    // makes on our behalf. It is polled (never waited on) before each lookup
+    g_fs_events_kq = kqueue();
+    if (g_fs_events_kq < 0) {
+        fprintf(stderr, "mount_table: kqueue() failed, snapshot will be rebuilt for every query: %s\n", strerror(errno));
+        g_fs_events_kq = -1;
+        return;
+    }
+
+    struct kevent kev;
+    EV_SET(&kev, 0, EVFILT_FS, EV_ADD | EV_CLEAR, 0, 0, NULL);
+    if (kevent(g_fs_events_kq, &kev, 1, NULL, 0, NULL) != 0) {
+        fprintf(stderr, "mount_table: failed to register EVFILT_FS: %s\n", strerror(errno));
+        close(g_fs_events_kq);
+        g_fs_events_kq = -1;
+    }
+}
+
+static bool fs_changed_since_last_poll_locked(void) {
+    if (g_fs_events_kq < 0) {
+        return true;
+    }
+
+    struct kevent events[4];
+    struct timespec no_wait = {0, 0};
+    bool changed = false;
+    int n;
+    while ((n = kevent(g_fs_events_kq, NULL, 0, events, 4, &no_wait)) > 0) {
+        changed = true;
+    }
+
+    return changed;
+}
+
+static bool rebuild_locked(void) {
+    // getfsstat() is the syscall behind getmntinfo(), but fills a caller-owned buffer instead of
+    // libc's shared static one, so it is safe with other threads calling getmntinfo()
+    int count = getfsstat(NULL, 0, MNT_NOWAIT);
+    if (count < 0) {
+        fprintf(stderr, "mount_table: getfsstat() failed: %s\n", strerror(errno));
+        return false;
+    }
+
+    // Leave room for mounts that appear between the two calls
+    int capacity = count + 8;
+    struct statfs *mounts = calloc(capacity, sizeof(struct statfs));
+    if (mounts == NULL) {
+        return false;
+    }
+
+    count = getfsstat(mounts, capacity * (int)sizeof(struct statfs), MNT_NOWAIT);
+    if (count < 0) {
+        fprintf(stderr, "mount_table: getfsstat() failed: %s\n", strerror(errno));
+        free(mounts);
+        return false;
+    }
+
+    mount_record_t *records = calloc(count > 0 ? count : 1, sizeof(mount_record_t));
+    mount_record_t **by_device = calloc(count > 0 ? count : 1, sizeof(mount_record_t *));
+    if (records == NULL || by_device == NULL) {
+        free(records);
+        free(by_device);
+        free(mounts);
+        return false;
+    }
+
+    for (int i = 0; i < count; i++) {
+        mount_record_t *record = &records[i];
+        strlcpy(record->path, mounts[i].f_mntonname, sizeof(record->path));
+        record->path_len = strlen(record->path);
+        record->entry.found = true;
+        record->entry.device = (dev_t)mounts[i].f_fsid.val[0];
+        strlcpy(record->entry.fstypename, mounts[i].f_fstypename, sizeof(record->entry.fstypename));
+        record->entry.is_tmpfs = strstr(mounts[i].f_fstypename, "tmpfs") != NULL;
+    }
+    free(mounts);
+
+    qsort(records, count, sizeof(mount_record_t), compare_records_by_path);
+    for (int i = 0; i < count; i++) {
+        by_device[i] = &records[i];
+    }
+    qsort(by_device, count, sizeof(mount_record_t *), compare_records_by_device);
+
+    free(g_records);
+    free(g_records_by_device);
+    g_records = records;
+    g_records_by_device = by_device;
+    g_record_count = count;
+    g_stale = false;
+    g_generation++;
+    return true;
+}
+
+static bool refresh_if_needed_locked(void) {
+    watch_fs_events_locked();
+    if (fs_changed_since_last_poll_locked()) {
+        g_stale = true;
+    }
+
+    if (g_stale || g_records == NULL) {
+        return rebuild_locked();
+    }
+
+    return true;
+}
+
+static size_t normalized_path_length(const char *path) {
+    size_t len = strlen(path);
+    while (len > 1 && path[len - 1] == '/') {
+        len--;
+    }
+
+    return len;
+}
+
+static bool lookup_path_locked(const char *path, mount_table_entry_t *entry_out) {
+    size_t path_len = normalized_path_length(path);
+    int lo = 0;
+    int hi = g_record_count - 1;
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        const mount_record_t *record = &g_records[mid];
+        int cmp = strncmp(path, record->path, path_len);
+        if (cmp == 0 && record->path_len != path_len) {
+            // `path` is a strict prefix of the record, so it sorts before it
+            cmp = (record->path_len > path_len) ? -1 : 1;
+        }
+
+        if (cmp == 0) {
+            if (entry_out) {
+                *entry_out = record->entry;
+            }
+
+            return true;
+        }
+        else if (cmp < 0) {
+            hi = mid - 1;
+        }
+        else {
+            lo = mid + 1;
+        }
+    }
+
+    return false;
+}
+
+static bool lookup_path(const char *path, mount_table_entry_t *entry_out) {
+    bool found = false;
+    pthread_mutex_lock(&g_mount_table_lock);
+    if (refresh_if_needed_locked()) {
+        found = lookup_path_locked(path, entry_out);
+    }
+    pthread_mutex_unlock(&g_mount_table_lock);
+
+    return found;
+}
+
+/**
+  * The mount table only knows canonical mount-on paths. Paths that reach a mount point some other way, through a
+  * symlink or a firmlink (e.g. /Library -> /System/Volumes/Data/Library), are recognized the way they were before
+  * the table existed: the directory is on a different device than its parent
+ */
+static bool lookup_path_by_device(const char *path, mount_table_entry_t *entry_out) {
+    struct stat path_stat, parent_stat;
+    if (stat(path, &path_stat) != 0) {
+        return false;
+    }
+
+    char parent_path[PATH_MAX];
+    if (snprintf(parent_path, sizeof(parent_path), "%s/..", path) >= (int)sizeof(parent_path)) {
+        return false;
+    }
+
+    if (stat(parent_path, &parent_stat) != 0 || path_stat.st_dev == parent_stat.st_dev) {
+        return false;
+    }
+
+    if (entry_out && !mount_table_lookup_device(path_stat.st_dev, entry_out)) {
+        struct statfs fs;
+        entry_out->found = true;
+        entry_out->device = path_stat.st_dev;
+        if (statfs(path, &fs) == 0) {
+            strlcpy(entry_out->fstypename, fs.f_fstypename, sizeof(entry_out->fstypename));
+            entry_out->is_tmpfs = strstr(fs.f_fstypename, "tmpfs") != NULL;
+        }
+    }
+
+    return true;
+}
+
+bool mount_table_lookup_path(const char *path, mount_table_entry_t *entry_out) {
+    if (entry_out) {
+        memset(entry_out, 0, sizeof(*entry_out));
+    }
+
+    if (path == NULL || path[0] == '\0') {
+        return false;
+    }
+
+    if (lookup_path(path, entry_out)) {
+        return true;
+    }
+
+    // Misses are checked against the filesystem outside the lock, since they touch the disk
+    char resolved[PATH_MAX];
+    if (realpath(path, resolved) != NULL && strcmp(resolved, path) != 0 && lookup_path(resolved, entry_out)) {
+        return true;
+    }
+
+    return lookup_path_by_device(path, entry_out);
+}
+
+bool mount_table_lookup_device(dev_t device, mount_table_entry_t *entry_out) {
+    if (entry_out) {
+        memset(entry_out, 0, sizeof(*entry_out));
+    }
+
+    bool found = false;
+
+    pthread_mutex_lock(&g_mount_table_lock);
+    if (refresh_if_needed_locked()) {
+        int lo = 0;
+        int hi = g_record_count - 1;
+        while (lo <= hi) {
+            int mid = lo + (hi - lo) / 2;
+            const mount_record_t *record = g_records_by_device[mid];
+            if (record->entry.device == device) {
+                if (entry_out) {
+                    *entry_out = record->entry;
+                }
+
+                found = true;
+                break;
+            }
+            else if (device < record->entry.device) {
+                hi = mid - 1;
+            }
+            else {
+                lo = mid + 1;
+            }
+        }
+    }
+    pthread_mutex_unlock(&g_mount_table_lock);
+
+    return found;
+}
+
+void mount_table_invalidate(void) {
+    pthread_mutex_lock(&g_mount_table_lock);
+    g_stale = true;
+    pthread_mutex_unlock(&g_mount_table_lock);
+}
+
+uint64_t mount_table_generation(void) {
+    pthread_mutex_lock(&g_mount_table_lock);
+    refresh_if_needed_locked();
+    uint64_t generation = g_generation;
+    pthread_mutex_unlock(&g_mount_table_lock);
+
+    return generation;
+}
@@ -0,0 +1,52 @@
+//
+//  mount_table.h
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#ifndef mount_table_h
+#define mount_table_h
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <sys/types.h>
+
+/**
+  * In-memory snapshot of the system mount table.
+  * Built with a single getmntinfo() call and indexed by mount-on path and by device id, so mount point
+  * queries are answered without statfs()/stat() probing. The snapshot is rebuilt lazily whenever the
+  * kernel reports a mount/unmount (EVFILT_FS) or when mount_table_invalidate() is called
+  */
+
+typedef struct {
+    bool found;
+    bool is_tmpfs;
+    dev_t device;
+    char fstypename[16];
+} mount_table_entry_t;
+
+/**
+  * Look up the mount whose mount-on path is `path` (trailing slashes are ignored). Paths that aren't in the table
+  * as written are canonicalized, and failing that compared by device with their parent directory, so symlinked
+  * and firmlinked paths to a mount point are found too
+  * @return true if `path` is a mount point, with its details written to `entry_out` (may be NULL)
+ */
+bool mount_table_lookup_path(const char *path, mount_table_entry_t *entry_out);
+
+/**
+  * Look up the mounted filesystem with the given device id
+  * @return true if a mount with that device id exists, with its details written to `entry_out` (may be NULL)
+ */
+bool mount_table_lookup_device(dev_t device, mount_table_entry_t *entry_out);
+
+/**
+  * Drop the current snapshot. Callers that mount or unmount anything must call this afterwards
+ */
+void mount_table_invalidate(void);
+
+/**
+  * Incremented every time the snapshot is rebuilt. Useful for caches layered on top of the mount table
+ */
+uint64_t mount_table_generation(void);
+
+#endif /* mount_table_h */
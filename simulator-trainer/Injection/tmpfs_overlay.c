@@ -7,10 +7,15 @@
 
 #include <CoreFoundation/CoreFoundation.h>
 #include "tmpfs_overlay.h"
+#include "mount_table.h"
+#include "fs_walk.h"
 #include <copyfile.h>
+#include <dispatch/dispatch.h>
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -18,26 +23,111 @@
 #include <sys/mount.h>
 #include <sys/param.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/sysctl.h>
 
 #define OVERLAY_CONFIG_PATH "/var/jb/overlays/overlay_list.conf"
 #define OVERLAY_STORE_PREFIX "/var/jb/overlays"
 
+// Overlays can be mounted concurrently, so read-modify-write of the config file is serialized
+static pthread_mutex_t g_overlay_config_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Size of the store tree behind each symlink, so metrics don't walk the store on every call. Direct-mapped by target path
+#define LINK_USAGE_CACHE_SIZE 256
+
+typedef struct {
+    char target[PATH_MAX];
+    uint64_t mount_generation;
+    uint64_t store_generation;
+    uint64_t bytes;
+} link_usage_t;
+
+static pthread_mutex_t g_link_usage_lock = PTHREAD_MUTEX_INITIALIZER;
+static link_usage_t *g_link_usage = NULL;
+// Bumped after every commit, since that changes the store without touching the mount table
+static _Atomic uint64_t g_store_generation = 0;
+
 typedef struct {
     char target_path[PATH_MAX];
     char backing_store[PATH_MAX];
+    // Size of the backing store when it was last seeded or committed. Both 0 if it was never measured
+    uint64_t estimated_nodes;
+    uint64_t estimated_bytes;
 } overlay_info_t;
 
+typedef struct {
+    char **names;
+    int count;
+    int capacity;
+} store_entry_list_t;
+
+typedef struct {
+    const char *store_root;
+    const char *store_prefix;
+    size_t store_prefix_len;
+} commit_walk_t;
+
+struct tmpfs_args {
+    uint64_t max_pages;
+    uint64_t max_nodes;
+    uint64_t case_insensitive;
+};
+
+typedef struct {
+    _Atomic uint64_t nodes;
+    _Atomic uint64_t bytes;
+} usage_walk_t;
+
+typedef struct {
+    const char *store_prefix;
+    size_t store_prefix_len;
+    uint64_t mount_generation;
+    uint64_t store_generation;
+    overlay_metrics_t *metrics;
+} metrics_walk_t;
+
+// tmpfs limits are sized from the backing store with this much headroom, then clamped
+#define OVERLAY_SIZE_HEADROOM 2
+#define OVERLAY_MIN_NODES 4096ull
+#define OVERLAY_MAX_NODES (16ull * 1024 * 1024)
+#define OVERLAY_MIN_BYTES (16ull * 1024 * 1024)
+#define OVERLAY_MAX_BYTES (4ull * 1024 * 1024 * 1024)
+// Overlays using more than this share of either limit get remounted larger
+#define OVERLAY_GROW_THRESHOLD_PERCENT 80
+
+// Per-directory walk ctx holding the matching destination directory's fd (offset so fd 0 isn't NULL)
+#define DIR_FD_CTX(fd) ((void *)(intptr_t)((fd) + 1))
+#define CTX_DIR_FD(ctx) ((int)(intptr_t)(ctx) - 1)
+
 static kern_return_t ensure_directory_exists(const char *path);
 static bool dir_exists_and_nonempty(const char *dir);
 static kern_return_t copy_dir_recursive(const char *src, const char *dst);
 static kern_return_t write_overlay_config(const overlay_info_t *overlay);
 static kern_return_t read_overlay_config(overlay_info_t **overlays_out, int *count_out);
+static kern_return_t save_overlay_config(const overlay_info_t *list, int count);
+static kern_return_t update_overlay_estimate(const char *target_path, uint64_t nodes, uint64_t bytes);
 static kern_return_t remove_directory_recursive(const char *path);
-static kern_return_t symlink_contents_of_dir(const char *store_path, const char *overlay_path);
-static bool is_symlink_pointing_to_store(const char *item_path, const char *store_prefix);
+static kern_return_t mount_overlay(overlay_remount_report_t *report);
+static void remount_overlay_at_index(void *context, size_t index);
+static kern_return_t estimate_tree_usage(const char *path, uint64_t *nodes_out, uint64_t *bytes_out);
+static kern_return_t link_target_usage(const char *target, uint64_t mount_generation, uint64_t store_generation, uint64_t *bytes_out);
+static uint64_t grown_limit(uint64_t current, uint64_t limit);
+static void size_overlay_limits(uint64_t nodes, uint64_t bytes, struct tmpfs_args *args_out);
+static kern_return_t read_overlay_usage(const char *path, overlay_metrics_t *metrics);
+static fs_walk_action_t usage_visitor(fs_walk_entry_t *entry, fs_walk_phase_t phase, void *info);
+static fs_walk_action_t metrics_visitor(fs_walk_entry_t *entry, fs_walk_phase_t phase, void *info);
+static int compare_overlays_by_target(const void *a, const void *b);
+static bool path_is_nested_in(const char *path, const char *parent);
+static kern_return_t list_store_entries(const char *store_path, store_entry_list_t *entries);
+static void free_store_entries(store_entry_list_t *entries);
+static kern_return_t link_store_entries(const char *store_path, const store_entry_list_t *entries, const char *overlay_path);
 static kern_return_t commit_item_recursive(const char *overlay_item, const char *store_item, const char *store_prefix);
+static kern_return_t remove_item_at(int dir_fd, const char *name);
+static fs_walk_action_t copy_tree_visitor(fs_walk_entry_t *entry, fs_walk_phase_t phase, void *info);
+static fs_walk_action_t remove_tree_visitor(fs_walk_entry_t *entry, fs_walk_phase_t phase, void *info);
+static fs_walk_action_t collect_store_entry_visitor(fs_walk_entry_t *entry, fs_walk_phase_t phase, void *info);
+static fs_walk_action_t commit_tree_visitor(fs_walk_entry_t *entry, fs_walk_phase_t phase, void *info);
 
 int commit_overlay_changes(const char *overlay_path) {
     if (overlay_path == NULL) {
@@ -57,10 +147,38 @@ int commit_overlay_changes(const char *overlay_path) {
     }
     
     kern_return_t ret = commit_item_recursive(overlay_path, store_path, store_path);
-    return (ret == 0) ? 0 : -1;
+    atomic_fetch_add(&g_store_generation, 1);
+    if (ret != 0) {
+        return -1;
+    }
+    
+    // Measured now so remounting this overlay, including at helper startup, doesn't have to walk the store
+    uint64_t nodes = 0;
+    uint64_t bytes = 0;
+    if (estimate_tree_usage(store_path, &nodes, &bytes) != 0 || update_overlay_estimate(overlay_path, nodes, bytes) != 0) {
+        fprintf(stderr, "Warning: Failed to record the size of %s, it will be measured on the next remount\n", store_path);
+    }
+    
+    return 0;
 }
 
 int reapply_all_overlays(void) {
+    return reapply_all_overlays_with_reports(NULL, NULL);
+}
+
+int reapply_all_overlays_with_reports(overlay_remount_report_t **reports_out, int *count_out) {
+    if (reports_out) {
+        *reports_out = NULL;
+    }
+    if (count_out) {
+        *count_out = 0;
+    }
+    
+    if (geteuid() != 0) {
+        fprintf(stderr, "Must be root to reapply overlays\n");
+        return -1;
+    }
+    
     overlay_info_t *list = NULL;
     int count = 0;
     kern_return_t ret = read_overlay_config(&list, &count);
@@ -68,15 +186,79 @@ int reapply_all_overlays(void) {
         return -1;
     }
     
-    int success = 0;
+    overlay_remount_report_t *reports = calloc(count, sizeof(overlay_remount_report_t));
+    if (reports == NULL) {
+        free(list);
+        return -1;
+    }
+    
+    // Sorting by path puts every overlay after the ones it's nested in, and duplicates next to each other
+    qsort(list, count, sizeof(overlay_info_t), compare_overlays_by_target);
+    int unique = 0;
+    int max_level = 0;
     for (int i = 0; i < count; i++) {
-        if (create_or_remount_overlay_symlinks(list[i].target_path) == 0) {
+        if (unique > 0 && strcmp(list[i].target_path, reports[unique - 1].target_path) == 0) {
+            continue;
+        }
+        
+        overlay_remount_report_t *report = &reports[unique];
+        strlcpy(report->target_path, list[i].target_path, sizeof(report->target_path));
+        report->estimated_nodes = list[i].estimated_nodes;
+        report->estimated_bytes = list[i].estimated_bytes;
+        for (int j = 0; j < unique; j++) {
+            if (path_is_nested_in(report->target_path, reports[j].target_path) && reports[j].level + 1 > report->level) {
+                report->level = reports[j].level + 1;
+            }
+        }
+        
+        if (report->level > max_level) {
+            max_level = report->level;
+        }
+        unique++;
+    }
+    free(list);
+    
+    // Parents have to be mounted before anything nested inside them. Overlays on the same level are independent
+    overlay_remount_report_t **batch = calloc(unique > 0 ? unique : 1, sizeof(overlay_remount_report_t *));
+    if (batch == NULL) {
+        free(reports);
+        return -1;
+    }
+    
+    for (int level = 0; level <= max_level; level++) {
+        size_t batch_count = 0;
+        for (int i = 0; i < unique; i++) {
+            if (reports[i].level == level) {
+                batch[batch_count++] = &reports[i];
+            }
+        }
+        
+        dispatch_apply_f(batch_count, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), batch, remount_overlay_at_index);
+    }
+    free(batch);
+    
+    int success = 0;
+    for (int i = 0; i < unique; i++) {
+        overlay_remount_report_t *report = &reports[i];
+        if (report->result == 0) {
             success++;
         }
+        
+        fprintf(stdout, "Overlay %s (level %d): %s, %d entries linked, seed %.1fms, mount %.1fms, link %.1fms, total %.1fms\n", report->target_path, report->level, (report->result == 0) ? (report->already_mounted ? "already mounted" : "mounted") : "failed", report->entries_linked, report->seed_ns / 1e6, report->mount_ns / 1e6, report->link_ns / 1e6, report->total_ns / 1e6);
     }
     
-    free(list);
-    return (success == count) ? 0 : -1;
+    if (reports_out) {
+        *reports_out = reports;
+    }
+    else {
+        free(reports);
+    }
+    
+    if (count_out) {
+        *count_out = unique;
+    }
+    
+    return (success == unique) ? 0 : -1;
 }
 
 kern_return_t create_or_remount_overlay_symlinks(const char *path) {
@@ -85,12 +267,197 @@ kern_return_t create_or_remount_overlay_symlinks(const char *path) {
         return -1;
     }
     
+    overlay_remount_report_t report;
+    memset(&report, 0, sizeof(report));
+    strlcpy(report.target_path, path, sizeof(report.target_path));
+    kern_return_t ret = mount_overlay(&report);
+    if (ret != 0 || report.already_mounted) {
+        return ret;
+    }
+    
+    overlay_info_t ov;
+    memset(&ov, 0, sizeof(ov));
+    strncpy(ov.target_path, path, sizeof(ov.target_path) - 1);
+    snprintf(ov.backing_store, sizeof(ov.backing_store), "%s%s", OVERLAY_STORE_PREFIX, path);
+    ov.estimated_nodes = report.estimated_nodes;
+    ov.estimated_bytes = report.estimated_bytes;
+    ret = write_overlay_config(&ov);
+    if (ret != 0) {
+        fprintf(stderr, "Warning: Failed to write overlay config, but overlay is mounted\n");
+    }
+    
+    return 0;
+}
+
+int forget_overlay(const char *path) {
+    if (path == NULL) {
+        return -1;
+    }
+    
+    pthread_mutex_lock(&g_overlay_config_lock);
+    overlay_info_t *list = NULL;
+    int count = 0;
+    if (read_overlay_config(&list, &count) != 0) {
+        pthread_mutex_unlock(&g_overlay_config_lock);
+        return -1;
+    }
+    
+    if (list == NULL) {
+        pthread_mutex_unlock(&g_overlay_config_lock);
+        return 0;
+    }
+    
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        if (strcmp(list[i].target_path, path) != 0) {
+            list[kept++] = list[i];
+        }
+    }
+    
+    kern_return_t ret = save_overlay_config(list, kept);
+    free(list);
+    pthread_mutex_unlock(&g_overlay_config_lock);
+    
+    return ret;
+}
+
+int overlay_get_metrics(const char *path, overlay_metrics_t *metrics_out) {
+    if (path == NULL || metrics_out == NULL) {
+        return -1;
+    }
+    
+    memset(metrics_out, 0, sizeof(*metrics_out));
+    if (!is_tmpfs_mount(path) || !is_mount_point(path)) {
+        fprintf(stderr, "%s is not a mounted overlay\n", path);
+        return -1;
+    }
+    
+    if (read_overlay_usage(path, metrics_out) != 0) {
+        return -1;
+    }
+    
+    // Split what the tmpfs holds itself from what it only links to in the store
+    metrics_walk_t walk = {
+        .store_prefix = OVERLAY_STORE_PREFIX,
+        .store_prefix_len = strlen(OVERLAY_STORE_PREFIX),
+        .mount_generation = mount_table_generation(),
+        .store_generation = atomic_load(&g_store_generation),
+        .metrics = metrics_out,
+    };
+    
+    return (fs_walk(path, NULL, metrics_visitor, &walk) == 0) ? 0 : -1;
+}
+
+int overlay_grow_if_needed(const char *path, bool *grew_out) {
+    if (grew_out) {
+        *grew_out = false;
+    }
+    
+    overlay_metrics_t usage;
+    memset(&usage, 0, sizeof(usage));
+    if (read_overlay_usage(path, &usage) != 0) {
+        return -1;
+    }
+    
+    bool nodes_tight = usage.nodes_used * 100 >= usage.max_nodes * OVERLAY_GROW_THRESHOLD_PERCENT;
+    bool pages_tight = usage.pages_used * 100 >= usage.max_pages * OVERLAY_GROW_THRESHOLD_PERCENT;
+    if (!nodes_tight && !pages_tight) {
+        return 0;
+    }
+    
+    struct tmpfs_args args;
+    args.max_nodes = nodes_tight ? grown_limit(usage.max_nodes, OVERLAY_MAX_NODES) : usage.max_nodes;
+    args.max_pages = pages_tight ? grown_limit(usage.max_pages, OVERLAY_MAX_BYTES / getpagesize()) : usage.max_pages;
+    args.case_insensitive = 0;
+    if (args.max_nodes == usage.max_nodes && args.max_pages == usage.max_pages) {
+        fprintf(stderr, "Overlay %s is nearly full but already at its size limit: nodes %llu/%llu, pages %llu/%llu\n", path, usage.nodes_used, usage.max_nodes, usage.pages_used, usage.max_pages);
+        return 0;
+    }
+    
+    fprintf(stdout, "Growing overlay %s: nodes %llu/%llu, pages %llu/%llu\n", path, usage.nodes_used, usage.max_nodes, usage.pages_used, usage.max_pages);
+    
+    if (mount("tmpfs", path, MNT_UPDATE, &args) == 0) {
+        mount_table_invalidate();
+        if (grew_out) {
+            *grew_out = true;
+        }
+        
+        return 0;
+    }
+    
+    // tmpfs can't resize in place: persist what was written into the tmpfs, then mount a bigger one over the store
+    fprintf(stderr, "In-place resize of %s failed (%s), remounting\n", path, strerror(errno));
+    if (commit_overlay_changes(path) != 0) {
+        return -1;
+    }
+    
+    if (unmount_if_mounted(path) != 0) {
+        return -1;
+    }
+    
+    overlay_remount_report_t report;
+    memset(&report, 0, sizeof(report));
+    strlcpy(report.target_path, path, sizeof(report.target_path));
+    overlay_info_t *list = NULL;
+    int count = 0;
+    if (read_overlay_config(&list, &count) == 0) {
+        for (int i = 0; i < count; i++) {
+            if (strcmp(list[i].target_path, path) == 0) {
+                report.estimated_nodes = list[i].estimated_nodes;
+                report.estimated_bytes = list[i].estimated_bytes;
+                break;
+            }
+        }
+        free(list);
+    }
+    report.max_nodes = args.max_nodes;
+    report.max_pages = args.max_pages;
+    if (mount_overlay(&report) != 0) {
+        return -1;
+    }
+    
+    chmod(path, 0777);
+    if (grew_out) {
+        *grew_out = true;
+    }
+    
+    return 0;
+}
+
+int grow_overlays_if_needed(void) {
+    overlay_info_t *list = NULL;
+    int count = 0;
+    if (read_overlay_config(&list, &count) != 0) {
+        return -1;
+    }
+    
+    int ret = 0;
+    for (int i = 0; i < count; i++) {
+        if (!is_mount_point(list[i].target_path) || !is_tmpfs_mount(list[i].target_path)) {
+            continue;
+        }
+        
+        if (overlay_grow_if_needed(list[i].target_path, NULL) != 0) {
+            ret = -1;
+        }
+    }
+    
+    free(list);
+    return ret;
+}
+
+static kern_return_t mount_overlay(overlay_remount_report_t *report) {
+    const char *path = report->target_path;
+    uint64_t start = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    
     if (is_tmpfs_mount(path)) {
         fprintf(stdout, "Overlay already exists on %s. Nothing to do\n", path);
+        report->already_mounted = true;
         return 0;
     }
     
-    if (is_mount_point(path) && !is_tmpfs_mount(path)) {
+    report->result = -1;
+    if (is_mount_point(path)) {
         fprintf(stderr, "Path %s is already a mount point. Cannot override\n", path);
         return -1;
     }
@@ -109,74 +476,174 @@ kern_return_t create_or_remount_overlay_symlinks(const char *path) {
         }
     }
     
-    unmount_if_mounted(path);
+    // The store's top level is listed before the mount, so the new tmpfs is populated in one pass
+    store_entry_list_t entries = {0};
+    if (list_store_entries(store_path, &entries) != 0) {
+        fprintf(stderr, "Failed to list backing store %s\n", store_path);
+        free_store_entries(&entries);
+        return -1;
+    }
     
-    struct tmpfs_args {
-        uint64_t max_pages;
-        uint64_t max_nodes;
-        uint64_t case_insensitive;
-    } args;
+    // Callers pass the size recorded in the overlay config. The store is only walked for overlays that don't have one
+    uint64_t store_nodes = report->estimated_nodes;
+    uint64_t store_bytes = report->estimated_bytes;
+    if (store_nodes == 0 && store_bytes == 0 && estimate_tree_usage(store_path, &store_nodes, &store_bytes) != 0) {
+        fprintf(stderr, "Failed to size backing store %s\n", store_path);
+        free_store_entries(&entries);
+        return -1;
+    }
+    
+    // Callers may pass floors in the report (when growing an overlay that ran out of room)
+    struct tmpfs_args args;
+    size_overlay_limits(store_nodes, store_bytes, &args);
+    if (report->max_nodes > args.max_nodes) {
+        args.max_nodes = report->max_nodes;
+    }
+    if (report->max_pages > args.max_pages) {
+        args.max_pages = report->max_pages;
+    }
+    report->max_nodes = args.max_nodes;
+    report->max_pages = args.max_pages;
+    report->estimated_nodes = store_nodes;
+    report->estimated_bytes = store_bytes;
+    
+    uint64_t mount_start = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    report->seed_ns = mount_start - start;
+    
+    unmount_if_mounted(path);
     
-    args.max_pages = 1024 * 1024 * 1024 / getpagesize();
-    args.max_nodes = UINT16_MAX;
-    args.case_insensitive = 0;
     if (mount("tmpfs", path, 0, &args) != 0) {
         fprintf(stderr, "Failed to mount tmpfs on %s: %s\n", path, strerror(errno));
+        free_store_entries(&entries);
         return -1;
     }
+    mount_table_invalidate();
     
-    kern_return_t ret = symlink_contents_of_dir(store_path, path);
+    uint64_t link_start = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    report->mount_ns = link_start - mount_start;
+    
+    kern_return_t ret = link_store_entries(store_path, &entries, path);
+    report->link_ns = clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - link_start;
+    report->entries_linked = entries.count;
+    free_store_entries(&entries);
     if (ret != 0) {
         fprintf(stderr, "Failed to symlink backing store contents\n");
         if (unmount(path, MNT_FORCE) != 0) {
             fprintf(stderr, "Warning: Failed to unmount after error: %s\n", strerror(errno));
         }
+        mount_table_invalidate();
         
+        report->entries_linked = 0;
         return ret;
     }
     
-    overlay_info_t ov;
-    memset(&ov, 0, sizeof(ov));
-    strncpy(ov.target_path, path, sizeof(ov.target_path) - 1);
-    strncpy(ov.backing_store, store_path, sizeof(ov.backing_store) - 1);
-    ret = write_overlay_config(&ov);
-    if (ret != 0) {
-        fprintf(stderr, "Warning: Failed to write overlay config, but overlay is mounted\n");
+    report->result = 0;
+    return 0;
+}
+
+static void remount_overlay_at_index(void *context, size_t index) {
+    overlay_remount_report_t **batch = (overlay_remount_report_t **)context;
+    overlay_remount_report_t *report = batch[index];
+    uint64_t start = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    mount_overlay(report);
+    report->total_ns = clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - start;
+}
+
+static int compare_overlays_by_target(const void *a, const void *b) {
+    return strcmp(((const overlay_info_t *)a)->target_path, ((const overlay_info_t *)b)->target_path);
+}
+
+static bool path_is_nested_in(const char *path, const char *parent) {
+    size_t parent_len = strlen(parent);
+    while (parent_len > 1 && parent[parent_len - 1] == '/') {
+        parent_len--;
     }
     
-    return 0;
+    return strncmp(path, parent, parent_len) == 0 && path[parent_len] == '/';
 }
 
-bool is_tmpfs_mount(const char *path) {
-    struct statfs fs;
-    if (statfs(path, &fs) != 0) {
-        return false;
+int overlay_set_permissions(const char *path, mode_t mode) {
+    if (path == NULL) {
+        return -1;
     }
     
-    return strstr(fs.f_fstypename, "tmpfs") != NULL;
+    char resolved[PATH_MAX];
+    if (realpath(path, resolved) == NULL) {
+        fprintf(stderr, "Cannot resolve %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    
+    overlay_info_t *list = NULL;
+    int count = 0;
+    if (read_overlay_config(&list, &count) != 0) {
+        return -1;
+    }
+    
+    // Overlay contents are mostly links into the store, so a path resolves to either the overlay or its store
+    bool managed = false;
+    for (int i = 0; i < count && !managed; i++) {
+        char target[PATH_MAX];
+        char store[PATH_MAX];
+        if (realpath(list[i].target_path, target) != NULL && is_tmpfs_mount(target) && (strcmp(resolved, target) == 0 || path_is_nested_in(resolved, target))) {
+            managed = true;
+        }
+        else if (realpath(list[i].backing_store, store) != NULL && path_is_nested_in(store, OVERLAY_STORE_PREFIX) && path_is_nested_in(resolved, store)) {
+            managed = true;
+        }
+    }
+    free(list);
+    
+    if (!managed) {
+        fprintf(stderr, "Refusing to change permissions of %s: not inside a mounted overlay\n", resolved);
+        return -1;
+    }
+    
+    // Changed through a descriptor, so the last component can't be swapped for a link after the check
+    int fd = open(resolved, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot open %s: %s\n", resolved, strerror(errno));
+        return -1;
+    }
+    
+    int ret = fchmod(fd, mode & 0777);
+    if (ret != 0) {
+        fprintf(stderr, "fchmod('%s') failed: %s\n", resolved, strerror(errno));
+    }
+    close(fd);
+    return ret == 0 ? 0 : -1;
 }
 
-bool is_mount_point(const char *path) {
-    struct statfs fs;
-    if (statfs(path, &fs) != 0) {
-        return false;
+bool is_tmpfs_mount(const char *path) {
+    // Mount points themselves are answered straight from the mount table snapshot
+    mount_table_entry_t entry;
+    if (mount_table_lookup_path(path, &entry)) {
+        return entry.is_tmpfs;
     }
     
-    struct stat path_stat, parent_stat;
-    if (stat(path, &path_stat) != 0) {
+    // Anything else is resolved to the filesystem that contains it
+    struct stat st;
+    if (stat(path, &st) != 0) {
         return false;
     }
     
-    char parent_path[PATH_MAX];
-    if (snprintf(parent_path, sizeof(parent_path), "%s/..", path) >= sizeof(parent_path)) {
+    if (mount_table_lookup_device(st.st_dev, &entry)) {
+        return entry.is_tmpfs;
+    }
+    
+    struct statfs fs;
+    if (statfs(path, &fs) != 0) {
         return false;
     }
     
-    if (stat(parent_path, &parent_stat) != 0) {
+    return strstr(fs.f_fstypename, "tmpfs") != NULL;
+}
+
+bool is_mount_point(const char *path) {
+    if (path == NULL) {
         return false;
     }
     
-    return path_stat.st_dev != parent_stat.st_dev;
+    return mount_table_lookup_path(path, NULL);
 }
 
 kern_return_t unmount_if_mounted(const char *path) {
@@ -185,6 +652,7 @@ kern_return_t unmount_if_mounted(const char *path) {
             fprintf(stderr, "Failed to unmount %s: %s\n", path, strerror(errno));
             return -1;
         }
+        mount_table_invalidate();
     }
     
     return 0;
@@ -241,117 +709,112 @@ static kern_return_t copy_dir_recursive(const char *src, const char *dst) {
         return -1;
     }
     
-    DIR *dir = opendir(src);
-    if (dir == NULL) {
-        fprintf(stderr, "Failed to opendir('%s'): %s\n", src, strerror(errno));
+    // Top-level subdirectories are copied concurrently; the visitor only touches fds it was handed
+    fs_walk_options_t options = {0};
+    options.parallel = true;
+    if (fs_walk(src, &options, copy_tree_visitor, (void *)dst) != 0) {
+        fprintf(stderr, "Failed to copy '%s' -> '%s'\n", src, dst);
+        return -1;
+    }
+    
+    return 0;
+}
+
+static kern_return_t write_overlay_config(const overlay_info_t *overlay) {
+    if (overlay == NULL) {
         return -1;
     }
     
-    kern_return_t ret = ensure_directory_exists(dst);
+    kern_return_t ret = ensure_directory_exists("/var/jb/overlays");
     if (ret != 0) {
-        closedir(dir);
         return ret;
     }
     
-    struct dirent *ent;
-    while ((ent = readdir(dir)) != NULL) {
-        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
-            continue;
-        }
-        
-        if (strcmp(ent->d_name, ".fseventsd") == 0) {
-            continue;
-        }
-        
-        char src_path[PATH_MAX];
-        if (snprintf(src_path, sizeof(src_path), "%s/%s", src, ent->d_name) >= sizeof(src_path)) {
-            fprintf(stderr, "Path too long: %s/%s\n", src, ent->d_name);
-            closedir(dir);
-            return -1;
-        }
-        
-        char dst_path[PATH_MAX];
-        if (snprintf(dst_path, sizeof(dst_path), "%s/%s", dst, ent->d_name) >= sizeof(dst_path)) {
-            fprintf(stderr, "Path too long: %s/%s\n", dst, ent->d_name);
-            closedir(dir);
-            return -1;
+    pthread_mutex_lock(&g_overlay_config_lock);
+    overlay_info_t *list = NULL;
+    int count = 0;
+    ret = read_overlay_config(&list, &count);
+    if (ret != 0) {
+        pthread_mutex_unlock(&g_overlay_config_lock);
+        return ret;
+    }
+    
+    // An overlay that's already listed only has its recorded size updated
+    bool found = false;
+    for (int i = 0; i < count; i++) {
+        if (strcmp(list[i].target_path, overlay->target_path) == 0) {
+            if (overlay->estimated_nodes == 0 && overlay->estimated_bytes == 0) {
+                free(list);
+                pthread_mutex_unlock(&g_overlay_config_lock);
+                return 0;
+            }
+            
+            list[i].estimated_nodes = overlay->estimated_nodes;
+            list[i].estimated_bytes = overlay->estimated_bytes;
+            found = true;
+            break;
         }
-        
-        struct stat st;
-        if (lstat(src_path, &st) != 0) {
-            fprintf(stderr, "Failed to lstat('%s'): %s\n", src_path, strerror(errno));
-            closedir(dir);
+    }
+    
+    if (!found) {
+        overlay_info_t *new_list = realloc(list, (count + 1) * sizeof(overlay_info_t));
+        if (new_list == NULL) {
+            free(list);
+            pthread_mutex_unlock(&g_overlay_config_lock);
+            fprintf(stderr, "Memory allocation failure\n");
             return -1;
         }
         
-        if (S_ISDIR(st.st_mode) && !S_ISLNK(st.st_mode)) {
-            ret = copy_dir_recursive(src_path, dst_path);
-            if (ret != 0) {
-                closedir(dir);
-                return ret;
-            }
-        }
-        else {
-            copyfile_state_t cst = copyfile_state_alloc();
-            if (cst == NULL) {
-                fprintf(stderr, "Failed to allocate copyfile state\n");
-                closedir(dir);
-                return -1;
-            }
-
-            if (copyfile(src_path, dst_path, cst, COPYFILE_ALL) != 0) {
-                if (errno == ENOENT) {
-                    fprintf(stderr, "Warning: Source missing, skipping '%s'\n", src_path);
-                    copyfile_state_free(cst);
-                    continue;
-                }
-                else {
-                    fprintf(stderr, "Failed copy '%s' -> '%s': %s\n", src_path, dst_path, strerror(errno));
-                    copyfile_state_free(cst);
-                    closedir(dir);
-                    return -1;
-                }
-            }
+        list = new_list;
+        list[count++] = *overlay;
+    }
+    
+    ret = save_overlay_config(list, count);
+    free(list);
+    pthread_mutex_unlock(&g_overlay_config_lock);
+    return ret;
+}
 
-            copyfile_state_free(cst);
+// Overlays that aren't in the config are left out of it
+static kern_return_t update_overlay_estimate(const char *target_path, uint64_t nodes, uint64_t bytes) {
+    pthread_mutex_lock(&g_overlay_config_lock);
+    overlay_info_t *list = NULL;
+    int count = 0;
+    kern_return_t ret = read_overlay_config(&list, &count);
+    for (int i = 0; ret == 0 && i < count; i++) {
+        if (strcmp(list[i].target_path, target_path) == 0) {
+            list[i].estimated_nodes = nodes;
+            list[i].estimated_bytes = bytes;
+            ret = save_overlay_config(list, count);
+            break;
         }
     }
     
-    closedir(dir);
-    return 0;
+    free(list);
+    pthread_mutex_unlock(&g_overlay_config_lock);
+    return ret;
 }
 
-static kern_return_t write_overlay_config(const overlay_info_t *overlay) {
-    if (overlay == NULL) {
+// Call with g_overlay_config_lock held. Written to a temporary file and renamed, so a crash can't leave half a config
+static kern_return_t save_overlay_config(const overlay_info_t *list, int count) {
+    char temp_path[PATH_MAX];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", OVERLAY_CONFIG_PATH);
+    FILE *f = fopen(temp_path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "Cannot open config '%s': %s\n", temp_path, strerror(errno));
         return -1;
     }
     
-    kern_return_t ret = ensure_directory_exists("/var/jb/overlays");
-    if (ret != 0) {
-        return ret;
-    }
-    
-    overlay_info_t *existing = NULL;
-    int count = 0;
-    ret = read_overlay_config(&existing, &count);
-    if (ret == 0 && existing != NULL) {
-        for (int i = 0; i < count; i++) {
-            if (strcmp(existing[i].target_path, overlay->target_path) == 0) {
-                free(existing);
-                return 0;
-            }
-        }
-        free(existing);
+    for (int i = 0; i < count; i++) {
+        fprintf(f, "%s|%s|%llu|%llu\n", list[i].target_path, list[i].backing_store, list[i].estimated_nodes, list[i].estimated_bytes);
     }
     
-    FILE *f = fopen(OVERLAY_CONFIG_PATH, "a");
-    if (f == NULL) {
-        fprintf(stderr, "Cannot open config '%s': %s\n", OVERLAY_CONFIG_PATH, strerror(errno));
+    if (fclose(f) != 0 || rename(temp_path, OVERLAY_CONFIG_PATH) != 0) {
+        fprintf(stderr, "Failed to write config '%s': %s\n", OVERLAY_CONFIG_PATH, strerror(errno));
+        unlink(temp_path);
         return -1;
     }
     
-    fprintf(f, "%s|%s\n", overlay->target_path, overlay->backing_store);
-    fclose(f);
     return 0;
 }
 
@@ -392,6 +855,18 @@ static kern_return_t read_overlay_config(overlay_info_t **overlays_out, int *cou
         const char *target = line;
         const char *store = sep + 1;
         
+        // Lines written before sizes were recorded end after the store path
+        unsigned long long nodes = 0;
+        unsigned long long bytes = 0;
+        char *sizes = strchr(store, '|');
+        if (sizes != NULL) {
+            *sizes = '\0';
+            if (sscanf(sizes + 1, "%llu|%llu", &nodes, &bytes) != 2) {
+                nodes = 0;
+                bytes = 0;
+            }
+        }
+        
         if (count >= capacity) {
             capacity = (capacity == 0) ? 8 : capacity * 2;
             overlay_info_t *new_list = realloc(list, capacity * sizeof(overlay_info_t));
@@ -407,6 +882,8 @@ static kern_return_t read_overlay_config(overlay_info_t **overlays_out, int *cou
         memset(&list[count], 0, sizeof(overlay_info_t));
         strncpy(list[count].target_path, target, sizeof(list[count].target_path) - 1);
         strncpy(list[count].backing_store, store, sizeof(list[count].backing_store) - 1);
+        list[count].estimated_nodes = nodes;
+        list[count].estimated_bytes = bytes;
         count++;
     }
     fclose(f);
@@ -421,279 +898,562 @@ static kern_return_t remove_directory_recursive(const char *path) {
         return -1;
     }
     
-    struct stat st;
-    if (lstat(path, &st) != 0) {
-        if (errno == ENOENT) {
-            return 0;
-        }
-        fprintf(stderr, "Could not lstat '%s': %s\n", path, strerror(errno));
+    return remove_item_at(AT_FDCWD, path);
+}
+
+static kern_return_t list_store_entries(const char *store_path, store_entry_list_t *entries) {
+    // Only the store's top level is linked, so the walk never descends
+    fs_walk_options_t options = {0};
+    options.max_depth = 1;
+    return (fs_walk(store_path, &options, collect_store_entry_visitor, entries) == 0) ? 0 : -1;
+}
+
+static void free_store_entries(store_entry_list_t *entries) {
+    for (int i = 0; i < entries->count; i++) {
+        free(entries->names[i]);
+    }
+    
+    free(entries->names);
+    memset(entries, 0, sizeof(*entries));
+}
+
+static kern_return_t link_store_entries(const char *store_path, const store_entry_list_t *entries, const char *overlay_path) {
+    if (store_path == NULL || entries == NULL || overlay_path == NULL) {
         return -1;
     }
     
-    if (S_ISDIR(st.st_mode) && !S_ISLNK(st.st_mode)) {
-        DIR *dir = opendir(path);
-        if (dir == NULL) {
-            fprintf(stderr, "remove_directory_recursive(), opendir('%s') failed: %s\n", path, strerror(errno));
-            return -1;
+    int overlay_fd = open(overlay_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (overlay_fd < 0) {
+        fprintf(stderr, "open('%s') failed: %s\n", overlay_path, strerror(errno));
+        return -1;
+    }
+    
+    // Link targets share the store prefix, only the last component is rewritten per entry
+    char store_item[PATH_MAX];
+    int prefix_len = snprintf(store_item, sizeof(store_item), "%s/", store_path);
+    if (prefix_len < 0 || prefix_len >= sizeof(store_item)) {
+        fprintf(stderr, "Path too long: %s\n", store_path);
+        close(overlay_fd);
+        return -1;
+    }
+    
+    kern_return_t ret = 0;
+    for (int i = 0; i < entries->count; i++) {
+        const char *name = entries->names[i];
+        if (strlcpy(store_item + prefix_len, name, sizeof(store_item) - prefix_len) >= sizeof(store_item) - prefix_len) {
+            fprintf(stderr, "Path too long: %s/%s\n", store_path, name);
+            ret = -1;
+            break;
         }
         
-        struct dirent *ent;
-        kern_return_t ret = 0;
-        while ((ent = readdir(dir)) != NULL) {
-            if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
-                continue;
-            }
-            
-            if (strcmp(ent->d_name, ".fseventsd") == 0) {
-                continue;
-            }
-            
-            char subpath[PATH_MAX];
-            if (snprintf(subpath, sizeof(subpath), "%s/%s", path, ent->d_name) >= sizeof(subpath)) {
-                fprintf(stderr, "Path too long: %s/%s\n", path, ent->d_name);
-                ret = -1;
-                break;
-            }
-            
-            if (remove_directory_recursive(subpath) != 0) {
+        if (symlinkat(store_item, overlay_fd, name) != 0) {
+            // A freshly mounted tmpfs is empty, so this only happens when linking over an existing overlay
+            if (errno != EEXIST || remove_item_at(overlay_fd, name) != 0 || symlinkat(store_item, overlay_fd, name) != 0) {
+                fprintf(stderr, "Failed symlink('%s','%s/%s'): %s\n", store_item, overlay_path, name, strerror(errno));
                 ret = -1;
                 break;
             }
         }
-        
-        closedir(dir);
-        if (ret != 0) {
-            return ret;
-        }
-        
-        if (rmdir(path) != 0) {
-            if (errno == EBUSY && is_mount_point(path)) {
-                return 0;
-            }
-            
-            fprintf(stderr, "rmdir('%s') failed: %s\n", path, strerror(errno));
-            return -1;
-        }
     }
-    else {
-        if (unlink(path) != 0) {
-            fprintf(stderr, "unlink('%s') failed: %s\n", path, strerror(errno));
-            return -1;
-        }
+    
+    close(overlay_fd);
+    return ret;
+}
+
+static kern_return_t commit_item_recursive(const char *overlay_item, const char *store_item, const char *store_prefix) {
+    if (overlay_item == NULL || store_item == NULL || store_prefix == NULL) {
+        return -1;
     }
     
-    return 0;
+    commit_walk_t walk = {
+        .store_root = store_item,
+        .store_prefix = store_prefix,
+        .store_prefix_len = strlen(store_prefix),
+    };
+    
+    return (fs_walk(overlay_item, NULL, commit_tree_visitor, &walk) == 0) ? 0 : -1;
+}
+
+static bool is_fseventsd(const fs_walk_entry_t *entry) {
+    return entry->depth > 0 && strcmp(entry->name, ".fseventsd") == 0;
+}
+
+static bool entry_is_mount_point(const fs_walk_entry_t *entry) {
+    if (entry->parent_fd == AT_FDCWD) {
+        return is_mount_point(entry->name);
+    }
+    
+    // A directory on a different device than its parent is the root of a mount
+    struct stat dir_st;
+    struct stat parent_st;
+    if (fstat(entry->fd, &dir_st) != 0 || fstat(entry->parent_fd, &parent_st) != 0) {
+        return false;
+    }
+    
+    return dir_st.st_dev != parent_st.st_dev;
 }
 
-static kern_return_t symlink_contents_of_dir(const char *store_path, const char *overlay_path) {
-    if (store_path == NULL || overlay_path == NULL) {
+static kern_return_t store_path_for_entry(const char *store_root, const fs_walk_entry_t *entry, char *buf, size_t buf_size) {
+    int written = (entry->relpath[0] == '\0') ? snprintf(buf, buf_size, "%s", store_root) : snprintf(buf, buf_size, "%s/%s", store_root, entry->relpath);
+    if (written < 0 || (size_t)written >= buf_size) {
+        fprintf(stderr, "Path too long: %s/%s\n", store_root, entry->relpath);
         return -1;
     }
     
-    DIR *d = opendir(store_path);
-    if (d == NULL) {
-        fprintf(stderr, "opendir***('%s') failed: %s\n", store_path, strerror(errno));
+    return 0;
+}
+
+static int open_or_create_dir_at(int dir_fd, const char *name) {
+    if (mkdirat(dir_fd, name, 0755) != 0 && errno != EEXIST) {
         return -1;
     }
     
-    kern_return_t ret = 0;
-    struct dirent *ent;
-    while ((ent = readdir(d)) != NULL) {
-        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
-            continue;
+    int fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0 && (errno == ENOTDIR || errno == ELOOP)) {
+        // Something other than a directory is in the way
+        if (remove_item_at(dir_fd, name) != 0 || mkdirat(dir_fd, name, 0755) != 0) {
+            return -1;
         }
         
-        if (strcmp(ent->d_name, ".fseventsd") == 0) {
-            continue;
+        fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    }
+    
+    return fd;
+}
+
+static int copy_item_at(int src_dir_fd, const char *name, uint8_t type, int dst_dir_fd, const char *display_path) {
+    if (type == DT_LNK) {
+        // Links are replicated as links rather than followed, so the copy resolves exactly like the original
+        char target[PATH_MAX];
+        ssize_t len = readlinkat(src_dir_fd, name, target, sizeof(target) - 1);
+        if (len < 0) {
+            if (errno == ENOENT) {
+                fprintf(stderr, "Warning: Source missing, skipping '%s'\n", display_path);
+                return 1;
+            }
+            
+            fprintf(stderr, "readlink('%s') failed: %s\n", display_path, strerror(errno));
+            return -1;
         }
+        target[len] = '\0';
         
-        char store_item[PATH_MAX];
-        if (snprintf(store_item, sizeof(store_item), "%s/%s", store_path, ent->d_name) >= sizeof(store_item)) {
-            fprintf(stderr, "Path too long: %s/%s\n", store_path, ent->d_name);
-            ret = -1;
-            break;
+        if (symlinkat(target, dst_dir_fd, name) != 0) {
+            if (errno != EEXIST || unlinkat(dst_dir_fd, name, 0) != 0 || symlinkat(target, dst_dir_fd, name) != 0) {
+                fprintf(stderr, "Failed to copy link '%s': %s\n", display_path, strerror(errno));
+                return -1;
+            }
         }
         
-        char overlay_item[PATH_MAX];
-        if (snprintf(overlay_item, sizeof(overlay_item), "%s/%s", overlay_path, ent->d_name) >= sizeof(overlay_item)) {
-            fprintf(stderr, "Path too long: %s/%s\n", overlay_path, ent->d_name);
-            ret = -1;
-            break;
+        return 0;
+    }
+    
+    if (type != DT_REG) {
+        fprintf(stderr, "Warning: Not a regular file, skipping '%s'\n", display_path);
+        return 1;
+    }
+    
+    int src_fd = openat(src_dir_fd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (src_fd < 0) {
+        if (errno == ENOENT) {
+            fprintf(stderr, "Warning: Source missing, skipping '%s'\n", display_path);
+            return 1;
         }
         
-        if (symlink(store_item, overlay_item) != 0) {
-            if (errno == EEXIST) {
-                if (remove_directory_recursive(overlay_item) != 0) {
-                    ret = -1;
-                    break;
-                }
-                
-                if (symlink(store_item, overlay_item) != 0) {
-                    fprintf(stderr, "Failed symlink('%s','%s'): %s\n", store_item, overlay_item, strerror(errno));
-                    ret = -1;
-                    break;
+        fprintf(stderr, "Failed to open '%s': %s\n", display_path, strerror(errno));
+        return -1;
+    }
+    
+    struct stat st;
+    if (fstat(src_fd, &st) != 0) {
+        fprintf(stderr, "fstat('%s') failed: %s\n", display_path, strerror(errno));
+        close(src_fd);
+        return -1;
+    }
+    
+    int dst_fd = openat(dst_dir_fd, name, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, st.st_mode & 07777);
+    if (dst_fd < 0) {
+        fprintf(stderr, "Failed to create copy of '%s': %s\n", display_path, strerror(errno));
+        close(src_fd);
+        return -1;
+    }
+    
+    int ret = 0;
+    if (fcopyfile(src_fd, dst_fd, NULL, COPYFILE_ALL) != 0) {
+        fprintf(stderr, "Failed copy '%s': %s\n", display_path, strerror(errno));
+        ret = -1;
+    }
+    
+    close(dst_fd);
+    close(src_fd);
+    return ret;
+}
+
+static fs_walk_action_t copy_tree_visitor(fs_walk_entry_t *entry, fs_walk_phase_t phase, void *info) {
+    const char *dst_root = (const char *)info;
+    if (is_fseventsd(entry)) {
+        return FS_WALK_SKIP;
+    }
+    
+    switch (phase) {
+        case FS_WALK_ENTER_DIR: {
+            int dst_fd = -1;
+            if (entry->depth == 0) {
+                if (ensure_directory_exists(dst_root) == 0) {
+                    dst_fd = open(dst_root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
                 }
             }
             else {
-                fprintf(stderr, "Failed symlink('%s','%s'): %s\n", store_item, overlay_item, strerror(errno));
-                ret = -1;
-                break;
+                dst_fd = open_or_create_dir_at(CTX_DIR_FD(entry->parent_ctx), entry->name);
             }
+            
+            if (dst_fd < 0) {
+                fprintf(stderr, "Failed to create '%s/%s': %s\n", dst_root, entry->relpath, strerror(errno));
+                return FS_WALK_STOP;
+            }
+            
+            entry->ctx = DIR_FD_CTX(dst_fd);
+            return FS_WALK_CONTINUE;
         }
+        case FS_WALK_LEAVE_DIR:
+            close(CTX_DIR_FD(entry->ctx));
+            return FS_WALK_CONTINUE;
+        case FS_WALK_ITEM:
+            if (entry->depth == 0) {
+                fprintf(stderr, "Failed to opendir('%s'): not a directory\n", entry->name);
+                return FS_WALK_STOP;
+            }
+            
+            return (copy_item_at(entry->parent_fd, entry->name, entry->type, CTX_DIR_FD(entry->parent_ctx), entry->relpath) < 0) ? FS_WALK_STOP : FS_WALK_CONTINUE;
     }
     
-    closedir(d);
-    return ret;
+    return FS_WALK_CONTINUE;
 }
 
-static bool is_symlink_pointing_to_store(const char *item_path, const char *store_prefix) {
-    if (item_path == NULL || store_prefix == NULL) {
-        return false;
+static fs_walk_action_t remove_tree_visitor(fs_walk_entry_t *entry, fs_walk_phase_t phase, void *info) {
+    if (is_fseventsd(entry)) {
+        return FS_WALK_SKIP;
     }
     
+    switch (phase) {
+        case FS_WALK_ENTER_DIR:
+            return FS_WALK_CONTINUE;
+        case FS_WALK_LEAVE_DIR:
+            if (entry->aborted) {
+                return FS_WALK_CONTINUE;
+            }
+            
+            if (unlinkat(entry->parent_fd, entry->name, AT_REMOVEDIR) != 0) {
+                if (errno == EBUSY && entry_is_mount_point(entry)) {
+                    return FS_WALK_CONTINUE;
+                }
+                
+                fprintf(stderr, "rmdir('%s') failed: %s\n", entry->name, strerror(errno));
+                return FS_WALK_STOP;
+            }
+            
+            return FS_WALK_CONTINUE;
+        case FS_WALK_ITEM:
+            if (unlinkat(entry->parent_fd, entry->name, 0) != 0) {
+                if (errno == ENOENT && entry->depth == 0) {
+                    return FS_WALK_CONTINUE;
+                }
+                
+                fprintf(stderr, "unlink('%s') failed: %s\n", entry->name, strerror(errno));
+                return FS_WALK_STOP;
+            }
+            
+            return FS_WALK_CONTINUE;
+    }
+    
+    return FS_WALK_CONTINUE;
+}
+
+static kern_return_t remove_item_at(int dir_fd, const char *name) {
+    return (fs_walk_at(dir_fd, name, NULL, remove_tree_visitor, NULL) == 0) ? 0 : -1;
+}
+
+static fs_walk_action_t collect_store_entry_visitor(fs_walk_entry_t *entry, fs_walk_phase_t phase, void *info) {
+    store_entry_list_t *entries = (store_entry_list_t *)info;
+    if (phase != FS_WALK_ITEM || is_fseventsd(entry)) {
+        return FS_WALK_CONTINUE;
+    }
+    
+    if (entry->depth == 0) {
+        fprintf(stderr, "opendir('%s') failed: not a directory\n", entry->name);
+        return FS_WALK_STOP;
+    }
+    
+    if (entries->count == entries->capacity) {
+        int capacity = entries->capacity ? entries->capacity * 2 : 64;
+        char **grown = realloc(entries->names, capacity * sizeof(char *));
+        if (grown == NULL) {
+            return FS_WALK_STOP;
+        }
+        
+        entries->names = grown;
+        entries->capacity = capacity;
+    }
+    
+    char *name = strdup(entry->name);
+    if (name == NULL) {
+        return FS_WALK_STOP;
+    }
+    
+    entries->names[entries->count++] = name;
+    return FS_WALK_CONTINUE;
+}
+
+static bool is_symlink_pointing_to_store_at(int dir_fd, const char *name, const commit_walk_t *walk) {
     char buf[PATH_MAX];
-    ssize_t len = readlink(item_path, buf, sizeof(buf) - 1);
+    ssize_t len = readlinkat(dir_fd, name, buf, sizeof(buf) - 1);
     if (len < 0) {
         return false;
     }
     buf[len] = '\0';
     
-    if (strncmp(buf, store_prefix, strlen(store_prefix)) == 0) {
-        return true;
-    }
-    
-    return false;
+    return strncmp(buf, walk->store_prefix, walk->store_prefix_len) == 0;
 }
 
-static kern_return_t commit_item_recursive(const char *overlay_item, const char *store_item, const char *store_prefix) {
-    if (overlay_item == NULL || store_item == NULL || store_prefix == NULL) {
+static kern_return_t replace_with_store_link(const fs_walk_entry_t *entry, const char *store_item) {
+    if (remove_item_at(entry->parent_fd, entry->name) != 0) {
         return -1;
     }
     
-    struct stat st;
-    if (lstat(overlay_item, &st) != 0) {
-        if (errno == ENOENT) {
-            return 0;
-        }
-        
-        fprintf(stderr, "lstat('%s') failed: %s\n", overlay_item, strerror(errno));
+    if (symlinkat(store_item, entry->parent_fd, entry->name) != 0) {
+        fprintf(stderr, "symlink('%s','%s') failed: %s\n", store_item, entry->name, strerror(errno));
         return -1;
     }
     
-    if (S_ISLNK(st.st_mode) && is_symlink_pointing_to_store(overlay_item, store_prefix)) {
-        return 0;
+    return 0;
+}
+
+static fs_walk_action_t commit_tree_visitor(fs_walk_entry_t *entry, fs_walk_phase_t phase, void *info) {
+    commit_walk_t *walk = (commit_walk_t *)info;
+    if (is_fseventsd(entry)) {
+        return FS_WALK_SKIP;
     }
     
-    if (S_ISDIR(st.st_mode) && !S_ISLNK(st.st_mode)) {
-        kern_return_t ret = ensure_directory_exists(store_item);
-        if (ret != 0) {
-            return ret;
-        }
-        
-        DIR *d = opendir(overlay_item);
-        if (d == NULL) {
-            fprintf(stderr, "opendir*('%s') failed: %s\n", overlay_item, strerror(errno));
-            return -1;
+    char store_item[PATH_MAX];
+    switch (phase) {
+        case FS_WALK_ENTER_DIR: {
+            int store_fd = -1;
+            if (entry->depth == 0) {
+                if (ensure_directory_exists(walk->store_root) == 0) {
+                    store_fd = open(walk->store_root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                }
+            }
+            else {
+                store_fd = open_or_create_dir_at(CTX_DIR_FD(entry->parent_ctx), entry->name);
+            }
+            
+            if (store_fd < 0) {
+                fprintf(stderr, "Failed to create store directory for '%s': %s\n", entry->relpath, strerror(errno));
+                return FS_WALK_STOP;
+            }
+            
+            entry->ctx = DIR_FD_CTX(store_fd);
+            return FS_WALK_CONTINUE;
         }
-        
-        struct dirent *ent;
-        kern_return_t ret_dir = 0;
-        while ((ent = readdir(d)) != NULL) {
-            if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
-                continue;
+        case FS_WALK_LEAVE_DIR:
+            close(CTX_DIR_FD(entry->ctx));
+            if (entry->aborted || entry_is_mount_point(entry)) {
+                return FS_WALK_CONTINUE;
             }
             
-            if (strcmp(ent->d_name, ".fseventsd") == 0) {
-                continue;
+            // Everything below has been committed, so the directory itself can become a link into the store
+            if (store_path_for_entry(walk->store_root, entry, store_item, sizeof(store_item)) != 0 || replace_with_store_link(entry, store_item) != 0) {
+                return FS_WALK_STOP;
             }
             
-            char child_overlay[PATH_MAX];
-            if (snprintf(child_overlay, sizeof(child_overlay), "%s/%s", overlay_item, ent->d_name) >= sizeof(child_overlay)) {
-                fprintf(stderr, "Path too long: %s/%s\n", overlay_item, ent->d_name);
-                ret_dir = -1;
-                break;
+            return FS_WALK_CONTINUE;
+        case FS_WALK_ITEM: {
+            if (entry->depth == 0) {
+                if (entry->type == DT_UNKNOWN) {
+                    // Nothing there to commit
+                    return FS_WALK_CONTINUE;
+                }
+                
+                fprintf(stderr, "Cannot commit '%s': not a directory\n", entry->name);
+                return FS_WALK_STOP;
             }
             
-            char child_store[PATH_MAX];
-            if (snprintf(child_store, sizeof(child_store), "%s/%s", store_item, ent->d_name) >= sizeof(child_store)) {
-                fprintf(stderr, "Path too long: %s/%s\n", store_item, ent->d_name);
-                ret_dir = -1;
-                break;
+            if (entry->type == DT_LNK && is_symlink_pointing_to_store_at(entry->parent_fd, entry->name, walk)) {
+                return FS_WALK_CONTINUE;
             }
             
-            if (commit_item_recursive(child_overlay, child_store, store_prefix) != 0) {
-                ret_dir = -1;
-                break;
+            int store_dir_fd = CTX_DIR_FD(entry->parent_ctx);
+            struct stat st;
+            if (fstatat(store_dir_fd, entry->name, &st, AT_SYMLINK_NOFOLLOW) == 0 && remove_item_at(store_dir_fd, entry->name) != 0) {
+                return FS_WALK_STOP;
             }
+            
+            int copied = copy_item_at(entry->parent_fd, entry->name, entry->type, store_dir_fd, entry->relpath);
+            if (copied < 0) {
+                return FS_WALK_STOP;
+            }
+            else if (copied > 0) {
+                // Skipped, leave the overlay's item alone
+                return FS_WALK_CONTINUE;
+            }
+            
+            if (store_path_for_entry(walk->store_root, entry, store_item, sizeof(store_item)) != 0 || replace_with_store_link(entry, store_item) != 0) {
+                return FS_WALK_STOP;
+            }
+            
+            return FS_WALK_CONTINUE;
         }
-        
-        closedir(d);
-        if (ret_dir != 0) {
-            return ret_dir;
-        }
-        
-        struct stat overlay_stat, parent_stat;
-        char parent_path[PATH_MAX];
-        snprintf(parent_path, sizeof(parent_path), "%s/..", overlay_item);
-        if (stat(overlay_item, &overlay_stat) == 0 && stat(parent_path, &parent_stat) == 0 && overlay_stat.st_dev != parent_stat.st_dev) {
-            return 0;
-        }
-        
-        if (remove_directory_recursive(overlay_item) != 0) {
-            return -1;
-        }
-        
-        if (symlink(store_item, overlay_item) != 0) {
-            fprintf(stderr, "symlink('%s','%s') failed: %s\n", store_item, overlay_item, strerror(errno));
-            return -1;
-        }
-        
+    }
+    
+    return FS_WALK_CONTINUE;
+}
+
+static kern_return_t estimate_tree_usage(const char *path, uint64_t *nodes_out, uint64_t *bytes_out) {
+    usage_walk_t walk;
+    atomic_init(&walk.nodes, 0);
+    atomic_init(&walk.bytes, 0);
+    
+    fs_walk_options_t options = {0};
+    options.parallel = true;
+    if (fs_walk(path, &options, usage_visitor, &walk) != 0) {
+        return -1;
+    }
+    
+    *nodes_out = atomic_load(&walk.nodes);
+    *bytes_out = atomic_load(&walk.bytes);
+    return 0;
+}
+
+static kern_return_t link_target_usage(const char *target, uint64_t mount_generation, uint64_t store_generation, uint64_t *bytes_out) {
+    size_t slot = 0;
+    for (const char *c = target; *c; c++) {
+        slot = slot * 31 + (unsigned char)*c;
+    }
+    slot %= LINK_USAGE_CACHE_SIZE;
+    
+    pthread_mutex_lock(&g_link_usage_lock);
+    if (g_link_usage == NULL) {
+        g_link_usage = calloc(LINK_USAGE_CACHE_SIZE, sizeof(link_usage_t));
+    }
+    
+    link_usage_t *entry = g_link_usage ? &g_link_usage[slot] : NULL;
+    if (entry && entry->mount_generation == mount_generation && entry->store_generation == store_generation && strcmp(entry->target, target) == 0) {
+        *bytes_out = entry->bytes;
+        pthread_mutex_unlock(&g_link_usage_lock);
         return 0;
     }
+    pthread_mutex_unlock(&g_link_usage_lock);
     
-    {
-        char store_dir[PATH_MAX];
-        strncpy(store_dir, store_item, sizeof(store_dir) - 1);
-        store_dir[sizeof(store_dir) - 1] = '\0';
-        
-        char *slash = strrchr(store_dir, '/');
-        if (slash) {
-            *slash = '\0';
-            kern_return_t ret = ensure_directory_exists(store_dir);
-            if (ret != 0) {
-                return ret;
-            }
-        }
-        
-        struct stat st2;
-        if (lstat(store_item, &st2) == 0) {
-            if (remove_directory_recursive(store_item) != 0) {
-                return -1;
-            }
-        }
-        
-        copyfile_state_t cst = copyfile_state_alloc();
-        if (cst == NULL) {
-            fprintf(stderr, "Failed to allocate copyfile state\n");
-            return -1;
+    // Walked outside the lock. Two callers missing on the same target both walk it, which is harmless
+    uint64_t nodes = 0;
+    if (estimate_tree_usage(target, &nodes, bytes_out) != 0) {
+        return -1;
+    }
+    
+    pthread_mutex_lock(&g_link_usage_lock);
+    if (entry) {
+        strlcpy(entry->target, target, sizeof(entry->target));
+        entry->mount_generation = mount_generation;
+        entry->store_generation = store_generation;
+        entry->bytes = *bytes_out;
+    }
+    pthread_mutex_unlock(&g_link_usage_lock);
+    return 0;
+}
+
+// Double a tmpfs limit without going past `limit`, or shrinking one that was already mounted above it
+static uint64_t grown_limit(uint64_t current, uint64_t limit) {
+    uint64_t grown = current * 2;
+    if (grown > limit) {
+        grown = limit;
+    }
+    
+    return grown > current ? grown : current;
+}
+
+static void size_overlay_limits(uint64_t nodes, uint64_t bytes, struct tmpfs_args *args_out) {
+    uint64_t max_nodes = nodes * OVERLAY_SIZE_HEADROOM;
+    if (max_nodes < OVERLAY_MIN_NODES) {
+        max_nodes = OVERLAY_MIN_NODES;
+    }
+    else if (max_nodes > OVERLAY_MAX_NODES) {
+        max_nodes = OVERLAY_MAX_NODES;
+    }
+    
+    uint64_t max_bytes = bytes * OVERLAY_SIZE_HEADROOM;
+    if (max_bytes < OVERLAY_MIN_BYTES) {
+        max_bytes = OVERLAY_MIN_BYTES;
+    }
+    else if (max_bytes > OVERLAY_MAX_BYTES) {
+        max_bytes = OVERLAY_MAX_BYTES;
+    }
+    
+    args_out->max_nodes = max_nodes;
+    args_out->max_pages = max_bytes / getpagesize();
+    args_out->case_insensitive = 0;
+}
+
+static kern_return_t read_overlay_usage(const char *path, overlay_metrics_t *metrics) {
+    struct statfs fs;
+    if (statfs(path, &fs) != 0) {
+        fprintf(stderr, "statfs('%s') failed: %s\n", path, strerror(errno));
+        return -1;
+    }
+    
+    // tmpfs reports its limits as the filesystem's total blocks and inodes
+    uint64_t page_size = getpagesize();
+    metrics->max_pages = (uint64_t)fs.f_blocks * fs.f_bsize / page_size;
+    metrics->pages_used = (uint64_t)(fs.f_blocks - fs.f_bfree) * fs.f_bsize / page_size;
+    metrics->max_nodes = fs.f_files;
+    metrics->nodes_used = fs.f_files - fs.f_ffree;
+    return 0;
+}
+
+static fs_walk_action_t usage_visitor(fs_walk_entry_t *entry, fs_walk_phase_t phase, void *info) {
+    usage_walk_t *walk = (usage_walk_t *)info;
+    if (phase == FS_WALK_LEAVE_DIR) {
+        return FS_WALK_CONTINUE;
+    }
+    
+    atomic_fetch_add(&walk->nodes, 1);
+    if (phase == FS_WALK_ITEM && entry->type == DT_REG) {
+        struct stat st;
+        if (fstatat(entry->parent_fd, entry->name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+            atomic_fetch_add(&walk->bytes, (uint64_t)st.st_size);
         }
-        
-        if (copyfile(overlay_item, store_item, cst, COPYFILE_ALL) != 0) {
-            fprintf(stderr, "Failed to copy '%s' -> '%s': %s\n", overlay_item, store_item, strerror(errno));
-            copyfile_state_free(cst);
-            return -1;
+    }
+    
+    return FS_WALK_CONTINUE;
+}
+
+static fs_walk_action_t metrics_visitor(fs_walk_entry_t *entry, fs_walk_phase_t phase, void *info) {
+    metrics_walk_t *walk = (metrics_walk_t *)info;
+    if (phase != FS_WALK_ITEM) {
+        return FS_WALK_CONTINUE;
+    }
+    
+    if (entry->type == DT_REG) {
+        struct stat st;
+        if (fstatat(entry->parent_fd, entry->name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+            walk->metrics->materialized_files++;
+            walk->metrics->materialized_bytes += st.st_size;
         }
-        copyfile_state_free(cst);
-        
-        if (remove_directory_recursive(overlay_item) != 0) {
-            return -1;
+    }
+    else if (entry->type == DT_LNK) {
+        char target[PATH_MAX];
+        ssize_t len = readlinkat(entry->parent_fd, entry->name, target, sizeof(target) - 1);
+        if (len < 0) {
+            return FS_WALK_CONTINUE;
         }
+        target[len] = '\0';
         
-        if (symlink(store_item, overlay_item) != 0) {
-            fprintf(stderr, "symlink('%s','%s') failed: %s\n", store_item, overlay_item, strerror(errno));
-            return -1;
+        if (strncmp(target, walk->store_prefix, walk->store_prefix_len) == 0) {
+            uint64_t bytes = 0;
+            walk->metrics->symlinks++;
+            if (link_target_usage(target, walk->mount_generation, walk->store_generation, &bytes) == 0) {
+                walk->metrics->symlinked_bytes += bytes;
+            }
         }
-        
-        return 0;
     }
+    
+    return FS_WALK_CONTINUE;
 }
@@ -5,10 +5,83 @@
 //  Created by Ethan Arbuckle on 4/29/25.
 //
 
+#include <sys/param.h>
+
+typedef struct {
+    char target_path[PATH_MAX];
+    // How many other restored overlays this one is nested inside. Each level is mounted concurrently
+    int level;
+    int result;
+    bool already_mounted;
+    int entries_linked;
+    // Backing store size and the tmpfs limits derived from it. A size set before mounting is used instead of walking
+    // the store, and limits set before mounting act as floors
+    uint64_t estimated_nodes;
+    uint64_t estimated_bytes;
+    uint64_t max_nodes;
+    uint64_t max_pages;
+    uint64_t seed_ns;
+    uint64_t mount_ns;
+    uint64_t link_ns;
+    uint64_t total_ns;
+} overlay_remount_report_t;
+
+typedef struct {
+    uint64_t max_pages;
+    uint64_t pages_used;
+    uint64_t max_nodes;
+    uint64_t nodes_used;
+    // Regular files written into the tmpfs itself
+    uint64_t materialized_files;
+    uint64_t materialized_bytes;
+    // Links into the backing store, and the store contents reachable through them
+    uint64_t symlinks;
+    uint64_t symlinked_bytes;
+} overlay_metrics_t;
+
 int create_or_remount_overlay_symlinks(const char *path);
 int commit_overlay_changes(const char *overlay_path);
 int reapply_all_overlays(void);
 
+/**
+  * Remount every overlay in the overlay config. Parents are mounted before the overlays nested inside
+  * them, and overlays that don't depend on each other are mounted concurrently
+  * @param reports_out If not NULL, receives a malloc'd array with one report per overlay that the caller frees
+  * @return 0 if every overlay is mounted
+ */
+int reapply_all_overlays_with_reports(overlay_remount_report_t **reports_out, int *count_out);
+
+/**
+  * Report how much of its tmpfs limits the overlay mounted at `path` is using
+  * @return 0 on success, -1 if `path` isn't a mounted overlay
+ */
+int overlay_get_metrics(const char *path, overlay_metrics_t *metrics_out);
+
+/**
+  * Remount the overlay at `path` with larger limits if it is close to running out of pages or nodes. Limits double, up to
+  * the same maximum used when sizing new overlays.
+  * Falls back to committing the overlay's changes and mounting a fresh, larger tmpfs if it can't be resized in place, so
+  * callers must make sure nothing else is using the overlay at the same time
+ */
+int overlay_grow_if_needed(const char *path, bool *grew_out);
+
+/**
+  * overlay_grow_if_needed() for every mounted overlay in the overlay config
+ */
+int grow_overlays_if_needed(void);
+
+/**
+  * Remove `path` from the overlay config so it isn't restored again
+ */
+int forget_overlay(const char *path);
+
+/**
+  * Set the permission bits of `path`, which has to resolve to somewhere inside a mounted overlay from the overlay config or
+  * its backing store. Only the 0777 bits of `mode` are applied, so setuid, setgid and sticky bits can't be set
+  * @return 0 on success, -1 if `path` is outside every overlay or can't be changed
+ */
+int overlay_set_permissions(const char *path, mode_t mode);
+
 bool is_tmpfs_mount(const char *path);
 bool is_mount_point(const char *path);
 kern_return_t unmount_if_mounted(const char *path);
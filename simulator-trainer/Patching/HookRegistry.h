@@ -0,0 +1,95 @@
+//
+//  HookRegistry.h
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#import <Foundation/Foundation.h>
+#import <stdatomic.h>
+#import <time.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+  * One installed hook. Allocated once and never freed, so a replacement block can keep a pointer to it
+  * even after the hook is removed
+ */
+typedef struct {
+    IMP original;
+    _Atomic uint64_t calls;
+    // Time spent in the replacement, including the call to the original
+    _Atomic uint64_t total_ns;
+} hook_entry_t;
+
+extern atomic_bool gHookMetricsEnabled;
+
+typedef struct {
+    hook_entry_t *hook;
+    uint64_t start;
+} hook_scope_t;
+
+static inline hook_scope_t hook_scope_begin(hook_entry_t *hook) {
+    if (!atomic_load_explicit(&gHookMetricsEnabled, memory_order_relaxed)) {
+        return (hook_scope_t){hook, 0};
+    }
+
+    atomic_fetch_add_explicit(&hook->calls, 1, memory_order_relaxed);
+    return (hook_scope_t){hook, clock_gettime_nsec_np(CLOCK_UPTIME_RAW)};
+}
+
+static inline void hook_scope_end(hook_scope_t *scope) {
+    if (scope->start) {
+        atomic_fetch_add_explicit(&scope->hook->total_ns, clock_gettime_nsec_np(CLOCK_UPTIME_RAW) - scope->start, memory_order_relaxed);
+    }
+}
+
+// Put at the top of a replacement block. Counts and times the call, until the block returns, while metrics are on
+#define HOOK_SCOPE(hook) __attribute__((cleanup(hook_scope_end), unused)) hook_scope_t _hookScope = hook_scope_begin(hook)
+
+#define HOOK_KEY_SET_MAX 8
+
+/**
+  * A fixed set of string keys that can be matched without allocating. Each check tries pointer equality first,
+  * which is what usually hits since callers pass the same constant, then length and hash before comparing
+ */
+typedef struct {
+    size_t count;
+    CFStringRef keys[HOOK_KEY_SET_MAX];
+    CFIndex lengths[HOOK_KEY_SET_MAX];
+    CFHashCode hashes[HOOK_KEY_SET_MAX];
+} hook_key_set_t;
+
+// The keys are retained for the life of the process
+void hook_key_set_init(hook_key_set_t *set, NSArray<NSString *> *keys);
+bool hook_key_set_contains(const hook_key_set_t *set, NSString * _Nullable key);
+
+/**
+  * Installs method replacements and tracks them in one place, with their original implementations and call metrics
+ */
+@interface HookRegistry : NSObject
+
++ (instancetype)sharedRegistry;
+
+// Count and time every hooked call. Off by default. Checking the flag is a single relaxed load per call
+@property (nonatomic) BOOL metricsEnabled;
+
+/**
+  * Replace `selector` on `cls` with the block returned by `blockFactory`. The factory gets the hook's entry before the
+  * block is installed, so the block can call `hook->original` and use HOOK_SCOPE.
+  * @return The entry, or NULL if the method doesn't exist, it's already hooked under another name, or `name` is taken
+ */
+- (hook_entry_t * _Nullable)hookSelector:(SEL)selector ofClass:(Class)cls name:(NSString *)name blockFactory:(id (^)(hook_entry_t *hook))blockFactory;
+
+/**
+  * Put the original implementation back. Fails if something else replaced the method on top of this hook
+ */
+- (BOOL)unhookNamed:(NSString *)name;
+- (void)unhookAll;
+
+// One line per hook, most called first
+- (NSString *)metricsReport;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,209 @@
+//
+//  HookRegistry.m
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#import <objc/runtime.h>
+#import "HookRegistry.h"
+
+atomic_bool gHookMetricsEnabled;
+
+void hook_key_set_init(hook_key_set_t *set, NSArray<NSString *> *keys) {
+    memset(set, 0, sizeof(hook_key_set_t));
+    for (NSString *key in keys) {
+        if (set->count == HOOK_KEY_SET_MAX) {
+            NSLog(@"Hook key set is full, ignoring %@", key);
+            break;
+        }
+
+        CFStringRef retainedKey = CFBridgingRetain([key copy]);
+        set->keys[set->count] = retainedKey;
+        set->lengths[set->count] = CFStringGetLength(retainedKey);
+        set->hashes[set->count] = CFHash(retainedKey);
+        set->count++;
+    }
+}
+
+bool hook_key_set_contains(const hook_key_set_t *set, NSString *key) {
+    CFStringRef candidate = (__bridge CFStringRef)key;
+    if (!candidate) {
+        return false;
+    }
+
+    for (size_t i = 0; i < set->count; i++) {
+        if (candidate == set->keys[i]) {
+            return true;
+        }
+    }
+
+    // Most lookups are for other keys and stop at the length
+    CFIndex length = CFStringGetLength(candidate);
+    CFHashCode hash = 0;
+    for (size_t i = 0; i < set->count; i++) {
+        if (set->lengths[i] != length) {
+            continue;
+        }
+
+        if (hash == 0) {
+            hash = CFHash(candidate);
+        }
+
+        if (set->hashes[i] == hash && CFStringCompare(candidate, set->keys[i], 0) == kCFCompareEqualTo) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+@interface HookRecord : NSObject
+@property (nonatomic, copy) NSString *name;
+@property (nonatomic, assign) Class cls;
+@property (nonatomic, assign) SEL selector;
+@property (nonatomic, assign) IMP replacement;
+@property (nonatomic, assign) hook_entry_t *entry;
+@end
+
+@implementation HookRecord
+@end
+
+@interface HookRegistry ()
+@property (nonatomic, strong) dispatch_queue_t queue;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, HookRecord *> *hooks;
+@end
+
+@implementation HookRegistry
+
++ (instancetype)sharedRegistry {
+    static HookRegistry *sharedRegistry = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedRegistry = [[HookRegistry alloc] init];
+    });
+
+    return sharedRegistry;
+}
+
+- (instancetype)init {
+    if ((self = [super init])) {
+        _queue = dispatch_queue_create("com.simulatortrainer.hooks", DISPATCH_QUEUE_SERIAL);
+        _hooks = [NSMutableDictionary dictionary];
+    }
+
+    return self;
+}
+
+- (BOOL)metricsEnabled {
+    return atomic_load_explicit(&gHookMetricsEnabled, memory_order_relaxed);
+}
+
+- (void)setMetricsEnabled:(BOOL)metricsEnabled {
+    atomic_store_explicit(&gHookMetricsEnabled, metricsEnabled, memory_order_relaxed);
+}
+
+- (hook_entry_t *)hookSelector:(SEL)selector ofClass:(Class)cls name:(NSString *)name blockFactory:(id (^)(hook_entry_t *hook))blockFactory {
+    __block hook_entry_t *installedEntry = NULL;
+    dispatch_sync(self.queue, ^{
+        if (self.hooks[name]) {
+            NSLog(@"A hook named %@ is already installed", name);
+            return;
+        }
+
+        Method method = class_getInstanceMethod(cls, selector);
+        if (!method) {
+            NSLog(@"Failed to find method %@ in class %@", NSStringFromSelector(selector), NSStringFromClass(cls));
+            return;
+        }
+
+        IMP originalImp = method_getImplementation(method);
+        for (HookRecord *record in self.hooks.allValues) {
+            if (record.replacement == originalImp) {
+                NSLog(@"Selector %@ already swizzled in class %@ by %@", NSStringFromSelector(selector), NSStringFromClass(cls), record.name);
+                return;
+            }
+        }
+
+        hook_entry_t *entry = calloc(1, sizeof(hook_entry_t));
+        if (!entry) {
+            NSLog(@"Failed to allocate hook %@", name);
+            return;
+        }
+
+        // Set before the replacement is live, since it can be called as soon as it is installed
+        entry->original = originalImp;
+        IMP replacementImp = imp_implementationWithBlock(blockFactory(entry));
+        IMP replacedImp = class_replaceMethod(cls, selector, replacementImp, method_getTypeEncoding(method));
+        if (replacedImp && replacedImp != originalImp) {
+            // Changed by someone else in between
+            entry->original = replacedImp;
+        }
+
+        HookRecord *record = [[HookRecord alloc] init];
+        record.name = name;
+        record.cls = cls;
+        record.selector = selector;
+        record.replacement = replacementImp;
+        record.entry = entry;
+        self.hooks[name] = record;
+        installedEntry = entry;
+    });
+
+    return installedEntry;
+}
+
+// Queue only
+- (BOOL)_unhookRecord:(HookRecord *)record {
+    Method method = class_getInstanceMethod(record.cls, record.selector);
+    if (!method || method_getImplementation(method) != record.replacement) {
+        NSLog(@"Can't remove hook %@, -[%@ %@] was replaced again after it", record.name, NSStringFromClass(record.cls), NSStringFromSelector(record.selector));
+        return NO;
+    }
+
+    // The replacement block is kept alive, since another thread may still be running it
+    method_setImplementation(method, record.entry->original);
+    [self.hooks removeObjectForKey:record.name];
+    return YES;
+}
+
+- (BOOL)unhookNamed:(NSString *)name {
+    __block BOOL unhooked = NO;
+    dispatch_sync(self.queue, ^{
+        HookRecord *record = self.hooks[name];
+        unhooked = record && [self _unhookRecord:record];
+    });
+
+    return unhooked;
+}
+
+- (void)unhookAll {
+    dispatch_sync(self.queue, ^{
+        for (HookRecord *record in self.hooks.allValues) {
+            [self _unhookRecord:record];
+        }
+    });
+}
+
+- (NSString *)metricsReport {
+    __block NSArray<HookRecord *> *records = nil;
+    dispatch_sync(self.queue, ^{
+        records = [self.hooks.allValues sortedArrayUsingComparator:^NSComparisonResult(HookRecord *lhs, HookRecord *rhs) {
+            uint64_t lhsCalls = atomic_load_explicit(&lhs.entry->calls, memory_order_relaxed);
+            uint64_t rhsCalls = atomic_load_explicit(&rhs.entry->calls, memory_order_relaxed);
+            return lhsCalls > rhsCalls ? NSOrderedAscending : lhsCalls < rhsCalls ? NSOrderedDescending : NSOrderedSame;
+        }];
+    });
+
+    NSMutableArray<NSString *> *lines = [NSMutableArray array];
+    for (HookRecord *record in records) {
+        uint64_t calls = atomic_load_explicit(&record.entry->calls, memory_order_relaxed);
+        uint64_t totalNs = atomic_load_explicit(&record.entry->total_ns, memory_order_relaxed);
+        double averageNs = calls > 0 ? (double)totalNs / (double)calls : 0;
+        [lines addObject:[NSString stringWithFormat:@"%@: %llu calls, %.3fms total, %.0fns avg", record.name, calls, (double)totalNs / 1e6, averageNs]];
+    }
+
+    return [lines componentsJoinedByString:@"\n"];
+}
+
+@end
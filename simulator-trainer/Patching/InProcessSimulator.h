@@ -14,6 +14,9 @@
 
 + (instancetype)sharedSetupIfNeeded;
 
+// The Simulator's app delegate, or nil until startup has brought up its UI. Doesn't start anything
++ (id)loadedSimulatorDelegate;
+
 - (void)focusSimulatorDevice:(BootedSimulatorWrapper *)device;
 - (void)setSimulatorBorderColor:(NSColor *)color;
 
@@ -13,60 +13,120 @@
 #import "InProcessSimulator.h"
 #import "AppBinaryPatcher.h"
 #import "dylib_conversion.h"
+#import "image_ranges.h"
+#import "HookRegistry.h"
 #import "CycriptLauncher.h"
-#import "CommandRunner.h"
+#import "ToolchainRegistry.h"
 #import "SimLogging.h"
 #import "ObjseeTraceLauncher.h"
+#import "StartupTimeline.h"
+#import "SimDeviceRegistry.h"
 
 @interface InProcessSimulator ()
 @property (nonatomic, strong) BootedSimulatorWrapper *focusedSimulatorDevice;
 @end
 
+static InProcessSimulator *simulatorInterposer = nil;
+
 @implementation InProcessSimulator
 
 + (instancetype)sharedSetupIfNeeded {
-    static InProcessSimulator *simulatorInterposer = nil;
     static dispatch_once_t onceToken;
     dispatch_once(&onceToken, ^{
-        
-        // Find Simulator.app, make a dylib version that can be loaded in-process
         simulatorInterposer = [[InProcessSimulator alloc] init];
-        [simulatorInterposer convertSimulatorToDylibWithCompletion:^(NSString *dylibPath) {
-            if (!dylibPath) {
-                NSLog(@"Failed to convert Simulator.app to dylib");
-                return;
-            }
-            
-            // Handle conflicts before loading the dylib (doesn't involve sim-exclusive classes)
-            [simulatorInterposer _patchCriticalSimulatorConflicts];
-
-            [SimLogging observeSimulatorLogs];
-
-            // Load simulator
-            if (dlopen([dylibPath UTF8String], 0) == NULL) {
-                NSLog(@"Failed to load Simulator dylib: %s", dlerror());
-                return;
-            }
-            
-            // With sim loaded in-process, its classes (AppDelegate, view controllers) can be directly modified.
-            // Setup drag-and-drop tweak installation
-            [simulatorInterposer _setupDragAndDropTweakInstallation];
-                        
-            // Open the simulator ui
-            [simulatorInterposer launchSimulatorFromDylib:dylibPath];
-        }];
+        [simulatorInterposer _scheduleStartupTasks];
     });
     
     return simulatorInterposer;
 }
 
++ (id)loadedSimulatorDelegate {
+    return simulatorInterposer.simulatorDelegate;
+}
+
+/**
+  * Find Simulator.app, make a dylib version that can be loaded in-process, then load it and bring up its UI.
+  * Only the steps that need each other's results are ordered; the rest overlap
+ */
+- (void)_scheduleStartupTasks {
+    StartupTimeline *timeline = [StartupTimeline sharedTimeline];
+    dispatch_queue_t backgroundQueue = dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0);
+    __block NSString *simulatorDylibPath = nil;
+
+    [timeline addTaskNamed:@"resolve-xcode" dependencies:@[] queue:backgroundQueue block:^BOOL{
+        return [self _simulatorBundle] != nil;
+    }];
+
+    [timeline addTaskNamed:@"simulator-log-hook" dependencies:@[] queue:backgroundQueue block:^BOOL{
+        [SimLogging observeSimulatorLogs];
+        return YES;
+    }];
+
+    // Warm the device list for the main window while the Simulator is prepared
+    [timeline addTaskNamed:@"device-registry" dependencies:@[@"resolve-xcode"] queue:backgroundQueue block:^BOOL{
+        return [SimDeviceRegistry sharedRegistry] != nil;
+    }];
+
+    [timeline addTaskNamed:@"prepare-simulator-dylib" dependencies:@[@"resolve-xcode"] queue:backgroundQueue block:^BOOL{
+        [self convertSimulatorToDylibWithCompletion:^(NSString *dylibPath) {
+            simulatorDylibPath = dylibPath;
+        }];
+
+        if (!simulatorDylibPath) {
+            NSLog(@"Failed to convert Simulator.app to dylib");
+        }
+        return simulatorDylibPath != nil;
+    }];
+
+    // Handle conflicts before loading the dylib (doesn't involve sim-exclusive classes).
+    // This and the load below run on the main queue, so swapping +[NSBundle mainBundle] and loading the
+    // Simulator's classes happen between, not during, the main window's loading
+    [timeline addTaskNamed:@"patch-simulator-conflicts" dependencies:@[@"resolve-xcode"] queue:dispatch_get_main_queue() block:^BOOL{
+        return [self _patchCriticalSimulatorConflicts];
+    }];
+
+    [timeline addTaskNamed:@"load-simulator-dylib" dependencies:@[@"prepare-simulator-dylib", @"patch-simulator-conflicts", @"simulator-log-hook"] queue:dispatch_get_main_queue() block:^BOOL{
+        if (dlopen([simulatorDylibPath UTF8String], 0) == NULL) {
+            NSLog(@"Failed to load Simulator dylib: %s", dlerror());
+            return NO;
+        }
+        return YES;
+    }];
+
+    // With sim loaded in-process, its classes (AppDelegate, view controllers) can be directly modified.
+    // Setup drag-and-drop tweak installation
+    [timeline addTaskNamed:@"hook-drag-and-drop" dependencies:@[@"load-simulator-dylib"] queue:backgroundQueue block:^BOOL{
+        // Tweaks can still be installed from the main window, so the UI comes up without it
+        if (![self _setupDragAndDropTweakInstallation]) {
+            NSLog(@"Failed to set up drag-and-drop tweak installation");
+        }
+        return YES;
+    }];
+
+    // Open the simulator ui
+    [timeline addTaskNamed:@"launch-simulator-ui" dependencies:@[@"hook-drag-and-drop"] queue:dispatch_get_main_queue() block:^BOOL{
+        [self launchSimulatorFromDylib:simulatorDylibPath];
+        return YES;
+    }];
+
+    [timeline notifyWhenTaskNamed:@"launch-simulator-ui" finishesOnQueue:backgroundQueue block:^(BOOL succeeded) {
+        NSString *tracePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"simulator-trainer-startup.json"];
+        NSError *error = nil;
+        if (![timeline writeChromeTraceToPath:tracePath error:&error]) {
+            NSLog(@"Failed to write startup trace: %@", error);
+            return;
+        }
+
+        NSLog(@"Startup %@. Critical path: %@. Timeline: %@", succeeded ? @"finished" : @"failed", [[timeline criticalPathToTaskNamed:@"launch-simulator-ui"] componentsJoinedByString:@" -> "], tracePath);
+    }];
+}
+
 - (NSString *)_simulatorBundlePath {
     static NSString *simulatorBundlePath = nil;
     static dispatch_once_t onceToken;
     dispatch_once(&onceToken, ^{
-        NSString *xcodeDeveloperPath = nil;
-        [CommandRunner runCommand:@"/usr/bin/xcode-select" withArguments:@[@"--print-path"] stdoutString:&xcodeDeveloperPath error:nil];
-        if (!xcodeDeveloperPath || ![xcodeDeveloperPath hasSuffix:@"/Contents/Developer"]) {
+        NSString *xcodeDeveloperPath = [[ToolchainRegistry sharedRegistry] developerDir];
+        if (![xcodeDeveloperPath hasSuffix:@"/Contents/Developer"]) {
             NSLog(@"Failed to get Xcode Developer path -- cannot find Simulator.app");
         }
         else {
@@ -94,24 +154,36 @@
 }
 
 - (void)convertSimulatorToDylibWithCompletion:(void (^)(NSString *dylibPath))completion {
+    StartupTimeline *timeline = [StartupTimeline sharedTimeline];
+
     // Make a copy of the Simulator.app executable at $TMPDIR/Simulator.dylib
+    NSUInteger copySpan = [timeline beginSpanNamed:@"copy-simulator-executable"];
     NSString *simulatorExecutablePath = [[self _simulatorBundlePath] stringByAppendingPathComponent:@"Contents/MacOS/Simulator"];
     NSString *simulatorDylibTmpPath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"Simulator.dylib"];
     if (![[NSFileManager defaultManager] fileExistsAtPath:simulatorDylibTmpPath]) {
         [[NSFileManager defaultManager] removeItemAtPath:simulatorDylibTmpPath error:nil];
     }
     [[NSFileManager defaultManager] copyItemAtPath:simulatorExecutablePath toPath:simulatorDylibTmpPath error:nil];
+    [timeline endSpan:copySpan];
     
     // Convert the simulator executable into a dylib (in-place)
+    NSUInteger thinSpan = [timeline beginSpanNamed:@"thin-simulator-executable"];
     [AppBinaryPatcher thinBinaryAtPath:simulatorDylibTmpPath];
-    if (!convert_to_dylib_inplace(simulatorDylibTmpPath.UTF8String)) {
+    [timeline endSpan:thinSpan];
+
+    NSUInteger convertSpan = [timeline beginSpanNamed:@"convert-to-dylib"];
+    BOOL converted = convert_to_dylib_inplace(simulatorDylibTmpPath.UTF8String);
+    [timeline endSpan:convertSpan];
+    if (!converted) {
         NSLog(@"Failed to convert Simulator.app to dylib");
         [[NSFileManager defaultManager] removeItemAtPath:simulatorDylibTmpPath error:nil];
         return;
     }
     
     // Then codesign the dylib
+    NSUInteger codesignSpan = [timeline beginSpanNamed:@"codesign-dylib"];
     [AppBinaryPatcher codesignItemAtPath:simulatorDylibTmpPath completion:^(BOOL success, NSError * _Nullable error) {
+        [timeline endSpan:codesignSpan];
         if (error) {
             NSLog(@"Failed to codesign Simulator dylib: %@", error);
             [[NSFileManager defaultManager] removeItemAtPath:simulatorDylibTmpPath error:nil];
@@ -143,76 +215,63 @@
     }];
 }
 
-- (IMP)_swizzleSelector:(SEL)selector ofClass:(Class)class withBlock:(id)newImpBlock {
-    Method method = class_getInstanceMethod(class, selector);
-    if (!method) {
-        NSLog(@"Failed to find method %@ in class %@", NSStringFromSelector(selector), NSStringFromClass(class));
-        return nil;
-    }
-    
-    IMP replacementImp = imp_implementationWithBlock(newImpBlock);
-    IMP originalImp = method_getImplementation(method);
-    if (originalImp == replacementImp) {
-        NSLog(@"Selector %@ already swizzled in class %@", NSStringFromSelector(selector), NSStringFromClass(class));
-        return nil;
-    }
-    
-    if (class_replaceMethod(class, selector, replacementImp, method_getTypeEncoding(method)) == NULL) {
-        return nil;
-    }
-
-    return originalImp;
-}
-
 - (BOOL)_patchCriticalSimulatorConflicts {
+    HookRegistry *hooks = [HookRegistry sharedRegistry];
+    hooks.metricsEnabled = getenv("SIMTRAINER_HOOK_METRICS") != NULL;
+
     // Swizzle +[NSBundle mainBundle] to handle Simulator.dylib expecting to get its own bundle path.
     // It breaks if it receives the real main app (this app) bundle path instead
     NSBundle *simulatorBundle = [self _simulatorBundle];
+    image_ranges_start();
     
     Class NSBundleClass = objc_getClass("NSBundle");
     SEL mainBundleSel = sel_registerName("mainBundle");
-    static IMP origMainBundleImp = nil;
-    id (^newMainBundle)(id) = ^(id _self) {
-        
-        // Get the address of whatever is calling mainBundle, then find the image path for that address.
-        // If from the real main executable (this app), return the original main bundle, otherwise return the Simulator bundle
-        void *caller = __builtin_return_address(0);
-        Dl_info info;
-        if (dladdr(caller, &info) && info.dli_fname && strstr(info.dli_fname, "trainer")) {
-            return ((NSBundle *(*)(id, SEL))origMainBundleImp)(_self, mainBundleSel);
-        }
-        
-        return simulatorBundle;
-    };
-    origMainBundleImp = [self _swizzleSelector:mainBundleSel ofClass:object_getClass(NSBundleClass) withBlock:newMainBundle];
+    [hooks hookSelector:mainBundleSel ofClass:object_getClass(NSBundleClass) name:@"+[NSBundle mainBundle]" blockFactory:^id(hook_entry_t *hook) {
+        return ^(id _self) {
+            HOOK_SCOPE(hook);
+
+            // Find which image is calling mainBundle. If it's this app (or a framework inside it), return the original main bundle,
+            // otherwise return the Simulator bundle. This runs on every mainBundle call in the process, so the lookup avoids dladdr
+            if (image_owner_for_address(__builtin_return_address(0)) == IMAGE_OWNER_APP) {
+                return ((NSBundle *(*)(id, SEL))hook->original)(_self, mainBundleSel);
+            }
+
+            return simulatorBundle;
+        };
+    }];
     
     // Swizzle NSBundle's objectForInfoDictionaryKey: to return a large CFBundleVersion.
     // There's a Simulator lifecycle arbitrator that may kill this process if it decides
     // an existing running Simulator instance should take priority. It compares versions, then
     // process age (via PID). We will fail the age comparison, so we need to pass the version check
+    static hook_key_set_t bundleVersionKeys;
+    hook_key_set_init(&bundleVersionKeys, @[(__bridge NSString *)kCFBundleVersionKey]);
     SEL objectForInfoDictionaryKeySel = sel_registerName("objectForInfoDictionaryKey:");
-    static IMP origObjectForInfoDictionaryKeyImp = nil;
-    id (^newObjForInfoDict)(id, NSString *) = ^(id _self, NSString *key) {
-        if ([key isEqualToString:@"CFBundleVersion"]) {
-            return @"99999.0";
-        }
-        
-        return ((NSString * (*)(id, SEL, NSString *))origObjectForInfoDictionaryKeyImp)(_self, objectForInfoDictionaryKeySel, key);
-    };
-    origObjectForInfoDictionaryKeyImp = [self _swizzleSelector:objectForInfoDictionaryKeySel ofClass:NSBundleClass withBlock:newObjForInfoDict];
+    [hooks hookSelector:objectForInfoDictionaryKeySel ofClass:NSBundleClass name:@"-[NSBundle objectForInfoDictionaryKey:]" blockFactory:^id(hook_entry_t *hook) {
+        return ^(id _self, NSString *key) {
+            HOOK_SCOPE(hook);
+            if (hook_key_set_contains(&bundleVersionKeys, key)) {
+                return @"99999.0";
+            }
+
+            return ((NSString * (*)(id, SEL, NSString *))hook->original)(_self, objectForInfoDictionaryKeySel, key);
+        };
+    }];
 
     // [NSUserDefaults boolForKey:]
+    static hook_key_set_t alwaysTrueKeys;
+    hook_key_set_init(&alwaysTrueKeys, @[@"CarPlayExtraOptions"]);
     SEL boolForKeySel = sel_registerName("boolForKey:");
-    static IMP origBoolForKeyImp = nil;
-    BOOL (^newBoolForKey)(id, NSString *) = ^BOOL(id _self, NSString *key) {
-        NSArray *alwaysTrueKeys = @[@"CarPlayExtraOptions"];
-        if ([alwaysTrueKeys containsObject:key]) {
-            return YES;
-        }
-        
-        return ((BOOL (*)(id, SEL, NSString *))origBoolForKeyImp)(_self, boolForKeySel, key);
-    };
-    origBoolForKeyImp = [self _swizzleSelector:boolForKeySel ofClass:NSUserDefaults.class withBlock:newBoolForKey];
+    [hooks hookSelector:boolForKeySel ofClass:NSUserDefaults.class name:@"-[NSUserDefaults boolForKey:]" blockFactory:^id(hook_entry_t *hook) {
+        return ^BOOL(id _self, NSString *key) {
+            HOOK_SCOPE(hook);
+            if (hook_key_set_contains(&alwaysTrueKeys, key)) {
+                return YES;
+            }
+
+            return ((BOOL (*)(id, SEL, NSString *))hook->original)(_self, boolForKeySel, key);
+        };
+    }];
     
     return YES;
 }
@@ -222,39 +281,40 @@
     // It swizzles the performDragOperation: method of the Simulator's DeviceWindow class.
     Class _SimulatorDeviceWindow = objc_getClass("_TtC9Simulator12DeviceWindow");
     SEL performDragOperationSel = sel_registerName("performDragOperation:");
-    static IMP origPerformDragOperationImp = nil;
-    BOOL (^newPerformDragOperation)(id, id <NSDraggingInfo>) = ^BOOL(id _self, id <NSDraggingInfo> sender) {
-        
-        NSPasteboard *pasteboard = [sender draggingPasteboard];
-        NSString *draggedType = [[pasteboard types] firstObject];
-        if (!draggedType) {
-            return NO;
-        }
-        
-        NSArray *files = [pasteboard readObjectsForClasses:@[[NSURL class]] options:nil];
-        if (files.count == 0 || ![files.firstObject isKindOfClass:[NSURL class]]) {
-            return NO;
-        }
-        
-        NSString *realPath = [[files firstObject] URLByResolvingSymlinksInPath].path;
-        if ([[realPath pathExtension] isEqualToString:@"deb"]) {
-            [[NSNotificationCenter defaultCenter] postNotificationName:@"InstallTweakNotification" object:realPath];
-            return YES;
-        }
-        else if ([[realPath pathExtension] isEqualToString:@"ipa"]) {
-            [[NSNotificationCenter defaultCenter] postNotificationName:@"InstallIpaNotification" object:realPath];
-            return YES;
-        }
-        else if ([[realPath pathExtension] isEqualToString:@"app"]) {
-            [[NSNotificationCenter defaultCenter] postNotificationName:@"InstallAppNotification" object:realPath];
-            return YES;
-        }
-        
-        return ((BOOL (*)(id, SEL, id))origPerformDragOperationImp)(_self, performDragOperationSel, sender);
-    };
-    
-    origPerformDragOperationImp = [self _swizzleSelector:performDragOperationSel ofClass:_SimulatorDeviceWindow withBlock:newPerformDragOperation];
-    return origPerformDragOperationImp != nil;
+    hook_entry_t *dragHook = [[HookRegistry sharedRegistry] hookSelector:performDragOperationSel ofClass:_SimulatorDeviceWindow name:@"-[DeviceWindow performDragOperation:]" blockFactory:^id(hook_entry_t *hook) {
+        return ^BOOL(id _self, id <NSDraggingInfo> sender) {
+            HOOK_SCOPE(hook);
+            
+            NSPasteboard *pasteboard = [sender draggingPasteboard];
+            NSString *draggedType = [[pasteboard types] firstObject];
+            if (!draggedType) {
+                return NO;
+            }
+            
+            NSArray *files = [pasteboard readObjectsForClasses:@[[NSURL class]] options:nil];
+            if (files.count == 0 || ![files.firstObject isKindOfClass:[NSURL class]]) {
+                return NO;
+            }
+            
+            NSString *realPath = [[files firstObject] URLByResolvingSymlinksInPath].path;
+            if ([[realPath pathExtension] isEqualToString:@"deb"]) {
+                [[NSNotificationCenter defaultCenter] postNotificationName:@"InstallTweakNotification" object:realPath];
+                return YES;
+            }
+            else if ([[realPath pathExtension] isEqualToString:@"ipa"]) {
+                [[NSNotificationCenter defaultCenter] postNotificationName:@"InstallIpaNotification" object:realPath];
+                return YES;
+            }
+            else if ([[realPath pathExtension] isEqualToString:@"app"]) {
+                [[NSNotificationCenter defaultCenter] postNotificationName:@"InstallAppNotification" object:realPath];
+                return YES;
+            }
+            
+            return ((BOOL (*)(id, SEL, id))hook->original)(_self, performDragOperationSel, sender);
+        };
+    }];
+
+    return dragHook != NULL;
 }
 
 - (void)launchSimulatorFromDylib:(NSString *)simulatorDylibPath {
@@ -262,24 +322,31 @@
     Class _SimulatorAppDelegate = objc_getClass("SimulatorAppDelegate");
     
     SEL _applicationOpenURLs = sel_registerName("application:openURLs:");
-    void (^newApplicationOpenURLs)(id, NSApplication *, NSArray<NSURL *> *) = ^(id _self, NSApplication *app, NSArray<NSURL *> *urls) {
-        NSLog(@"SimulatorAppDelegate received openURLs: %@", urls);
-        
-        // Forward to the main app delegate
-        id mainAppDelegate = [NSApp delegate];
-        if ([mainAppDelegate respondsToSelector:@selector(application:openURLs:)]) {
-            [mainAppDelegate application:app openURLs:urls];
-        }
-    };
-    [self _swizzleSelector:_applicationOpenURLs ofClass:_SimulatorAppDelegate withBlock:newApplicationOpenURLs];
+    [[HookRegistry sharedRegistry] hookSelector:_applicationOpenURLs ofClass:_SimulatorAppDelegate name:@"-[SimulatorAppDelegate application:openURLs:]" blockFactory:^id(hook_entry_t *hook) {
+        return ^(id _self, NSApplication *app, NSArray<NSURL *> *urls) {
+            HOOK_SCOPE(hook);
+            NSLog(@"SimulatorAppDelegate received openURLs: %@", urls);
+            
+            // Forward to the main app delegate
+            id mainAppDelegate = [NSApp delegate];
+            if ([mainAppDelegate respondsToSelector:@selector(application:openURLs:)]) {
+                [mainAppDelegate application:app openURLs:urls];
+            }
+        };
+    }];
     
+    StartupTimeline *timeline = [StartupTimeline sharedTimeline];
+    NSUInteger didFinishLaunchingSpan = [timeline beginSpanNamed:@"simulator-did-finish-launching"];
     self->_simulatorDelegate = [[_SimulatorAppDelegate alloc] init];
     ((void (*)(id, SEL, id))objc_msgSend)(self.simulatorDelegate, sel_registerName("applicationDidFinishLaunching:"), nil);
+    [timeline endSpan:didFinishLaunchingSpan];
     
     // Load the MainMenu.xib from Simulator.app bundle. This populates the menu bar with the Simulator's menu items
+    NSUInteger mainMenuSpan = [timeline beginSpanNamed:@"load-simulator-main-menu"];
     NSBundle *simBundle = [NSBundle bundleWithPath:[self _simulatorBundlePath]];
     NSArray *topObjects = nil;
     [simBundle loadNibNamed:@"MainMenu" owner:NSApp topLevelObjects:&topObjects];
+    [timeline endSpan:mainMenuSpan];
     for (NSObject *object in topObjects) {
         if (![object isKindOfClass:[NSMenu class]]) {
             continue;
@@ -301,19 +368,60 @@
     NSMenuItem *traceItem = [[NSMenuItem alloc] initWithTitle:@"objc_msgSend trace" action:@selector(handleObjcMsgSendTrace:) keyEquivalent:@""];
     [traceItem setTarget:self];
     
+    NSMenuItem *queryRecordingItem = [[NSMenuItem alloc] initWithTitle:@"Query Trace Recording" action:@selector(handleQueryTraceRecording:) keyEquivalent:@""];
+    [queryRecordingItem setTarget:self];
+    
     NSMenuItem *flexItem = [[NSMenuItem alloc] initWithTitle:@"FLEX" action:@selector(handleObjcMsgSendTrace:) keyEquivalent:@""];
     [flexItem setTarget:self];
     
     [simHacksMenu addItem:placeholder1];
     [simHacksMenu addItem:placeholder2];
     [simHacksMenu addItem:traceItem];
+    [simHacksMenu addItem:queryRecordingItem];
     [simHacksMenu addItem:flexItem];
 
+    NSMenuItem *hookMetricsItem = [[NSMenuItem alloc] initWithTitle:@"Hook Metrics" action:@selector(handleHookMetrics:) keyEquivalent:@""];
+    [hookMetricsItem setTarget:self];
+    [simHacksMenu addItem:hookMetricsItem];
+
+    NSMenuItem *setUpDevicesItem = [[NSMenuItem alloc] initWithTitle:@"Set Up Devices..." action:@selector(handleSetUpDevices:) keyEquivalent:@""];
+    [setUpDevicesItem setTarget:self];
+    [simHacksMenu addItem:setUpDevicesItem];
+
     NSMenuItem *simHacksMenuItem = [[NSMenuItem alloc] initWithTitle:@"Sim Hacks" action:nil keyEquivalent:@""];
     [simHacksMenuItem setSubmenu:simHacksMenu];
     [mainMenu addItem:simHacksMenuItem];
 }
 
+- (void)handleHookMetrics:(id)sender {
+    HookRegistry *hooks = [HookRegistry sharedRegistry];
+    NSAlert *alert = [[NSAlert alloc] init];
+    [alert setMessageText:@"Hook Metrics"];
+    if (hooks.metricsEnabled) {
+        [alert setInformativeText:[hooks metricsReport]];
+        [alert addButtonWithTitle:@"OK"];
+        [alert addButtonWithTitle:@"Stop Collecting"];
+    }
+    else {
+        [alert setInformativeText:@"Hooked calls aren't being counted. Start counting them?"];
+        [alert addButtonWithTitle:@"Start Collecting"];
+        [alert addButtonWithTitle:@"Cancel"];
+    }
+
+    [alert beginSheetModalForWindow:[NSApp mainWindow] completionHandler:^(NSModalResponse returnCode) {
+        if (hooks.metricsEnabled && returnCode == NSAlertSecondButtonReturn) {
+            hooks.metricsEnabled = NO;
+        }
+        else if (!hooks.metricsEnabled && returnCode == NSAlertFirstButtonReturn) {
+            hooks.metricsEnabled = YES;
+        }
+    }];
+}
+
+- (void)handleSetUpDevices:(id)sender {
+    [[NSNotificationCenter defaultCenter] postNotificationName:@"SetUpDevicesNotification" object:nil];
+}
+
 - (void)handleOpenSimForgeGui:(id)sender {
     [[NSNotificationCenter defaultCenter] postNotificationName:@"SimForgeShowMainWindow" object:nil];
 }
@@ -369,12 +477,26 @@
     NSTextField *bundleIdField = [[NSTextField alloc] initWithFrame:NSMakeRect(0, 0, 250, 24)];
     [bundleIdField setPlaceholderString:@"bundle ID"];
 
-    NSStackView *inputStack = [[NSStackView alloc] initWithFrame:NSMakeRect(0, 0, 250, 30 * 3)];
+    // Describing arguments is the slowest part of tracing. Turning it off keeps busy apps responsive
+    NSButton *includeArgumentsCheckbox = [NSButton checkboxWithTitle:@"Include arguments" target:nil action:nil];
+    [includeArgumentsCheckbox setState:NSControlStateValueOn];
+
+    // A number here profiles instead of printing every call, sampling one in that many call trees
+    NSTextField *profileSampleField = [[NSTextField alloc] initWithFrame:NSMakeRect(0, 0, 250, 24)];
+    [profileSampleField setPlaceholderString:@"profile 1 in N calls (default: trace)"];
+
+    NSTextField *recordingPathField = [[NSTextField alloc] initWithFrame:NSMakeRect(0, 0, 250, 24)];
+    [recordingPathField setPlaceholderString:@"record to file (optional)"];
+
+    NSStackView *inputStack = [[NSStackView alloc] initWithFrame:NSMakeRect(0, 0, 250, 30 * 6)];
     [inputStack setOrientation:NSUserInterfaceLayoutOrientationVertical];
     [inputStack setSpacing:8];
     [inputStack addView:classPatternField inGravity:NSStackViewGravityTop];
     [inputStack addView:methodPatternField inGravity:NSStackViewGravityTop];
     [inputStack addView:bundleIdField inGravity:NSStackViewGravityTop];
+    [inputStack addView:includeArgumentsCheckbox inGravity:NSStackViewGravityTop];
+    [inputStack addView:profileSampleField inGravity:NSStackViewGravityTop];
+    [inputStack addView:recordingPathField inGravity:NSStackViewGravityTop];
 
     [alert setAccessoryView:inputStack];
 
@@ -393,6 +515,11 @@
             
             request.targetBundleId = [bundleIdField stringValue];
             request.targetDeviceId = self.focusedSimulatorDevice.udidString;
+            request.includeArguments = ([includeArgumentsCheckbox state] == NSControlStateValueOn);
+            request.profileSampleInterval = (NSUInteger)MAX([profileSampleField integerValue], 0);
+            if ([recordingPathField stringValue].length > 0) {
+                request.recordingPath = [[recordingPathField stringValue] stringByExpandingTildeInPath];
+            }
             
             ObjseeTraceLauncher *traceLauncher = [[ObjseeTraceLauncher alloc] initWithTraceRequest:request];
             [traceLauncher launch];
@@ -400,6 +527,41 @@
     }];
 }
 
+- (void)handleQueryTraceRecording:(id)sender {
+    NSAlert *alert = [[NSAlert alloc] init];
+    [alert setMessageText:@"Query Trace Recording"];
+    [alert setInformativeText:@"Show the recorded calls to a method, optionally on one thread"];
+    [alert addButtonWithTitle:@"Show Calls"];
+    [alert addButtonWithTitle:@"Cancel"];
+
+    NSTextField *recordingPathField = [[NSTextField alloc] initWithFrame:NSMakeRect(0, 0, 250, 24)];
+    [recordingPathField setPlaceholderString:@"recording path"];
+
+    NSTextField *methodField = [[NSTextField alloc] initWithFrame:NSMakeRect(0, 0, 250, 24)];
+    [methodField setPlaceholderString:@"-[Class selector] or class (default: *)"];
+
+    NSTextField *threadField = [[NSTextField alloc] initWithFrame:NSMakeRect(0, 0, 250, 24)];
+    [threadField setPlaceholderString:@"thread (default: all)"];
+
+    NSStackView *inputStack = [[NSStackView alloc] initWithFrame:NSMakeRect(0, 0, 250, 30 * 3)];
+    [inputStack setOrientation:NSUserInterfaceLayoutOrientationVertical];
+    [inputStack setSpacing:8];
+    [inputStack addView:recordingPathField inGravity:NSStackViewGravityTop];
+    [inputStack addView:methodField inGravity:NSStackViewGravityTop];
+    [inputStack addView:threadField inGravity:NSStackViewGravityTop];
+
+    [alert setAccessoryView:inputStack];
+
+    [alert beginSheetModalForWindow:[NSApp mainWindow] completionHandler:^(NSModalResponse returnCode) {
+        if (returnCode != NSAlertFirstButtonReturn || [recordingPathField stringValue].length == 0) {
+            return;
+        }
+
+        NSInteger threadId = [threadField stringValue].length > 0 ? [threadField integerValue] : -1;
+        [ObjseeTraceLauncher presentRecordingAtPath:[[recordingPathField stringValue] stringByExpandingTildeInPath] method:[methodField stringValue] threadId:threadId];
+    }];
+}
+
 - (void)focusSimulatorDevice:(BootedSimulatorWrapper *)device {
     NSLog(@"InProcessSimulator: focusing on device %@", device);
     self.focusedSimulatorDevice = device;
@@ -0,0 +1,287 @@
+//
+//  image_ranges.c
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#include "image_ranges.h"
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mach/vm_prot.h>
+#include <mach-o/dyld.h>
+#include <mach-o/loader.h>
+
+#define CALLER_CACHE_BITS 8
+#define CALLER_CACHE_SIZE (1 << CALLER_CACHE_BITS)
+
+typedef struct {
+    uintptr_t start;
+    uintptr_t end;
+    const struct mach_header *header;
+    // Owned by dyld, valid while the image is loaded
+    const char *path;
+    image_owner_t owner;
+} image_range_t;
+
+// Immutable once published. Sorted by start address
+typedef struct {
+    // Bumped for every published table, and stamped on the caller cache entries looked up in it
+    uint64_t generation;
+    size_t count;
+    image_range_t ranges[];
+} image_table_t;
+
+static pthread_once_t start_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic(image_table_t *) current_table;
+static char app_bundle_prefix[PATH_MAX];
+static uint64_t table_generation;
+
+/**
+  * Return address -> owner, packed as (address << 16) | (generation << 8) | owner, with the low 8 bits of the
+  * generation of the table the owner came from. User space addresses fit in 47 bits. 0 is an empty slot
+ */
+static _Atomic uint64_t caller_cache[CALLER_CACHE_SIZE];
+
+static uint64_t pack_cache_entry(uintptr_t address, uint64_t generation, image_owner_t owner) {
+    return ((uint64_t)address << 16) | ((generation & 0xff) << 8) | (uint64_t)owner;
+}
+
+static size_t caller_cache_slot(uintptr_t address) {
+    return (size_t)(((uint64_t)address * 0x9e3779b97f4a7c15ULL) >> (64 - CALLER_CACHE_BITS));
+}
+
+static void clear_caller_cache(void) {
+    for (size_t i = 0; i < CALLER_CACHE_SIZE; i++) {
+        atomic_store_explicit(&caller_cache[i], 0, memory_order_relaxed);
+    }
+}
+
+// Images in the shared cache aren't on disk, so their path is used as is
+static void resolve_path(const char *path, char resolved[PATH_MAX]) {
+    if (!realpath(path, resolved)) {
+        snprintf(resolved, PATH_MAX, "%s", path);
+    }
+}
+
+// Call with table_lock held
+static image_owner_t classify_image(const char *path) {
+    if (!path) {
+        return IMAGE_OWNER_SYSTEM;
+    }
+
+    char resolved[PATH_MAX];
+    resolve_path(path, resolved);
+    if (app_bundle_prefix[0] && strncmp(resolved, app_bundle_prefix, strlen(app_bundle_prefix)) == 0) {
+        return IMAGE_OWNER_APP;
+    }
+
+    return IMAGE_OWNER_SYSTEM;
+}
+
+/**
+  * The span covering the image's executable segments, which is where any return address into it points
+ */
+static bool image_code_range(const struct mach_header *header, intptr_t slide, uintptr_t *start_out, uintptr_t *end_out) {
+    if (header->magic != MH_MAGIC_64) {
+        return false;
+    }
+
+    uintptr_t start = UINTPTR_MAX;
+    uintptr_t end = 0;
+    const uint8_t *command = (const uint8_t *)header + sizeof(struct mach_header_64);
+    for (uint32_t i = 0; i < header->ncmds; i++) {
+        const struct load_command *load_command = (const struct load_command *)command;
+        if (load_command->cmd == LC_SEGMENT_64) {
+            const struct segment_command_64 *segment = (const struct segment_command_64 *)command;
+            if ((segment->initprot & VM_PROT_EXECUTE) && segment->vmsize > 0) {
+                uintptr_t segment_start = (uintptr_t)(segment->vmaddr + (uint64_t)slide);
+                if (segment_start < start) {
+                    start = segment_start;
+                }
+                if (segment_start + segment->vmsize > end) {
+                    end = segment_start + (uintptr_t)segment->vmsize;
+                }
+            }
+        }
+
+        command += load_command->cmdsize;
+    }
+
+    *start_out = start;
+    *end_out = end;
+    return start < end;
+}
+
+// Index of the range containing `address`, or -1
+static ssize_t find_range(const image_table_t *table, uintptr_t address) {
+    size_t low = 0;
+    size_t high = table->count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (address < table->ranges[middle].start) {
+            high = middle;
+        }
+        else if (address >= table->ranges[middle].end) {
+            low = middle + 1;
+        }
+        else {
+            return (ssize_t)middle;
+        }
+    }
+
+    return -1;
+}
+
+static image_table_t *allocate_table(size_t count) {
+    image_table_t *table = malloc(sizeof(image_table_t) + count * sizeof(image_range_t));
+    if (!table) {
+        fprintf(stderr, "Failed to allocate image table with %zu entries\n", count);
+        return NULL;
+    }
+
+    table->count = count;
+    return table;
+}
+
+static int compare_ranges(const void *lhs, const void *rhs) {
+    uintptr_t lhs_start = ((const image_range_t *)lhs)->start;
+    uintptr_t rhs_start = ((const image_range_t *)rhs)->start;
+    return lhs_start < rhs_start ? -1 : lhs_start > rhs_start;
+}
+
+/**
+  * Call with table_lock held. Readers may still be using the old table, and there's no way to know when they are
+  * done, so it's never freed. Images are rarely loaded after launch, so this leaks very little.
+  * A reader that looked up the old table can still cache its answer after the clear. That entry carries the old
+  * generation and is ignored, and the next publish clears it before the 8-bit generation could come round again
+ */
+static void publish_table(image_table_t *table) {
+    table->generation = ++table_generation;
+    atomic_store_explicit(&current_table, table, memory_order_release);
+    clear_caller_cache();
+}
+
+static void image_added(const struct mach_header *header, intptr_t slide) {
+    image_range_t range = {.header = header};
+    if (!image_code_range(header, slide, &range.start, &range.end)) {
+        return;
+    }
+
+    pthread_mutex_lock(&table_lock);
+    image_table_t *table = atomic_load_explicit(&current_table, memory_order_relaxed);
+    if (!table || find_range(table, range.start) >= 0) {
+        // Already picked up by the initial scan
+        pthread_mutex_unlock(&table_lock);
+        return;
+    }
+
+    range.path = dyld_image_path_containing_address(header);
+    range.owner = classify_image(range.path);
+
+    image_table_t *new_table = allocate_table(table->count + 1);
+    if (new_table) {
+        size_t insert_at = 0;
+        while (insert_at < table->count && table->ranges[insert_at].start < range.start) {
+            insert_at++;
+        }
+
+        memcpy(new_table->ranges, table->ranges, insert_at * sizeof(image_range_t));
+        new_table->ranges[insert_at] = range;
+        memcpy(&new_table->ranges[insert_at + 1], &table->ranges[insert_at], (table->count - insert_at) * sizeof(image_range_t));
+        publish_table(new_table);
+    }
+    pthread_mutex_unlock(&table_lock);
+}
+
+static void image_removed(const struct mach_header *header, intptr_t slide) {
+    (void)slide;
+    pthread_mutex_lock(&table_lock);
+    image_table_t *table = atomic_load_explicit(&current_table, memory_order_relaxed);
+    image_table_t *new_table = table ? allocate_table(table->count) : NULL;
+    if (new_table) {
+        size_t count = 0;
+        for (size_t i = 0; i < table->count; i++) {
+            if (table->ranges[i].header != header) {
+                new_table->ranges[count++] = table->ranges[i];
+            }
+        }
+
+        new_table->count = count;
+        publish_table(new_table);
+    }
+    pthread_mutex_unlock(&table_lock);
+}
+
+static void start_tracking(void) {
+    // Everything inside this app's bundle counts as the app, including its embedded frameworks
+    char executable_path[PATH_MAX];
+    uint32_t size = sizeof(executable_path);
+    if (_NSGetExecutablePath(executable_path, &size) == 0) {
+        char resolved[PATH_MAX];
+        resolve_path(executable_path, resolved);
+        char *contents = strstr(resolved, ".app/Contents/MacOS/");
+        if (contents) {
+            contents[strlen(".app/")] = '\0';
+        }
+        snprintf(app_bundle_prefix, sizeof(app_bundle_prefix), "%s", resolved);
+    }
+
+    // Build the table for what's already loaded in one go. The add-image callback below reports all of these again
+    uint32_t image_count = _dyld_image_count();
+    image_table_t *table = allocate_table(image_count);
+    if (!table) {
+        return;
+    }
+
+    size_t count = 0;
+    pthread_mutex_lock(&table_lock);
+    for (uint32_t i = 0; i < image_count; i++) {
+        image_range_t range = {.header = _dyld_get_image_header(i), .path = _dyld_get_image_name(i)};
+        if (range.header && image_code_range(range.header, _dyld_get_image_vmaddr_slide(i), &range.start, &range.end)) {
+            range.owner = classify_image(range.path);
+            table->ranges[count++] = range;
+        }
+    }
+
+    table->count = count;
+    qsort(table->ranges, count, sizeof(image_range_t), compare_ranges);
+    publish_table(table);
+    pthread_mutex_unlock(&table_lock);
+
+    _dyld_register_func_for_add_image(image_added);
+    _dyld_register_func_for_remove_image(image_removed);
+}
+
+void image_ranges_start(void) {
+    pthread_once(&start_once, start_tracking);
+}
+
+image_owner_t image_owner_for_address(const void *address) {
+    uintptr_t caller = (uintptr_t)address;
+    image_table_t *table = atomic_load_explicit(&current_table, memory_order_acquire);
+    if (!table) {
+        return IMAGE_OWNER_UNKNOWN;
+    }
+
+    _Atomic uint64_t *slot = &caller_cache[caller_cache_slot(caller)];
+    uint64_t cached = atomic_load_explicit(slot, memory_order_relaxed);
+    if (cached != 0 && (cached & ~(uint64_t)0xff) == pack_cache_entry(caller, table->generation, 0)) {
+        return (image_owner_t)(cached & 0xff);
+    }
+
+    ssize_t index = find_range(table, caller);
+    if (index < 0) {
+        // Not cached: unknown addresses are things like JIT code or trampolines, which come and go
+        return IMAGE_OWNER_UNKNOWN;
+    }
+
+    image_owner_t owner = table->ranges[index].owner;
+    atomic_store_explicit(slot, pack_cache_entry(caller, table->generation, owner), memory_order_relaxed);
+    return owner;
+}
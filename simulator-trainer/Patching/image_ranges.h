@@ -0,0 +1,32 @@
+//
+//  image_ranges.h
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#ifndef image_ranges_h
+#define image_ranges_h
+
+#include <CoreFoundation/CoreFoundation.h>
+
+typedef enum {
+    IMAGE_OWNER_UNKNOWN = 0,
+    // System frameworks and anything else loaded into the process
+    IMAGE_OWNER_SYSTEM,
+    // This app's executable and the frameworks inside its bundle
+    IMAGE_OWNER_APP,
+} image_owner_t;
+
+/**
+  * Start tracking the code ranges of every loaded image. Images loaded later are added as dyld reports them.
+  * Safe to call more than once
+ */
+void image_ranges_start(void);
+
+/**
+  * Which image the code at `address` belongs to. Lock-free and allocation-free, meant for hooks on hot paths
+ */
+image_owner_t image_owner_for_address(const void *address);
+
+#endif /* image_ranges_h */
@@ -0,0 +1,321 @@
+//
+//  load_command_injection.c
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#include "load_command_injection.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <libkern/OSByteOrder.h>
+#include <mach-o/loader.h>
+#include <mach-o/fat.h>
+
+#define MAX_FAT_ARCHS 16
+
+typedef struct {
+    uint8_t *base;
+    size_t size;
+} macho_slice_t;
+
+static uint32_t load_dylib_command_size(const char *dylib_path) {
+    return (uint32_t)((sizeof(struct dylib_command) + strlen(dylib_path) + 1 + 7) & ~7);
+}
+
+static int collect_slices(uint8_t *file, size_t file_size, macho_slice_t *slices_out, int max_slices) {
+    if (file_size < sizeof(uint32_t)) {
+        return -1;
+    }
+    
+    uint32_t magic = *(uint32_t *)file;
+    if (magic == MH_MAGIC_64) {
+        slices_out[0].base = file;
+        slices_out[0].size = file_size;
+        return 1;
+    }
+    
+    if (magic != FAT_CIGAM && magic != FAT_MAGIC) {
+        return -1;
+    }
+    
+    // Fat headers are big endian on disk
+    struct fat_header *fat = (struct fat_header *)file;
+    bool swap = (magic == FAT_CIGAM);
+    uint32_t nfat_arch = swap ? OSSwapInt32(fat->nfat_arch) : fat->nfat_arch;
+    if (nfat_arch == 0 || nfat_arch > (uint32_t)max_slices || sizeof(struct fat_header) + nfat_arch * sizeof(struct fat_arch) > file_size) {
+        return -1;
+    }
+    
+    struct fat_arch *archs = (struct fat_arch *)(fat + 1);
+    int count = 0;
+    for (uint32_t i = 0; i < nfat_arch; i++) {
+        uint32_t offset = swap ? OSSwapInt32(archs[i].offset) : archs[i].offset;
+        uint32_t size = swap ? OSSwapInt32(archs[i].size) : archs[i].size;
+        if ((uint64_t)offset + size > file_size || size < sizeof(struct mach_header_64)) {
+            return -1;
+        }
+        
+        // 32-bit slices can't be loaded by a simulator runtime, leave them alone
+        if (*(uint32_t *)(file + offset) != MH_MAGIC_64) {
+            continue;
+        }
+        
+        slices_out[count].base = file + offset;
+        slices_out[count].size = size;
+        count++;
+    }
+    
+    return count;
+}
+
+/**
+  * Walk the load commands of a slice, checking for `dylib_path` and measuring the padding after the last command
+  * @return 0 if the commands are well formed
+ */
+static int inspect_slice(const macho_slice_t *slice, const char *dylib_path, bool *loads_out, uint64_t *free_space_out) {
+    struct mach_header_64 *header = (struct mach_header_64 *)slice->base;
+    uint64_t commands_end = sizeof(struct mach_header_64) + (uint64_t)header->sizeofcmds;
+    if (commands_end > slice->size) {
+        return -1;
+    }
+    
+    // Padding ends where the first section's contents begin
+    uint64_t first_data_offset = slice->size;
+    *loads_out = false;
+    
+    uint8_t *p = (uint8_t *)(header + 1);
+    uint32_t offset = 0;
+    for (uint32_t i = 0; i < header->ncmds; i++) {
+        if (offset + sizeof(struct load_command) > header->sizeofcmds) {
+            return -1;
+        }
+        
+        struct load_command *lc = (struct load_command *)(p + offset);
+        if (lc->cmdsize < sizeof(struct load_command) || offset + lc->cmdsize > header->sizeofcmds) {
+            return -1;
+        }
+        
+        if (lc->cmd == LC_LOAD_DYLIB || lc->cmd == LC_LOAD_WEAK_DYLIB || lc->cmd == LC_REEXPORT_DYLIB || lc->cmd == LC_LAZY_LOAD_DYLIB || lc->cmd == LC_LOAD_UPWARD_DYLIB) {
+            struct dylib_command *dylib = (struct dylib_command *)lc;
+            uint32_t name_offset = dylib->dylib.name.offset;
+            if (name_offset < lc->cmdsize) {
+                const char *name = (const char *)lc + name_offset;
+                if (strncmp(name, dylib_path, lc->cmdsize - name_offset) == 0) {
+                    *loads_out = true;
+                }
+            }
+        }
+        else if (lc->cmd == LC_SEGMENT_64 && lc->cmdsize >= sizeof(struct segment_command_64)) {
+            struct segment_command_64 *segment = (struct segment_command_64 *)lc;
+            if (sizeof(struct segment_command_64) + (uint64_t)segment->nsects * sizeof(struct section_64) > lc->cmdsize) {
+                return -1;
+            }
+            
+            struct section_64 *sections = (struct section_64 *)(segment + 1);
+            for (uint32_t j = 0; j < segment->nsects; j++) {
+                uint8_t type = sections[j].flags & SECTION_TYPE;
+                bool zero_fill = (type == S_ZEROFILL || type == S_GB_ZEROFILL || type == S_THREAD_LOCAL_ZEROFILL);
+                if (!zero_fill && sections[j].size > 0 && sections[j].offset > 0 && sections[j].offset < first_data_offset) {
+                    first_data_offset = sections[j].offset;
+                }
+            }
+            
+            // Segments other than __TEXT start after the load commands too
+            if (segment->fileoff > 0 && segment->filesize > 0 && segment->fileoff < first_data_offset) {
+                first_data_offset = segment->fileoff;
+            }
+        }
+        
+        offset += lc->cmdsize;
+    }
+    
+    *free_space_out = (first_data_offset > commands_end) ? first_data_offset - commands_end : 0;
+    return 0;
+}
+
+static void append_load_dylib(const macho_slice_t *slice, const char *dylib_path) {
+    struct mach_header_64 *header = (struct mach_header_64 *)slice->base;
+    uint32_t command_size = load_dylib_command_size(dylib_path);
+    
+    struct dylib_command *command = (struct dylib_command *)(slice->base + sizeof(struct mach_header_64) + header->sizeofcmds);
+    memset(command, 0, command_size);
+    command->cmd = LC_LOAD_DYLIB;
+    command->cmdsize = command_size;
+    command->dylib.name.offset = sizeof(struct dylib_command);
+    command->dylib.timestamp = 2;
+    command->dylib.current_version = 0x10000;
+    command->dylib.compatibility_version = 0x10000;
+    memcpy((uint8_t *)command + sizeof(struct dylib_command), dylib_path, strlen(dylib_path) + 1);
+    
+    header->ncmds += 1;
+    header->sizeofcmds += command_size;
+}
+
+static int map_binary(const char *binary_path, bool writable, uint8_t **file_out, size_t *size_out) {
+    int fd = open(binary_path, writable ? O_RDWR : O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot open '%s': %s\n", binary_path, strerror(errno));
+        return -1;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct mach_header_64)) {
+        close(fd);
+        return -1;
+    }
+    
+    void *file = mmap(NULL, (size_t)st.st_size, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED) {
+        fprintf(stderr, "Cannot map '%s': %s\n", binary_path, strerror(errno));
+        return -1;
+    }
+    
+    *file_out = file;
+    *size_out = (size_t)st.st_size;
+    return 0;
+}
+
+int macho_loads_dylib(const char *binary_path, const char *dylib_path) {
+    if (binary_path == NULL || dylib_path == NULL) {
+        return -1;
+    }
+    
+    uint8_t *file = NULL;
+    size_t file_size = 0;
+    if (map_binary(binary_path, false, &file, &file_size) != 0) {
+        return -1;
+    }
+    
+    macho_slice_t slices[MAX_FAT_ARCHS];
+    int slice_count = collect_slices(file, file_size, slices, MAX_FAT_ARCHS);
+    int result = (slice_count > 0) ? 1 : -1;
+    for (int i = 0; i < slice_count; i++) {
+        bool loads = false;
+        uint64_t free_space = 0;
+        if (inspect_slice(&slices[i], dylib_path, &loads, &free_space) != 0) {
+            result = -1;
+            break;
+        }
+        
+        if (!loads) {
+            result = 0;
+        }
+    }
+    
+    munmap(file, file_size);
+    return result;
+}
+
+int macho_insert_load_dylib(const char *binary_path, const char *dylib_path) {
+    if (binary_path == NULL || dylib_path == NULL) {
+        return -1;
+    }
+    
+    uint8_t *file = NULL;
+    size_t file_size = 0;
+    if (map_binary(binary_path, true, &file, &file_size) != 0) {
+        return -1;
+    }
+    
+    macho_slice_t slices[MAX_FAT_ARCHS];
+    int slice_count = collect_slices(file, file_size, slices, MAX_FAT_ARCHS);
+    if (slice_count <= 0) {
+        fprintf(stderr, "'%s' has no 64-bit Mach-O slices\n", binary_path);
+        munmap(file, file_size);
+        return -1;
+    }
+    
+    // Check every slice before touching any of them
+    bool needs_command[MAX_FAT_ARCHS];
+    int pending = 0;
+    uint32_t command_size = load_dylib_command_size(dylib_path);
+    for (int i = 0; i < slice_count; i++) {
+        bool loads = false;
+        uint64_t free_space = 0;
+        if (inspect_slice(&slices[i], dylib_path, &loads, &free_space) != 0) {
+            fprintf(stderr, "Malformed load commands in '%s'\n", binary_path);
+            munmap(file, file_size);
+            return -1;
+        }
+        
+        needs_command[i] = !loads;
+        if (loads) {
+            continue;
+        }
+        
+        if (free_space < command_size) {
+            fprintf(stderr, "Not enough room for LC_LOAD_DYLIB in '%s' (%llu bytes free, %u needed)\n", binary_path, free_space, command_size);
+            munmap(file, file_size);
+            return -1;
+        }
+        pending++;
+    }
+    
+    if (pending == 0) {
+        munmap(file, file_size);
+        return 1;
+    }
+    
+    for (int i = 0; i < slice_count; i++) {
+        if (needs_command[i]) {
+            append_load_dylib(&slices[i], dylib_path);
+        }
+    }
+    
+    int result = 0;
+    if (msync(file, file_size, MS_SYNC) != 0) {
+        fprintf(stderr, "Failed to write '%s': %s\n", binary_path, strerror(errno));
+        result = -1;
+    }
+    
+    munmap(file, file_size);
+    return result;
+}
+
+int macho_read_uuid(const char *binary_path, uint8_t uuid_out[16]) {
+    if (binary_path == NULL || uuid_out == NULL) {
+        return -1;
+    }
+    
+    uint8_t *file = NULL;
+    size_t file_size = 0;
+    if (map_binary(binary_path, false, &file, &file_size) != 0) {
+        return -1;
+    }
+    
+    macho_slice_t slices[MAX_FAT_ARCHS];
+    int result = -1;
+    if (collect_slices(file, file_size, slices, MAX_FAT_ARCHS) > 0) {
+        struct mach_header_64 *header = (struct mach_header_64 *)slices[0].base;
+        uint8_t *p = (uint8_t *)(header + 1);
+        uint32_t offset = 0;
+        if (sizeof(struct mach_header_64) + (uint64_t)header->sizeofcmds <= slices[0].size) {
+            for (uint32_t i = 0; i < header->ncmds && offset + sizeof(struct load_command) <= header->sizeofcmds; i++) {
+                struct load_command *lc = (struct load_command *)(p + offset);
+                if (lc->cmdsize < sizeof(struct load_command) || offset + lc->cmdsize > header->sizeofcmds) {
+                    break;
+                }
+                
+                if (lc->cmd == LC_UUID && lc->cmdsize >= sizeof(struct uuid_command)) {
+                    memcpy(uuid_out, ((struct uuid_command *)lc)->uuid, 16);
+                    result = 0;
+                    break;
+                }
+                
+                offset += lc->cmdsize;
+            }
+        }
+    }
+    
+    munmap(file, file_size);
+    return result;
+}
@@ -0,0 +1,33 @@
+//
+//  load_command_injection.h
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#ifndef load_command_injection_h
+#define load_command_injection_h
+
+#include <CoreFoundation/CoreFoundation.h>
+
+/**
+  * Check whether every 64-bit slice of the Mach-O at `binary_path` already loads `dylib_path`
+  * @return 1 if it does, 0 if at least one slice doesn't, -1 if the file can't be read or isn't a Mach-O
+ */
+int macho_loads_dylib(const char *binary_path, const char *dylib_path);
+
+/**
+  * Append an LC_LOAD_DYLIB for `dylib_path` to every 64-bit slice of the Mach-O at `binary_path` that doesn't already load it.
+  * The command goes into the padding between the load commands and the first section, so no file content moves.
+  * Nothing is written unless every slice has room. The existing code signature is left in place and has to be redone
+  * @return 0 if a command was added, 1 if every slice already loaded the dylib, -1 on failure or if there isn't enough padding
+ */
+int macho_insert_load_dylib(const char *binary_path, const char *dylib_path);
+
+/**
+  * Read the LC_UUID of the first 64-bit slice of the Mach-O at `binary_path`
+  * @return 0 with the uuid written to `uuid_out`, -1 if the file can't be read or has no LC_UUID
+ */
+int macho_read_uuid(const char *binary_path, uint8_t uuid_out[16]);
+
+#endif /* load_command_injection_h */
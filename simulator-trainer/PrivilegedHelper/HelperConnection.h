@@ -6,7 +6,7 @@
 //
 
 #import <Foundation/Foundation.h>
-#import "SimInjectionOptions.h"
+#import "SimRuntimeHelperProtocol.h"
 
 NS_ASSUME_NONNULL_BEGIN
 
@@ -14,10 +14,23 @@ NS_ASSUME_NONNULL_BEGIN
 
 - (NSXPCConnection *)getConnection;
 
+/**
+  * Connect ahead of the first request, so it doesn't wait for authorization and the XPC setup. Does nothing when
+  * the helper isn't installed yet, since installing it asks for an admin password
+  * @return NO if the helper is installed but the connection couldn't be made
+ */
+- (BOOL)connectIfInstalled;
+
 // These mirror the helper protocol methods
 - (void)mountTmpfsOverlaysAtPaths:(NSArray<NSString *> *)overlayPaths completion:(void (^)(NSError * _Nullable error))completion;
-- (void)setupTweakInjectionWithOptions:(SimInjectionOptions *)options completion:(void (^)(NSError * _Nullable error))completion;
 - (void)unmountMountPoints:(NSArray<NSString *> *)mountPoints completion:(void (^)(NSError * _Nullable error))completion;
+- (void)overlayMetricsForPaths:(NSArray<NSString *> *)overlayPaths completion:(void (^)(NSArray<NSDictionary<NSString *, id> *> * _Nullable metrics, NSError * _Nullable error))completion;
+
+/**
+  * Send every step of `transaction` to the helper in one authorized message.
+  * `progress` is called from the helper as steps start and finish, on an XPC queue
+ */
+- (void)runTransaction:(SimHelperTransaction *)transaction progress:(nullable id<SimHelperTransactionProgress>)progress completion:(void (^)(NSArray<SimHelperStepResult *> * _Nullable results, NSError * _Nullable error))completion;
 
 @end
 
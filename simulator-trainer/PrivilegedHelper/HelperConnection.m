@@ -9,12 +9,16 @@
 #import "SimRuntimeHelperProtocol.h"
 #import "HelperConnection.h"
 
+// How long acquired rights are reused before asking authd again. Shorter than the default admin rule's credential timeout
+static const NSTimeInterval kAuthorizationReuseInterval = 240;
+
 @interface HelperConnection () {
     AuthorizationRef authRef;
 }
 
 @property (atomic, strong) NSXPCConnection *helperConnection;
 @property (atomic, copy) NSData *authorizationData;
+@property (atomic, strong) NSDate *authorizationAcquiredDate;
 
 @end
 
@@ -78,6 +82,13 @@
 }
 
 - (void)connectToHelperService {
+    // Startup connects from a background queue, and a request may come in at the same time
+    @synchronized (self) {
+        [self _connectToHelperService];
+    }
+}
+
+- (void)_connectToHelperService {
     if (self.helperConnection) {
         // Already connected
         return;
@@ -101,7 +112,7 @@
     }
     
     self.helperConnection = [[NSXPCConnection alloc] initWithMachServiceName:(NSString *)kSimRuntimeHelperServiceName options:NSXPCConnectionPrivileged];
-    self.helperConnection.remoteObjectInterface = [NSXPCInterface interfaceWithProtocol:@protocol(SimRuntimeHelperProtocol)];
+    self.helperConnection.remoteObjectInterface = SimRuntimeHelperXPCInterface();
     self.helperConnection.exportedInterface = [NSXPCInterface interfaceWithProtocol:@protocol(SimRuntimeHelperProtocol)];
     self.helperConnection.exportedObject = self;
     
@@ -117,6 +128,16 @@
     [self.helperConnection resume];
 }
 
+- (BOOL)connectIfInstalled {
+    CFDictionaryRef jobDictionary = SMJobCopyDictionary(kSMDomainSystemLaunchd, (CFStringRef)kSimRuntimeHelperServiceName);
+    if (!jobDictionary) {
+        return YES;
+    }
+    CFRelease(jobDictionary);
+
+    return [self getConnection] != nil;
+}
+
 - (NSXPCConnection *)getConnection {
     if (!self.helperConnection) {
         [self connectToHelperService];
@@ -125,27 +146,23 @@
     return self.helperConnection;
 }
 
-- (void)mountTmpfsOverlaysAtPaths:(NSArray<NSString *> *)overlayPaths completion:(void (^)(NSError * _Nullable error))completion {
-    NSXPCConnection *conn = [self getConnection];
-    if (!conn) {
-        if (completion) {
-            completion([NSError errorWithDomain:NSCocoaErrorDomain code:-1 userInfo:@{NSLocalizedDescriptionKey: @"XPC connection not available."}]);
-        }
-
-        return;
-    }
-
+- (NSData *)_acquireAuthorizationData:(NSError **)error {
     // Ensure we have valid authorization
     if (!self->authRef) {
         [self _setupAuthorizationForHelper];
         if (!self->authRef) {
-            if (completion) {
-                completion([NSError errorWithDomain:NSCocoaErrorDomain code:-1 userInfo:@{NSLocalizedDescriptionKey: @"Failed to create authorization reference."}]);
+            if (error) {
+                *error = [NSError errorWithDomain:NSCocoaErrorDomain code:-1 userInfo:@{NSLocalizedDescriptionKey: @"Failed to create authorization reference."}];
             }
-            return;
+            return nil;
         }
     }
 
+    // Rights acquired recently are still valid. Skip the authd round trip when a batch of requests arrives together
+    if (self.authorizationData && self.authorizationAcquiredDate && -[self.authorizationAcquiredDate timeIntervalSinceNow] < kAuthorizationReuseInterval) {
+        return self.authorizationData;
+    }
+
     // Acquire the right
     AuthorizationItem right = {kSimRuntimeHelperAuthRightName.UTF8String, 0, NULL, 0};
     AuthorizationRights rights = {1, &right};
@@ -154,22 +171,44 @@
     OSStatus status = AuthorizationCopyRights(self->authRef, &rights, NULL, flags, NULL);
     if (status != errAuthorizationSuccess) {
         NSLog(@"Failed to acquire authorization rights: %d", (int)status);
-        if (completion) {
-            completion([NSError errorWithDomain:NSOSStatusErrorDomain code:status userInfo:@{NSLocalizedDescriptionKey: @"Failed to acquire authorization rights."}]);
+        if (error) {
+            *error = [NSError errorWithDomain:NSOSStatusErrorDomain code:status userInfo:@{NSLocalizedDescriptionKey: @"Failed to acquire authorization rights."}];
         }
-        return;
+        return nil;
     }
 
     // Create fresh external form
     AuthorizationExternalForm extForm;
     if (AuthorizationMakeExternalForm(self->authRef, &extForm) != errAuthorizationSuccess) {
+        if (error) {
+            *error = [NSError errorWithDomain:NSCocoaErrorDomain code:-1 userInfo:@{NSLocalizedDescriptionKey: @"Failed to create external authorization form."}];
+        }
+        return nil;
+    }
+
+    self.authorizationData = [NSData dataWithBytes:&extForm length:sizeof(extForm)];
+    self.authorizationAcquiredDate = [NSDate date];
+    return self.authorizationData;
+}
+
+- (void)mountTmpfsOverlaysAtPaths:(NSArray<NSString *> *)overlayPaths completion:(void (^)(NSError * _Nullable error))completion {
+    NSXPCConnection *conn = [self getConnection];
+    if (!conn) {
         if (completion) {
-            completion([NSError errorWithDomain:NSCocoaErrorDomain code:-1 userInfo:@{NSLocalizedDescriptionKey: @"Failed to create external authorization form."}]);
+            completion([NSError errorWithDomain:NSCocoaErrorDomain code:-1 userInfo:@{NSLocalizedDescriptionKey: @"XPC connection not available."}]);
         }
+
         return;
     }
 
-    self.authorizationData = [NSData dataWithBytes:&extForm length:sizeof(extForm)];
+    NSError *authError = nil;
+    NSData *authorizationData = [self _acquireAuthorizationData:&authError];
+    if (!authorizationData) {
+        if (completion) {
+            completion(authError);
+        }
+        return;
+    }
 
     id <SimRuntimeHelperProtocol> proxy = [conn remoteObjectProxyWithErrorHandler:^(NSError * _Nonnull proxyError) {
         NSLog(@"XPC proxy error (mountTmpfsOverlaysAtPaths): %@", proxyError);
@@ -178,10 +217,10 @@
         }
     }];
     
-    [proxy mountTmpfsOverlaysAtPaths:overlayPaths withAuthorization:self.authorizationData completion:completion];
+    [proxy mountTmpfsOverlaysAtPaths:overlayPaths withAuthorization:authorizationData completion:completion];
 }
 
-- (void)setupTweakInjectionWithOptions:(SimInjectionOptions *)options completion:(void (^)(NSError * _Nullable error))completion {
+- (void)unmountMountPoints:(NSArray<NSString *> *)mountPoints completion:(void (^)(NSError * _Nullable error))completion {
     NSXPCConnection *conn = [self getConnection];
     if (!conn) {
         if (completion) {
@@ -191,106 +230,89 @@
         return;
     }
 
-    // Ensure we have valid authorization
-    if (!self->authRef) {
-        [self _setupAuthorizationForHelper];
-        if (!self->authRef) {
-            if (completion) {
-                completion([NSError errorWithDomain:NSCocoaErrorDomain code:-1 userInfo:@{NSLocalizedDescriptionKey: @"Failed to create authorization reference."}]);
-            }
-            return;
+    NSError *authError = nil;
+    NSData *authorizationData = [self _acquireAuthorizationData:&authError];
+    if (!authorizationData) {
+        if (completion) {
+            completion(authError);
         }
+        return;
     }
 
-    // Acquire the right
-    AuthorizationItem right = {kSimRuntimeHelperAuthRightName.UTF8String, 0, NULL, 0};
-    AuthorizationRights rights = {1, &right};
-    AuthorizationFlags flags = kAuthorizationFlagExtendRights | kAuthorizationFlagInteractionAllowed;
+    id <SimRuntimeHelperProtocol> proxy = [conn remoteObjectProxyWithErrorHandler:^(NSError * _Nonnull proxyError) {
+        NSLog(@"XPC proxy error (unmountMountPoints): %@", proxyError);
+        if (completion) {
+            completion(proxyError);
+        }
+    }];
 
-    OSStatus status = AuthorizationCopyRights(self->authRef, &rights, NULL, flags, NULL);
-    if (status != errAuthorizationSuccess) {
-        NSLog(@"Failed to acquire authorization rights: %d", (int)status);
+    [proxy unmountMountPoints:mountPoints withAuthorization:authorizationData completion:completion];
+}
+
+- (void)overlayMetricsForPaths:(NSArray<NSString *> *)overlayPaths completion:(void (^)(NSArray<NSDictionary<NSString *, id> *> * _Nullable metrics, NSError * _Nullable error))completion {
+    NSXPCConnection *conn = [self getConnection];
+    if (!conn) {
         if (completion) {
-            completion([NSError errorWithDomain:NSOSStatusErrorDomain code:status userInfo:@{NSLocalizedDescriptionKey: @"Failed to acquire authorization rights."}]);
+            completion(nil, [NSError errorWithDomain:NSCocoaErrorDomain code:-1 userInfo:@{NSLocalizedDescriptionKey: @"XPC connection not available."}]);
         }
+
         return;
     }
 
-    // Create fresh external form
-    AuthorizationExternalForm extForm;
-    if (AuthorizationMakeExternalForm(self->authRef, &extForm) != errAuthorizationSuccess) {
+    NSError *authError = nil;
+    NSData *authorizationData = [self _acquireAuthorizationData:&authError];
+    if (!authorizationData) {
         if (completion) {
-            completion([NSError errorWithDomain:NSCocoaErrorDomain code:-1 userInfo:@{NSLocalizedDescriptionKey: @"Failed to create external authorization form."}]);
+            completion(nil, authError);
         }
         return;
     }
 
-    self.authorizationData = [NSData dataWithBytes:&extForm length:sizeof(extForm)];
-
     id <SimRuntimeHelperProtocol> proxy = [conn remoteObjectProxyWithErrorHandler:^(NSError * _Nonnull proxyError) {
-        NSLog(@"XPC proxy error (setupTweakInjectionWithOptions): %@", proxyError);
+        NSLog(@"XPC proxy error (overlayMetricsForPaths): %@", proxyError);
         if (completion) {
-            completion(proxyError);
+            completion(nil, proxyError);
         }
     }];
-    
-    [proxy setupTweakInjectionWithOptions:options withAuthorization:self.authorizationData completion:completion];
+
+    [proxy overlayMetricsForPaths:overlayPaths withAuthorization:authorizationData completion:completion];
 }
 
-- (void)unmountMountPoints:(NSArray<NSString *> *)mountPoints completion:(void (^)(NSError * _Nullable error))completion {
+- (void)runTransaction:(SimHelperTransaction *)transaction progress:(id<SimHelperTransactionProgress>)progress completion:(void (^)(NSArray<SimHelperStepResult *> * _Nullable results, NSError * _Nullable error))completion {
     NSXPCConnection *conn = [self getConnection];
     if (!conn) {
         if (completion) {
-            completion([NSError errorWithDomain:NSCocoaErrorDomain code:-1 userInfo:@{NSLocalizedDescriptionKey: @"XPC connection not available."}]);
+            completion(nil, [NSError errorWithDomain:NSCocoaErrorDomain code:-1 userInfo:@{NSLocalizedDescriptionKey: @"XPC connection not available."}]);
         }
 
         return;
     }
 
-    // Ensure we have valid authorization
-    if (!self->authRef) {
-        [self _setupAuthorizationForHelper];
-        if (!self->authRef) {
-            if (completion) {
-                completion([NSError errorWithDomain:NSCocoaErrorDomain code:-1 userInfo:@{NSLocalizedDescriptionKey: @"Failed to create authorization reference."}]);
-            }
-            return;
-        }
-    }
-
-    // Acquire the right
-    AuthorizationItem right = {kSimRuntimeHelperAuthRightName.UTF8String, 0, NULL, 0};
-    AuthorizationRights rights = {1, &right};
-    AuthorizationFlags flags = kAuthorizationFlagExtendRights | kAuthorizationFlagInteractionAllowed;
-
-    OSStatus status = AuthorizationCopyRights(self->authRef, &rights, NULL, flags, NULL);
-    if (status != errAuthorizationSuccess) {
-        NSLog(@"Failed to acquire authorization rights: %d", (int)status);
+    NSError *planError = nil;
+    if (![transaction validatePlan:&planError]) {
         if (completion) {
-            completion([NSError errorWithDomain:NSOSStatusErrorDomain code:status userInfo:@{NSLocalizedDescriptionKey: @"Failed to acquire authorization rights."}]);
+            completion(nil, planError);
         }
         return;
     }
 
-    // Create fresh external form
-    AuthorizationExternalForm extForm;
-    if (AuthorizationMakeExternalForm(self->authRef, &extForm) != errAuthorizationSuccess) {
+    NSError *authError = nil;
+    NSData *authorizationData = [self _acquireAuthorizationData:&authError];
+    if (!authorizationData) {
         if (completion) {
-            completion([NSError errorWithDomain:NSCocoaErrorDomain code:-1 userInfo:@{NSLocalizedDescriptionKey: @"Failed to create external authorization form."}]);
+            completion(nil, authError);
         }
         return;
     }
 
-    self.authorizationData = [NSData dataWithBytes:&extForm length:sizeof(extForm)];
-
     id <SimRuntimeHelperProtocol> proxy = [conn remoteObjectProxyWithErrorHandler:^(NSError * _Nonnull proxyError) {
-        NSLog(@"XPC proxy error (unmountMountPoints): %@", proxyError);
+        NSLog(@"XPC proxy error (runTransaction): %@", proxyError);
         if (completion) {
-            completion(proxyError);
+            completion(nil, proxyError);
         }
     }];
 
-    [proxy unmountMountPoints:mountPoints withAuthorization:self.authorizationData completion:completion];
+    [proxy runTransaction:transaction progress:progress withAuthorization:authorizationData completion:completion];
 }
 
 @end
@@ -0,0 +1,79 @@
+//
+//  SimHelperTransaction.h
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+typedef NS_ENUM(NSInteger, SimHelperStepKind) {
+    SimHelperStepKindMountOverlay,
+    SimHelperStepKindUnmount,
+    // Copies sourcePath to path. Skipped if something already exists at path
+    SimHelperStepKindCopyItem,
+    // Adds an LC_LOAD_DYLIB for sourcePath to the binary at path, falling back to the optool at toolPath.
+    // Skipped if the binary's load commands already include it
+    SimHelperStepKindAddLoadCommand,
+    // Sets the 0777 bits of mode on path, which has to be inside an overlay the helper mounted
+    SimHelperStepKindSetPermissions,
+    // Places the contents of the bootstrap image at sourcePath under the runtime root at path
+    SimHelperStepKindDeployBootstrapImage,
+    // Ad-hoc signs the binary at path. Skipped if its current signature is still valid
+    SimHelperStepKindSignBinary,
+};
+
+@interface SimHelperTransactionStep : NSObject <NSSecureCoding>
+
+@property (nonatomic, copy, readonly) NSString *identifier;
+@property (nonatomic, readonly) SimHelperStepKind kind;
+@property (nonatomic, copy, readonly) NSString *path;
+@property (nonatomic, copy, readonly, nullable) NSString *sourcePath;
+@property (nonatomic, copy, readonly, nullable) NSString *toolPath;
+@property (nonatomic, readonly) NSInteger mode;
+// Identifiers of the steps that have to succeed before this one runs
+@property (nonatomic, copy, readonly) NSArray<NSString *> *dependencies;
+
++ (instancetype)mountOverlayAtPath:(NSString *)path;
++ (instancetype)unmountAtPath:(NSString *)path;
++ (instancetype)copyItemAtPath:(NSString *)sourcePath toPath:(NSString *)destinationPath;
++ (instancetype)addLoadCommandForDylib:(NSString *)dylibPath toBinary:(NSString *)binaryPath usingOptoolAtPath:(nullable NSString *)optoolPath;
++ (instancetype)signBinaryAtPath:(NSString *)binaryPath;
++ (instancetype)setPermissions:(NSInteger)mode ofItemAtPath:(NSString *)path;
++ (instancetype)deployBootstrapImage:(NSString *)imagePath toRuntimeRoot:(NSString *)runtimeRoot;
+
+- (void)addDependency:(SimHelperTransactionStep *)step;
+- (void)addDependencies:(NSArray<SimHelperTransactionStep *> *)steps;
+
+@end
+
+@interface SimHelperStepResult : NSObject <NSSecureCoding>
+
+@property (nonatomic, copy) NSString *identifier;
+@property (nonatomic, strong, nullable) NSError *error;
+// Not run, because a dependency failed or there was nothing to do
+@property (nonatomic) BOOL skipped;
+@property (nonatomic) NSTimeInterval duration;
+
+@end
+
+/**
+  * A plan of privileged steps that the helper authorizes once and executes as a unit.
+  * Steps without a dependency between them run concurrently
+ */
+@interface SimHelperTransaction : NSObject <NSSecureCoding>
+
+@property (nonatomic, copy, readonly) NSArray<SimHelperTransactionStep *> *steps;
+
+- (SimHelperTransactionStep *)addStep:(SimHelperTransactionStep *)step;
+
+/**
+  * Check that every dependency refers to a step in this transaction and that there are no cycles
+ */
+- (BOOL)validatePlan:(NSError **)error;
+
+@end
+
+NS_ASSUME_NONNULL_END
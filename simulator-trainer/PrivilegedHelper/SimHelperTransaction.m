@@ -0,0 +1,255 @@
+//
+//  SimHelperTransaction.m
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#import "SimHelperTransaction.h"
+
+@interface SimHelperTransactionStep ()
+@property (nonatomic, copy, readwrite) NSString *identifier;
+@property (nonatomic, readwrite) SimHelperStepKind kind;
+@property (nonatomic, copy, readwrite) NSString *path;
+@property (nonatomic, copy, readwrite, nullable) NSString *sourcePath;
+@property (nonatomic, copy, readwrite, nullable) NSString *toolPath;
+@property (nonatomic, readwrite) NSInteger mode;
+@property (nonatomic, strong) NSMutableArray<NSString *> *mutableDependencies;
+@end
+
+@implementation SimHelperTransactionStep
+
++ (BOOL)supportsSecureCoding {
+    return YES;
+}
+
+- (instancetype)initWithKind:(SimHelperStepKind)kind path:(NSString *)path {
+    if ((self = [super init])) {
+        _identifier = [[NSUUID UUID] UUIDString];
+        _kind = kind;
+        _path = [path copy];
+        _mutableDependencies = [[NSMutableArray alloc] init];
+    }
+
+    return self;
+}
+
++ (instancetype)mountOverlayAtPath:(NSString *)path {
+    return [[self alloc] initWithKind:SimHelperStepKindMountOverlay path:path];
+}
+
++ (instancetype)unmountAtPath:(NSString *)path {
+    return [[self alloc] initWithKind:SimHelperStepKindUnmount path:path];
+}
+
++ (instancetype)copyItemAtPath:(NSString *)sourcePath toPath:(NSString *)destinationPath {
+    SimHelperTransactionStep *step = [[self alloc] initWithKind:SimHelperStepKindCopyItem path:destinationPath];
+    step.sourcePath = sourcePath;
+    return step;
+}
+
++ (instancetype)addLoadCommandForDylib:(NSString *)dylibPath toBinary:(NSString *)binaryPath usingOptoolAtPath:(NSString *)optoolPath {
+    SimHelperTransactionStep *step = [[self alloc] initWithKind:SimHelperStepKindAddLoadCommand path:binaryPath];
+    step.sourcePath = dylibPath;
+    step.toolPath = optoolPath;
+    return step;
+}
+
++ (instancetype)signBinaryAtPath:(NSString *)binaryPath {
+    return [[self alloc] initWithKind:SimHelperStepKindSignBinary path:binaryPath];
+}
+
++ (instancetype)setPermissions:(NSInteger)mode ofItemAtPath:(NSString *)path {
+    SimHelperTransactionStep *step = [[self alloc] initWithKind:SimHelperStepKindSetPermissions path:path];
+    step.mode = mode;
+    return step;
+}
+
++ (instancetype)deployBootstrapImage:(NSString *)imagePath toRuntimeRoot:(NSString *)runtimeRoot {
+    SimHelperTransactionStep *step = [[self alloc] initWithKind:SimHelperStepKindDeployBootstrapImage path:runtimeRoot];
+    step.sourcePath = imagePath;
+    return step;
+}
+
+- (NSArray<NSString *> *)dependencies {
+    return [self.mutableDependencies copy];
+}
+
+- (void)addDependency:(SimHelperTransactionStep *)step {
+    if (step && ![self.mutableDependencies containsObject:step.identifier]) {
+        [self.mutableDependencies addObject:step.identifier];
+    }
+}
+
+- (void)addDependencies:(NSArray<SimHelperTransactionStep *> *)steps {
+    for (SimHelperTransactionStep *step in steps) {
+        [self addDependency:step];
+    }
+}
+
+- (void)encodeWithCoder:(NSCoder *)coder {
+    [coder encodeObject:self.identifier forKey:@"identifier"];
+    [coder encodeInteger:self.kind forKey:@"kind"];
+    [coder encodeObject:self.path forKey:@"path"];
+    [coder encodeObject:self.sourcePath forKey:@"sourcePath"];
+    [coder encodeObject:self.toolPath forKey:@"toolPath"];
+    [coder encodeInteger:self.mode forKey:@"mode"];
+    [coder encodeObject:self.mutableDependencies forKey:@"dependencies"];
+}
+
+- (instancetype)initWithCoder:(NSCoder *)coder {
+    if ((self = [super init])) {
+        _identifier = [coder decodeObjectOfClass:[NSString class] forKey:@"identifier"];
+        _kind = [coder decodeIntegerForKey:@"kind"];
+        _path = [coder decodeObjectOfClass:[NSString class] forKey:@"path"];
+        _sourcePath = [coder decodeObjectOfClass:[NSString class] forKey:@"sourcePath"];
+        _toolPath = [coder decodeObjectOfClass:[NSString class] forKey:@"toolPath"];
+        _mode = [coder decodeIntegerForKey:@"mode"];
+
+        NSSet *allowedClasses = [NSSet setWithObjects:[NSArray class], [NSString class], nil];
+        NSArray *dependencies = [coder decodeObjectOfClasses:allowedClasses forKey:@"dependencies"];
+        _mutableDependencies = dependencies ? [dependencies mutableCopy] : [[NSMutableArray alloc] init];
+    }
+
+    return self;
+}
+
+- (NSString *)description {
+    NSArray *kindNames = @[@"mount", @"unmount", @"copy", @"loadcommand", @"chmod", @"bootstrap", @"sign"];
+    NSString *kindName = (self.kind >= 0 && self.kind < (NSInteger)kindNames.count) ? kindNames[self.kind] : @"unknown";
+    return [NSString stringWithFormat:@"<%@ %@ %@>", kindName, self.path, self.identifier];
+}
+
+@end
+
+@implementation SimHelperStepResult
+
++ (BOOL)supportsSecureCoding {
+    return YES;
+}
+
+- (void)encodeWithCoder:(NSCoder *)coder {
+    [coder encodeObject:self.identifier forKey:@"identifier"];
+    [coder encodeObject:self.error forKey:@"error"];
+    [coder encodeBool:self.skipped forKey:@"skipped"];
+    [coder encodeDouble:self.duration forKey:@"duration"];
+}
+
+- (instancetype)initWithCoder:(NSCoder *)coder {
+    if ((self = [super init])) {
+        _identifier = [coder decodeObjectOfClass:[NSString class] forKey:@"identifier"];
+        _error = [coder decodeObjectOfClass:[NSError class] forKey:@"error"];
+        _skipped = [coder decodeBoolForKey:@"skipped"];
+        _duration = [coder decodeDoubleForKey:@"duration"];
+    }
+
+    return self;
+}
+
+@end
+
+@interface SimHelperTransaction ()
+@property (nonatomic, strong) NSMutableArray<SimHelperTransactionStep *> *mutableSteps;
+@end
+
+@implementation SimHelperTransaction
+
++ (BOOL)supportsSecureCoding {
+    return YES;
+}
+
+- (id)init {
+    if ((self = [super init])) {
+        _mutableSteps = [[NSMutableArray alloc] init];
+    }
+
+    return self;
+}
+
+- (NSArray<SimHelperTransactionStep *> *)steps {
+    return [self.mutableSteps copy];
+}
+
+- (SimHelperTransactionStep *)addStep:(SimHelperTransactionStep *)step {
+    [self.mutableSteps addObject:step];
+    return step;
+}
+
+- (BOOL)validatePlan:(NSError **)error {
+    NSMutableDictionary<NSString *, SimHelperTransactionStep *> *stepsById = [[NSMutableDictionary alloc] init];
+    for (SimHelperTransactionStep *step in self.mutableSteps) {
+        if (!step.identifier || !step.path || stepsById[step.identifier]) {
+            if (error) {
+                *error = [NSError errorWithDomain:NSCocoaErrorDomain code:1 userInfo:@{NSLocalizedDescriptionKey: [NSString stringWithFormat:@"Invalid or duplicate step: %@", step]}];
+            }
+            return NO;
+        }
+
+        stepsById[step.identifier] = step;
+    }
+
+    // Kahn's algorithm: if not every step can be ordered, there is a cycle
+    NSMutableDictionary<NSString *, NSNumber *> *remainingDependencies = [[NSMutableDictionary alloc] init];
+    NSMutableDictionary<NSString *, NSMutableArray<NSString *> *> *dependents = [[NSMutableDictionary alloc] init];
+    NSMutableArray<NSString *> *ready = [[NSMutableArray alloc] init];
+    for (SimHelperTransactionStep *step in self.mutableSteps) {
+        for (NSString *dependency in step.dependencies) {
+            if (!stepsById[dependency]) {
+                if (error) {
+                    *error = [NSError errorWithDomain:NSCocoaErrorDomain code:1 userInfo:@{NSLocalizedDescriptionKey: [NSString stringWithFormat:@"Step %@ depends on a step that isn't in the transaction", step]}];
+                }
+                return NO;
+            }
+
+            if (!dependents[dependency]) {
+                dependents[dependency] = [[NSMutableArray alloc] init];
+            }
+            [dependents[dependency] addObject:step.identifier];
+        }
+
+        remainingDependencies[step.identifier] = @(step.dependencies.count);
+        if (step.dependencies.count == 0) {
+            [ready addObject:step.identifier];
+        }
+    }
+
+    NSUInteger ordered = 0;
+    while (ready.count > 0) {
+        NSString *identifier = ready.lastObject;
+        [ready removeLastObject];
+        ordered++;
+
+        for (NSString *dependent in dependents[identifier]) {
+            NSInteger remaining = remainingDependencies[dependent].integerValue - 1;
+            remainingDependencies[dependent] = @(remaining);
+            if (remaining == 0) {
+                [ready addObject:dependent];
+            }
+        }
+    }
+
+    if (ordered != self.mutableSteps.count) {
+        if (error) {
+            *error = [NSError errorWithDomain:NSCocoaErrorDomain code:1 userInfo:@{NSLocalizedDescriptionKey: @"Transaction steps have a dependency cycle"}];
+        }
+        return NO;
+    }
+
+    return YES;
+}
+
+- (void)encodeWithCoder:(NSCoder *)coder {
+    [coder encodeObject:self.mutableSteps forKey:@"steps"];
+}
+
+- (instancetype)initWithCoder:(NSCoder *)coder {
+    if ((self = [super init])) {
+        NSSet *allowedClasses = [NSSet setWithObjects:[NSArray class], [SimHelperTransactionStep class], nil];
+        NSArray *steps = [coder decodeObjectOfClasses:allowedClasses forKey:@"steps"];
+        _mutableSteps = steps ? [steps mutableCopy] : [[NSMutableArray alloc] init];
+    }
+
+    return self;
+}
+
+@end
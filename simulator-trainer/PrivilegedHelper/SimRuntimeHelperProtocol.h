@@ -6,19 +6,44 @@
 //
 
 #import <Foundation/Foundation.h>
-#import "SimInjectionOptions.h"
+#import "SimHelperTransaction.h"
 
 FOUNDATION_EXPORT NSString * const kSimRuntimeHelperServiceName;
 FOUNDATION_EXPORT NSString * const kSimRuntimeHelperAuthRightName;
 FOUNDATION_EXPORT NSString * const kSimRuntimeHelperAuthRightDefaultRule;
 FOUNDATION_EXPORT NSString * const kSimRuntimeHelperAuthRightDescription;
 
+// Keys of the per-overlay dictionaries returned by overlayMetricsForPaths:
+FOUNDATION_EXPORT NSString * const kSimOverlayMetricsPathKey;
+FOUNDATION_EXPORT NSString * const kSimOverlayMetricsMaxPagesKey;
+FOUNDATION_EXPORT NSString * const kSimOverlayMetricsPagesUsedKey;
+FOUNDATION_EXPORT NSString * const kSimOverlayMetricsMaxNodesKey;
+FOUNDATION_EXPORT NSString * const kSimOverlayMetricsNodesUsedKey;
+FOUNDATION_EXPORT NSString * const kSimOverlayMetricsMaterializedFilesKey;
+FOUNDATION_EXPORT NSString * const kSimOverlayMetricsMaterializedBytesKey;
+FOUNDATION_EXPORT NSString * const kSimOverlayMetricsSymlinksKey;
+FOUNDATION_EXPORT NSString * const kSimOverlayMetricsSymlinkedBytesKey;
+
+// Passed by the app to runTransaction: and called back by the helper as each step runs
+@protocol SimHelperTransactionProgress
+
+- (void)transactionStepDidStart:(NSString *)stepIdentifier;
+- (void)transactionStepDidFinish:(SimHelperStepResult *)result completedSteps:(NSInteger)completedSteps totalSteps:(NSInteger)totalSteps;
+
+@end
 
 @protocol SimRuntimeHelperProtocol
 
 @required
-- (void)setupTweakInjectionWithOptions:(SimInjectionOptions *)options withAuthorization:(NSData *)authData completion:(void (^)(NSError *error))completion;
 - (void)mountTmpfsOverlaysAtPaths:(NSArray<NSString *> *)overlayPaths withAuthorization:(NSData *)authData completion:(void (^)(NSError *error))completion;
 - (void)unmountMountPoints:(NSArray <NSString *> *)mountPoints withAuthorization:(NSData *)authData completion:(void (^)(NSError *))completion;
+- (void)overlayMetricsForPaths:(NSArray<NSString *> *)overlayPaths withAuthorization:(NSData *)authData completion:(void (^)(NSArray<NSDictionary<NSString *, id> *> *metrics, NSError *error))completion;
+- (void)runTransaction:(SimHelperTransaction *)transaction progress:(id<SimHelperTransactionProgress>)progress withAuthorization:(NSData *)authData completion:(void (^)(NSArray<SimHelperStepResult *> *results, NSError *error))completion;
 
 @end
+
+/**
+  * The XPC interface for SimRuntimeHelperProtocol, used by both ends of the connection.
+  * Sets up the progress proxy and the reply classes of the methods that return step results
+ */
+FOUNDATION_EXPORT NSXPCInterface *SimRuntimeHelperXPCInterface(void);
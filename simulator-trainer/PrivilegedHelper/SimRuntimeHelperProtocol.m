@@ -11,3 +11,27 @@ NSString * const kSimRuntimeHelperServiceName = @"com.objc.simulator-trainer.Sim
 NSString * const kSimRuntimeHelperAuthRightName = @"com.objc.simulator-trainer.helper.right";
 NSString * const kSimRuntimeHelperAuthRightDefaultRule = @kAuthorizationRuleIsAdmin;
 NSString * const kSimRuntimeHelperAuthRightDescription = @"Authorize simulator-trainer to modify simulator runtime overlays and jailbreak them.";
+
+NSString * const kSimOverlayMetricsPathKey = @"path";
+NSString * const kSimOverlayMetricsMaxPagesKey = @"maxPages";
+NSString * const kSimOverlayMetricsPagesUsedKey = @"pagesUsed";
+NSString * const kSimOverlayMetricsMaxNodesKey = @"maxNodes";
+NSString * const kSimOverlayMetricsNodesUsedKey = @"nodesUsed";
+NSString * const kSimOverlayMetricsMaterializedFilesKey = @"materializedFiles";
+NSString * const kSimOverlayMetricsMaterializedBytesKey = @"materializedBytes";
+NSString * const kSimOverlayMetricsSymlinksKey = @"symlinks";
+NSString * const kSimOverlayMetricsSymlinkedBytesKey = @"symlinkedBytes";
+
+NSXPCInterface *SimRuntimeHelperXPCInterface(void) {
+    NSXPCInterface *interface = [NSXPCInterface interfaceWithProtocol:@protocol(SimRuntimeHelperProtocol)];
+    
+    // The progress argument is a proxy back into the app rather than a copied object
+    SEL runTransaction = @selector(runTransaction:progress:withAuthorization:completion:);
+    NSXPCInterface *progressInterface = [NSXPCInterface interfaceWithProtocol:@protocol(SimHelperTransactionProgress)];
+    [interface setInterface:progressInterface forSelector:runTransaction argumentIndex:1 ofReply:NO];
+    
+    NSSet *resultClasses = [NSSet setWithObjects:[NSArray class], [SimHelperStepResult class], [NSError class], nil];
+    [interface setClasses:resultClasses forSelector:runTransaction argumentIndex:0 ofReply:YES];
+    
+    return interface;
+}
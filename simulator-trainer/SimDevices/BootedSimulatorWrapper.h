@@ -7,21 +7,23 @@
 
 #import <Cocoa/Cocoa.h>
 #import "SimulatorWrapper.h"
+#import "SimRuntimeStateCache.h"
 
 NS_ASSUME_NONNULL_BEGIN
 
 @interface BootedSimulatorWrapper : SimulatorWrapper
 
-@property (nonatomic) BOOL pendingReboot;
-
 + (BootedSimulatorWrapper * _Nullable)fromSimulatorWrapper:(SimulatorWrapper * _Nonnull)simDevice;
 
 - (NSString * _Nonnull)tweakLoaderDylibPath;
 - (NSArray <NSString *> *)directoriesToOverlay;
 - (NSDictionary *)bootstrapFilesToCopy;
+- (SimRuntimeJailbreakState *)jailbreakState;
 - (BOOL)isJailbroken;
 - (void)reboot;
 - (void)respring;
+// Restarts SpringBoard in this device only, and completes once it is running again
+- (void)respringWithCompletion:(void (^ _Nullable)(NSError * _Nullable error))completion;
 - (void)shutdownWithCompletion:(void (^ _Nullable)(NSError *error))completion;
 
 @end
@@ -7,8 +7,10 @@
 
 #import <objc/message.h>
 #import "BootedSimulatorWrapper.h"
-#import "CommandRunner.h"
-#import "tmpfs_overlay.h"
+#import "SimDeviceRegistry.h"
+#import "SimDeviceStateMachine.h"
+#import "sim_process_tree.h"
+#import "SimRuntimeStateCache.h"
 
 @implementation BootedSimulatorWrapper
 
@@ -27,18 +29,16 @@
         return nil;
     }
     
-    return [[BootedSimulatorWrapper alloc] initWithCoreSimDevice:wrapper.coreSimDevice];
-}
-
-
-- (instancetype)initWithCoreSimDevice:(NSDictionary *)coreSimDevice {
-    if ((self = [super initWithCoreSimDevice:coreSimDevice])) {
-        self.pendingReboot = NO;
+    // Prefer the registry's wrapper so delegates and state stay on one instance per device
+    SimulatorWrapper *registeredWrapper = [[SimDeviceRegistry sharedRegistry] deviceForUdid:wrapper.udidString];
+    if ([registeredWrapper isKindOfClass:[BootedSimulatorWrapper class]]) {
+        return (BootedSimulatorWrapper *)registeredWrapper;
     }
     
-    return self;
+    return [[BootedSimulatorWrapper alloc] initWithCoreSimDevice:wrapper.coreSimDevice];
 }
 
+
 - (NSArray <NSString *> *)directoriesToOverlay {
     return @[
         [self.runtimeRoot stringByAppendingPathComponent:@"/usr/lib"],
@@ -48,17 +48,13 @@
 }
 
 - (NSDictionary *)bootstrapFilesToCopy {
-    NSDictionary *bundleFiles = @{
-        @"FLEX.dylib": @"/Library/MobileSubstrate/DynamicLibraries/FLEX.dylib",
-        @"FLEX.plist": @"/Library/MobileSubstrate/DynamicLibraries/FLEX.plist",
-        @"CydiaSubstrate": @"/Library/Frameworks/CydiaSubstrate.framework/CydiaSubstrate",
-        @"libhooker.dylib": @"/usr/lib/libhooker.dylib",
-        @"loader.dylib": @"/usr/lib/loader.dylib",
-        @"cycript_server.dylib": @"/Library/MobileSubstrate/DynamicLibraries/cycript_server.dylib",
-        @"cycript_server.plist": @"/Library/MobileSubstrate/DynamicLibraries/cycript_server.plist",
-        @"libcycript.dylib": @"/usr/lib/libcycript.dylib",
-        @"libcycript.db": @"/usr/lib/libcycript.db",
-    };
+    // Shared with build_bootstrap_image.py, which packs the same files into the bootstrap image
+    NSString *manifestPath = [[NSBundle mainBundle] pathForResource:@"BootstrapFiles" ofType:@"plist"];
+    NSDictionary<NSString *, NSString *> *bundleFiles = manifestPath ? [NSDictionary dictionaryWithContentsOfFile:manifestPath] : nil;
+    if (!bundleFiles) {
+        NSLog(@"Missing bootstrap file manifest");
+        return @{};
+    }
     
     NSMutableDictionary *filesToCopy = [[NSMutableDictionary alloc] init];
     NSString *simRuntimePath = self.runtimeRoot;
@@ -74,39 +70,17 @@
     return [filesToCopy copy];
 }
 
-- (BOOL)hasOverlays {    
-    NSString *libraryMountPath = [self.runtimeRoot stringByAppendingPathComponent:@"/usr/lib/"];
-    if (![[NSFileManager defaultManager] fileExistsAtPath:libraryMountPath]) {
-        NSLog(@"simruntime does not have a `/usr/lib/` directory: %@", self.runtimeRoot);
-        return NO;
-    }
-    
-    if (!is_mount_point(libraryMountPath.UTF8String)) {
-        return NO;
-    }
-    
-    if (!is_tmpfs_mount(libraryMountPath.UTF8String)) {
-        NSLog(@"Mount point is not a tmpfs overlay: %@", libraryMountPath);
-        return NO;
-    }
-    
-    return YES;
+- (SimRuntimeJailbreakState *)jailbreakState {
+    // Shared by every device on this runtime and kept in memory, so this is cheap enough for every UI refresh
+    return [[SimRuntimeStateCache sharedCache] stateForRuntimeRoot:self.runtimeRoot loaderPath:[self tweakLoaderDylibPath]];
 }
 
-- (BOOL)hasInjection {
-    if (!self.runtimeRoot) {
-        NSLog(@"No runtime root?");
-        return NO;
-    }
+- (BOOL)hasOverlays {
+    return [self jailbreakState].hasOverlays;
+}
 
-    NSString *libPath = [self.runtimeRoot stringByAppendingPathComponent:@"/usr/lib/libobjc.A.dylib"];
-    NSString *otoolOutput = [CommandRunner xcrunInvokeAndWait:@[@"otool", @"-l", libPath]];
-    if (!otoolOutput) {
-        NSLog(@"Failed to get otool output");
-        return NO;
-    }
-    
-    return [otoolOutput containsString:[self tweakLoaderDylibPath]];
+- (BOOL)hasInjection {
+    return [self jailbreakState].hasInjection;
 }
 
 - (NSString *)tweakLoaderDylibPath {
@@ -124,41 +98,50 @@
         }
     }
     
+    // Created before the shutdown starts so the transition gets timed
+    SimDeviceStateMachine *stateMachine = [SimDeviceStateMachine stateMachineForUdid:self.udidString];
+    
     // Shutdown the simulator. This doesn't reliably terminate the actual Simulator frontend app process
     ((void (*)(id, SEL, id))objc_msgSend)(self.coreSimDevice, NSSelectorFromString(@"shutdownAsyncWithCompletionHandler:"), ^(NSError *error) {
         if (error) {
             NSLog(@"Failed to shutdown device: %@", error);
+            self.pendingReboot = NO;
+            if (completion) {
+                completion(error);
+            }
             return;
         }
         
-        for (int i = 0; i < 10 && self.isBooted; i++) {
-            NSLog(@"Waiting for device to shutdown: %@", self);
-            [self reloadDeviceState];
-            [NSThread sleepForTimeInterval:1.0];
-        }
-        
-        // If the device was shutdown for a reboot, boot it again now.
-        // Note: Reboots will not call the didShutdown: delegate method
-        if (self.pendingReboot) {
-            // -boot will cleanup the pendingReboot
-            [self bootWithCompletion:nil];
-            return;
-        }
-        
-        if (self.delegate) {
-            if (self.isBooted && [self.delegate respondsToSelector:@selector(device:didFailToShutdownWithError:)]) {
-                // Device is still booted, something went wrong
-                [self.delegate device:self didFailToShutdownWithError:[NSError errorWithDomain:NSOSStatusErrorDomain code:paramErr userInfo:@{NSLocalizedDescriptionKey: @"Failed to shutdown device"}]];
-            }
-            else if (!self.isBooted && [self.delegate respondsToSelector:@selector(deviceDidShutdown:)]) {
-                [self.delegate deviceDidShutdown:self];
-            }
+        [stateMachine waitForTransition:SimDeviceTransitionShutdown timeout:10.0 queue:dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0) completion:^(NSTimeInterval elapsed, NSError *waitError) {
+            [self _shutdownFinishedWithCompletion:completion];
+        }];
+    });
+}
+
+- (void)_shutdownFinishedWithCompletion:(void (^)(NSError *error))completion {
+    [self reloadDeviceState];
+    
+    // If the device was shutdown for a reboot, boot it again now.
+    // Note: Reboots will not call the didShutdown: delegate method
+    if (self.pendingReboot) {
+        // -boot will cleanup the pendingReboot
+        [self bootWithCompletion:nil];
+        return;
+    }
+    
+    if (self.delegate) {
+        if (self.isBooted && [self.delegate respondsToSelector:@selector(device:didFailToShutdownWithError:)]) {
+            // Device is still booted, something went wrong
+            [self.delegate device:self didFailToShutdownWithError:[NSError errorWithDomain:NSOSStatusErrorDomain code:paramErr userInfo:@{NSLocalizedDescriptionKey: @"Failed to shutdown device"}]];
         }
-        
-        if (completion) {
-            completion(error);
+        else if (!self.isBooted && [self.delegate respondsToSelector:@selector(deviceDidShutdown:)]) {
+            [self.delegate deviceDidShutdown:self];
         }
-    });
+    }
+    
+    if (completion) {
+        completion(self.isBooted ? [NSError errorWithDomain:NSOSStatusErrorDomain code:paramErr userInfo:@{NSLocalizedDescriptionKey: @"Failed to shutdown device"}] : nil);
+    }
 }
 
 - (void)reboot {
@@ -177,11 +160,48 @@
 }
 
 - (void)respring {
-    [CommandRunner runCommand:@"/usr/bin/killall" withArguments:@[@"-9", @"backboardd"] stdoutString:nil error:nil];
+    [self respringWithCompletion:nil];
+}
+
+- (void)respringWithCompletion:(void (^)(NSError *error))completion {
+    NSString *udid = self.udidString;
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+        NSError *error = nil;
+        
+        // Only signal processes under this device's launchd_sim. killall would respring every booted simulator
+        pid_t launchdPid = sim_launchd_pid_for_udid(udid.UTF8String);
+        pid_t springBoardPid = sim_child_pid_named(launchdPid, "SpringBoard");
+        pid_t targetPid = sim_child_pid_named(launchdPid, "backboardd");
+        if (targetPid <= 0) {
+            targetPid = springBoardPid;
+        }
+        
+        if (launchdPid <= 0) {
+            error = [NSError errorWithDomain:NSCocoaErrorDomain code:1 userInfo:@{NSLocalizedDescriptionKey: [NSString stringWithFormat:@"launchd_sim not found for device %@", udid]}];
+        }
+        else if (targetPid <= 0) {
+            error = [NSError errorWithDomain:NSCocoaErrorDomain code:1 userInfo:@{NSLocalizedDescriptionKey: @"Neither backboardd nor SpringBoard is running"}];
+        }
+        // SpringBoard goes down with backboardd and launchd_sim starts both again
+        else if (kill(targetPid, SIGKILL) != 0) {
+            error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:@{NSLocalizedDescriptionKey: [NSString stringWithFormat:@"Failed to signal pid %d", targetPid]}];
+        }
+        else if (sim_wait_for_child_named(launchdPid, "SpringBoard", springBoardPid, 30.0) <= 0) {
+            error = [NSError errorWithDomain:NSCocoaErrorDomain code:1 userInfo:@{NSLocalizedDescriptionKey: @"SpringBoard did not come back after respring"}];
+        }
+        
+        if (error) {
+            NSLog(@"Failed to respring %@: %@", udid, error);
+        }
+        
+        if (completion) {
+            completion(error);
+        }
+    });
 }
 
 - (BOOL)isJailbroken {
-    return [self hasOverlays] || [self hasInjection];
+    return [[self jailbreakState] isJailbroken];
 }
 
 @end
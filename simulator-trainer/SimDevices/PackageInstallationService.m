@@ -259,17 +259,25 @@
     }
 
     cleanupBlock();
+    [[SimRuntimeStateCache sharedCache] invalidateRuntimeRoot:device.runtimeRoot];
 
-    [device respring];
-
-    if (completion) {
-        completion(nil);
-    }
+    [device respringWithCompletion:^(NSError * _Nullable respringError) {
+        if (respringError) {
+            NSLog(@"Installed, but respring failed: %@", respringError);
+        }
+        
+        if (completion) {
+            completion(nil);
+        }
+    }];
 }
 
 - (void)installAppBundleAtPath:(NSString *)appPath toDevice:(BootedSimulatorWrapper *)device completion:(void (^)(NSError * _Nullable error))completion {
-    NSString *tempAppPath = [NSTemporaryDirectory() stringByAppendingPathComponent:[appPath lastPathComponent]];
-    if (![[NSFileManager defaultManager] copyItemAtPath:appPath toPath:tempAppPath error:nil]) {
+    // Unique per install, so the same app can be installed to several devices at once
+    NSString *tempAppDir = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    NSString *tempAppPath = [tempAppDir stringByAppendingPathComponent:[appPath lastPathComponent]];
+    if (![[NSFileManager defaultManager] createDirectoryAtPath:tempAppDir withIntermediateDirectories:YES attributes:nil error:nil] ||
+        ![[NSFileManager defaultManager] copyItemAtPath:appPath toPath:tempAppPath error:nil]) {
         NSLog(@"Failed to copy app bundle to temporary location");
         if (completion) {
             completion([NSError errorWithDomain:NSCocoaErrorDomain code:1 userInfo:@{NSLocalizedDescriptionKey: @"Failed to copy app bundle"}]);
@@ -283,6 +291,7 @@
     NSURL *tmpAppUrl = [NSURL fileURLWithPath:tempAppPath];
     SEL _sel = sel_registerName("installApplication:withOptions:error:");
     ((void (*)(id, SEL, NSURL *, NSDictionary *, NSError **))objc_msgSend)(device.coreSimDevice, _sel, tmpAppUrl, nil, &error);
+    [[NSFileManager defaultManager] removeItemAtPath:tempAppDir error:nil];
     if (error) {
         NSLog(@"Failed to install app bundle: %@", error);
         if (completion) {
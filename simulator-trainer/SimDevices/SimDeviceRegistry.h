@@ -0,0 +1,68 @@
+//
+//  SimDeviceRegistry.h
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#import <Foundation/Foundation.h>
+#import "SimulatorWrapper.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+// Posted on the main queue whenever devices are added, removed or change state
+FOUNDATION_EXPORT NSNotificationName const SimDeviceRegistryDidChangeNotification;
+// NSArray<SimDeviceRegistryChange *>, in the order they have to be applied
+FOUNDATION_EXPORT NSString * const SimDeviceRegistryChangesKey;
+// NSNumber. Increases with every posted batch of changes
+FOUNDATION_EXPORT NSString * const SimDeviceRegistryGenerationKey;
+
+typedef NS_ENUM(NSInteger, SimDeviceRegistryChangeKind) {
+    SimDeviceRegistryChangeInserted,
+    SimDeviceRegistryChangeRemoved,
+    SimDeviceRegistryChangeUpdated,
+};
+
+@interface SimDeviceRegistryChange : NSObject
+
+@property (nonatomic, readonly) SimDeviceRegistryChangeKind kind;
+@property (nonatomic, copy, readonly) NSString *udid;
+// Position in the device list at the time this change is applied. Changes are applied one after another
+@property (nonatomic, readonly) NSUInteger index;
+// The wrapper now in the list. Nil for removals
+@property (nonatomic, strong, readonly, nullable) SimulatorWrapper *device;
+// The wrapper that was in the list before. Differs from `device` when a device crossed between booted and shutdown
+@property (nonatomic, strong, readonly, nullable) SimulatorWrapper *previousDevice;
+@property (nonatomic, readonly) BOOL wasBooted;
+
+@end
+
+/**
+  * Long-lived index of the CoreSimulator device set. Wrappers are kept per UDID and reused for as long as the device
+  * stays in the same booted/shutdown state, and the index is updated from CoreSimulator's notifications rather than
+  * by re-listing the device set
+ */
+@interface SimDeviceRegistry : NSObject
+
++ (instancetype)sharedRegistry;
+
+// Ordered as CoreSimulator lists them, with devices added later at the end
+- (NSArray<SimulatorWrapper *> *)devices;
+
+/**
+  * The device list together with the generation it reflects. Changes posted with a generation at or below
+  * this one are already included in the list
+ */
+- (NSArray<SimulatorWrapper *> *)devicesWithGeneration:(uint64_t *)generation;
+- (SimulatorWrapper * _Nullable)deviceForUdid:(NSString *)udid;
+- (id _Nullable)coreSimDeviceForUdid:(NSString *)udid;
+- (NSArray<id> * _Nullable)coreSimDevices;
+
+/**
+  * Re-list the device set and post the differences. Only needed if notifications are unavailable
+ */
+- (void)resynchronize;
+
+@end
+
+NS_ASSUME_NONNULL_END
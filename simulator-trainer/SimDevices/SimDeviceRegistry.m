@@ -0,0 +1,432 @@
+//
+//  SimDeviceRegistry.m
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#import <objc/runtime.h>
+#import <objc/message.h>
+#import "SimDeviceRegistry.h"
+#import "BootedSimulatorWrapper.h"
+#import "ToolchainRegistry.h"
+
+NSNotificationName const SimDeviceRegistryDidChangeNotification = @"SimDeviceRegistryDidChangeNotification";
+NSString * const SimDeviceRegistryChangesKey = @"changes";
+NSString * const SimDeviceRegistryGenerationKey = @"generation";
+
+@interface SimDeviceRegistryChange ()
+@property (nonatomic, readwrite) SimDeviceRegistryChangeKind kind;
+@property (nonatomic, copy, readwrite) NSString *udid;
+@property (nonatomic, readwrite) NSUInteger index;
+@property (nonatomic, strong, readwrite, nullable) SimulatorWrapper *device;
+@property (nonatomic, strong, readwrite, nullable) SimulatorWrapper *previousDevice;
+@property (nonatomic, readwrite) BOOL wasBooted;
+@end
+
+@implementation SimDeviceRegistryChange
+
+- (NSString *)description {
+    NSArray *kindNames = @[@"inserted", @"removed", @"updated"];
+    return [NSString stringWithFormat:@"<%@ %@ %@ at %lu>", NSStringFromClass(self.class), kindNames[self.kind], self.udid, (unsigned long)self.index];
+}
+
+@end
+
+@interface SimDeviceRegistry ()
+
+@property (nonatomic, strong) dispatch_queue_t queue;
+@property (nonatomic, strong) id deviceSet;
+@property (nonatomic, strong) NSMutableArray<NSString *> *orderedUdids;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, SimulatorWrapper *> *wrappersByUdid;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, id> *coreSimDevicesByUdid;
+@property (nonatomic, strong) NSMutableSet<NSString *> *bootedUdids;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSNumber *> *notificationRegistrations;
+@property (nonatomic) uint64_t generation;
+
+@end
+
+@implementation SimDeviceRegistry
+
++ (instancetype)sharedRegistry {
+    static SimDeviceRegistry *sharedRegistry = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedRegistry = [[SimDeviceRegistry alloc] init];
+    });
+
+    return sharedRegistry;
+}
+
+- (id)init {
+    if ((self = [super init])) {
+        _queue = dispatch_queue_create("com.simulatortrainer.deviceregistry", DISPATCH_QUEUE_SERIAL);
+        _orderedUdids = [[NSMutableArray alloc] init];
+        _wrappersByUdid = [[NSMutableDictionary alloc] init];
+        _coreSimDevicesByUdid = [[NSMutableDictionary alloc] init];
+        _bootedUdids = [[NSMutableSet alloc] init];
+        _notificationRegistrations = [[NSMutableDictionary alloc] init];
+
+        // The service context and device set live for the whole process, so they are only looked up once
+        _deviceSet = [SimDeviceRegistry _loadDefaultDeviceSet];
+        dispatch_sync(_queue, ^{
+            for (id coreSimDevice in [self _listDeviceSet]) {
+                [self _insertCoreSimDevice:coreSimDevice];
+            }
+
+            [self _registerDeviceSetNotifications];
+        });
+    }
+
+    return self;
+}
+
++ (id)_loadDefaultDeviceSet {
+    Class _SimServiceContext = objc_getClass("SimServiceContext");
+    SEL _sharedServiceContextForDeveloperDir = sel_registerName("sharedServiceContextForDeveloperDir:error:");
+    if (_SimServiceContext == NULL) {
+        NSLog(@"CoreSimulator framework issue. SimServiceContext not found");
+        return nil;
+    }
+
+    if (![_SimServiceContext respondsToSelector:_sharedServiceContextForDeveloperDir]) {
+        NSLog(@"Expected method -[SimServiceContext sharedServiceContextForDeveloperDir:error:] not found");
+        return nil;
+    }
+
+    NSError *error = nil;
+    NSString *developerDir = [[ToolchainRegistry sharedRegistry] developerDir];
+    id simServiceContext = ((id (*)(id, SEL, id, NSError **))objc_msgSend)(_SimServiceContext, _sharedServiceContextForDeveloperDir, developerDir, &error);
+    if (error || !simServiceContext) {
+        NSLog(@"Failed to get SimServiceContext: %@", error);
+        return nil;
+    }
+
+    SEL _defaultDeviceSet = sel_registerName("defaultDeviceSetWithError:");
+    if (![_SimServiceContext instancesRespondToSelector:_defaultDeviceSet]) {
+        NSLog(@"Expected method -[SimServiceContext defaultDeviceSetWithError:] not found");
+        return nil;
+    }
+
+    id deviceSet = ((id (*)(id, SEL, NSError **))objc_msgSend)(simServiceContext, _defaultDeviceSet, &error);
+    if (error || !deviceSet) {
+        NSLog(@"Failed to get default device set: %@", error);
+        return nil;
+    }
+
+    return deviceSet;
+}
+
+- (NSArray *)_listDeviceSet {
+    SEL _devices = sel_registerName("devices");
+    if (!self.deviceSet || ![self.deviceSet respondsToSelector:_devices]) {
+        NSLog(@"Expected method -[SimDeviceSet devices] not found");
+        return nil;
+    }
+
+    return ((id (*)(id, SEL))objc_msgSend)(self.deviceSet, _devices);
+}
+
++ (NSString *)_udidForCoreSimDevice:(id)coreSimDevice {
+    NSUUID *udid = ((id (*)(id, SEL))objc_msgSend)(coreSimDevice, NSSelectorFromString(@"UDID"));
+    return [udid UUIDString];
+}
+
++ (BOOL)_coreSimDeviceIsBooted:(id)coreSimDevice {
+    NSString *state = ((id (*)(id, SEL))objc_msgSend)(coreSimDevice, NSSelectorFromString(@"stateString"));
+    return [state isEqualToString:@"Booted"];
+}
+
+#pragma mark - Lookup
+
+- (NSArray<SimulatorWrapper *> *)devices {
+    return [self devicesWithGeneration:NULL];
+}
+
+- (NSArray<SimulatorWrapper *> *)devicesWithGeneration:(uint64_t *)generation {
+    __block NSMutableArray<SimulatorWrapper *> *devices = nil;
+    dispatch_sync(self.queue, ^{
+        devices = [[NSMutableArray alloc] initWithCapacity:self.orderedUdids.count];
+        for (NSString *udid in self.orderedUdids) {
+            [devices addObject:self.wrappersByUdid[udid]];
+        }
+
+        if (generation) {
+            *generation = self.generation;
+        }
+    });
+
+    return devices;
+}
+
+- (SimulatorWrapper *)deviceForUdid:(NSString *)udid {
+    if (!udid) {
+        return nil;
+    }
+
+    __block SimulatorWrapper *device = nil;
+    dispatch_sync(self.queue, ^{
+        device = self.wrappersByUdid[udid];
+    });
+
+    return device;
+}
+
+- (id)coreSimDeviceForUdid:(NSString *)udid {
+    if (!udid) {
+        return nil;
+    }
+
+    __block id coreSimDevice = nil;
+    dispatch_sync(self.queue, ^{
+        coreSimDevice = self.coreSimDevicesByUdid[udid];
+    });
+
+    return coreSimDevice;
+}
+
+- (NSArray<id> *)coreSimDevices {
+    if (!self.deviceSet) {
+        return nil;
+    }
+
+    __block NSMutableArray *coreSimDevices = nil;
+    dispatch_sync(self.queue, ^{
+        coreSimDevices = [[NSMutableArray alloc] initWithCapacity:self.orderedUdids.count];
+        for (NSString *udid in self.orderedUdids) {
+            [coreSimDevices addObject:self.coreSimDevicesByUdid[udid]];
+        }
+    });
+
+    return coreSimDevices;
+}
+
+#pragma mark - Index maintenance (registry queue only)
+
+- (SimulatorWrapper *)_wrapperForCoreSimDevice:(id)coreSimDevice booted:(BOOL)booted {
+    if (booted) {
+        return [[BootedSimulatorWrapper alloc] initWithCoreSimDevice:coreSimDevice];
+    }
+
+    return [[SimulatorWrapper alloc] initWithCoreSimDevice:coreSimDevice];
+}
+
+- (SimDeviceRegistryChange *)_insertCoreSimDevice:(id)coreSimDevice {
+    // Devices without a runtime can't be used for anything
+    id runtime = ((id (*)(id, SEL))objc_msgSend)(coreSimDevice, sel_registerName("runtime"));
+    NSString *udid = [SimDeviceRegistry _udidForCoreSimDevice:coreSimDevice];
+    if (!runtime || !udid || self.wrappersByUdid[udid]) {
+        return nil;
+    }
+
+    BOOL booted = [SimDeviceRegistry _coreSimDeviceIsBooted:coreSimDevice];
+    SimulatorWrapper *wrapper = [self _wrapperForCoreSimDevice:coreSimDevice booted:booted];
+    if (!wrapper) {
+        return nil;
+    }
+
+    [self.orderedUdids addObject:udid];
+    self.wrappersByUdid[udid] = wrapper;
+    self.coreSimDevicesByUdid[udid] = coreSimDevice;
+    if (booted) {
+        [self.bootedUdids addObject:udid];
+    }
+    [self _registerNotificationsForCoreSimDevice:coreSimDevice udid:udid];
+
+    SimDeviceRegistryChange *change = [[SimDeviceRegistryChange alloc] init];
+    change.kind = SimDeviceRegistryChangeInserted;
+    change.udid = udid;
+    change.index = self.orderedUdids.count - 1;
+    change.device = wrapper;
+    return change;
+}
+
+- (SimDeviceRegistryChange *)_removeUdid:(NSString *)udid {
+    NSUInteger index = [self.orderedUdids indexOfObject:udid];
+    if (index == NSNotFound) {
+        return nil;
+    }
+
+    [self _unregisterNotificationsForUdid:udid];
+
+    SimDeviceRegistryChange *change = [[SimDeviceRegistryChange alloc] init];
+    change.kind = SimDeviceRegistryChangeRemoved;
+    change.udid = udid;
+    change.index = index;
+    change.previousDevice = self.wrappersByUdid[udid];
+    change.wasBooted = [self.bootedUdids containsObject:udid];
+
+    [self.orderedUdids removeObjectAtIndex:index];
+    [self.wrappersByUdid removeObjectForKey:udid];
+    [self.coreSimDevicesByUdid removeObjectForKey:udid];
+    [self.bootedUdids removeObject:udid];
+    return change;
+}
+
+- (SimDeviceRegistryChange *)_updateUdid:(NSString *)udid {
+    id coreSimDevice = self.coreSimDevicesByUdid[udid];
+    SimulatorWrapper *wrapper = self.wrappersByUdid[udid];
+    if (!coreSimDevice || !wrapper) {
+        return nil;
+    }
+
+    BOOL wasBooted = [self.bootedUdids containsObject:udid];
+    BOOL booted = [SimDeviceRegistry _coreSimDeviceIsBooted:coreSimDevice];
+    if (booted) {
+        [self.bootedUdids addObject:udid];
+    }
+    else {
+        [self.bootedUdids removeObject:udid];
+    }
+
+    // The wrapper class follows the boot state. Within a state the same instance is kept, and across states
+    // the replacement takes over the old wrapper's state
+    SimulatorWrapper *currentWrapper = wrapper;
+    if (booted != [wrapper isKindOfClass:[BootedSimulatorWrapper class]]) {
+        currentWrapper = [self _wrapperForCoreSimDevice:coreSimDevice booted:booted];
+        [currentWrapper adoptStateFromWrapper:wrapper];
+        self.wrappersByUdid[udid] = currentWrapper;
+    }
+
+    SimDeviceRegistryChange *change = [[SimDeviceRegistryChange alloc] init];
+    change.kind = SimDeviceRegistryChangeUpdated;
+    change.udid = udid;
+    change.index = [self.orderedUdids indexOfObject:udid];
+    change.device = currentWrapper;
+    change.previousDevice = wrapper;
+    change.wasBooted = wasBooted;
+    return change;
+}
+
+- (void)_postChanges:(NSArray<SimDeviceRegistryChange *> *)changes {
+    if (changes.count == 0) {
+        return;
+    }
+
+    self.generation += 1;
+    NSDictionary *userInfo = @{SimDeviceRegistryChangesKey: changes, SimDeviceRegistryGenerationKey: @(self.generation)};
+    dispatch_async(dispatch_get_main_queue(), ^{
+        [NSNotificationCenter.defaultCenter postNotificationName:SimDeviceRegistryDidChangeNotification object:self userInfo:userInfo];
+    });
+}
+
+#pragma mark - CoreSimulator notifications
+
+- (void)_registerDeviceSetNotifications {
+    SEL _registerHandler = NSSelectorFromString(@"registerNotificationHandlerOnQueue:handler:");
+    if (![self.deviceSet respondsToSelector:_registerHandler]) {
+        NSLog(@"Device set notifications unavailable, device list will only update on resynchronize");
+        return;
+    }
+
+    __weak typeof(self) weakSelf = self;
+    ((unsigned long long (*)(id, SEL, dispatch_queue_t, id))objc_msgSend)(self.deviceSet, _registerHandler, self.queue, ^(NSDictionary *notification) {
+        NSString *name = notification[@"notification"];
+        id coreSimDevice = notification[@"device"];
+        if (!coreSimDevice) {
+            return;
+        }
+
+        SimDeviceRegistryChange *change = nil;
+        if ([name isEqualToString:@"device_added"]) {
+            change = [weakSelf _insertCoreSimDevice:coreSimDevice];
+        }
+        else if ([name isEqualToString:@"device_removed"]) {
+            change = [weakSelf _removeUdid:[SimDeviceRegistry _udidForCoreSimDevice:coreSimDevice]];
+        }
+
+        if (change) {
+            [weakSelf _postChanges:@[change]];
+        }
+    });
+}
+
+- (void)_registerNotificationsForCoreSimDevice:(id)coreSimDevice udid:(NSString *)udid {
+    SEL _registerHandler = NSSelectorFromString(@"registerNotificationHandlerOnQueue:handler:");
+    if (![coreSimDevice respondsToSelector:_registerHandler]) {
+        return;
+    }
+
+    __weak typeof(self) weakSelf = self;
+    unsigned long long registration = ((unsigned long long (*)(id, SEL, dispatch_queue_t, id))objc_msgSend)(coreSimDevice, _registerHandler, self.queue, ^(NSDictionary *notification) {
+        if (![notification[@"notification"] isEqualToString:@"device_state"]) {
+            return;
+        }
+
+        SimDeviceRegistryChange *change = [weakSelf _updateUdid:udid];
+        if (change) {
+            [weakSelf _postChanges:@[change]];
+        }
+    });
+
+    self.notificationRegistrations[udid] = @(registration);
+}
+
+- (void)_unregisterNotificationsForUdid:(NSString *)udid {
+    NSNumber *registration = self.notificationRegistrations[udid];
+    id coreSimDevice = self.coreSimDevicesByUdid[udid];
+    SEL _unregisterHandler = NSSelectorFromString(@"unregisterNotificationHandler:error:");
+    if (registration && [coreSimDevice respondsToSelector:_unregisterHandler]) {
+        ((BOOL (*)(id, SEL, unsigned long long, NSError **))objc_msgSend)(coreSimDevice, _unregisterHandler, registration.unsignedLongLongValue, nil);
+    }
+
+    [self.notificationRegistrations removeObjectForKey:udid];
+}
+
+#pragma mark - Resynchronize
+
+- (void)resynchronize {
+    dispatch_async(self.queue, ^{
+        NSArray *listedDevices = [self _listDeviceSet];
+        if (!listedDevices) {
+            return;
+        }
+
+        NSMutableDictionary<NSString *, id> *listedByUdid = [[NSMutableDictionary alloc] initWithCapacity:listedDevices.count];
+        for (id coreSimDevice in listedDevices) {
+            NSString *udid = [SimDeviceRegistry _udidForCoreSimDevice:coreSimDevice];
+            if (udid) {
+                listedByUdid[udid] = coreSimDevice;
+            }
+        }
+
+        NSMutableArray<SimDeviceRegistryChange *> *changes = [[NSMutableArray alloc] init];
+
+        // Removals go from the back so earlier indexes stay valid
+        for (NSString *udid in [self.orderedUdids reverseObjectEnumerator].allObjects) {
+            if (!listedByUdid[udid]) {
+                SimDeviceRegistryChange *change = [self _removeUdid:udid];
+                if (change) {
+                    [changes addObject:change];
+                }
+            }
+        }
+
+        for (id coreSimDevice in listedDevices) {
+            NSString *udid = [SimDeviceRegistry _udidForCoreSimDevice:coreSimDevice];
+            if (!udid) {
+                continue;
+            }
+
+            SimDeviceRegistryChange *change = nil;
+            if (self.wrappersByUdid[udid]) {
+                // Only report devices whose boot state actually moved
+                BOOL booted = [SimDeviceRegistry _coreSimDeviceIsBooted:coreSimDevice];
+                if (booted != [self.bootedUdids containsObject:udid]) {
+                    change = [self _updateUdid:udid];
+                }
+            }
+            else {
+                change = [self _insertCoreSimDevice:coreSimDevice];
+            }
+
+            if (change) {
+                [changes addObject:change];
+            }
+        }
+
+        [self _postChanges:changes];
+    });
+}
+
+@end
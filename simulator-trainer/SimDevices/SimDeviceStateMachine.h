@@ -0,0 +1,55 @@
+//
+//  SimDeviceStateMachine.h
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+// Matches CoreSimulator's SimDeviceState values
+typedef NS_ENUM(NSInteger, SimDeviceLifecycleState) {
+    SimDeviceLifecycleStateCreating = 0,
+    SimDeviceLifecycleStateShutdown = 1,
+    SimDeviceLifecycleStateBooting = 2,
+    SimDeviceLifecycleStateBooted = 3,
+    SimDeviceLifecycleStateShuttingDown = 4,
+};
+
+typedef NS_ENUM(NSInteger, SimDeviceTransition) {
+    SimDeviceTransitionBooted,
+    SimDeviceTransitionShutdown,
+    // Booted, and CoreSimulator reports the boot finished, which includes SpringBoard coming up
+    SimDeviceTransitionSpringBoardReady,
+};
+
+/**
+  * Tracks one device's lifecycle from CoreSimulator's state notifications, so callers can wait for a transition
+  * instead of sleeping and re-checking. Transition durations are recorded per runtime version
+ */
+@interface SimDeviceStateMachine : NSObject
+
+@property (nonatomic, copy, readonly) NSString *udid;
+@property (nonatomic, readonly) SimDeviceLifecycleState state;
+@property (nonatomic, readonly) BOOL springBoardReady;
+
+// One instance per device, created on first use
++ (instancetype _Nullable)stateMachineForUdid:(NSString *)udid;
+
+/**
+  * Calls completion on `queue` once the device reaches `transition`, or with an error after `timeout` seconds.
+  * Completes right away if the device is already there
+ */
+- (void)waitForTransition:(SimDeviceTransition)transition timeout:(NSTimeInterval)timeout queue:(dispatch_queue_t)queue completion:(void (^)(NSTimeInterval elapsed, NSError * _Nullable error))completion;
+
+/**
+  * Recorded durations, keyed by runtime version then transition name ("boot", "shutdown", "springboard").
+  * Each value is an array of counts, where bucket i holds durations under 2^i * 100ms
+ */
++ (NSDictionary<NSString *, NSDictionary<NSString *, NSArray<NSNumber *> *> *> *)transitionHistograms;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,328 @@
+//
+//  SimDeviceStateMachine.m
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#import <objc/message.h>
+#import "SimDeviceStateMachine.h"
+#import "SimDeviceRegistry.h"
+
+#define HISTOGRAM_BUCKET_COUNT 10
+// Longest gap between boot status checks while CoreSimulator doesn't notify about boot progress
+#define MAX_BOOT_STATUS_RECHECK_INTERVAL 2.0
+
+static NSMutableDictionary<NSString *, NSMutableDictionary<NSString *, NSMutableArray<NSNumber *> *> *> *g_transitionHistograms = nil;
+static dispatch_queue_t g_histogramQueue = nil;
+
+@interface SimDeviceTransitionWaiter : NSObject
+@property (nonatomic) SimDeviceTransition transition;
+@property (nonatomic) CFAbsoluteTime startTime;
+@property (nonatomic, strong) dispatch_queue_t queue;
+@property (nonatomic, copy) void (^completion)(NSTimeInterval elapsed, NSError *error);
+@end
+
+@implementation SimDeviceTransitionWaiter
+@end
+
+@interface SimDeviceStateMachine ()
+@property (nonatomic, copy, readwrite) NSString *udid;
+@property (nonatomic, readwrite) SimDeviceLifecycleState state;
+@property (nonatomic, readwrite) BOOL springBoardReady;
+@property (nonatomic, strong) id coreSimDevice;
+@property (nonatomic, copy) NSString *runtimeVersion;
+@property (nonatomic, strong) dispatch_queue_t queue;
+@property (nonatomic, strong) NSMutableArray<SimDeviceTransitionWaiter *> *waiters;
+@property (nonatomic) CFAbsoluteTime bootStartTime;
+@property (nonatomic) CFAbsoluteTime shutdownStartTime;
+@property (nonatomic) NSTimeInterval bootStatusRecheckInterval;
+@property (nonatomic) BOOL bootStatusRecheckScheduled;
+@end
+
+@implementation SimDeviceStateMachine
+
++ (instancetype)stateMachineForUdid:(NSString *)udid {
+    static NSMutableDictionary<NSString *, SimDeviceStateMachine *> *stateMachines = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        stateMachines = [[NSMutableDictionary alloc] init];
+        g_transitionHistograms = [[NSMutableDictionary alloc] init];
+        g_histogramQueue = dispatch_queue_create("com.simulatortrainer.transitionhistograms", DISPATCH_QUEUE_SERIAL);
+    });
+
+    if (!udid) {
+        return nil;
+    }
+
+    @synchronized (stateMachines) {
+        SimDeviceStateMachine *stateMachine = stateMachines[udid];
+        if (!stateMachine) {
+            stateMachine = [[SimDeviceStateMachine alloc] initWithUdid:udid];
+            if (stateMachine) {
+                stateMachines[udid] = stateMachine;
+            }
+        }
+
+        return stateMachine;
+    }
+}
+
+- (instancetype)initWithUdid:(NSString *)udid {
+    SimDeviceRegistry *registry = [SimDeviceRegistry sharedRegistry];
+    id coreSimDevice = [registry coreSimDeviceForUdid:udid];
+    if (!coreSimDevice) {
+        NSLog(@"No CoreSimulator device for %@", udid);
+        return nil;
+    }
+
+    if ((self = [super init])) {
+        _udid = [udid copy];
+        _coreSimDevice = coreSimDevice;
+        _runtimeVersion = [[registry deviceForUdid:udid] runtimeVersion] ?: @"unknown";
+        _queue = dispatch_queue_create("com.simulatortrainer.devicestate", DISPATCH_QUEUE_SERIAL);
+        _waiters = [[NSMutableArray alloc] init];
+        _state = [self _readState];
+        _springBoardReady = (_state == SimDeviceLifecycleStateBooted) && [self _bootStatusFinished];
+
+        SEL _registerHandler = NSSelectorFromString(@"registerNotificationHandlerOnQueue:handler:");
+        if ([coreSimDevice respondsToSelector:_registerHandler]) {
+            __weak typeof(self) weakSelf = self;
+            ((unsigned long long (*)(id, SEL, dispatch_queue_t, id))objc_msgSend)(coreSimDevice, _registerHandler, _queue, ^(NSDictionary *notification) {
+                // Boot progress arrives under different notification names across Xcode versions, so any of them triggers a re-read
+                [weakSelf _evaluate];
+            });
+        }
+        else {
+            NSLog(@"Device notifications unavailable for %@, transitions will only be noticed on timeout", udid);
+        }
+    }
+
+    return self;
+}
+
+#pragma mark - Reading CoreSimulator state
+
+- (SimDeviceLifecycleState)_readState {
+    SEL _state = NSSelectorFromString(@"state");
+    if ([self.coreSimDevice respondsToSelector:_state]) {
+        return (SimDeviceLifecycleState)((unsigned long long (*)(id, SEL))objc_msgSend)(self.coreSimDevice, _state);
+    }
+
+    NSString *stateString = ((id (*)(id, SEL))objc_msgSend)(self.coreSimDevice, NSSelectorFromString(@"stateString"));
+    return [stateString isEqualToString:@"Booted"] ? SimDeviceLifecycleStateBooted : SimDeviceLifecycleStateShutdown;
+}
+
+- (BOOL)_bootStatusFinished {
+    SEL _bootStatus = NSSelectorFromString(@"bootStatus");
+    if (![self.coreSimDevice respondsToSelector:_bootStatus]) {
+        // Older CoreSimulator. Booted is as close as it gets
+        return YES;
+    }
+
+    id bootStatus = ((id (*)(id, SEL))objc_msgSend)(self.coreSimDevice, _bootStatus);
+    if (!bootStatus) {
+        return NO;
+    }
+
+    SEL _isTerminalStatus = NSSelectorFromString(@"isTerminalStatus");
+    if (![bootStatus respondsToSelector:_isTerminalStatus]) {
+        return YES;
+    }
+
+    return ((BOOL (*)(id, SEL))objc_msgSend)(bootStatus, _isTerminalStatus);
+}
+
+#pragma mark - Transitions
+
+// Queue only
+- (void)_evaluate {
+    SimDeviceLifecycleState previousState = self.state;
+    SimDeviceLifecycleState state = [self _readState];
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+
+    if (state != previousState) {
+        self.state = state;
+        switch (state) {
+            case SimDeviceLifecycleStateBooting:
+                self.bootStartTime = now;
+                self.springBoardReady = NO;
+                break;
+            case SimDeviceLifecycleStateBooted:
+                if (self.bootStartTime > 0) {
+                    [self _recordTransition:@"boot" duration:now - self.bootStartTime];
+                }
+                break;
+            case SimDeviceLifecycleStateShuttingDown:
+                self.shutdownStartTime = now;
+                self.springBoardReady = NO;
+                break;
+            case SimDeviceLifecycleStateShutdown:
+                if (self.shutdownStartTime > 0) {
+                    [self _recordTransition:@"shutdown" duration:now - self.shutdownStartTime];
+                    self.shutdownStartTime = 0;
+                }
+                self.springBoardReady = NO;
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (state == SimDeviceLifecycleStateBooted && !self.springBoardReady && [self _bootStatusFinished]) {
+        self.springBoardReady = YES;
+        if (self.bootStartTime > 0) {
+            [self _recordTransition:@"springboard" duration:now - self.bootStartTime];
+            self.bootStartTime = 0;
+        }
+    }
+
+    [self _completeSatisfiedWaiters];
+}
+
+- (BOOL)_isAtTransition:(SimDeviceTransition)transition {
+    switch (transition) {
+        case SimDeviceTransitionBooted:
+            return self.state == SimDeviceLifecycleStateBooted;
+        case SimDeviceTransitionShutdown:
+            return self.state == SimDeviceLifecycleStateShutdown;
+        case SimDeviceTransitionSpringBoardReady:
+            return self.state == SimDeviceLifecycleStateBooted && self.springBoardReady;
+    }
+
+    return NO;
+}
+
+// Queue only
+- (void)_completeSatisfiedWaiters {
+    BOOL waitingOnBootStatus = NO;
+    for (SimDeviceTransitionWaiter *waiter in [self.waiters copy]) {
+        if ([self _isAtTransition:waiter.transition]) {
+            [self.waiters removeObject:waiter];
+            [self _finishWaiter:waiter error:nil];
+        }
+        else if (waiter.transition == SimDeviceTransitionSpringBoardReady && self.state == SimDeviceLifecycleStateBooted) {
+            waitingOnBootStatus = YES;
+        }
+    }
+
+    if (waitingOnBootStatus) {
+        [self _scheduleBootStatusRecheck];
+    }
+    else {
+        self.bootStatusRecheckInterval = 0;
+    }
+}
+
+// Queue only. Not every CoreSimulator version notifies when the boot status moves, so while someone
+// waits on it the status is re-read on a backing-off interval
+- (void)_scheduleBootStatusRecheck {
+    if (self.bootStatusRecheckScheduled) {
+        return;
+    }
+
+    self.bootStatusRecheckInterval = self.bootStatusRecheckInterval > 0 ? MIN(self.bootStatusRecheckInterval * 2, MAX_BOOT_STATUS_RECHECK_INTERVAL) : 0.25;
+    self.bootStatusRecheckScheduled = YES;
+    __weak typeof(self) weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.bootStatusRecheckInterval * NSEC_PER_SEC)), self.queue, ^{
+        weakSelf.bootStatusRecheckScheduled = NO;
+        [weakSelf _evaluate];
+    });
+}
+
+- (void)_finishWaiter:(SimDeviceTransitionWaiter *)waiter error:(NSError *)error {
+    NSTimeInterval elapsed = CFAbsoluteTimeGetCurrent() - waiter.startTime;
+    void (^completion)(NSTimeInterval, NSError *) = waiter.completion;
+    waiter.completion = nil;
+    if (completion) {
+        dispatch_async(waiter.queue, ^{
+            completion(elapsed, error);
+        });
+    }
+}
+
+- (void)waitForTransition:(SimDeviceTransition)transition timeout:(NSTimeInterval)timeout queue:(dispatch_queue_t)queue completion:(void (^)(NSTimeInterval elapsed, NSError *error))completion {
+    SimDeviceTransitionWaiter *waiter = [[SimDeviceTransitionWaiter alloc] init];
+    waiter.transition = transition;
+    waiter.startTime = CFAbsoluteTimeGetCurrent();
+    waiter.queue = queue ?: dispatch_get_main_queue();
+    waiter.completion = completion;
+
+    dispatch_async(self.queue, ^{
+        [self.waiters addObject:waiter];
+        // Picks up anything that changed before the notification handler ran
+        [self _evaluate];
+    });
+
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(timeout * NSEC_PER_SEC)), self.queue, ^{
+        if (![self.waiters containsObject:waiter]) {
+            return;
+        }
+
+        // One last read, in case the notification never came
+        [self _evaluate];
+        if (![self.waiters containsObject:waiter]) {
+            return;
+        }
+
+        [self.waiters removeObject:waiter];
+        NSArray *transitionNames = @[@"boot", @"shut down", @"finish starting SpringBoard"];
+        NSString *reason = [NSString stringWithFormat:@"Timed out after %.0fs waiting for %@ to %@", timeout, self.udid, transitionNames[transition]];
+        [self _finishWaiter:waiter error:[NSError errorWithDomain:NSCocoaErrorDomain code:1 userInfo:@{NSLocalizedDescriptionKey: reason}]];
+    });
+}
+
+#pragma mark - Histograms
+
+- (void)_recordTransition:(NSString *)transitionName duration:(NSTimeInterval)duration {
+    NSLog(@"%@ %@ took %.2fs (runtime %@)", self.udid, transitionName, duration, self.runtimeVersion);
+
+    NSString *runtimeVersion = self.runtimeVersion;
+    dispatch_async(g_histogramQueue, ^{
+        NSMutableDictionary<NSString *, NSMutableArray<NSNumber *> *> *runtimeHistograms = g_transitionHistograms[runtimeVersion];
+        if (!runtimeHistograms) {
+            runtimeHistograms = [[NSMutableDictionary alloc] init];
+            g_transitionHistograms[runtimeVersion] = runtimeHistograms;
+        }
+
+        NSMutableArray<NSNumber *> *buckets = runtimeHistograms[transitionName];
+        if (!buckets) {
+            buckets = [[NSMutableArray alloc] initWithCapacity:HISTOGRAM_BUCKET_COUNT];
+            for (int i = 0; i < HISTOGRAM_BUCKET_COUNT; i++) {
+                [buckets addObject:@0];
+            }
+            runtimeHistograms[transitionName] = buckets;
+        }
+
+        // Bucket i covers durations under 2^i * 100ms. The last bucket takes everything longer
+        NSUInteger bucket = 0;
+        double bucketLimit = 0.1;
+        while (bucket < HISTOGRAM_BUCKET_COUNT - 1 && duration >= bucketLimit) {
+            bucket++;
+            bucketLimit *= 2;
+        }
+
+        buckets[bucket] = @(buckets[bucket].unsignedIntegerValue + 1);
+    });
+}
+
++ (NSDictionary<NSString *, NSDictionary<NSString *, NSArray<NSNumber *> *> *> *)transitionHistograms {
+    if (!g_histogramQueue) {
+        return @{};
+    }
+
+    __block NSMutableDictionary *snapshot = [[NSMutableDictionary alloc] init];
+    dispatch_sync(g_histogramQueue, ^{
+        for (NSString *runtimeVersion in g_transitionHistograms) {
+            NSMutableDictionary *runtimeSnapshot = [[NSMutableDictionary alloc] init];
+            for (NSString *transitionName in g_transitionHistograms[runtimeVersion]) {
+                runtimeSnapshot[transitionName] = [g_transitionHistograms[runtimeVersion][transitionName] copy];
+            }
+            snapshot[runtimeVersion] = runtimeSnapshot;
+        }
+    });
+
+    return snapshot;
+}
+
+@end
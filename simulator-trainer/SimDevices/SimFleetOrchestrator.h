@@ -0,0 +1,101 @@
+//
+//  SimFleetOrchestrator.h
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#import <Foundation/Foundation.h>
+#import "SimulatorOrchestrationService.h"
+#import "PackageInstallationService.h"
+#import "SimLogStore.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+typedef NS_ENUM(NSInteger, SimFleetStepKind) {
+    SimFleetStepKindBoot,
+    // Jailbreaks and debs are applied once per runtime root. Other devices on the same runtime wait for it and only respring
+    SimFleetStepKindJailbreak,
+    SimFleetStepKindRespring,
+    SimFleetStepKindInstallApp,
+    SimFleetStepKindInstallDeb,
+    SimFleetStepKindShutdown,
+};
+
+// What a step is throttled on while it runs
+typedef NS_ENUM(NSInteger, SimFleetResource) {
+    // CoreSimulator boots, shutdowns and resprings
+    SimFleetResourceCoreSimulator,
+    // Operations that go through the privileged helper
+    SimFleetResourceHelper,
+    // Binary patching and app conversion on this machine
+    SimFleetResourcePatching,
+    SimFleetResourceCount,
+};
+
+@interface SimFleetPipelineStep : NSObject
+
+@property (nonatomic, readonly) SimFleetStepKind kind;
+@property (nonatomic, copy, readonly, nullable) NSString *path;
+// Total tries before the device is marked as failed. Defaults to 1, or 3 for boots
+@property (nonatomic) NSUInteger maxAttempts;
+
++ (instancetype)bootStep;
++ (instancetype)jailbreakStep;
++ (instancetype)respringStep;
++ (instancetype)installAppStepWithPath:(NSString *)appPath;
++ (instancetype)installDebStepWithPath:(NSString *)debPath;
++ (instancetype)shutdownStep;
+
+- (NSString *)name;
+- (SimFleetResource)resource;
+// Whether the step changes the runtime root, which every device on that runtime shares
+- (BOOL)appliesToRuntime;
+
+@end
+
+@interface SimFleetTimelineEvent : NSObject
+
+@property (nonatomic, copy, readonly) NSString *stepName;
+@property (nonatomic, readonly) NSUInteger attempt;
+// Seconds since the fleet run started
+@property (nonatomic, readonly) NSTimeInterval queuedAt;
+@property (nonatomic, readonly) NSTimeInterval startedAt;
+@property (nonatomic, readonly) NSTimeInterval duration;
+@property (nonatomic, strong, readonly, nullable) NSError *error;
+// Set when the work was done for another device on the same runtime
+@property (nonatomic, copy, readonly, nullable) NSString *sharedFromUdid;
+// For failed steps, the simulator log messages of the device around the time of the failure
+@property (nonatomic, copy, readonly, nullable) NSArray<SimLogRecord *> *surroundingLogs;
+
+@end
+
+@interface SimFleetDeviceReport : NSObject
+
+@property (nonatomic, copy, readonly) NSString *udid;
+@property (nonatomic, copy, readonly) NSArray<SimFleetTimelineEvent *> *timeline;
+// The error of the step that stopped this device's pipeline
+@property (nonatomic, strong, readonly, nullable) NSError *error;
+
+@end
+
+/**
+  * Runs a pipeline of steps on many devices at once. Each device goes through the pipeline in order, while
+  * devices run alongside each other up to the limit of each resource. Failed steps are retried with
+  * exponential backoff
+ */
+@interface SimFleetOrchestrator : NSObject
+
+// Delay before the first retry. Doubles with every further attempt
+@property (nonatomic) NSTimeInterval retryBaseDelay;
+
+- (id)initWithOrchestrationService:(SimulatorOrchestrationService *)orchestrationService helperConnection:(HelperConnection *)helperConnection;
+
+- (void)setLimit:(NSUInteger)limit forResource:(SimFleetResource)resource;
+- (NSUInteger)limitForResource:(SimFleetResource)resource;
+
+- (void)runPipeline:(NSArray<SimFleetPipelineStep *> *)pipeline onDevicesWithUdids:(NSArray<NSString *> *)udids completion:(void (^)(NSDictionary<NSString *, SimFleetDeviceReport *> *reports))completion;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,563 @@
+//
+//  SimFleetOrchestrator.m
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#import "SimFleetOrchestrator.h"
+#import "SimDeviceRegistry.h"
+#import "SimDeviceStateMachine.h"
+
+@interface SimFleetPipelineStep ()
+@property (nonatomic, readwrite) SimFleetStepKind kind;
+@property (nonatomic, copy, readwrite, nullable) NSString *path;
+@end
+
+@implementation SimFleetPipelineStep
+
+- (instancetype)initWithKind:(SimFleetStepKind)kind path:(NSString *)path {
+    if ((self = [super init])) {
+        _kind = kind;
+        _path = [path copy];
+        // Boots are the step most likely to fail transiently, when CoreSimulator is busy
+        _maxAttempts = (kind == SimFleetStepKindBoot) ? 3 : 1;
+    }
+
+    return self;
+}
+
++ (instancetype)bootStep {
+    return [[self alloc] initWithKind:SimFleetStepKindBoot path:nil];
+}
+
++ (instancetype)jailbreakStep {
+    return [[self alloc] initWithKind:SimFleetStepKindJailbreak path:nil];
+}
+
++ (instancetype)respringStep {
+    return [[self alloc] initWithKind:SimFleetStepKindRespring path:nil];
+}
+
++ (instancetype)installAppStepWithPath:(NSString *)appPath {
+    return [[self alloc] initWithKind:SimFleetStepKindInstallApp path:appPath];
+}
+
++ (instancetype)installDebStepWithPath:(NSString *)debPath {
+    return [[self alloc] initWithKind:SimFleetStepKindInstallDeb path:debPath];
+}
+
++ (instancetype)shutdownStep {
+    return [[self alloc] initWithKind:SimFleetStepKindShutdown path:nil];
+}
+
+- (NSString *)name {
+    switch (self.kind) {
+        case SimFleetStepKindBoot:
+            return @"boot";
+        case SimFleetStepKindJailbreak:
+            return @"jailbreak";
+        case SimFleetStepKindRespring:
+            return @"respring";
+        case SimFleetStepKindInstallApp:
+            return [NSString stringWithFormat:@"install %@", [self.path lastPathComponent]];
+        case SimFleetStepKindInstallDeb:
+            return [NSString stringWithFormat:@"install %@", [self.path lastPathComponent]];
+        case SimFleetStepKindShutdown:
+            return @"shutdown";
+    }
+
+    return @"unknown";
+}
+
+- (SimFleetResource)resource {
+    switch (self.kind) {
+        case SimFleetStepKindJailbreak:
+        case SimFleetStepKindInstallDeb:
+            return SimFleetResourceHelper;
+        case SimFleetStepKindInstallApp:
+            return SimFleetResourcePatching;
+        default:
+            return SimFleetResourceCoreSimulator;
+    }
+}
+
+- (BOOL)appliesToRuntime {
+    return self.kind == SimFleetStepKindJailbreak || self.kind == SimFleetStepKindInstallDeb;
+}
+
+@end
+
+@interface SimFleetTimelineEvent ()
+@property (nonatomic, copy, readwrite) NSString *stepName;
+@property (nonatomic, readwrite) NSUInteger attempt;
+@property (nonatomic, readwrite) NSTimeInterval queuedAt;
+@property (nonatomic, readwrite) NSTimeInterval startedAt;
+@property (nonatomic, readwrite) NSTimeInterval duration;
+@property (nonatomic, strong, readwrite, nullable) NSError *error;
+@property (nonatomic, copy, readwrite, nullable) NSString *sharedFromUdid;
+@property (nonatomic, copy, readwrite, nullable) NSArray<SimLogRecord *> *surroundingLogs;
+@end
+
+@implementation SimFleetTimelineEvent
+
+- (NSString *)description {
+    NSString *outcome = self.error ? [NSString stringWithFormat:@"failed: %@", self.error.localizedDescription] : @"ok";
+    NSString *shared = self.sharedFromUdid ? [NSString stringWithFormat:@" (shared with %@)", self.sharedFromUdid] : @"";
+    NSString *logs = self.surroundingLogs.count > 0 ? [NSString stringWithFormat:@"\n    %@", [self.surroundingLogs componentsJoinedByString:@"\n    "]] : @"";
+    return [NSString stringWithFormat:@"%@ #%lu queued %.2fs started %.2fs took %.2fs %@%@%@", self.stepName, (unsigned long)self.attempt, self.queuedAt, self.startedAt, self.duration, outcome, shared, logs];
+}
+
+@end
+
+@interface SimFleetDeviceReport ()
+@property (nonatomic, copy, readwrite) NSString *udid;
+@property (nonatomic, strong) NSMutableArray<SimFleetTimelineEvent *> *events;
+@property (nonatomic, strong, readwrite, nullable) NSError *error;
+// Progress through the pipeline, only touched on the orchestrator's state queue
+@property (nonatomic, strong, nullable) SimulatorWrapper *device;
+@property (nonatomic) NSUInteger stepIndex;
+@property (nonatomic) NSUInteger attempt;
+@end
+
+@implementation SimFleetDeviceReport
+
+- (NSArray<SimFleetTimelineEvent *> *)timeline {
+    return [self.events copy];
+}
+
+@end
+
+@interface SimFleetRun : NSObject
+@property (nonatomic, copy) NSArray<SimFleetPipelineStep *> *pipeline;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, SimFleetDeviceReport *> *reports;
+@property (nonatomic) CFAbsoluteTime startTime;
+@property (nonatomic) NSUInteger remainingDevices;
+@property (nonatomic, copy) void (^completion)(NSDictionary<NSString *, SimFleetDeviceReport *> *reports);
+// Runtime step key -> udid of the device that applied that step to the runtime in this run
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSString *> *appliedRuntimeSteps;
+// Runtime step key -> udid of the device currently applying that step, including its retries
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSString *> *runtimeStepLeaders;
+// Runtime step key -> devices waiting for that step to finish
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSMutableArray<SimFleetDeviceReport *> *> *pendingRuntimeSteps;
+@end
+
+@implementation SimFleetRun
+
+// Runtime steps are tracked per position in the pipeline, so two different debs on one runtime are both installed
+- (NSString *)runtimeStepKeyForStepIndex:(NSUInteger)stepIndex runtimeRoot:(NSString *)runtimeRoot {
+    return runtimeRoot ? [NSString stringWithFormat:@"%lu:%@", (unsigned long)stepIndex, runtimeRoot] : nil;
+}
+
+@end
+
+@interface SimFleetOrchestrator () {
+    NSUInteger resourceLimits[SimFleetResourceCount];
+    NSUInteger resourcesInUse[SimFleetResourceCount];
+}
+
+@property (nonatomic, strong) SimulatorOrchestrationService *orchestrationService;
+@property (nonatomic, strong) HelperConnection *helperConnection;
+@property (nonatomic, strong) PackageInstallationService *packageService;
+@property (nonatomic, strong) dispatch_queue_t stateQueue;
+@property (nonatomic, strong) NSArray<NSMutableArray<dispatch_block_t> *> *resourceWaiters;
+
+@end
+
+@implementation SimFleetOrchestrator
+
+- (id)initWithOrchestrationService:(SimulatorOrchestrationService *)orchestrationService helperConnection:(HelperConnection *)helperConnection {
+    if ((self = [super init])) {
+        _orchestrationService = orchestrationService;
+        _helperConnection = helperConnection;
+        _packageService = [[PackageInstallationService alloc] init];
+        _stateQueue = dispatch_queue_create("com.simulatortrainer.fleet", DISPATCH_QUEUE_SERIAL);
+        _retryBaseDelay = 2.0;
+
+        NSMutableArray *waiters = [NSMutableArray array];
+        for (NSInteger resource = 0; resource < SimFleetResourceCount; resource++) {
+            [waiters addObject:[NSMutableArray array]];
+        }
+        _resourceWaiters = waiters;
+
+        // A handful of boots at a time keeps CoreSimulator responsive. Helper operations
+        // share one authorization and mostly contend on the same runtime roots
+        resourceLimits[SimFleetResourceCoreSimulator] = 4;
+        resourceLimits[SimFleetResourceHelper] = 1;
+        resourceLimits[SimFleetResourcePatching] = MAX([[NSProcessInfo processInfo] activeProcessorCount], 1);
+    }
+
+    return self;
+}
+
+- (void)setLimit:(NSUInteger)limit forResource:(SimFleetResource)resource {
+    if (resource < 0 || resource >= SimFleetResourceCount) {
+        return;
+    }
+
+    dispatch_async(self.stateQueue, ^{
+        self->resourceLimits[resource] = MAX(limit, 1);
+        [self _drainWaitersForResource:resource];
+    });
+}
+
+- (NSUInteger)limitForResource:(SimFleetResource)resource {
+    if (resource < 0 || resource >= SimFleetResourceCount) {
+        return 0;
+    }
+
+    __block NSUInteger limit = 0;
+    dispatch_sync(self.stateQueue, ^{
+        limit = self->resourceLimits[resource];
+    });
+
+    return limit;
+}
+
+#pragma mark - Resource limits
+
+// State queue only. Runs `block` on the state queue once a slot of `resource` is free
+- (void)_acquireResource:(SimFleetResource)resource then:(dispatch_block_t)block {
+    [self.resourceWaiters[resource] addObject:[block copy]];
+    [self _drainWaitersForResource:resource];
+}
+
+// State queue only
+- (void)_releaseResource:(SimFleetResource)resource {
+    if (resourcesInUse[resource] > 0) {
+        resourcesInUse[resource]--;
+    }
+
+    [self _drainWaitersForResource:resource];
+}
+
+- (void)_drainWaitersForResource:(SimFleetResource)resource {
+    NSMutableArray<dispatch_block_t> *waiters = self.resourceWaiters[resource];
+    while (waiters.count > 0 && resourcesInUse[resource] < resourceLimits[resource]) {
+        dispatch_block_t next = waiters.firstObject;
+        [waiters removeObjectAtIndex:0];
+        resourcesInUse[resource]++;
+        dispatch_async(self.stateQueue, next);
+    }
+}
+
+#pragma mark - Running
+
+- (void)runPipeline:(NSArray<SimFleetPipelineStep *> *)pipeline onDevicesWithUdids:(NSArray<NSString *> *)udids completion:(void (^)(NSDictionary<NSString *, SimFleetDeviceReport *> *reports))completion {
+    SimFleetRun *run = [[SimFleetRun alloc] init];
+    run.pipeline = pipeline;
+    run.reports = [NSMutableDictionary dictionary];
+    run.startTime = CFAbsoluteTimeGetCurrent();
+    run.completion = completion;
+    run.appliedRuntimeSteps = [NSMutableDictionary dictionary];
+    run.runtimeStepLeaders = [NSMutableDictionary dictionary];
+    run.pendingRuntimeSteps = [NSMutableDictionary dictionary];
+
+    NSOrderedSet<NSString *> *uniqueUdids = [NSOrderedSet orderedSetWithArray:udids];
+    run.remainingDevices = uniqueUdids.count;
+    if (run.remainingDevices == 0) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            if (completion) {
+                completion(@{});
+            }
+        });
+        return;
+    }
+
+    SimDeviceRegistry *registry = [SimDeviceRegistry sharedRegistry];
+    dispatch_async(self.stateQueue, ^{
+        for (NSString *udid in uniqueUdids) {
+            SimFleetDeviceReport *report = [[SimFleetDeviceReport alloc] init];
+            report.udid = udid;
+            report.events = [NSMutableArray array];
+            report.device = [registry deviceForUdid:udid];
+            run.reports[udid] = report;
+        }
+
+        for (NSString *udid in uniqueUdids) {
+            SimFleetDeviceReport *report = run.reports[udid];
+            if (!report.device) {
+                [self _finishDevice:report inRun:run error:[NSError errorWithDomain:NSCocoaErrorDomain code:1 userInfo:@{NSLocalizedDescriptionKey: [NSString stringWithFormat:@"No simulator with UDID %@", udid]}]];
+                continue;
+            }
+
+            [self _runNextStepForDevice:report inRun:run];
+        }
+    });
+}
+
+// State queue only
+- (void)_runNextStepForDevice:(SimFleetDeviceReport *)report inRun:(SimFleetRun *)run {
+    if (report.stepIndex >= run.pipeline.count) {
+        [self _finishDevice:report inRun:run error:nil];
+        return;
+    }
+
+    SimFleetPipelineStep *step = run.pipeline[report.stepIndex];
+    CFAbsoluteTime queuedTime = CFAbsoluteTimeGetCurrent();
+
+    if ([step appliesToRuntime]) {
+        // Overlays, the loader and tweaks go into the runtime root, which every device on that runtime shares
+        NSString *stepKey = [run runtimeStepKeyForStepIndex:report.stepIndex runtimeRoot:[report.device runtimeRoot]];
+        NSString *leaderUdid = stepKey ? run.appliedRuntimeSteps[stepKey] : nil;
+        if (leaderUdid) {
+            [self _runSharedStepForDevice:report fromDevice:leaderUdid step:step queuedTime:queuedTime inRun:run];
+            return;
+        }
+
+        NSString *applyingUdid = stepKey ? run.runtimeStepLeaders[stepKey] : nil;
+        if (applyingUdid && ![applyingUdid isEqualToString:report.udid]) {
+            // Re-evaluated once the device applying it finishes
+            [run.pendingRuntimeSteps[stepKey] addObject:report];
+            return;
+        }
+
+        if (stepKey && !applyingUdid) {
+            run.runtimeStepLeaders[stepKey] = report.udid;
+            run.pendingRuntimeSteps[stepKey] = [NSMutableArray array];
+        }
+    }
+
+    SimFleetResource resource = [step resource];
+    [self _acquireResource:resource then:^{
+        report.attempt++;
+        NSUInteger attempt = report.attempt;
+        CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
+
+        [self _performStep:step onDevice:report.device completion:^(SimulatorWrapper *updatedDevice, NSError *error) {
+            dispatch_async(self.stateQueue, ^{
+                [self _releaseResource:resource];
+
+                if (updatedDevice) {
+                    report.device = updatedDevice;
+                }
+
+                [self _recordStep:step attempt:attempt queuedTime:queuedTime startTime:startTime error:error sharedFrom:nil forDevice:report inRun:run];
+                [self _stepFinished:step error:error forDevice:report inRun:run];
+            });
+        }];
+    }];
+}
+
+// State queue only
+- (void)_runSharedStepForDevice:(SimFleetDeviceReport *)report fromDevice:(NSString *)leaderUdid step:(SimFleetPipelineStep *)step queuedTime:(CFAbsoluteTime)queuedTime inRun:(SimFleetRun *)run {
+    // The runtime already has it. This device only has to respring to load the tweaks
+    [self _acquireResource:SimFleetResourceCoreSimulator then:^{
+        report.attempt++;
+        NSUInteger attempt = report.attempt;
+        CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
+
+        BootedSimulatorWrapper *bootedDevice = [self _bootedDeviceFromDevice:report.device];
+        void (^finish)(NSError *) = ^(NSError *error) {
+            dispatch_async(self.stateQueue, ^{
+                [self _releaseResource:SimFleetResourceCoreSimulator];
+                [self _recordStep:step attempt:attempt queuedTime:queuedTime startTime:startTime error:error sharedFrom:leaderUdid forDevice:report inRun:run];
+                [self _stepFinished:step error:error forDevice:report inRun:run];
+            });
+        };
+
+        if (!bootedDevice) {
+            finish([NSError errorWithDomain:NSCocoaErrorDomain code:1 userInfo:@{NSLocalizedDescriptionKey: @"Device needs to be booted"}]);
+            return;
+        }
+
+        report.device = bootedDevice;
+        [bootedDevice reloadDeviceState];
+        [self.orchestrationService respringDevice:bootedDevice completion:finish];
+    }];
+}
+
+// State queue only
+- (void)_stepFinished:(SimFleetPipelineStep *)step error:(NSError *)error forDevice:(SimFleetDeviceReport *)report inRun:(SimFleetRun *)run {
+    if (error && report.attempt < step.maxAttempts) {
+        NSTimeInterval delay = self.retryBaseDelay * (double)(1ULL << MIN(report.attempt - 1, 16));
+        NSLog(@"Fleet: %@ failed on %@ (attempt %lu), retrying in %.1fs: %@", [step name], report.udid, (unsigned long)report.attempt, delay, error);
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), self.stateQueue, ^{
+            [self _runNextStepForDevice:report inRun:run];
+        });
+        return;
+    }
+
+    if ([step appliesToRuntime]) {
+        [self _resolvePendingRuntimeStepForDevice:report error:error inRun:run];
+    }
+
+    if (error) {
+        [self _finishDevice:report inRun:run error:error];
+        return;
+    }
+
+    report.stepIndex++;
+    report.attempt = 0;
+    [self _runNextStepForDevice:report inRun:run];
+}
+
+// State queue only
+- (void)_resolvePendingRuntimeStepForDevice:(SimFleetDeviceReport *)report error:(NSError *)error inRun:(SimFleetRun *)run {
+    NSString *stepKey = [run runtimeStepKeyForStepIndex:report.stepIndex runtimeRoot:[report.device runtimeRoot]];
+    if (!stepKey) {
+        return;
+    }
+
+    if (![run.runtimeStepLeaders[stepKey] isEqualToString:report.udid]) {
+        // A device that followed someone else's work
+        return;
+    }
+
+    NSMutableArray<SimFleetDeviceReport *> *waiters = run.pendingRuntimeSteps[stepKey];
+    [run.runtimeStepLeaders removeObjectForKey:stepKey];
+    [run.pendingRuntimeSteps removeObjectForKey:stepKey];
+    if (!error) {
+        run.appliedRuntimeSteps[stepKey] = report.udid;
+    }
+
+    // On failure the next waiter takes its own turn at the runtime
+    for (SimFleetDeviceReport *waiter in waiters) {
+        [self _runNextStepForDevice:waiter inRun:run];
+    }
+}
+
+// State queue only
+- (void)_recordStep:(SimFleetPipelineStep *)step attempt:(NSUInteger)attempt queuedTime:(CFAbsoluteTime)queuedTime startTime:(CFAbsoluteTime)startTime error:(NSError *)error sharedFrom:(NSString *)sharedFromUdid forDevice:(SimFleetDeviceReport *)report inRun:(SimFleetRun *)run {
+    SimFleetTimelineEvent *event = [[SimFleetTimelineEvent alloc] init];
+    event.stepName = [step name];
+    event.attempt = attempt;
+    event.queuedAt = queuedTime - run.startTime;
+    event.startedAt = startTime - run.startTime;
+    event.duration = CFAbsoluteTimeGetCurrent() - startTime;
+    event.error = error;
+    event.sharedFromUdid = sharedFromUdid;
+    if (error) {
+        // Keep the failure next to CoreSimulator's own messages for the device, then snapshot both
+        SimLogStore *logStore = [SimLogStore sharedStore];
+        [logStore appendMessage:[NSString stringWithFormat:@"%@ failed: %@", event.stepName, error.localizedDescription] level:0 function:__PRETTY_FUNCTION__ line:__LINE__ deviceUdid:report.udid subsystem:nil];
+        event.surroundingLogs = [logStore recordsForDeviceUdid:report.udid around:[NSDate date] window:30.0];
+    }
+    [report.events addObject:event];
+}
+
+// State queue only
+- (void)_finishDevice:(SimFleetDeviceReport *)report inRun:(SimFleetRun *)run error:(NSError *)error {
+    report.error = error;
+    report.device = nil;
+
+    if (run.remainingDevices == 0) {
+        return;
+    }
+
+    run.remainingDevices--;
+    if (run.remainingDevices > 0) {
+        return;
+    }
+
+    for (NSString *udid in run.reports) {
+        SimFleetDeviceReport *deviceReport = run.reports[udid];
+        NSLog(@"Fleet: %@ %@\n%@", udid, deviceReport.error ? @"failed" : @"done", [deviceReport.events componentsJoinedByString:@"\n"]);
+    }
+
+    NSDictionary<NSString *, SimFleetDeviceReport *> *reports = [run.reports copy];
+    void (^completion)(NSDictionary<NSString *, SimFleetDeviceReport *> *) = run.completion;
+    run.completion = nil;
+    dispatch_async(dispatch_get_main_queue(), ^{
+        if (completion) {
+            completion(reports);
+        }
+    });
+}
+
+#pragma mark - Steps
+
+- (BootedSimulatorWrapper *)_bootedDeviceFromDevice:(SimulatorWrapper *)device {
+    if ([device isKindOfClass:[BootedSimulatorWrapper class]]) {
+        return (BootedSimulatorWrapper *)device;
+    }
+
+    [device reloadDeviceState];
+    return device.isBooted ? [BootedSimulatorWrapper fromSimulatorWrapper:device] : nil;
+}
+
+// Completion can be called on any queue. `updatedDevice` is set when the step changed which wrapper represents the device
+- (void)_performStep:(SimFleetPipelineStep *)step onDevice:(SimulatorWrapper *)device completion:(void (^)(SimulatorWrapper * _Nullable updatedDevice, NSError * _Nullable error))completion {
+    if (step.kind == SimFleetStepKindBoot) {
+        [self.orchestrationService bootDevice:device completion:^(BootedSimulatorWrapper * _Nullable bootedDevice, NSError * _Nullable error) {
+            if (!bootedDevice && !error) {
+                error = [NSError errorWithDomain:NSCocoaErrorDomain code:1 userInfo:@{NSLocalizedDescriptionKey: @"Boot finished without a booted device"}];
+            }
+
+            SimDeviceStateMachine *stateMachine = [SimDeviceStateMachine stateMachineForUdid:device.udidString];
+            if (error || !stateMachine) {
+                completion(bootedDevice, error);
+                return;
+            }
+
+            // Later steps install into and respring SpringBoard, so a boot only counts once it is up
+            [stateMachine waitForTransition:SimDeviceTransitionSpringBoardReady timeout:120.0 queue:self.stateQueue completion:^(NSTimeInterval elapsed, NSError * _Nullable waitError) {
+                completion(bootedDevice, waitError);
+            }];
+        }];
+        return;
+    }
+
+    BootedSimulatorWrapper *bootedDevice = [self _bootedDeviceFromDevice:device];
+    if (step.kind == SimFleetStepKindShutdown) {
+        if (!bootedDevice) {
+            completion(nil, nil);
+            return;
+        }
+
+        [self.orchestrationService shutdownDevice:bootedDevice completion:^(NSError * _Nullable error) {
+            completion(nil, error);
+        }];
+        return;
+    }
+
+    if (!bootedDevice) {
+        completion(nil, [NSError errorWithDomain:NSCocoaErrorDomain code:1 userInfo:@{NSLocalizedDescriptionKey: @"Device needs to be booted"}]);
+        return;
+    }
+
+    switch (step.kind) {
+        case SimFleetStepKindJailbreak: {
+            [bootedDevice reloadDeviceState];
+            if ([bootedDevice isJailbroken]) {
+                completion(bootedDevice, nil);
+                return;
+            }
+
+            [self.orchestrationService applyJailbreakToDevice:bootedDevice completion:^(BOOL success, NSError * _Nullable error) {
+                if (!success && !error) {
+                    error = [NSError errorWithDomain:NSCocoaErrorDomain code:1 userInfo:@{NSLocalizedDescriptionKey: @"Jailbreak failed"}];
+                }
+
+                completion(bootedDevice, success ? nil : error);
+            }];
+            break;
+        }
+        case SimFleetStepKindRespring: {
+            [self.orchestrationService respringDevice:bootedDevice completion:^(NSError * _Nullable error) {
+                completion(bootedDevice, error);
+            }];
+            break;
+        }
+        case SimFleetStepKindInstallApp: {
+            // Converting the app's binaries is synchronous and CPU-bound
+            dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+                [self.packageService installAppBundleAtPath:step.path toDevice:bootedDevice completion:^(NSError * _Nullable error) {
+                    completion(bootedDevice, error);
+                }];
+            });
+            break;
+        }
+        case SimFleetStepKindInstallDeb: {
+            [self.packageService installDebFileAtPath:step.path toDevice:bootedDevice serviceConnection:self.helperConnection completion:^(NSError * _Nullable error) {
+                completion(bootedDevice, error);
+            }];
+            break;
+        }
+        default:
+            completion(bootedDevice, [NSError errorWithDomain:NSCocoaErrorDomain code:1 userInfo:@{NSLocalizedDescriptionKey: @"Unsupported step"}]);
+            break;
+    }
+}
+
+@end
@@ -0,0 +1,47 @@
+//
+//  SimProcessIndex.h
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+@interface SimProcessInfo : NSObject
+
+@property (nonatomic, readonly) pid_t pid;
+@property (nonatomic, copy, readonly) NSString *deviceUdid;
+@property (nonatomic, copy, readonly) NSString *executablePath;
+// Nil for daemons and anything else that isn't inside a bundle
+@property (nonatomic, copy, readonly, nullable) NSString *bundleIdentifier;
+
+- (NSString *)name;
+
+@end
+
+/**
+  * Processes running inside booted simulators, found by walking each device's launchd_sim subtree. The index
+  * follows process exits, forks and execs through a kqueue, so lookups don't list every process on the host
+ */
+@interface SimProcessIndex : NSObject
+
++ (instancetype)sharedIndex;
+
+- (NSArray<SimProcessInfo *> *)processesForDeviceUdid:(NSString *)udid;
+- (SimProcessInfo * _Nullable)processWithPid:(pid_t)pid;
+
+/**
+  * Processes whose executable name or bundle id equals `nameOrBundleId`. Pass a nil udid to search every device
+ */
+- (NSArray<SimProcessInfo *> *)processesNamed:(NSString *)nameOrBundleId deviceUdid:(NSString * _Nullable)udid;
+
+/**
+  * Processes whose executable path, name or bundle id matches the shell-style `pattern`, like "*Safari*"
+ */
+- (NSArray<SimProcessInfo *> *)processesMatchingPattern:(NSString *)pattern deviceUdid:(NSString * _Nullable)udid;
+
+@end
+
+NS_ASSUME_NONNULL_END
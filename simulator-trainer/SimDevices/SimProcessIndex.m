@@ -0,0 +1,336 @@
+//
+//  SimProcessIndex.m
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#import <libproc.h>
+#import <fnmatch.h>
+#import <sys/event.h>
+#import "SimProcessIndex.h"
+#import "SimDeviceRegistry.h"
+#import "sim_process_tree.h"
+
+#define MAX_EVENTS_PER_READ 64
+
+@interface SimProcessInfo ()
+@property (nonatomic, readwrite) pid_t pid;
+@property (nonatomic, copy, readwrite) NSString *deviceUdid;
+@property (nonatomic, copy, readwrite) NSString *executablePath;
+@property (nonatomic, copy, readwrite, nullable) NSString *bundleIdentifier;
+@end
+
+@implementation SimProcessInfo
+
+- (NSString *)name {
+    return [self.executablePath lastPathComponent];
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@ %d %@ %@ (%@)>", NSStringFromClass(self.class), self.pid, self.name, self.bundleIdentifier ?: @"-", self.deviceUdid];
+}
+
+@end
+
+@interface SimProcessIndex ()
+@property (nonatomic, strong) dispatch_queue_t queue;
+@property (nonatomic, strong) dispatch_source_t kqueueSource;
+@property (nonatomic) int kq;
+// udid -> launchd_sim pid, and back
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSNumber *> *launchdPidsByUdid;
+@property (nonatomic, strong) NSMutableDictionary<NSNumber *, NSString *> *udidsByLaunchdPid;
+@property (nonatomic, strong) NSMutableDictionary<NSNumber *, SimProcessInfo *> *processesByPid;
+// Bundle directory -> bundle id, or NSNull for bundles without one
+@property (nonatomic, strong) NSMutableDictionary<NSString *, id> *bundleIdsByBundlePath;
+@property (nonatomic) BOOL needsDeviceRefresh;
+@end
+
+@implementation SimProcessIndex
+
++ (instancetype)sharedIndex {
+    static SimProcessIndex *sharedIndex = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedIndex = [[SimProcessIndex alloc] init];
+    });
+
+    return sharedIndex;
+}
+
+- (id)init {
+    if ((self = [super init])) {
+        _queue = dispatch_queue_create("com.simulatortrainer.processindex", DISPATCH_QUEUE_SERIAL);
+        _launchdPidsByUdid = [[NSMutableDictionary alloc] init];
+        _udidsByLaunchdPid = [[NSMutableDictionary alloc] init];
+        _processesByPid = [[NSMutableDictionary alloc] init];
+        _bundleIdsByBundlePath = [[NSMutableDictionary alloc] init];
+        _needsDeviceRefresh = YES;
+
+        _kq = kqueue();
+        if (_kq < 0) {
+            NSLog(@"kqueue failed, the process index will rescan on every miss: %s", strerror(errno));
+        }
+        else {
+            // One source for the whole kqueue rather than one per process
+            _kqueueSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, (uintptr_t)_kq, 0, _queue);
+            __weak typeof(self) weakSelf = self;
+            dispatch_source_set_event_handler(_kqueueSource, ^{
+                [weakSelf _drainEvents];
+            });
+            dispatch_resume(_kqueueSource);
+        }
+
+        [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(_deviceRegistryDidChange:) name:SimDeviceRegistryDidChangeNotification object:nil];
+    }
+
+    return self;
+}
+
+- (void)_deviceRegistryDidChange:(NSNotification *)notification {
+    dispatch_async(self.queue, ^{
+        self.needsDeviceRefresh = YES;
+    });
+}
+
+#pragma mark - Indexing
+
+// Queue only
+- (void)_watchPid:(pid_t)pid flags:(uint32_t)flags {
+    if (self.kq < 0) {
+        return;
+    }
+
+    struct kevent change;
+    EV_SET(&change, pid, EVFILT_PROC, EV_ADD | EV_CLEAR, flags, 0, NULL);
+    kevent(self.kq, &change, 1, NULL, 0, NULL);
+}
+
+// Queue only
+- (NSString *)_bundleIdentifierForExecutablePath:(NSString *)executablePath {
+    // iOS bundles keep the executable at the top level of the bundle directory
+    NSString *bundlePath = [executablePath stringByDeletingLastPathComponent];
+    NSString *extension = [bundlePath pathExtension];
+    if (![extension isEqualToString:@"app"] && ![extension isEqualToString:@"appex"] && ![extension isEqualToString:@"xpc"]) {
+        return nil;
+    }
+
+    id bundleIdentifier = self.bundleIdsByBundlePath[bundlePath];
+    if (!bundleIdentifier) {
+        NSDictionary *infoPlist = [NSDictionary dictionaryWithContentsOfFile:[bundlePath stringByAppendingPathComponent:@"Info.plist"]];
+        bundleIdentifier = infoPlist[@"CFBundleIdentifier"] ?: [NSNull null];
+        self.bundleIdsByBundlePath[bundlePath] = bundleIdentifier;
+    }
+
+    return (bundleIdentifier == [NSNull null]) ? nil : bundleIdentifier;
+}
+
+// Queue only. Returns nil if the process is already gone
+- (SimProcessInfo *)_processInfoForPid:(pid_t)pid udid:(NSString *)udid {
+    char path[PROC_PIDPATHINFO_MAXSIZE];
+    if (proc_pidpath(pid, path, sizeof(path)) <= 0) {
+        return nil;
+    }
+
+    SimProcessInfo *info = [[SimProcessInfo alloc] init];
+    info.pid = pid;
+    info.deviceUdid = udid;
+    info.executablePath = [NSString stringWithUTF8String:path];
+    info.bundleIdentifier = [self _bundleIdentifierForExecutablePath:info.executablePath];
+    return info;
+}
+
+// Queue only. Adds every descendant of `parentPid` that isn't indexed yet
+- (void)_walkChildrenOfPid:(pid_t)parentPid udid:(NSString *)udid {
+    NSMutableArray<NSNumber *> *pending = [NSMutableArray arrayWithObject:@(parentPid)];
+    while (pending.count > 0) {
+        pid_t parent = pending.lastObject.intValue;
+        [pending removeLastObject];
+
+        pid_t *children = NULL;
+        int count = sim_list_child_pids(parent, &children);
+        for (int i = 0; i < count; i++) {
+            pid_t child = children[i];
+            if (child <= 0) {
+                continue;
+            }
+
+            if (!self.processesByPid[@(child)]) {
+                SimProcessInfo *info = [self _processInfoForPid:child udid:udid];
+                if (!info) {
+                    continue;
+                }
+
+                self.processesByPid[@(child)] = info;
+                [self _watchPid:child flags:NOTE_EXIT | NOTE_FORK | NOTE_EXEC];
+            }
+
+            [pending addObject:@(child)];
+        }
+
+        free(children);
+    }
+}
+
+// Queue only
+- (void)_dropDevice:(NSString *)udid {
+    NSNumber *launchdPid = self.launchdPidsByUdid[udid];
+    if (launchdPid) {
+        [self.udidsByLaunchdPid removeObjectForKey:launchdPid];
+    }
+
+    [self.launchdPidsByUdid removeObjectForKey:udid];
+    for (NSNumber *pid in [self.processesByPid allKeys]) {
+        if ([self.processesByPid[pid].deviceUdid isEqualToString:udid]) {
+            [self.processesByPid removeObjectForKey:pid];
+        }
+    }
+}
+
+// Queue only. Start or stop following devices as they boot and shut down
+- (void)_refreshDevices {
+    self.needsDeviceRefresh = NO;
+
+    NSMutableSet<NSString *> *bootedUdids = [NSMutableSet set];
+    for (SimulatorWrapper *device in [[SimDeviceRegistry sharedRegistry] devices]) {
+        if (device.isBooted && device.udidString) {
+            [bootedUdids addObject:device.udidString];
+        }
+    }
+
+    for (NSString *udid in [self.launchdPidsByUdid allKeys]) {
+        if (![bootedUdids containsObject:udid]) {
+            [self _dropDevice:udid];
+        }
+    }
+
+    for (NSString *udid in bootedUdids) {
+        if (self.launchdPidsByUdid[udid]) {
+            continue;
+        }
+
+        pid_t launchdPid = sim_launchd_pid_for_udid(udid.UTF8String);
+        if (launchdPid <= 0) {
+            // Booted according to CoreSimulator but launchd_sim isn't up yet. Try again on the next lookup
+            self.needsDeviceRefresh = YES;
+            continue;
+        }
+
+        self.launchdPidsByUdid[udid] = @(launchdPid);
+        self.udidsByLaunchdPid[@(launchdPid)] = udid;
+        [self _watchPid:launchdPid flags:NOTE_EXIT | NOTE_FORK];
+        [self _walkChildrenOfPid:launchdPid udid:udid];
+    }
+}
+
+// Queue only
+- (void)_drainEvents {
+    struct kevent events[MAX_EVENTS_PER_READ];
+    struct timespec no_wait = {0, 0};
+    int count = kevent(self.kq, NULL, 0, events, MAX_EVENTS_PER_READ, &no_wait);
+    for (int i = 0; i < count; i++) {
+        pid_t pid = (pid_t)events[i].ident;
+        uint32_t fflags = events[i].fflags;
+
+        NSString *launchdUdid = self.udidsByLaunchdPid[@(pid)];
+        if (launchdUdid) {
+            if (fflags & NOTE_EXIT) {
+                [self _dropDevice:launchdUdid];
+            }
+            else if (fflags & NOTE_FORK) {
+                [self _walkChildrenOfPid:pid udid:launchdUdid];
+            }
+            continue;
+        }
+
+        SimProcessInfo *info = self.processesByPid[@(pid)];
+        if (!info) {
+            continue;
+        }
+
+        if (fflags & NOTE_EXIT) {
+            [self.processesByPid removeObjectForKey:@(pid)];
+            continue;
+        }
+
+        if (fflags & NOTE_EXEC) {
+            SimProcessInfo *updatedInfo = [self _processInfoForPid:pid udid:info.deviceUdid];
+            if (updatedInfo) {
+                self.processesByPid[@(pid)] = updatedInfo;
+            }
+        }
+
+        if (fflags & NOTE_FORK) {
+            [self _walkChildrenOfPid:pid udid:info.deviceUdid];
+        }
+    }
+}
+
+#pragma mark - Lookup
+
+// Filters on the queue. If nothing matches, the subtrees are walked once more before giving up, because
+// processes posix_spawn'd by launchd_sim don't always raise a fork event
+- (NSArray<SimProcessInfo *> *)_processesPassingTest:(BOOL (^)(SimProcessInfo *info))test {
+    __block NSMutableArray<SimProcessInfo *> *matches = [NSMutableArray array];
+    dispatch_sync(self.queue, ^{
+        if (self.needsDeviceRefresh) {
+            [self _refreshDevices];
+        }
+
+        for (int pass = 0; pass < 2 && matches.count == 0; pass++) {
+            if (pass == 1) {
+                for (NSString *udid in self.launchdPidsByUdid) {
+                    [self _walkChildrenOfPid:self.launchdPidsByUdid[udid].intValue udid:udid];
+                }
+            }
+
+            for (SimProcessInfo *info in [self.processesByPid objectEnumerator]) {
+                if (test(info)) {
+                    [matches addObject:info];
+                }
+            }
+        }
+    });
+
+    [matches sortUsingComparator:^NSComparisonResult(SimProcessInfo *a, SimProcessInfo *b) {
+        return (a.pid < b.pid) ? NSOrderedAscending : (a.pid > b.pid) ? NSOrderedDescending : NSOrderedSame;
+    }];
+    return matches;
+}
+
+- (NSArray<SimProcessInfo *> *)processesForDeviceUdid:(NSString *)udid {
+    return [self _processesPassingTest:^BOOL(SimProcessInfo *info) {
+        return [info.deviceUdid isEqualToString:udid];
+    }];
+}
+
+- (SimProcessInfo *)processWithPid:(pid_t)pid {
+    return [[self _processesPassingTest:^BOOL(SimProcessInfo *info) {
+        return info.pid == pid;
+    }] firstObject];
+}
+
+- (NSArray<SimProcessInfo *> *)processesNamed:(NSString *)nameOrBundleId deviceUdid:(NSString *)udid {
+    return [self _processesPassingTest:^BOOL(SimProcessInfo *info) {
+        if (udid && ![info.deviceUdid isEqualToString:udid]) {
+            return NO;
+        }
+
+        return [info.name isEqualToString:nameOrBundleId] || [info.bundleIdentifier isEqualToString:nameOrBundleId];
+    }];
+}
+
+- (NSArray<SimProcessInfo *> *)processesMatchingPattern:(NSString *)pattern deviceUdid:(NSString *)udid {
+    const char *cPattern = pattern.UTF8String;
+    return [self _processesPassingTest:^BOOL(SimProcessInfo *info) {
+        if (udid && ![info.deviceUdid isEqualToString:udid]) {
+            return NO;
+        }
+
+        return fnmatch(cPattern, info.executablePath.fileSystemRepresentation, 0) == 0 ||
+               fnmatch(cPattern, info.name.fileSystemRepresentation, 0) == 0 ||
+               (info.bundleIdentifier && fnmatch(cPattern, info.bundleIdentifier.UTF8String, 0) == 0);
+    }];
+}
+
+@end
@@ -0,0 +1,39 @@
+//
+//  SimRuntimeStateCache.h
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+@interface SimRuntimeJailbreakState : NSObject
+
+@property (nonatomic, readonly) BOOL hasOverlays;
+@property (nonatomic, readonly) BOOL hasInjection;
+// LC_UUID of the tweak loader in the runtime, nil if it isn't there
+@property (nonatomic, copy, readonly, nullable) NSString *loaderUUID;
+// The runtime's loader matches the one bundled with the app. The bootstrap files ship in the same image as the loader
+@property (nonatomic, readonly) BOOL loaderIsCurrent;
+
+- (BOOL)isJailbroken;
+
+@end
+
+/**
+  * Jailbreak state per runtime root, shared by every device on that runtime. Entries are dropped when the
+  * mount table changes, when libobjc's modification time changes, or when invalidated after our own
+  * mount, inject and unmount operations
+ */
+@interface SimRuntimeStateCache : NSObject
+
++ (instancetype)sharedCache;
+
+- (SimRuntimeJailbreakState *)stateForRuntimeRoot:(NSString *)runtimeRoot loaderPath:(NSString *)loaderPath;
+- (void)invalidateRuntimeRoot:(NSString * _Nullable)runtimeRoot;
+
+@end
+
+NS_ASSUME_NONNULL_END
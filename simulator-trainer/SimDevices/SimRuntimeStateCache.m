@@ -0,0 +1,181 @@
+//
+//  SimRuntimeStateCache.m
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#import <sys/stat.h>
+#import "SimRuntimeStateCache.h"
+#import "mount_table.h"
+#import "load_command_injection.h"
+
+// How long an entry is trusted before libobjc is stat'd again to catch changes made outside this app
+#define LIBOBJC_RECHECK_INTERVAL 1.0
+
+static NSString *uuidStringFromBytes(const uint8_t uuid[16]) {
+    return [[[NSUUID alloc] initWithUUIDBytes:uuid] UUIDString];
+}
+
+@interface SimRuntimeJailbreakState ()
+@property (nonatomic, readwrite) BOOL hasOverlays;
+@property (nonatomic, readwrite) BOOL hasInjection;
+@property (nonatomic, copy, readwrite, nullable) NSString *loaderUUID;
+@property (nonatomic, readwrite) BOOL loaderIsCurrent;
+@end
+
+@implementation SimRuntimeJailbreakState
+
+- (BOOL)isJailbroken {
+    return self.hasOverlays || self.hasInjection;
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@ overlays:%d injection:%d loader:%@%@>", NSStringFromClass(self.class), self.hasOverlays, self.hasInjection, self.loaderUUID, self.loaderIsCurrent ? @"" : @" (outdated)"];
+}
+
+@end
+
+@interface SimRuntimeStateCacheEntry : NSObject
+@property (nonatomic, strong) SimRuntimeJailbreakState *state;
+@property (nonatomic, copy) NSString *loaderPath;
+@property (nonatomic) uint64_t mountGeneration;
+@property (nonatomic) struct timespec libobjcModified;
+@property (nonatomic) ino_t libobjcInode;
+@property (nonatomic) CFAbsoluteTime validatedAt;
+@end
+
+@implementation SimRuntimeStateCacheEntry
+@end
+
+@interface SimRuntimeStateCache ()
+@property (nonatomic, strong) dispatch_queue_t queue;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, SimRuntimeStateCacheEntry *> *entries;
+@property (nonatomic, copy) NSString *bundledLoaderUUID;
+@end
+
+@implementation SimRuntimeStateCache
+
++ (instancetype)sharedCache {
+    static SimRuntimeStateCache *sharedCache = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedCache = [[SimRuntimeStateCache alloc] init];
+    });
+
+    return sharedCache;
+}
+
+- (id)init {
+    if ((self = [super init])) {
+        _queue = dispatch_queue_create("com.simulatortrainer.runtimestatecache", DISPATCH_QUEUE_SERIAL);
+        _entries = [[NSMutableDictionary alloc] init];
+
+        uint8_t uuid[16];
+        NSString *bundledLoaderPath = [[NSBundle mainBundle] pathForResource:@"loader" ofType:@"dylib"];
+        if (bundledLoaderPath && macho_read_uuid(bundledLoaderPath.UTF8String, uuid) == 0) {
+            _bundledLoaderUUID = uuidStringFromBytes(uuid);
+        }
+    }
+
+    return self;
+}
+
++ (NSString *)_libObjcPathForRuntimeRoot:(NSString *)runtimeRoot {
+    return [runtimeRoot stringByAppendingPathComponent:@"/usr/lib/libobjc.A.dylib"];
+}
+
+- (SimRuntimeJailbreakState *)stateForRuntimeRoot:(NSString *)runtimeRoot loaderPath:(NSString *)loaderPath {
+    if (!runtimeRoot || !loaderPath) {
+        return [[SimRuntimeJailbreakState alloc] init];
+    }
+
+    __block SimRuntimeJailbreakState *state = nil;
+    dispatch_sync(self.queue, ^{
+        // Looking up a mount point rebuilds the snapshot if the kernel reported a change, which bumps the generation
+        NSString *libraryMountPath = [runtimeRoot stringByAppendingPathComponent:@"/usr/lib/"];
+        mount_table_entry_t mountEntry;
+        BOOL mounted = mount_table_lookup_path(libraryMountPath.UTF8String, &mountEntry);
+        uint64_t mountGeneration = mount_table_generation();
+
+        SimRuntimeStateCacheEntry *entry = self.entries[runtimeRoot];
+        if (entry && entry.mountGeneration == mountGeneration && [entry.loaderPath isEqualToString:loaderPath] && [self _libObjcUnchangedForEntry:entry runtimeRoot:runtimeRoot]) {
+            state = entry.state;
+            return;
+        }
+
+        entry = [self _probeRuntimeRoot:runtimeRoot loaderPath:loaderPath mounted:mounted mountEntry:mountEntry];
+        entry.mountGeneration = mountGeneration;
+        self.entries[runtimeRoot] = entry;
+        state = entry.state;
+    });
+
+    return state;
+}
+
+// Queue only
+- (BOOL)_libObjcUnchangedForEntry:(SimRuntimeStateCacheEntry *)entry runtimeRoot:(NSString *)runtimeRoot {
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    if (now - entry.validatedAt < LIBOBJC_RECHECK_INTERVAL) {
+        return YES;
+    }
+
+    struct stat st;
+    if (stat([SimRuntimeStateCache _libObjcPathForRuntimeRoot:runtimeRoot].UTF8String, &st) != 0) {
+        return NO;
+    }
+
+    struct timespec modified = entry.libobjcModified;
+    if (st.st_ino != entry.libobjcInode || st.st_mtimespec.tv_sec != modified.tv_sec || st.st_mtimespec.tv_nsec != modified.tv_nsec) {
+        return NO;
+    }
+
+    entry.validatedAt = now;
+    return YES;
+}
+
+// Queue only
+- (SimRuntimeStateCacheEntry *)_probeRuntimeRoot:(NSString *)runtimeRoot loaderPath:(NSString *)loaderPath mounted:(BOOL)mounted mountEntry:(mount_table_entry_t)mountEntry {
+    SimRuntimeJailbreakState *state = [[SimRuntimeJailbreakState alloc] init];
+    if (mounted && !mountEntry.is_tmpfs) {
+        NSLog(@"Mount point is not a tmpfs overlay: %@/usr/lib", runtimeRoot);
+    }
+    state.hasOverlays = mounted && mountEntry.is_tmpfs;
+
+    SimRuntimeStateCacheEntry *entry = [[SimRuntimeStateCacheEntry alloc] init];
+    entry.loaderPath = loaderPath;
+    entry.validatedAt = CFAbsoluteTimeGetCurrent();
+
+    NSString *libObjcPath = [SimRuntimeStateCache _libObjcPathForRuntimeRoot:runtimeRoot];
+    struct stat st;
+    if (stat(libObjcPath.UTF8String, &st) == 0) {
+        entry.libobjcModified = st.st_mtimespec;
+        entry.libobjcInode = st.st_ino;
+    }
+
+    // Reads the load commands in place rather than spawning otool
+    state.hasInjection = (macho_loads_dylib(libObjcPath.UTF8String, loaderPath.UTF8String) == 1);
+
+    uint8_t uuid[16];
+    if (macho_read_uuid(loaderPath.UTF8String, uuid) == 0) {
+        state.loaderUUID = uuidStringFromBytes(uuid);
+        state.loaderIsCurrent = !self.bundledLoaderUUID || [state.loaderUUID isEqualToString:self.bundledLoaderUUID];
+    }
+
+    entry.state = state;
+    return entry;
+}
+
+- (void)invalidateRuntimeRoot:(NSString *)runtimeRoot {
+    if (!runtimeRoot) {
+        return;
+    }
+
+    // The kernel's mount notification can arrive after our own operation completes, so don't wait for it
+    mount_table_invalidate();
+    dispatch_sync(self.queue, ^{
+        [self.entries removeObjectForKey:runtimeRoot];
+    });
+}
+
+@end
@@ -21,6 +21,12 @@ NS_ASSUME_NONNULL_BEGIN
 - (void)rebootDevice:(BootedSimulatorWrapper *)device completion:(void (^)(NSError * _Nullable error))completion;
 - (void)respringDevice:(BootedSimulatorWrapper *)device completion:(void (^)(NSError * _Nullable error))completion;
 - (void)applyJailbreakToDevice:(BootedSimulatorWrapper *)device completion:(void (^)(BOOL success, NSError * _Nullable error))completion;
+
+/**
+  * Same as applyJailbreakToDevice:completion:, reporting each helper step as it finishes.
+  * `progress` is called on an XPC queue with the finished step's name and the number of steps done so far
+ */
+- (void)applyJailbreakToDevice:(BootedSimulatorWrapper *)device progress:(void (^ _Nullable)(NSString *stepName, NSInteger completedSteps, NSInteger totalSteps))progress completion:(void (^)(BOOL success, NSError * _Nullable error))completion;
 - (void)removeJailbreakFromDevice:(BootedSimulatorWrapper *)device completion:(void (^)(BOOL success, NSError * _Nullable error))completion;
 
 @end
@@ -6,12 +6,56 @@
 //
 
 #import "SimulatorOrchestrationService.h"
-#import "SimInjectionOptions.h"
+#import "SimHelperTransaction.h"
 
 @interface SimulatorOrchestrationService ()
 @property (nonatomic, strong, nonnull) HelperConnection *helperConnection;
 @end
 
+/**
+  * Receives the helper's per-step callbacks for one transaction and reports them as readable step names
+ */
+@interface SimTransactionProgressReporter : NSObject <SimHelperTransactionProgress>
+@property (nonatomic, copy) NSDictionary<NSString *, NSString *> *stepNames;
+// Cleared when the transaction completes, so a late callback can't overwrite the final status
+@property (atomic, copy) void (^progressHandler)(NSString *stepName, NSInteger completedSteps, NSInteger totalSteps);
+@end
+
+@implementation SimTransactionProgressReporter
+
+- (id)initWithTransaction:(SimHelperTransaction *)transaction progress:(void (^)(NSString *, NSInteger, NSInteger))progress {
+    if ((self = [super init])) {
+        NSArray *kindNames = @[@"Mounting", @"Unmounting", @"Copying", @"Adding the loader to", @"Setting permissions of", @"Deploying bootstrap to", @"Signing"];
+        NSMutableDictionary<NSString *, NSString *> *stepNames = [NSMutableDictionary dictionary];
+        for (SimHelperTransactionStep *step in transaction.steps) {
+            NSString *kindName = (step.kind >= 0 && step.kind < (NSInteger)kindNames.count) ? kindNames[step.kind] : @"Running";
+            stepNames[step.identifier] = [NSString stringWithFormat:@"%@ %@", kindName, step.path.lastPathComponent];
+        }
+        
+        _stepNames = stepNames;
+        _progressHandler = progress;
+    }
+    
+    return self;
+}
+
+- (void)transactionStepDidStart:(NSString *)stepIdentifier {
+    NSLog(@"Transaction step started: %@", self.stepNames[stepIdentifier] ?: stepIdentifier);
+}
+
+- (void)transactionStepDidFinish:(SimHelperStepResult *)result completedSteps:(NSInteger)completedSteps totalSteps:(NSInteger)totalSteps {
+    NSString *stepName = self.stepNames[result.identifier] ?: result.identifier;
+    if (result.error) {
+        NSLog(@"Transaction step failed after %.1fms: %@: %@", result.duration * 1000, stepName, result.error);
+    }
+    
+    if (self.progressHandler) {
+        self.progressHandler(stepName, completedSteps, totalSteps);
+    }
+}
+
+@end
+
 @implementation SimulatorOrchestrationService
 
 - (nonnull id)initWithHelperConnection:(nonnull HelperConnection *)helperConnection {
@@ -111,16 +155,18 @@
        return;
     }
 
-    [device respring];
-
-    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(0.5 * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+    [device respringWithCompletion:^(NSError * _Nullable error) {
         if (completion) {
-            completion(nil);
+            completion(error);
         }
-    });
+    }];
 }
 
 - (void)applyJailbreakToDevice:(nonnull BootedSimulatorWrapper *)device completion:(nonnull void (^)(BOOL, NSError * _Nullable __strong))completion {
+    [self applyJailbreakToDevice:device progress:nil completion:completion];
+}
+
+- (void)applyJailbreakToDevice:(nonnull BootedSimulatorWrapper *)device progress:(void (^ _Nullable)(NSString * _Nonnull, NSInteger, NSInteger))progress completion:(nonnull void (^)(BOOL, NSError * _Nullable __strong))completion {
     if (!self.helperConnection) {
         if (completion) {
             completion(NO, [NSError errorWithDomain:NSCocoaErrorDomain code:1 userInfo:@{NSLocalizedDescriptionKey: @"Helper connection is not available"}]);
@@ -137,52 +183,105 @@
         return;
     }
 
-    [self.helperConnection mountTmpfsOverlaysAtPaths:[device directoriesToOverlay] completion:^(NSError *mountError) {
-        if (mountError) {
+    // Mounts, bootstrap copies and the loader injection go to the helper as one authorized transaction.
+    // Each copy only waits for the overlay it lands in, and the overlays mount concurrently
+    SimHelperTransaction *transaction = [[SimHelperTransaction alloc] init];
+    NSMutableArray<SimHelperTransactionStep *> *mountSteps = [NSMutableArray array];
+    for (NSString *overlayPath in [device directoriesToOverlay]) {
+        [mountSteps addObject:[transaction addStep:[SimHelperTransactionStep mountOverlayAtPath:overlayPath]]];
+    }
+    
+    NSString *loaderSourcePath = [[NSBundle mainBundle] pathForResource:@"loader" ofType:@"dylib"];
+    NSString *optoolPath = [[NSBundle mainBundle] pathForResource:@"optool" ofType:nil];
+    NSString *loaderDestinationPath = [device tweakLoaderDylibPath];
+    if (!loaderSourcePath || !optoolPath || !loaderDestinationPath) {
+        if (completion) {
+            completion(NO, [NSError errorWithDomain:NSCocoaErrorDomain code:1 userInfo:@{NSLocalizedDescriptionKey: @"Missing tweak loader or optool"}]);
+        }
+        
+        return;
+    }
+    
+    SimHelperTransactionStep *copyLoaderStep = nil;
+    NSString *bootstrapImagePath = [[NSBundle mainBundle] pathForResource:@"bootstrap" ofType:@"image"];
+    if (bootstrapImagePath) {
+        // The loader is part of the pre-signed image, which lands across several overlays in one pass
+        copyLoaderStep = [transaction addStep:[SimHelperTransactionStep deployBootstrapImage:bootstrapImagePath toRuntimeRoot:[device runtimeRoot]]];
+        [copyLoaderStep addDependencies:mountSteps];
+    }
+    else {
+        copyLoaderStep = [transaction addStep:[SimHelperTransactionStep copyItemAtPath:loaderSourcePath toPath:loaderDestinationPath]];
+        [copyLoaderStep addDependencies:[self _mountSteps:mountSteps containingPath:loaderDestinationPath]];
+        
+        NSDictionary<NSString *, NSString *> *bootstrapFiles = [device bootstrapFilesToCopy];
+        for (NSString *sourcePath in bootstrapFiles) {
+            NSString *targetPath = bootstrapFiles[sourcePath];
+            SimHelperTransactionStep *copyStep = [transaction addStep:[SimHelperTransactionStep copyItemAtPath:sourcePath toPath:targetPath]];
+            [copyStep addDependencies:[self _mountSteps:mountSteps containingPath:targetPath]];
+        }
+    }
+    
+    // Placement -> load command -> signing, each its own step with its own result. The load command and the
+    // signature are checked on the binary itself, so a runtime that's already done skips both
+    SimHelperTransactionStep *loadCommandStep = [transaction addStep:[SimHelperTransactionStep addLoadCommandForDylib:loaderDestinationPath toBinary:[device libObjcPath] usingOptoolAtPath:optoolPath]];
+    [loadCommandStep addDependency:copyLoaderStep];
+    [loadCommandStep addDependencies:[self _mountSteps:mountSteps containingPath:[device libObjcPath]]];
+    
+    SimHelperTransactionStep *signStep = [transaction addStep:[SimHelperTransactionStep signBinaryAtPath:[device libObjcPath]]];
+    [signStep addDependency:loadCommandStep];
+    
+    // The helper calls back into the reporter over XPC as each step finishes
+    SimTransactionProgressReporter *progressReporter = [[SimTransactionProgressReporter alloc] initWithTransaction:transaction progress:progress];
+    [self.helperConnection runTransaction:transaction progress:progressReporter completion:^(NSArray<SimHelperStepResult *> *results, NSError *transactionError) {
+        progressReporter.progressHandler = nil;
+        NSTimeInterval stepTime = 0;
+        for (SimHelperStepResult *result in results) {
+            stepTime += result.duration;
+            NSLog(@"Jailbreak step %@: %@ in %.1fms", progressReporter.stepNames[result.identifier] ?: result.identifier, result.error ? @"failed" : (result.skipped ? @"skipped" : @"done"), result.duration * 1000);
+        }
+        NSLog(@"Jailbreak transaction finished %lu steps (%.1fms of step time)", (unsigned long)results.count, stepTime * 1000);
+        
+        if (transactionError) {
             if (completion) {
-                completion(NO, [NSError errorWithDomain:NSCocoaErrorDomain code:1 userInfo:@{NSLocalizedDescriptionKey:[NSString stringWithFormat:@"Failed to mount tmpfs overlays: %@", mountError]}]);
+                completion(NO, [NSError errorWithDomain:NSCocoaErrorDomain code:1 userInfo:@{NSLocalizedDescriptionKey:[NSString stringWithFormat:@"Failed to setup tweak injection: %@", transactionError]}]);
             }
 
             return;
         }
 
-        SimInjectionOptions *options = [[SimInjectionOptions alloc] init];
-        options.tweakLoaderDestinationPath = [device tweakLoaderDylibPath];
-        options.victimPathForTweakLoader = [device libObjcPath];
-        options.tweakLoaderSourcePath = [[NSBundle mainBundle] pathForResource:@"loader" ofType:@"dylib"];
-        options.optoolPath = [[NSBundle mainBundle] pathForResource:@"optool" ofType:nil];
-        options.filesToCopy = [device bootstrapFilesToCopy];
-        
-        [self.helperConnection setupTweakInjectionWithOptions:options completion:^(NSError *injectionError) {
-            if (injectionError) {
-                if (completion) {
-                    completion(NO, [NSError errorWithDomain:NSCocoaErrorDomain code:1 userInfo:@{NSLocalizedDescriptionKey:[NSString stringWithFormat:@"Failed to setup tweak injection: %@", injectionError]}]);
+        [[SimRuntimeStateCache sharedCache] invalidateRuntimeRoot:[device runtimeRoot]];
+        [device reloadDeviceState];
+        if ([device isJailbroken]) {
+            [self respringDevice:device completion:^(NSError * _Nullable respringError) {
+                if (respringError) {
+                     NSLog(@"Jailbreak applied, but respring might have an issue: %@", respringError);
                 }
-
-                return;
-            }
-
-            [device reloadDeviceState];
-            if ([device isJailbroken]) {
-                [self respringDevice:device completion:^(NSError * _Nullable respringError) {
-                    if (respringError) {
-                         NSLog(@"Jailbreak applied, but respring might have an issue: %@", respringError);
-                    }
-                    
-                    if (completion) {
-                        completion(YES, nil);
-                    }
-                }];
-            }
-            else {
+                
                 if (completion) {
-                    completion(NO, [NSError errorWithDomain:NSCocoaErrorDomain code:1 userInfo:@{NSLocalizedDescriptionKey:@"No errors but it didn't work"}]);
+                    completion(YES, nil);
                 }
+            }];
+        }
+        else {
+            if (completion) {
+                completion(NO, [NSError errorWithDomain:NSCocoaErrorDomain code:1 userInfo:@{NSLocalizedDescriptionKey:@"No errors but it didn't work"}]);
             }
-        }];
+        }
     }];
 }
 
+- (NSArray<SimHelperTransactionStep *> *)_mountSteps:(NSArray<SimHelperTransactionStep *> *)mountSteps containingPath:(NSString *)path {
+    NSMutableArray<SimHelperTransactionStep *> *containing = [NSMutableArray array];
+    for (SimHelperTransactionStep *mountStep in mountSteps) {
+        NSString *mountPrefix = [mountStep.path hasSuffix:@"/"] ? mountStep.path : [mountStep.path stringByAppendingString:@"/"];
+        if ([path isEqualToString:mountStep.path] || [path hasPrefix:mountPrefix]) {
+            [containing addObject:mountStep];
+        }
+    }
+    
+    return containing;
+}
+
 - (void)removeJailbreakFromDevice:(nonnull BootedSimulatorWrapper *)device completion:(nonnull void (^)(BOOL, NSError * _Nullable __strong))completion {
     if (!device || !device.isJailbroken) {
         if (completion) {
@@ -197,6 +296,7 @@
             NSLog(@"Failed to unmount mount points: %@", unmountError);
             // Don't fail
         }
+        [[SimRuntimeStateCache sharedCache] invalidateRuntimeRoot:[device runtimeRoot]];
         
         if (!device.isBooted) {
             completion(YES, nil);
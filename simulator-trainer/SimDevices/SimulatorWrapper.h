@@ -26,9 +26,17 @@ NS_ASSUME_NONNULL_BEGIN
 
 @property (nonatomic, weak) id<SimulatorWrapperDelegate> delegate;
 @property (nonatomic, strong) id coreSimDevice;
+// Set while the device is shut down to be booted again. Stored per UDID, so every wrapper of the device sees the same
+// value, including the one that replaces it when the device crosses between booted and shutdown
+@property (nonatomic) BOOL pendingReboot;
 
 - (instancetype)initWithCoreSimDevice:(id)coreSimDevice;
 
+/**
+  * Take over the per-device state of `wrapper`, the wrapper this one replaces for the same device
+ */
+- (void)adoptStateFromWrapper:(SimulatorWrapper *)wrapper;
+
 - (BOOL)isBooted;
 - (NSString * _Nonnull)displayString;
 - (NSString * _Nullable)udidString;
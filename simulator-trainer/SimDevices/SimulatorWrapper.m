@@ -9,6 +9,7 @@
 #import <objc/message.h>
 #import "SimulatorWrapper.h"
 #import "SimDeviceManager.h"
+#import "SimDeviceStateMachine.h"
 
 @interface SimulatorWrapper ()
 @end
@@ -28,6 +29,46 @@
     return self;
 }
 
++ (NSMutableSet<NSString *> *)_pendingRebootUdids {
+    static NSMutableSet<NSString *> *pendingRebootUdids = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        pendingRebootUdids = [[NSMutableSet alloc] init];
+    });
+    
+    return pendingRebootUdids;
+}
+
+- (BOOL)pendingReboot {
+    NSString *udid = self.udidString;
+    NSMutableSet<NSString *> *pendingRebootUdids = [SimulatorWrapper _pendingRebootUdids];
+    @synchronized (pendingRebootUdids) {
+        return udid && [pendingRebootUdids containsObject:udid];
+    }
+}
+
+- (void)setPendingReboot:(BOOL)pendingReboot {
+    NSString *udid = self.udidString;
+    if (!udid) {
+        return;
+    }
+    
+    NSMutableSet<NSString *> *pendingRebootUdids = [SimulatorWrapper _pendingRebootUdids];
+    @synchronized (pendingRebootUdids) {
+        if (pendingReboot) {
+            [pendingRebootUdids addObject:udid];
+        }
+        else {
+            [pendingRebootUdids removeObject:udid];
+        }
+    }
+}
+
+- (void)adoptStateFromWrapper:(SimulatorWrapper *)wrapper {
+    // Everything else, like pendingReboot, is already stored per device
+    self.delegate = wrapper.delegate;
+}
+
 - (NSString *)description {
     return [NSString stringWithFormat:@"<%@ booted:%d udid:%@>", NSStringFromClass(self.class), self.isBooted, self.udidString];
 }
@@ -155,14 +196,13 @@
         }
     }
     
-    // todo: improve
     // Keep track of whether this is a reboot or a cold boot
-    BOOL bootingForReboot = NO;
-    if ([self isKindOfClass:NSClassFromString(@"BootedSimulatorWrapper")]) {
-        bootingForReboot = [[self valueForKey:@"pendingReboot"] boolValue];
-        // Clear pending reboot flag regardless of whether boot failed or not
-        [self setValue:@(NO) forKey:@"pendingReboot"];
-    }
+    BOOL bootingForReboot = self.pendingReboot;
+    // Clear pending reboot flag regardless of whether boot failed or not
+    self.pendingReboot = NO;
+    
+    // Make sure the device's state machine is listening before the boot starts, so the boot gets timed
+    [SimDeviceStateMachine stateMachineForUdid:self.udidString];
     
     // Begin boot
     NSDictionary *options = @{};
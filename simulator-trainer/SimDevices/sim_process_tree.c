@@ -0,0 +1,211 @@
+//
+//  sim_process_tree.c
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#include "sim_process_tree.h"
+#include <libproc.h>
+#include <sys/sysctl.h>
+#include <sys/event.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Children of launchd_sim are usually posix_spawn'd, which doesn't always raise NOTE_FORK,
+// so the children are looked at again at least this often while waiting
+#define CHILD_RESCAN_INTERVAL 0.1
+
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int process_is_named(pid_t pid, const char *name) {
+    char path[PROC_PIDPATHINFO_MAXSIZE];
+    if (proc_pidpath(pid, path, sizeof(path)) <= 0) {
+        return 0;
+    }
+
+    const char *slash = strrchr(path, '/');
+    const char *basename = slash ? slash + 1 : path;
+    return strcmp(basename, name) == 0;
+}
+
+static int process_arguments_contain(pid_t pid, const char *needle) {
+    int argmax = 0;
+    size_t size = sizeof(argmax);
+    int mib[3] = {CTL_KERN, KERN_ARGMAX, 0};
+    if (sysctl(mib, 2, &argmax, &size, NULL, 0) != 0 || argmax <= 0) {
+        return 0;
+    }
+
+    char *buffer = malloc((size_t)argmax);
+    if (!buffer) {
+        return 0;
+    }
+
+    mib[1] = KERN_PROCARGS2;
+    mib[2] = pid;
+    size = (size_t)argmax;
+    if (sysctl(mib, 3, buffer, &size, NULL, 0) != 0) {
+        free(buffer);
+        return 0;
+    }
+
+    // argc, then the executable path, arguments and environment as NUL-terminated strings
+    int found = 0;
+    size_t offset = sizeof(int);
+    while (offset < size && !found) {
+        const char *string = buffer + offset;
+        size_t length = strnlen(string, size - offset);
+        if (length < size - offset && strstr(string, needle)) {
+            found = 1;
+        }
+
+        offset += length + 1;
+    }
+
+    free(buffer);
+    return found;
+}
+
+pid_t sim_launchd_pid_for_udid(const char *udid) {
+    if (!udid || udid[0] == '\0') {
+        return -1;
+    }
+
+    int capacity = proc_listallpids(NULL, 0);
+    if (capacity <= 0) {
+        fprintf(stderr, "Failed to count processes: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // Room for processes started between the two calls
+    capacity += 64;
+    pid_t *pids = calloc((size_t)capacity, sizeof(pid_t));
+    if (!pids) {
+        return -1;
+    }
+
+    int count = proc_listallpids(pids, capacity * (int)sizeof(pid_t));
+    pid_t launchd_pid = -1;
+    for (int i = 0; i < count && i < capacity; i++) {
+        // The device's launchd_sim is started with paths inside the device's directory, which is named after the UDID
+        if (pids[i] > 0 && process_is_named(pids[i], "launchd_sim") && process_arguments_contain(pids[i], udid)) {
+            launchd_pid = pids[i];
+            break;
+        }
+    }
+
+    free(pids);
+    return launchd_pid;
+}
+
+int sim_list_child_pids(pid_t parent_pid, pid_t **pids_out) {
+    if (parent_pid <= 0 || !pids_out) {
+        return -1;
+    }
+
+    int capacity = 512;
+    for (;;) {
+        pid_t *pids = calloc((size_t)capacity, sizeof(pid_t));
+        if (!pids) {
+            return -1;
+        }
+
+        int bytes = proc_listpids(PROC_PPID_ONLY, (uint32_t)parent_pid, pids, capacity * (int)sizeof(pid_t));
+        if (bytes < 0) {
+            free(pids);
+            return -1;
+        }
+
+        int count = bytes / (int)sizeof(pid_t);
+        if (count < capacity) {
+            *pids_out = pids;
+            return count;
+        }
+
+        // Filled the buffer, there may be more
+        free(pids);
+        capacity *= 2;
+    }
+}
+
+pid_t sim_child_pid_named(pid_t launchd_pid, const char *name) {
+    if (!name) {
+        return -1;
+    }
+
+    pid_t *pids = NULL;
+    int count = sim_list_child_pids(launchd_pid, &pids);
+    if (count < 0) {
+        return -1;
+    }
+
+    pid_t child_pid = -1;
+    for (int i = 0; i < count; i++) {
+        if (pids[i] > 0 && process_is_named(pids[i], name)) {
+            child_pid = pids[i];
+            break;
+        }
+    }
+
+    free(pids);
+    return child_pid;
+}
+
+pid_t sim_wait_for_child_named(pid_t launchd_pid, const char *name, pid_t previous_pid, double timeout_seconds) {
+    int kq = kqueue();
+    if (kq < 0) {
+        fprintf(stderr, "kqueue failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    struct kevent change;
+    EV_SET(&change, launchd_pid, EVFILT_PROC, EV_ADD | EV_CLEAR, NOTE_FORK | NOTE_EXIT, 0, NULL);
+    if (kevent(kq, &change, 1, NULL, 0, NULL) < 0) {
+        fprintf(stderr, "Failed to watch launchd_sim %d: %s\n", launchd_pid, strerror(errno));
+        close(kq);
+        return -1;
+    }
+
+    if (previous_pid > 0) {
+        // Fails with ESRCH if it already exited, which is fine
+        EV_SET(&change, previous_pid, EVFILT_PROC, EV_ADD | EV_ONESHOT, NOTE_EXIT, 0, NULL);
+        kevent(kq, &change, 1, NULL, 0, NULL);
+    }
+
+    double deadline = monotonic_seconds() + timeout_seconds;
+    pid_t new_pid = -1;
+    for (;;) {
+        pid_t current_pid = sim_child_pid_named(launchd_pid, name);
+        if (current_pid > 0 && current_pid != previous_pid) {
+            new_pid = current_pid;
+            break;
+        }
+
+        double remaining = deadline - monotonic_seconds();
+        if (remaining <= 0) {
+            fprintf(stderr, "Timed out waiting for %s under launchd_sim %d\n", name, launchd_pid);
+            break;
+        }
+
+        double wait = remaining < CHILD_RESCAN_INTERVAL ? remaining : CHILD_RESCAN_INTERVAL;
+        struct timespec timeout = {(time_t)wait, (long)((wait - (double)(time_t)wait) * 1e9)};
+        struct kevent event;
+        int events = kevent(kq, NULL, 0, &event, 1, &timeout);
+        if (events > 0 && (pid_t)event.ident == launchd_pid && (event.fflags & NOTE_EXIT)) {
+            fprintf(stderr, "launchd_sim %d exited while waiting for %s\n", launchd_pid, name);
+            break;
+        }
+    }
+
+    close(kq);
+    return new_pid;
+}
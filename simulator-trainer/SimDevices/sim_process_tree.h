@@ -0,0 +1,38 @@
+//
+//  sim_process_tree.h
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#ifndef sim_process_tree_h
+#define sim_process_tree_h
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <sys/types.h>
+
+/**
+  * Find the launchd_sim that hosts the device with this UDID. Every process in the simulator
+  * is a child of it. Returns -1 if the device isn't running
+ */
+pid_t sim_launchd_pid_for_udid(const char *udid);
+
+/**
+  * List the direct children of `parent_pid` into a malloc'd array that the caller frees.
+  * Returns the number of children, or -1 on failure
+ */
+int sim_list_child_pids(pid_t parent_pid, pid_t **pids_out);
+
+/**
+  * Find a direct child of launchd_sim whose executable is named `name`, like "SpringBoard" or "backboardd".
+  * Returns -1 if there is none
+ */
+pid_t sim_child_pid_named(pid_t launchd_pid, const char *name);
+
+/**
+  * Wait until launchd_sim has a child named `name` that isn't `previous_pid`. Wakes up on launchd_sim's
+  * fork events and `previous_pid` exiting. Returns the new pid, or -1 on timeout or if launchd_sim went away
+ */
+pid_t sim_wait_for_child_named(pid_t launchd_pid, const char *name, pid_t previous_pid, double timeout_seconds);
+
+#endif /* sim_process_tree_h */
@@ -38,12 +38,23 @@
     [NSApp activateIgnoringOtherApps:YES];
 }
 
+- (BOOL)respondsToSelector:(SEL)aSelector {
+    if ([super respondsToSelector:aSelector]) {
+        return YES;
+    }
+
+    // The Simulator's delegate methods only count once it exists, so AppKit doesn't send them here before then
+    return [[InProcessSimulator loadedSimulatorDelegate] respondsToSelector:aSelector];
+}
+
 - (id)forwardingTargetForSelector:(SEL)aSelector {
-    if ([self respondsToSelector:aSelector]) {
-        return self;
+    id receiver = [InProcessSimulator loadedSimulatorDelegate];
+    if (!receiver) {
+        // Startup hasn't brought up the Simulator yet
+        NSLog(@"-[AppDelegate %@] was sent before the Simulator finished loading", NSStringFromSelector(aSelector));
+        return [super forwardingTargetForSelector:aSelector];
     }
-        
-    id receiver = [InProcessSimulator sharedSetupIfNeeded].simulatorDelegate;
+    
     if ([receiver respondsToSelector:aSelector]) {
         return receiver;
     }
@@ -0,0 +1,52 @@
+//
+//  TerminalOutputCoalescer.h
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#import <Foundation/Foundation.h>
+#import <sys/ioctl.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+  * Runs a process on its own pty and sits between it and a terminal view.
+  * The process's output is always drained at full speed. Every byte goes to a scrollback file on disk, rotated so
+  * only the most recent output is kept, and the view is sent one batch per frame. Lines are paced by a token bucket
+  * refilled at `maxDisplayedLinesPerSecond` and holding up to one second's worth. When output outruns it, a frame
+  * shows only the newest lines, behind a marker saying how many lines were collapsed.
+  * The terminal view runs a small relay (see -relayExecutable) that prints the paced output and sends keystrokes back
+ */
+@interface TerminalOutputCoalescer : NSObject
+
+// Defaults to 3000
+@property (nonatomic) NSUInteger maxDisplayedLinesPerSecond;
+@property (nonatomic, copy, nullable) void (^terminationHandler)(int exitCode);
+@property (nonatomic, readonly) uint64_t collapsedLineCount;
+@property (nonatomic, copy, readonly) NSString *scrollbackPath;
+
+- (instancetype)initWithExecutable:(NSString *)executable args:(NSArray<NSString *> * _Nullable)args env:(NSArray<NSString *> * _Nullable)env;
+
+- (BOOL)startWithWindowSize:(struct winsize)windowSize error:(NSError **)error;
+- (void)stop;
+
+// What the terminal view should run instead of the process itself
+- (NSString *)relayExecutable;
+- (NSArray<NSString *> *)relayArguments;
+
+- (void)setWindowSizeWithColumns:(NSInteger)columns rows:(NSInteger)rows;
+
+/**
+  * Show text in the terminal. Unlike the process's output it is never collapsed
+ */
+- (void)showText:(NSString *)text;
+
+/**
+  * Lines in the full scrollback that contain `needle`, with escape sequences removed, oldest first
+ */
+- (void)searchScrollbackForString:(NSString *)needle limit:(NSUInteger)limit completion:(void (^)(NSArray<NSString *> *lines))completion;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,578 @@
+//
+//  TerminalOutputCoalescer.m
+//  simulator-trainer
+//
+//  Created by m1book on 10/18/26.
+//
+
+#import <os/lock.h>
+#import <stdatomic.h>
+#import <sys/mman.h>
+#import <sys/stat.h>
+#import <util.h>
+#import "TerminalOutputCoalescer.h"
+
+#define READ_CHUNK_SIZE (64 * 1024)
+#define FRAMES_PER_SECOND 60
+// The scrollback rotates to a second file at this size, so at most twice this is kept on disk
+#define MAX_SCROLLBACK_BYTES (128 * 1024 * 1024)
+
+@interface TerminalOutputCoalescer () {
+    os_unfair_lock _pendingLock;
+    NSMutableData *_pendingOutput;
+    // Newlines in _pendingOutput, and the lines already dropped from its front since the last frame
+    NSUInteger _pendingLineCount;
+    uint64_t _pendingTrimmedLines;
+    NSMutableData *_pendingShownText;
+    _Atomic bool _outputEnded;
+    _Atomic bool _stopping;
+    _Atomic uint64_t _collapsedLineCount;
+    int _masterFd;
+    int _scrollbackFd;
+    off_t _scrollbackSize;
+    pid_t _childPid;
+}
+
+@property (nonatomic, copy) NSString *executable;
+@property (nonatomic, copy) NSArray<NSString *> *args;
+@property (nonatomic, copy, nullable) NSArray<NSString *> *env;
+@property (nonatomic, copy) NSString *sessionDirectory;
+@property (nonatomic, copy, readwrite) NSString *scrollbackPath;
+@property (nonatomic, copy) NSString *previousScrollbackPath;
+@property (nonatomic, strong) dispatch_semaphore_t frameWakeup;
+@property (nonatomic, strong) dispatch_source_t exitSource;
+
+@end
+
+static NSString *printable_line(const uint8_t *start, const uint8_t *end) {
+    NSMutableData *stripped = [NSMutableData dataWithCapacity:(NSUInteger)(end - start)];
+    for (const uint8_t *p = start; p < end; p++) {
+        if (*p == 0x1b && p + 1 < end && p[1] == '[') {
+            // Skip a CSI sequence up to its final byte
+            p += 2;
+            while (p < end && (*p < 0x40 || *p > 0x7e)) {
+                p++;
+            }
+            continue;
+        }
+
+        if (*p != '\r') {
+            [stripped appendBytes:p length:1];
+        }
+    }
+
+    return [[NSString alloc] initWithData:stripped encoding:NSUTF8StringEncoding] ?: [[NSString alloc] initWithData:stripped encoding:NSISOLatin1StringEncoding];
+}
+
+static NSUInteger count_lines(const uint8_t *bytes, NSUInteger length) {
+    NSUInteger lineCount = 0;
+    for (const uint8_t *newline = memchr(bytes, '\n', length); newline; newline = memchr(newline + 1, '\n', length - (NSUInteger)(newline + 1 - bytes))) {
+        lineCount++;
+    }
+
+    return lineCount;
+}
+
+static void search_scrollback_file(NSString *path, const char *needle, size_t needleLength, NSUInteger limit, NSMutableArray<NSString *> *lines) {
+    int fd = open(path.fileSystemRepresentation, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+
+    // Only the part of the file written so far is mapped, later output isn't searched
+    struct stat st;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        mapping = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        return;
+    }
+
+    const uint8_t *base = mapping;
+    const uint8_t *end = base + st.st_size;
+    const uint8_t *cursor = base;
+    while (lines.count < limit && cursor < end) {
+        const uint8_t *match = memmem(cursor, (size_t)(end - cursor), needle, needleLength);
+        if (!match) {
+            break;
+        }
+
+        const uint8_t *lineStart = match;
+        while (lineStart > base && lineStart[-1] != '\n') {
+            lineStart--;
+        }
+
+        const uint8_t *lineEnd = memchr(match, '\n', (size_t)(end - match));
+        if (!lineEnd) {
+            lineEnd = end;
+        }
+        [lines addObject:printable_line(lineStart, lineEnd)];
+        cursor = lineEnd < end ? lineEnd + 1 : end;
+    }
+
+    munmap(mapping, (size_t)st.st_size);
+}
+
+@implementation TerminalOutputCoalescer
+
+- (instancetype)initWithExecutable:(NSString *)executable args:(NSArray<NSString *> *)args env:(NSArray<NSString *> *)env {
+    if ((self = [super init])) {
+        _executable = [executable copy];
+        _args = [args copy] ?: @[];
+        _env = [env copy];
+        _maxDisplayedLinesPerSecond = 3000;
+        _pendingLock = OS_UNFAIR_LOCK_INIT;
+        _pendingOutput = [[NSMutableData alloc] init];
+        _pendingShownText = [[NSMutableData alloc] init];
+        _masterFd = -1;
+        _scrollbackFd = -1;
+        _childPid = -1;
+        _frameWakeup = dispatch_semaphore_create(0);
+    }
+
+    return self;
+}
+
+- (void)dealloc {
+    if (_masterFd >= 0) {
+        close(_masterFd);
+    }
+
+    if (_scrollbackFd >= 0) {
+        close(_scrollbackFd);
+    }
+}
+
+- (uint64_t)collapsedLineCount {
+    return atomic_load(&_collapsedLineCount);
+}
+
+- (NSString *)_outputFifoPath {
+    return [self.sessionDirectory stringByAppendingPathComponent:@"output.fifo"];
+}
+
+- (NSString *)_inputFifoPath {
+    return [self.sessionDirectory stringByAppendingPathComponent:@"input.fifo"];
+}
+
+- (NSString *)relayExecutable {
+    return @"/bin/sh";
+}
+
+- (NSArray<NSString *> *)relayArguments {
+    // Raw mode so every keystroke, ^C included, reaches the process's own pty, which does the echoing
+    return @[@"-c", @"stty raw -echo; /bin/cat \"$0\" & exec /bin/cat > \"$1\"", [self _outputFifoPath], [self _inputFifoPath]];
+}
+
+- (BOOL)startWithWindowSize:(struct winsize)windowSize error:(NSError **)error {
+    self.sessionDirectory = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSString stringWithFormat:@"terminal-%@", [[NSUUID UUID] UUIDString]]];
+    self.scrollbackPath = [self.sessionDirectory stringByAppendingPathComponent:@"scrollback"];
+    self.previousScrollbackPath = [self.sessionDirectory stringByAppendingPathComponent:@"scrollback.1"];
+    if (![[NSFileManager defaultManager] createDirectoryAtPath:self.sessionDirectory withIntermediateDirectories:YES attributes:nil error:error]) {
+        return NO;
+    }
+
+    if (mkfifo([self _outputFifoPath].fileSystemRepresentation, 0600) != 0 || mkfifo([self _inputFifoPath].fileSystemRepresentation, 0600) != 0) {
+        if (error) {
+            *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:@{NSLocalizedDescriptionKey: @"Failed to create terminal FIFOs"}];
+        }
+        return NO;
+    }
+
+    _scrollbackFd = open(self.scrollbackPath.fileSystemRepresentation, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0600);
+    if (_scrollbackFd < 0) {
+        if (error) {
+            *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:@{NSLocalizedDescriptionKey: @"Failed to create terminal scrollback"}];
+        }
+        return NO;
+    }
+
+    // Everything the child needs is built before forking, it can only exec afterwards
+    NSMutableDictionary *environment = [[[NSProcessInfo processInfo] environment] mutableCopy];
+    environment[@"TERM"] = @"xterm-256color";
+    for (NSString *entry in self.env) {
+        NSRange separator = [entry rangeOfString:@"="];
+        if (separator.location != NSNotFound) {
+            environment[[entry substringToIndex:separator.location]] = [entry substringFromIndex:separator.location + 1];
+        }
+    }
+
+    NSMutableArray<NSString *> *envEntries = [NSMutableArray array];
+    [environment enumerateKeysAndObjectsUsingBlock:^(NSString *key, NSString *value, BOOL *stop) {
+        [envEntries addObject:[NSString stringWithFormat:@"%@=%@", key, value]];
+    }];
+
+    NSArray<NSString *> *argvStrings = [@[self.executable] arrayByAddingObjectsFromArray:self.args];
+    char **argv = calloc(argvStrings.count + 1, sizeof(char *));
+    char **envp = calloc(envEntries.count + 1, sizeof(char *));
+    for (NSUInteger i = 0; i < argvStrings.count; i++) {
+        argv[i] = strdup(argvStrings[i].UTF8String);
+    }
+    for (NSUInteger i = 0; i < envEntries.count; i++) {
+        envp[i] = strdup(envEntries[i].UTF8String);
+    }
+    char *executablePath = strdup(self.executable.fileSystemRepresentation);
+
+    pid_t pid = forkpty(&_masterFd, NULL, NULL, &windowSize);
+    if (pid == 0) {
+        execve(executablePath, argv, envp);
+        _exit(127);
+    }
+
+    for (NSUInteger i = 0; i < argvStrings.count; i++) {
+        free(argv[i]);
+    }
+    for (NSUInteger i = 0; i < envEntries.count; i++) {
+        free(envp[i]);
+    }
+    free(argv);
+    free(envp);
+    free(executablePath);
+
+    if (pid < 0) {
+        if (error) {
+            *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:@{NSLocalizedDescriptionKey: [NSString stringWithFormat:@"Failed to start %@", self.executable]}];
+        }
+        return NO;
+    }
+
+    _childPid = pid;
+    [self _watchForExit];
+
+    // The reader never waits on the view, so a busy process is never slowed down by rendering
+    [NSThread detachNewThreadWithBlock:^{
+        [self _readOutput];
+    }];
+
+    [NSThread detachNewThreadWithBlock:^{
+        [self _presentFrames];
+    }];
+
+    [NSThread detachNewThreadWithBlock:^{
+        [self _forwardInput];
+    }];
+
+    return YES;
+}
+
+- (void)_watchForExit {
+    pid_t pid = _childPid;
+    self.exitSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_PROC, (uintptr_t)pid, DISPATCH_PROC_EXIT, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0));
+    __weak typeof(self) weakSelf = self;
+    dispatch_source_set_event_handler(self.exitSource, ^{
+        int status = 0;
+        waitpid(pid, &status, 0);
+        int exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+
+        TerminalOutputCoalescer *strongSelf = weakSelf;
+        if (!strongSelf) {
+            return;
+        }
+
+        dispatch_source_cancel(strongSelf.exitSource);
+        dispatch_async(dispatch_get_main_queue(), ^{
+            if (strongSelf.terminationHandler) {
+                strongSelf.terminationHandler(exitCode);
+            }
+        });
+    });
+    dispatch_resume(self.exitSource);
+}
+
+- (void)setWindowSizeWithColumns:(NSInteger)columns rows:(NSInteger)rows {
+    if (_masterFd < 0) {
+        return;
+    }
+
+    struct winsize windowSize = {.ws_col = (unsigned short)columns, .ws_row = (unsigned short)rows};
+    ioctl(_masterFd, TIOCSWINSZ, &windowSize);
+}
+
+- (void)showText:(NSString *)text {
+    NSData *data = [[text stringByReplacingOccurrencesOfString:@"\n" withString:@"\r\n"] dataUsingEncoding:NSUTF8StringEncoding];
+    os_unfair_lock_lock(&_pendingLock);
+    [_pendingShownText appendData:data];
+    os_unfair_lock_unlock(&_pendingLock);
+    dispatch_semaphore_signal(self.frameWakeup);
+}
+
+- (void)stop {
+    if (atomic_exchange(&_stopping, true)) {
+        return;
+    }
+
+    if (_childPid > 0 && kill(_childPid, 0) == 0) {
+        kill(_childPid, SIGTERM);
+    }
+
+    dispatch_semaphore_signal(self.frameWakeup);
+
+    // Release threads still blocked opening a FIFO by briefly opening the other end
+    int outputFd = open([self _outputFifoPath].fileSystemRepresentation, O_RDONLY | O_NONBLOCK);
+    if (outputFd >= 0) {
+        close(outputFd);
+    }
+
+    int inputFd = open([self _inputFifoPath].fileSystemRepresentation, O_WRONLY | O_NONBLOCK);
+    if (inputFd >= 0) {
+        close(inputFd);
+    }
+
+    NSString *sessionDirectory = self.sessionDirectory;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(1 * NSEC_PER_SEC)), dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+        [[NSFileManager defaultManager] removeItemAtPath:sessionDirectory error:nil];
+    });
+}
+
+#pragma mark - Output
+
+// Reader thread only
+- (void)_appendToScrollback:(const uint8_t *)bytes length:(size_t)length {
+    if (_scrollbackSize > 0 && _scrollbackSize + (off_t)length > MAX_SCROLLBACK_BYTES) {
+        // The full file becomes the previous one, replacing the one before it
+        if (rename(self.scrollbackPath.fileSystemRepresentation, self.previousScrollbackPath.fileSystemRepresentation) == 0) {
+            int rotatedFd = open(self.scrollbackPath.fileSystemRepresentation, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0600);
+            if (rotatedFd >= 0) {
+                close(_scrollbackFd);
+                _scrollbackFd = rotatedFd;
+                _scrollbackSize = 0;
+            }
+        }
+    }
+
+    for (size_t written = 0; written < length;) {
+        ssize_t result = write(_scrollbackFd, bytes + written, length - written);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        written += (size_t)result;
+        _scrollbackSize += result;
+    }
+}
+
+/**
+  * Call with _pendingLock held. Drops the oldest lines until `keepLines` are left, counting them as collapsed.
+  * No frame can show more lines than that, so output waiting on a slow view stays bounded
+ */
+- (void)_trimPendingOutputToLines:(NSUInteger)keepLines {
+    const uint8_t *bytes = _pendingOutput.bytes;
+    NSUInteger length = _pendingOutput.length;
+    NSUInteger cut = 0;
+    NSUInteger dropped = 0;
+    while (_pendingLineCount - dropped > keepLines) {
+        const uint8_t *newline = memchr(bytes + cut, '\n', length - cut);
+        if (!newline) {
+            break;
+        }
+
+        cut = (NSUInteger)(newline - bytes) + 1;
+        dropped++;
+    }
+
+    [_pendingOutput replaceBytesInRange:NSMakeRange(0, cut) withBytes:NULL length:0];
+    _pendingLineCount -= dropped;
+    _pendingTrimmedLines += dropped;
+}
+
+- (void)_readOutput {
+    uint8_t *buffer = malloc(READ_CHUNK_SIZE);
+    for (;;) {
+        ssize_t bytesRead = read(_masterFd, buffer, READ_CHUNK_SIZE);
+        if (bytesRead < 0 && errno == EINTR) {
+            continue;
+        }
+
+        // EIO once the child and everything sharing its pty are gone
+        if (bytesRead <= 0) {
+            break;
+        }
+
+        [self _appendToScrollback:buffer length:(size_t)bytesRead];
+
+        NSUInteger lineCount = count_lines(buffer, (NSUInteger)bytesRead);
+        NSUInteger keepLines = MAX(self.maxDisplayedLinesPerSecond, 1);
+        os_unfair_lock_lock(&_pendingLock);
+        [_pendingOutput appendBytes:buffer length:(NSUInteger)bytesRead];
+        _pendingLineCount += lineCount;
+        if (_pendingLineCount > keepLines) {
+            [self _trimPendingOutputToLines:keepLines];
+        }
+        os_unfair_lock_unlock(&_pendingLock);
+    }
+
+    free(buffer);
+    atomic_store(&_outputEnded, true);
+    dispatch_semaphore_signal(self.frameWakeup);
+}
+
+/**
+  * Reduce one frame's worth of output to what fits the line budget: the newest lines, after a marker counting
+  * the ones left out, including `trimmedLines` already dropped before the frame. Cuts are made at line starts
+  * so escape sequences aren't split
+ */
+- (NSData *)_coalescedFrameFromOutput:(NSData *)output lineCount:(NSUInteger)lineCount trimmedLines:(uint64_t)trimmedLines lineBudget:(NSUInteger)lineBudget shownLines:(NSUInteger *)shownLines {
+    *shownLines = MIN(lineCount, lineBudget);
+    if (lineCount <= lineBudget && trimmedLines == 0) {
+        return output;
+    }
+
+    // Walk back over the lines that will be kept, counting a trailing partial line as one of them
+    const uint8_t *bytes = output.bytes;
+    NSUInteger length = output.length;
+    NSUInteger keepFrom = 0;
+    if (lineCount > lineBudget) {
+        keepFrom = length;
+        NSUInteger keptLines = 0;
+        while (keepFrom > 0 && keptLines < lineBudget) {
+            keepFrom--;
+            if (bytes[keepFrom] == '\n' && keepFrom != length - 1) {
+                keptLines++;
+            }
+        }
+
+        if (keptLines == lineBudget) {
+            keepFrom++;
+        }
+    }
+
+    uint64_t collapsed = trimmedLines + lineCount - MIN(lineCount, lineBudget);
+    uint64_t totalCollapsed = atomic_fetch_add(&_collapsedLineCount, collapsed) + collapsed;
+    NSString *marker = [NSString stringWithFormat:@"\x1b[0m\r\n\x1b[2m[%llu lines collapsed, %llu in total. Full output is in the scrollback, search it with Find]\x1b[0m\r\n", collapsed, totalCollapsed];
+
+    NSMutableData *frame = [[marker dataUsingEncoding:NSUTF8StringEncoding] mutableCopy];
+    [frame appendBytes:bytes + keepFrom length:length - keepFrom];
+    return frame;
+}
+
+- (BOOL)_writeAll:(NSData *)data toFd:(int)fd {
+    const uint8_t *bytes = data.bytes;
+    for (NSUInteger written = 0; written < data.length;) {
+        ssize_t result = write(fd, bytes + written, data.length - written);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return NO;
+        }
+        written += (NSUInteger)result;
+    }
+
+    return YES;
+}
+
+- (void)_presentFrames {
+    // Blocks until the relay's cat opens the read end
+    int outputFd = open([self _outputFifoPath].fileSystemRepresentation, O_WRONLY);
+    if (outputFd < 0) {
+        return;
+    }
+
+    fcntl(outputFd, F_SETNOSIGPIPE, 1);
+
+    // Lines are paced by a token bucket holding up to one second's worth, so a short burst is shown whole while
+    // sustained output is held to the rate
+    double lineTokens = (double)MAX(self.maxDisplayedLinesPerSecond, 1);
+    uint64_t lastRefill = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+    BOOL viewGone = NO;
+    while (!viewGone && !atomic_load(&_stopping)) {
+        dispatch_semaphore_wait(self.frameWakeup, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(NSEC_PER_SEC / FRAMES_PER_SECOND)));
+        bool outputEnded = atomic_load(&_outputEnded);
+
+        double linesPerSecond = (double)MAX(self.maxDisplayedLinesPerSecond, 1);
+        uint64_t now = clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+        lineTokens = MIN(lineTokens + linesPerSecond * (double)(now - lastRefill) / NSEC_PER_SEC, linesPerSecond);
+        lastRefill = now;
+        NSUInteger lineBudget = (NSUInteger)lineTokens;
+
+        NSData *output = nil;
+        NSUInteger outputLines = 0;
+        uint64_t trimmedLines = 0;
+        os_unfair_lock_lock(&_pendingLock);
+        // With the bucket empty, output waits for the next frame rather than being collapsed away
+        if (lineBudget > 0 || outputEnded) {
+            output = _pendingOutput;
+            outputLines = _pendingLineCount;
+            trimmedLines = _pendingTrimmedLines;
+            _pendingOutput = [[NSMutableData alloc] init];
+            _pendingLineCount = 0;
+            _pendingTrimmedLines = 0;
+        }
+        NSData *shownText = _pendingShownText;
+        _pendingShownText = [[NSMutableData alloc] init];
+        os_unfair_lock_unlock(&_pendingLock);
+
+        if (output.length > 0) {
+            NSUInteger shownLines = 0;
+            viewGone = ![self _writeAll:[self _coalescedFrameFromOutput:output lineCount:outputLines trimmedLines:trimmedLines lineBudget:MAX(lineBudget, 1) shownLines:&shownLines] toFd:outputFd];
+            lineTokens -= MIN((double)shownLines, lineTokens);
+        }
+
+        if (shownText.length > 0 && !viewGone) {
+            viewGone = ![self _writeAll:shownText toFd:outputFd];
+        }
+
+        if (outputEnded && output.length == 0 && shownText.length == 0) {
+            // Keep showing text written after the process is gone, such as search results, until the window closes
+            dispatch_semaphore_wait(self.frameWakeup, DISPATCH_TIME_FOREVER);
+        }
+    }
+
+    close(outputFd);
+}
+
+#pragma mark - Input
+
+- (void)_forwardInput {
+    // Blocks until the relay opens the write end
+    int inputFd = open([self _inputFifoPath].fileSystemRepresentation, O_RDONLY);
+    if (inputFd < 0) {
+        return;
+    }
+
+    uint8_t buffer[4096];
+    while (!atomic_load(&_stopping)) {
+        ssize_t bytesRead = read(inputFd, buffer, sizeof(buffer));
+        if (bytesRead < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (bytesRead <= 0 || atomic_load(&_outputEnded)) {
+            break;
+        }
+
+        if (![self _writeAll:[NSData dataWithBytesNoCopy:buffer length:(NSUInteger)bytesRead freeWhenDone:NO] toFd:_masterFd]) {
+            break;
+        }
+    }
+
+    close(inputFd);
+}
+
+#pragma mark - Search
+
+- (void)searchScrollbackForString:(NSString *)needle limit:(NSUInteger)limit completion:(void (^)(NSArray<NSString *> *lines))completion {
+    NSArray<NSString *> *scrollbackPaths = @[self.previousScrollbackPath, self.scrollbackPath];
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+        NSMutableArray<NSString *> *lines = [NSMutableArray array];
+        const char *needleBytes = needle.UTF8String;
+        size_t needleLength = strlen(needleBytes);
+        if (needleLength > 0) {
+            // Oldest first: what's left of the rotated file, then the current one
+            for (NSString *path in scrollbackPaths) {
+                search_scrollback_file(path, needleBytes, needleLength, limit, lines);
+            }
+        }
+
+        dispatch_async(dispatch_get_main_queue(), ^{
+            completion(lines);
+        });
+    });
+}
+
+@end
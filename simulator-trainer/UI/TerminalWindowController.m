@@ -6,9 +6,13 @@
 //
 
 #import "TerminalWindowController.h"
+#import "TerminalOutputCoalescer.h"
+
+#define SEARCH_RESULT_LIMIT 200
 
 @interface TerminalWindowController ()
 @property (nonatomic, strong) LocalProcessTerminalView *terminalView;
+@property (nonatomic, strong) TerminalOutputCoalescer *outputCoalescer;
 @end
 
 @implementation TerminalWindowController
@@ -38,14 +42,32 @@
         _terminalView.processDelegate = self;
         _terminalView.font = [NSFont monospacedSystemFontOfSize:10 weight:NSFontWeightRegular];
         [termWindow setContentView:_terminalView];
-        
-         [_terminalView startProcessWithExecutable:exe args:args environment:env execName:nil];
+
+        // The process runs behind a coalescer so a flood of output can't stall the view, or the process
+        _outputCoalescer = [[TerminalOutputCoalescer alloc] initWithExecutable:exe args:args env:env];
+        __weak typeof(self) weakSelf = self;
+        _outputCoalescer.terminationHandler = ^(int exitCode) {
+            weakSelf.window.title = [NSString stringWithFormat:@"Process exited %d", exitCode];
+        };
+
+        NSError *error = nil;
+        if ([_outputCoalescer startWithWindowSize:[_terminalView getWindowSize] error:&error]) {
+            [_terminalView startProcessWithExecutable:[_outputCoalescer relayExecutable] args:[_outputCoalescer relayArguments] environment:nil execName:nil];
+        }
+        else {
+            NSLog(@"Failed to start output coalescer, running %@ directly: %@", exe, error);
+            _outputCoalescer = nil;
+            [_terminalView startProcessWithExecutable:exe args:args ?: @[] environment:env execName:nil];
+        }
     }
 
     return self;
 }
 
 - (void)windowWillClose:(NSNotification *)note {
+    [self.outputCoalescer stop];
+    self.outputCoalescer.terminationHandler = nil;
+
     if (self.terminalView.process.running) {
         kill(self.terminalView.process.running, SIGTERM);
     }
@@ -56,6 +78,7 @@
 
 - (void)sizeChangedWithSource:(LocalProcessTerminalView *)source newCols:(NSInteger)newCols newRows:(NSInteger)newRows {
     NSLog(@"Terminal size changed: %ld cols, %ld rows", (long)newCols, (long)newRows);
+    [self.outputCoalescer setWindowSizeWithColumns:newCols rows:newRows];
 }
 
 - (void)setTerminalTitleWithSource:(LocalProcessTerminalView *)source title:(NSString *)title {
@@ -67,8 +90,48 @@
 }
 
 - (void)processTerminatedWithSource:(TerminalView *)source exitCode:(int32_t)exitCode {
+    if (self.outputCoalescer) {
+        // Only the relay. The coalescer reports the real process
+        return;
+    }
+
     NSString *msg = [NSString stringWithFormat:@"Process exited %d", exitCode];
     self.window.title = msg;
 }
 
+// Edit > Find searches the full scrollback, including output that was collapsed on screen
+- (void)performFindPanelAction:(id)sender {
+    if (!self.outputCoalescer) {
+        NSBeep();
+        return;
+    }
+
+    NSAlert *alert = [[NSAlert alloc] init];
+    [alert setMessageText:@"Search Scrollback"];
+    [alert setInformativeText:@"Matching lines are printed below the current output"];
+    [alert addButtonWithTitle:@"Search"];
+    [alert addButtonWithTitle:@"Cancel"];
+
+    NSTextField *searchField = [[NSTextField alloc] initWithFrame:NSMakeRect(0, 0, 250, 24)];
+    [searchField setPlaceholderString:@"text"];
+    [alert setAccessoryView:searchField];
+
+    [alert beginSheetModalForWindow:self.window completionHandler:^(NSModalResponse returnCode) {
+        NSString *needle = [searchField stringValue];
+        if (returnCode != NSAlertFirstButtonReturn || needle.length == 0) {
+            return;
+        }
+
+        TerminalOutputCoalescer *coalescer = self.outputCoalescer;
+        [coalescer searchScrollbackForString:needle limit:SEARCH_RESULT_LIMIT completion:^(NSArray<NSString *> *lines) {
+            NSMutableString *results = [NSMutableString stringWithFormat:@"\n\x1b[7m %lu%@ lines matching \"%@\" \x1b[0m\n", (unsigned long)lines.count, lines.count == SEARCH_RESULT_LIMIT ? @"+" : @"", needle];
+            for (NSString *line in lines) {
+                [results appendFormat:@"%@\n", line];
+            }
+            [results appendString:@"\x1b[7m end of matches \x1b[0m\n"];
+            [coalescer showText:results];
+        }];
+    }];
+}
+
 @end
@@ -8,7 +8,10 @@
 #import "SimulatorOrchestrationService.h"
 #import "InProcessSimulator.h"
 #import "HelperConnection.h"
-#import "SimDeviceManager.h"
+#import "SimDeviceRegistry.h"
+#import "SimFleetOrchestrator.h"
+#import "SimLogStore.h"
+#import "StartupTimeline.h"
 #import "ViewController.h"
 
 #define ON_MAIN_THREAD(block) \
@@ -19,12 +22,17 @@
     }
 
 @interface ViewController () {
-    NSArray *allSimDevices;
+    NSMutableArray *allSimDevices;
+    uint64_t deviceListGeneration;
+    // Change batches that arrived while a device list snapshot was loading
+    NSMutableArray<NSDictionary *> *pendingDeviceChanges;
+    BOOL loadingDeviceList;
     SimulatorWrapper *selectedDevice;
     NSInteger selectedDeviceIndex;
     
     HelperConnection *helperConnection;
     SimulatorOrchestrationService *orchestrator;
+    SimFleetOrchestrator *fleetOrchestrator;
 }
 
 @property (nonatomic, strong) InProcessSimulator *simInterposer;
@@ -37,13 +45,23 @@
 - (instancetype)initWithCoder:(NSCoder *)coder {
     if ((self = [super initWithCoder:coder])) {
         allSimDevices = nil;
+        pendingDeviceChanges = [NSMutableArray array];
         selectedDevice = nil;
         selectedDeviceIndex = -1;
+        NSUInteger servicesSpan = [[StartupTimeline sharedTimeline] beginSpanNamed:@"main-window-services"];
         helperConnection = [[HelperConnection alloc] init];
         orchestrator = [[SimulatorOrchestrationService alloc] initWithHelperConnection:helperConnection];
+        fleetOrchestrator = [[SimFleetOrchestrator alloc] initWithOrchestrationService:orchestrator helperConnection:helperConnection];
+
+        // Nothing at startup waits for the helper, so connecting overlaps with the Simulator being prepared
+        HelperConnection *connection = helperConnection;
+        [[StartupTimeline sharedTimeline] addTaskNamed:@"helper-connection" dependencies:@[] queue:dispatch_get_global_queue(QOS_CLASS_UTILITY, 0) block:^BOOL{
+            return [connection connectIfInstalled];
+        }];
         
         self.packageService = [[PackageInstallationService alloc] init];
         self.simInterposer = [InProcessSimulator sharedSetupIfNeeded];
+        [[StartupTimeline sharedTimeline] endSpan:servicesSpan];
     }
 
     return self;
@@ -102,17 +120,16 @@
         [self installAppBundleAtURL:[NSURL fileURLWithPath:filePath]];
     }];
     
-    void (^deviceListFullRefreshBlock)(void) = ^(void) {
-        [self _populateDevicePopup];
-        [self refreshDeviceList];
-    };
+    [NSNotificationCenter.defaultCenter addObserverForName:@"SetUpDevicesNotification" object:nil queue:NSOperationQueue.mainQueue usingBlock:^(NSNotification * _Nonnull notification) {
+        [self handleSetUpDevicesSelected:nil];
+    }];
     
-    _simDeviceObserver = [NSNotificationCenter.defaultCenter addObserverForName:@"SimDeviceStateChanged" object:nil queue:nil usingBlock:^(NSNotification * _Nonnull notification) {
-        NSLog(@"Device list changed, refreshing...");
-        deviceListFullRefreshBlock();
+    // The registry posts only what changed, so hundreds of devices don't mean hundreds of rows rebuilt per event
+    _simDeviceObserver = [NSNotificationCenter.defaultCenter addObserverForName:SimDeviceRegistryDidChangeNotification object:nil queue:NSOperationQueue.mainQueue usingBlock:^(NSNotification * _Nonnull notification) {
+        [self _receiveDeviceChanges:notification.userInfo];
     }];
     
-    deviceListFullRefreshBlock();
+    [self refreshDeviceList];
 }
 
 - (void)setStatusImageName:(NSImageName)imageName text:(NSString *)text {
@@ -150,49 +167,183 @@
 #pragma mark - Device List
 
 - (void)refreshDeviceList {
+    if (self->allSimDevices) {
+        // Already loaded. Changes arrive as SimDeviceRegistryDidChangeNotification
+        [[SimDeviceRegistry sharedRegistry] resynchronize];
+        return;
+    }
+    
+    [self _loadDeviceListSnapshot];
+}
+
+- (void)_loadDeviceListSnapshot {
+    if (self->loadingDeviceList) {
+        return;
+    }
+    
+    self->loadingDeviceList = YES;
     dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
-        // Reload the list of devices
-        NSArray *oldDeviceList = self->allSimDevices;
-        BOOL isFirstFetch = (oldDeviceList == nil);
-        self->allSimDevices = [SimDeviceManager buildDeviceList];
-        
-        // After reloading, check if any devices have been removed.
-        // If a jailbroken sim is no longer around, its jailbreak (tmpfs mounts) need to be removed
-        for (SimulatorWrapper *oldDevice in oldDeviceList) {
-            BOOL stillExists = [self->allSimDevices containsObject:oldDevice];
-            if (!stillExists) {
-                oldDevice.delegate = nil;
-            }
-            
-            BOOL isJailbroken = ([oldDevice isKindOfClass:[BootedSimulatorWrapper class]] && [(BootedSimulatorWrapper *)oldDevice isJailbroken]);
-            BOOL needsJbRemoval = isJailbroken && (!stillExists || !oldDevice.isBooted);
-            if (needsJbRemoval) {
-                BootedSimulatorWrapper *noLongerBootedSim = (BootedSimulatorWrapper *)oldDevice;
-                [self->orchestrator removeJailbreakFromDevice:noLongerBootedSim completion:^(BOOL success, NSError * _Nullable error) {
-                    if (error) {
-                        NSLog(@"Failed to remove jailbreak from shutdown device %@: %@", noLongerBootedSim, error);
-                        ON_MAIN_THREAD((^{
-                            [self setNegativeStatus:[NSString stringWithFormat:@"Failed to remove jailbreak: %@", error]];
-                        }));
-                    }
-                }];
-            }
-        }
-        
+        // Changes at or below this generation are already part of the list
+        uint64_t generation = 0;
+        NSUInteger deviceListSpan = [[StartupTimeline sharedTimeline] beginSpanNamed:@"device-list"];
+        NSMutableArray *deviceList = [[[SimDeviceRegistry sharedRegistry] devicesWithGeneration:&generation] mutableCopy];
+        [[StartupTimeline sharedTimeline] endSpan:deviceListSpan];
         ON_MAIN_THREAD(^{
-            // Update the device list UI whenever the list changes
+            BOOL initialLoad = self->allSimDevices == nil;
+            SimulatorWrapper *previouslySelectedDevice = self->selectedDevice;
+            self->allSimDevices = deviceList;
+            self->deviceListGeneration = generation;
+            self->loadingDeviceList = NO;
             [self _populateDevicePopup];
             
-            // A device needs to be preselected for the initial load, before the user has a chance to select one themselves.
-            // If this is the first load, signaled by the device list being empty which only occurs the first time devices are loaded,
-            // then autoselect the best device in the popup list
-            if (isFirstFetch) {
+            // Wrappers are compared by UDID, so the previous selection is found again even if its wrapper was replaced
+            NSUInteger previousIndex = previouslySelectedDevice ? [deviceList indexOfObject:previouslySelectedDevice] : NSNotFound;
+            if (!initialLoad && previousIndex != NSNotFound) {
+                [self.devicePopup selectItemAtIndex:previousIndex];
+                [self popupListDidSelectDevice:self.devicePopup];
+            }
+            else {
+                // A device needs to be preselected for the initial load, before the user has a chance to select one themselves
                 [self _autoselectDevice];
             }
+            
+            NSArray<NSDictionary *> *pendingChanges = [self->pendingDeviceChanges copy];
+            [self->pendingDeviceChanges removeAllObjects];
+            for (NSDictionary *userInfo in pendingChanges) {
+                [self _receiveDeviceChanges:userInfo];
+            }
         });
     });
 }
 
+- (void)_receiveDeviceChanges:(NSDictionary *)userInfo {
+    if (!self->allSimDevices || self->loadingDeviceList) {
+        // Applied once the snapshot lands, unless it already includes them
+        [self->pendingDeviceChanges addObject:userInfo];
+        return;
+    }
+    
+    uint64_t generation = [userInfo[SimDeviceRegistryGenerationKey] unsignedLongLongValue];
+    if (generation <= self->deviceListGeneration) {
+        return;
+    }
+    
+    if (generation != self->deviceListGeneration + 1) {
+        // Indexes in a batch are only valid against the list as of the batch before it. With one missing, start over
+        NSLog(@"Device list is at generation %llu but got changes for %llu, reloading it", self->deviceListGeneration, generation);
+        [self->pendingDeviceChanges addObject:userInfo];
+        [self _loadDeviceListSnapshot];
+        return;
+    }
+    
+    self->deviceListGeneration = generation;
+    [self _applyDeviceChanges:userInfo[SimDeviceRegistryChangesKey]];
+}
+
+- (void)_applyDeviceChanges:(NSArray<SimDeviceRegistryChange *> *)changes {
+    BOOL selectionChanged = NO;
+    for (SimDeviceRegistryChange *change in changes) {
+        switch (change.kind) {
+            case SimDeviceRegistryChangeInserted: {
+                if (self->allSimDevices.count == 0) {
+                    // Replaces the "-- None --" placeholder
+                    [self.devicePopup removeAllItems];
+                    [self.devicePopup setEnabled:YES];
+                }
+                
+                [self->allSimDevices insertObject:change.device atIndex:change.index];
+                [self.devicePopup insertItemWithTitle:[change.device displayString] atIndex:change.index];
+                [self _updateMenuItemAtIndex:change.index];
+                break;
+            }
+                
+            case SimDeviceRegistryChangeRemoved: {
+                [self->allSimDevices removeObjectAtIndex:change.index];
+                [self.devicePopup removeItemAtIndex:change.index];
+                change.previousDevice.delegate = nil;
+                
+                if (self->selectedDevice == change.previousDevice) {
+                    self->selectedDevice = nil;
+                    selectionChanged = YES;
+                }
+                
+                [self _removeJailbreakIfOrphaned:change];
+                break;
+            }
+                
+            case SimDeviceRegistryChangeUpdated: {
+                self->allSimDevices[change.index] = change.device;
+                [self _updateMenuItemAtIndex:change.index];
+                
+                if (self->selectedDevice == change.previousDevice) {
+                    self->selectedDevice = change.device;
+                    self->selectedDevice.delegate = self;
+                    selectionChanged = YES;
+                }
+                
+                if (change.wasBooted && !change.device.isBooted) {
+                    [self _removeJailbreakIfOrphaned:change];
+                }
+                break;
+            }
+        }
+    }
+    
+    if (self->allSimDevices.count == 0) {
+        [self _populateDevicePopup];
+        return;
+    }
+    
+    // Indexes shift around inserts and removals, the selected device doesn't
+    NSInteger selectedIndex = self->selectedDevice ? [self->allSimDevices indexOfObject:self->selectedDevice] : NSNotFound;
+    if (selectedIndex != NSNotFound) {
+        self->selectedDeviceIndex = selectedIndex;
+        [self.devicePopup selectItemAtIndex:selectedIndex];
+    }
+    else {
+        self->selectedDeviceIndex = -1;
+        [self _autoselectDevice];
+    }
+    
+    if (selectionChanged) {
+        [self _updateSelectedDeviceUI];
+    }
+}
+
+- (void)_updateMenuItemAtIndex:(NSInteger)index {
+    SimulatorWrapper *device = self->allSimDevices[index];
+    NSMenuItem *item = [self.devicePopup itemAtIndex:index];
+    NSString *deviceLabel = [device displayString];
+    if (![item.title isEqualToString:deviceLabel]) {
+        item.title = deviceLabel;
+    }
+    
+    item.image = device.isBooted ? [NSImage imageNamed:NSImageNameStatusAvailable] : nil;
+}
+
+- (void)_removeJailbreakIfOrphaned:(SimDeviceRegistryChange *)change {
+    // If a jailbroken sim is gone or no longer booted, its jailbreak (tmpfs mounts) needs to be removed
+    if (!change.wasBooted || ![change.previousDevice isKindOfClass:[BootedSimulatorWrapper class]]) {
+        return;
+    }
+    
+    BootedSimulatorWrapper *noLongerBootedSim = (BootedSimulatorWrapper *)change.previousDevice;
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        if (![noLongerBootedSim isJailbroken]) {
+            return;
+        }
+        
+        [self->orchestrator removeJailbreakFromDevice:noLongerBootedSim completion:^(BOOL success, NSError * _Nullable error) {
+            if (error) {
+                NSLog(@"Failed to remove jailbreak from shutdown device %@: %@", noLongerBootedSim, error);
+                ON_MAIN_THREAD((^{
+                    [self setNegativeStatus:[NSString stringWithFormat:@"Failed to remove jailbreak: %@", error]];
+                }));
+            }
+        }];
+    });
+}
+
 - (void)_populateDevicePopup {
     __weak typeof(self) weakSelf = self;
     ON_MAIN_THREAD(^{
@@ -242,24 +393,12 @@
 }
 
 - (void)_updateDeviceMenuItemLabels {
-    // For every device in the popup list, refresh the coresimulator state then update the label's text.
-    // This is necessary because the text includes the device's current boot state
-    __weak typeof(self) weakSelf = self;
+    // Update every label's text, which includes the device's current boot state. The registry keeps the
+    // CoreSimulator devices current, so nothing has to be reloaded here
     ON_MAIN_THREAD(^{
-        for (int i = 0; i < weakSelf.devicePopup.numberOfItems; i++) {
-            NSMenuItem *item = [weakSelf.devicePopup itemAtIndex:i];
-
-            SimulatorWrapper *device = self->allSimDevices[i];
-            NSString *oldDeviceLabel = item.title;
-            
-            // Reload the sim device's state
-            [device reloadDeviceState];
-            
-            // Update the label with the potentially-changed displayString
-            NSString *newDeviceLabel = [device displayString];
-            if (![oldDeviceLabel isEqualToString:newDeviceLabel]) {
-                [item setTitle:newDeviceLabel];
-            }
+        NSInteger itemCount = MIN(self.devicePopup.numberOfItems, (NSInteger)self->allSimDevices.count);
+        for (NSInteger i = 0; i < itemCount; i++) {
+            [self _updateMenuItemAtIndex:i];
         }
     });
 }
@@ -414,7 +553,9 @@
     [self setStatus:@"Applying jb..."];
     self.jailbreakButton.enabled = NO;
     BootedSimulatorWrapper *bootedSim = [BootedSimulatorWrapper fromSimulatorWrapper:self->selectedDevice];
-    [self->orchestrator applyJailbreakToDevice:bootedSim completion:^(BOOL success, NSError * _Nullable error) {
+    [self->orchestrator applyJailbreakToDevice:bootedSim progress:^(NSString *stepName, NSInteger completedSteps, NSInteger totalSteps) {
+        [self setStatus:[NSString stringWithFormat:@"Applying jb: %@ (%ld/%ld)", stepName, (long)completedSteps, (long)totalSteps]];
+    } completion:^(BOOL success, NSError * _Nullable error) {
         [self device:self->selectedDevice jailbreakFinished:success error:error];
     }];
 }
@@ -496,8 +637,100 @@
     [[NSWorkspace sharedWorkspace] openURL:[NSURL fileURLWithPath:deviceTweakFolder]];
 }
 
+- (void)handleSetUpDevicesSelected:(id)sender {
+    // Default to every booted device, or the selected one when nothing is booted yet
+    NSMutableArray<NSString *> *defaultUdids = [NSMutableArray array];
+    for (SimulatorWrapper *device in allSimDevices) {
+        if (device.isBooted && device.udidString) {
+            [defaultUdids addObject:device.udidString];
+        }
+    }
+    if (defaultUdids.count == 0 && selectedDevice.udidString) {
+        [defaultUdids addObject:selectedDevice.udidString];
+    }
+
+    NSAlert *alert = [[NSAlert alloc] init];
+    [alert setMessageText:@"Set Up Devices"];
+    [alert setInformativeText:@"Boot and jailbreak several devices at once, optionally installing a tweak on each"];
+    [alert addButtonWithTitle:@"Start"];
+    [alert addButtonWithTitle:@"Cancel"];
+
+    NSTextField *udidsField = [[NSTextField alloc] initWithFrame:NSMakeRect(0, 0, 300, 24)];
+    [udidsField setPlaceholderString:@"device UDIDs, comma separated"];
+    [udidsField setStringValue:[defaultUdids componentsJoinedByString:@", "]];
+
+    NSTextField *debPathField = [[NSTextField alloc] initWithFrame:NSMakeRect(0, 0, 300, 24)];
+    [debPathField setPlaceholderString:@".deb path (optional)"];
+
+    NSStackView *inputStack = [[NSStackView alloc] initWithFrame:NSMakeRect(0, 0, 300, 30 * 2)];
+    [inputStack setOrientation:NSUserInterfaceLayoutOrientationVertical];
+    [inputStack setSpacing:8];
+    [inputStack addView:udidsField inGravity:NSStackViewGravityTop];
+    [inputStack addView:debPathField inGravity:NSStackViewGravityTop];
+    [alert setAccessoryView:inputStack];
+
+    if ([alert runModal] != NSAlertFirstButtonReturn) {
+        return;
+    }
+
+    NSMutableArray<NSString *> *udids = [NSMutableArray array];
+    for (NSString *udid in [udidsField.stringValue componentsSeparatedByString:@","]) {
+        NSString *trimmedUdid = [udid stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceAndNewlineCharacterSet]];
+        if (trimmedUdid.length > 0) {
+            [udids addObject:trimmedUdid];
+        }
+    }
+
+    if (udids.count == 0) {
+        [self setNegativeStatus:@"No devices to set up"];
+        return;
+    }
+
+    NSMutableArray<SimFleetPipelineStep *> *pipeline = [NSMutableArray arrayWithObjects:[SimFleetPipelineStep bootStep], [SimFleetPipelineStep jailbreakStep], nil];
+    NSString *debPath = [debPathField.stringValue stringByExpandingTildeInPath];
+    if (debPath.length > 0) {
+        // Installing a deb resprings the device
+        [pipeline addObject:[SimFleetPipelineStep installDebStepWithPath:debPath]];
+    }
+    else {
+        [pipeline addObject:[SimFleetPipelineStep respringStep]];
+    }
+
+    [self setStatus:[NSString stringWithFormat:@"Setting up %lu devices...", (unsigned long)udids.count]];
+    [fleetOrchestrator runPipeline:pipeline onDevicesWithUdids:udids completion:^(NSDictionary<NSString *, SimFleetDeviceReport *> *reports) {
+        NSUInteger failed = 0;
+        for (SimFleetDeviceReport *report in reports.allValues) {
+            if (report.error) {
+                failed++;
+            }
+        }
+
+        if (failed > 0) {
+            [self setNegativeStatus:[NSString stringWithFormat:@"%lu of %lu devices failed to set up", (unsigned long)failed, (unsigned long)reports.count]];
+        }
+        else {
+            [self setPositiveStatus:[NSString stringWithFormat:@"Set up %lu devices", (unsigned long)reports.count]];
+        }
+
+        [self refreshDeviceList];
+    }];
+}
+
 #pragma mark - SimulatorWrapperDelegate
 
+// Print what CoreSimulator logged for this device shortly before a failure
+- (void)_logRecentSimulatorMessagesForDevice:(SimulatorWrapper *)simDevice {
+    NSString *udid = [simDevice udidString];
+    if (!udid) {
+        return;
+    }
+
+    NSArray<SimLogRecord *> *records = [[SimLogStore sharedStore] recordsForDeviceUdid:udid around:[NSDate date] window:30.0];
+    if (records.count > 0) {
+        NSLog(@"Simulator logs for %@ before the failure:\n%@", udid, [records componentsJoinedByString:@"\n"]);
+    }
+}
+
 - (void)deviceDidBoot:(SimulatorWrapper *)simDevice {
     NSLog(@"Device did boot: %@", simDevice);
     // Switch to this device if one has not already been selected, otherwiss do nothing
@@ -562,6 +795,7 @@
 
 - (void)device:(SimulatorWrapper *)simDevice didFailToBootWithError:(NSError * _Nullable)error {
     NSLog(@"Device failed to boot: %@", error);
+    [self _logRecentSimulatorMessagesForDevice:simDevice];
     [self _updateDeviceMenuItemLabels];
 }
 
@@ -576,6 +810,7 @@
         if (error || !success) {
             weakSelf.jailbreakButton.enabled = YES;
             NSLog(@"Failed to jailbreak device with error: %@", error);
+            [self _logRecentSimulatorMessagesForDevice:simDevice];
             [self setNegativeStatus:@"Failed to jailbreak sim device"];
         }
         else if (success) {